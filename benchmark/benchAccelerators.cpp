@@ -0,0 +1,91 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include "World.hpp"
+
+// Compares the accelerators (linear search, BVH, uniform grid) on two kinds of scenes:
+// a dense packing of spheres of the same size, on a jittered lattice, and spheres of very different
+// sizes placed at random, some of them in clusters. Reports build time, memory and rays per second,
+// for closest hits and for shadow rays.
+
+using std::cout, std::endl;
+
+auto material = std::make_shared<DiffuseMaterial>();
+
+template <typename Function>
+double raysPerSecond(const std::vector<Ray>& rays, Function function) {
+    int hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Ray& ray : rays) hits += function(ray);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (hits < 0) cout << hits; // keep the compiler from removing the loop
+    return rays.size() / seconds;
+}
+
+// spheres of radius 0.4 on a lattice of step 1, moved a bit
+void packing(World& world, PCG& pcg, int nSpheres, float& side) {
+    int n = static_cast<int>(std::ceil(std::cbrt(nSpheres)));
+    side = static_cast<float>(n);
+    for (int i = 0; i < nSpheres; i++) {
+        Point3 centre(i % n + 0.5f, (i / n) % n + 0.5f, i / (n * n) + 0.5f);
+        world.addShape(std::make_shared<Sphere>(material, translation(Vec3(centre.x, centre.y, centre.z)
+                                                                      + Vec3(pcg.random(-0.1, 0.1), pcg.random(-0.1, 0.1), pcg.random(-0.1, 0.1)))
+                                                          * scaling(0.4)));
+    }
+}
+
+// a tenth of the spheres are big and sparse, the rest are small, in clusters around some of the big ones
+void uneven(World& world, PCG& pcg, int nSpheres, float& side) {
+    side = 2.0f * std::cbrt(static_cast<float>(nSpheres));
+    std::vector<Point3> centres;
+    for (int i = 0; i < nSpheres / 10; i++) {
+        centres.emplace_back(pcg.random(0., side), pcg.random(0., side), pcg.random(0., side));
+        world.addShape(std::make_shared<Sphere>(material, translation(Vec3(centres.back().x, centres.back().y, centres.back().z)) * scaling(pcg.random(0.5, 2.))));
+    }
+    for (int i = nSpheres / 10; i < nSpheres; i++) {
+        const Point3& around = centres[static_cast<int>(pcg.random(0., centres.size() / 20.0))];
+        world.addShape(std::make_shared<Sphere>(material, translation(Vec3(around.x + pcg.random(-3., 3.), around.y + pcg.random(-3., 3.), around.z + pcg.random(-3., 3.)))
+                                                          * scaling(pcg.random(0.01, 0.05))));
+    }
+}
+
+int main() {
+    PCG pcg;
+    cout << std::setw(9) << "spheres" << std::setw(9) << "scene" << std::setw(8) << "accel" << std::setw(12) << "build [s]"
+         << std::setw(13) << "memory [MB]" << std::setw(14) << "hit [ray/s]" << std::setw(16) << "shadow [ray/s]" << endl;
+
+    for (int nSpheres : {1000, 100000, 1000000}) {
+        for (int scene = 0; scene < 2; scene++) {
+            World world;
+            float side;
+            if (scene == 0) packing(world, pcg, nSpheres, side);
+            else uneven(world, pcg, nSpheres, side);
+
+            std::vector<Ray> rays, shadowRays;
+            for (int i = 0; i < 20000; i++) {
+                rays.emplace_back(Point3(pcg.random(0., side), pcg.random(0., side), pcg.random(0., side)), pcg.randomVersor());
+                shadowRays.emplace_back(rays.back().origin, rays.back().direction, RAY_MIN, 5.0f);
+            }
+
+            for (Accelerator::Type type : {Accelerator::Type::Linear, Accelerator::Type::BVH, Accelerator::Type::Grid}) {
+                std::vector<Ray> used = rays, usedShadows = shadowRays;
+                if (type == Accelerator::Type::Linear) { // a few, too slow otherwise
+                    used.resize(std::max(100, 2000000 / nSpheres)), usedShadows.resize(used.size());
+                }
+
+                world.buildSettings.accelerator = type;
+                world.build();
+                double hit = raysPerSecond(used, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+                double shadow = raysPerSecond(usedShadows, [&](const Ray& ray) { return world.occluded(ray); });
+
+                cout << std::setw(9) << nSpheres << std::setw(9) << (scene == 0 ? "packing" : "uneven") << std::setw(8) << Accelerator::name(type)
+                     << std::fixed << std::setprecision(3) << std::setw(12) << world.buildStats().seconds
+                     << std::setprecision(1) << std::setw(13) << world.buildStats().memory / 1e6
+                     << std::setprecision(0) << std::setw(14) << hit << std::setw(16) << shadow << endl;
+            }
+        }
+    }
+
+    return 0;
+}
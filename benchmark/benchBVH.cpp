@@ -0,0 +1,160 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <cstdio>
+#include "World.hpp"
+
+// Compares the linear search (SpherePack kernels over all the spheres) with the BVH and its compact
+// version with quantized boxes, on scenes from 10^2 to 10^6 randomly placed spheres, with the same density.
+// Then compares the build presets, on one and on all the hardware threads,
+// and the refit of the BVH with a new build, for spheres moving a bit in every frame.
+// Last, the time to get the BVH when it's mapped from the cache file instead of built.
+
+using std::cout, std::endl;
+
+auto material = std::make_shared<DiffuseMaterial>();
+
+template <typename Function>
+double raysPerSecond(const std::vector<Ray>& rays, Function function) {
+    int hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Ray& ray : rays) hits += function(ray);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (hits < 0) cout << hits; // keep the compiler from removing the loop
+    return rays.size() / seconds;
+}
+
+// random spheres with the same density for any number, and random rays starting among them
+void fill(World& world, std::vector<Ray>& rays, PCG& pcg, int nSpheres) {
+    float side = 20.0f * std::cbrt(nSpheres / 100.0f);
+    for (int i = 0; i < nSpheres; i++) {
+        world.addShape(std::make_shared<Sphere>(material, translation(pcg.random(0., side), pcg.random(0., side), pcg.random(0., side))
+                                                          * scaling(pcg.random(0.2, 1.))));
+    }
+    for (int i = 0; i < 20000; i++) {
+        rays.emplace_back(Point3(pcg.random(0., side), pcg.random(0., side), pcg.random(0., side)), pcg.randomVersor());
+    }
+}
+
+int main() {
+    PCG pcg;
+    cout << "best instruction set: " << simdLevelName(bestSimdLevel()) << "\n" << endl;
+    cout << std::setw(9) << "spheres" << std::setw(12) << "build [s]" << std::setw(16) << "linear [ray/s]"
+         << std::setw(14) << "BVH [ray/s]" << std::setw(12) << "speedup" << std::setw(20) << "BVH shadow [ray/s]"
+         << std::setw(18) << "compact [ray/s]" << std::setw(12) << "speedup" << std::setw(18) << "bytes/primitive" << endl;
+
+    for (int nSpheres : {100, 1000, 10000, 100000, 1000000}) {
+        World world;
+        std::vector<Ray> rays;
+        fill(world, rays, pcg, nSpheres);
+        std::vector<Ray> fewRays(rays.begin(), rays.begin() + std::max(200, std::min(20000, 20000000 / nSpheres)));
+
+        double linear = raysPerSecond(fewRays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+
+        auto start = std::chrono::steady_clock::now();
+        world.build();
+        double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double bvh = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+        double shadow = raysPerSecond(rays, [&](const Ray& ray) { return world.occluded(Ray(ray.origin, ray.direction, RAY_MIN, 5.0f)); });
+        float bytes = world.indexBytesPerShape();
+
+        world.buildSettings.compact = true;
+        world.build();
+        double compact = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+        float compactBytes = world.indexBytesPerShape();
+
+        cout << std::setw(9) << nSpheres << std::fixed << std::setprecision(3) << std::setw(12) << build
+             << std::setprecision(0) << std::setw(16) << linear << std::setw(14) << bvh
+             << std::setprecision(1) << std::setw(11) << bvh / linear << "x"
+             << std::setprecision(0) << std::setw(20) << shadow << std::setw(18) << compact
+             << std::setprecision(1) << std::setw(11) << compact / linear << "x"
+             << std::setw(9) << bytes << " / " << compactBytes << endl;
+    }
+
+    int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    cout << "\n" << std::setw(9) << "spheres" << std::setw(8) << "preset" << std::setw(9) << "threads" << std::setw(12) << "build [s]"
+         << std::setw(10) << "SAH cost" << std::setw(14) << "BVH [ray/s]" << endl;
+
+    for (int nSpheres : {100000, 1000000}) {
+        World world;
+        std::vector<Ray> rays;
+        fill(world, rays, pcg, nSpheres);
+
+        for (BVH::Preset preset : {BVH::Preset::SAH, BVH::Preset::LBVH}) {
+            for (int threads : {1, nThreads}) {
+                world.buildSettings.preset = preset;
+                world.buildSettings.nThreads = threads;
+                world.build();
+                double bvh = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+
+                cout << std::setw(9) << nSpheres << std::setw(8) << (preset == BVH::Preset::SAH ? "sah" : "lbvh") << std::setw(9) << threads
+                     << std::fixed << std::setprecision(3) << std::setw(12) << world.buildStats().seconds
+                     << std::setprecision(1) << std::setw(10) << world.buildStats().sahCost << std::setprecision(0) << std::setw(14) << bvh << endl;
+                if (nThreads == 1) break;
+            }
+        }
+    }
+
+    cout << "\n" << std::setw(9) << "spheres" << std::setw(7) << "frame" << std::setw(12) << "update [s]" << std::setw(12) << "build [s]"
+         << std::setw(10) << "SAH cost" << std::setw(14) << "refit [ray/s]" << std::setw(14) << "build [ray/s]" << endl;
+    for (int nSpheres : {100000, 1000000}) {
+        World world, reference;
+        std::vector<Ray> rays;
+        PCG copy = pcg;
+        fill(world, rays, pcg, nSpheres);
+        fill(reference, rays, copy, nSpheres);
+        world.build();
+
+        // every sphere moves on its own, so the boxes of the tree get bigger and bigger
+        std::vector<Vec3> velocities;
+        for (int i = 0; i < nSpheres; i++) velocities.emplace_back(pcg.random(-0.5, 0.5), pcg.random(-0.5, 0.5), pcg.random(-0.5, 0.5));
+        for (int frame = 1; frame <= 8; frame++) {
+            for (int i = 0; i < nSpheres; i++) {
+                Transformation t = translation(velocities[i]);
+                world._shapes[i]->transformation = t * world._shapes[i]->transformation;
+                reference._shapes[i]->transformation = t * reference._shapes[i]->transformation;
+            }
+            bool rebuilt = world.update();
+            double update = world.buildStats().seconds;
+            reference.build();
+
+            double refit = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+            double build = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return reference.isHit(ray, rec); });
+            cout << std::setw(9) << nSpheres << std::setw(7) << frame << std::fixed << std::setprecision(3) << std::setw(11) << update << (rebuilt ? "*" : " ")
+                 << std::setw(12) << reference.buildStats().seconds << std::setprecision(1) << std::setw(10) << world.buildStats().sahCost
+                 << std::setprecision(0) << std::setw(14) << refit << std::setw(14) << build << endl;
+        }
+    }
+    cout << "* built again, the SAH cost grew too much" << endl;
+
+    cout << "\n" << std::setw(9) << "spheres" << std::setw(8) << "preset" << std::setw(12) << "build [s]" << std::setw(12) << "cache [s]"
+         << std::setw(12) << "file [MB]" << std::setw(14) << "cache [ray/s]" << endl;
+    const std::string path = "benchBVH.bvh";
+    for (int nSpheres : {100000, 1000000}) {
+        World world;
+        std::vector<Ray> rays;
+        fill(world, rays, pcg, nSpheres);
+        world.buildSettings.cachePath = path;
+
+        for (BVH::Preset preset : {BVH::Preset::SAH, BVH::Preset::LBVH}) {
+            std::remove(path.c_str());
+            world.buildSettings.preset = preset;
+            world.build(); // and saved
+            double build = world.buildStats().seconds;
+            world.build();
+            double cache = world.buildStats().seconds;
+            double bvh = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return world.isHit(ray, rec); });
+
+            cout << std::setw(9) << nSpheres << std::setw(8) << (preset == BVH::Preset::SAH ? "sah" : "lbvh")
+                 << std::fixed << std::setprecision(3) << std::setw(12) << build << std::setw(11) << cache << (world.buildStats().cached ? " " : "!")
+                 << std::setprecision(1) << std::setw(12) << world.indexBytesPerShape() * nSpheres / 1e6 << std::setprecision(0) << std::setw(14) << bvh << endl;
+        }
+    }
+    std::remove(path.c_str());
+    cout << "the cache times include the bounding boxes and the hash that checks them" << endl;
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "TriangleMesh.hpp"
+
+// Triangle meshes: rays per second against a bumpy sphere of more and more triangles,
+// hitting it from all around, with the time to build the BVH of the triangles and the memory used.
+// Then the time to read the biggest mesh from an OBJ file and from a binary PLY file.
+
+using std::cout, std::endl;
+
+auto material = std::make_shared<DiffuseMaterial>();
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Function>
+double raysPerSecond(const std::vector<Ray>& rays, Function function) {
+    int hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Ray& ray : rays) hits += function(ray);
+    double elapsed = seconds(start);
+    if (hits < 0) cout << hits; // keep the compiler from removing the loop
+    return rays.size() / elapsed;
+}
+
+// sphere with waves on it, 2 * rings * segments triangles (a few less at the poles)
+MeshData bumpySphere(int rings, int segments) {
+    MeshData mesh;
+    for (int i = 0; i <= rings; i++) {
+        float theta = PI * i / rings;
+        for (int j = 0; j < segments; j++) {
+            float phi = 2.0f * PI * j / segments;
+            float r = 1.0f + 0.05f * std::sin(12.0f * theta) * std::sin(12.0f * phi);
+            mesh.x.push_back(r * std::sin(theta) * std::cos(phi)), mesh.y.push_back(r * std::sin(theta) * std::sin(phi)), mesh.z.push_back(r * std::cos(theta));
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            int a = i * segments + j, b = (i + 1) * segments + j, c = (i + 1) * segments + (j + 1) % segments, d = i * segments + (j + 1) % segments;
+            if (i > 0) mesh.indices.insert(mesh.indices.end(), {a, c, d});
+            if (i < rings - 1) mesh.indices.insert(mesh.indices.end(), {a, b, c});
+        }
+    }
+    return mesh;
+}
+
+void writeOBJ(const MeshData& mesh, const std::string& path) {
+    std::ofstream file(path);
+    for (int i = 0; i < mesh.nVertices(); i++) file << "v " << mesh.x[i] << " " << mesh.y[i] << " " << mesh.z[i] << "\n";
+    for (int i = 0; i < mesh.nTriangles(); i++) {
+        file << "f " << mesh.indices[3 * i] + 1 << " " << mesh.indices[3 * i + 1] + 1 << " " << mesh.indices[3 * i + 2] + 1 << "\n";
+    }
+}
+
+void writePLY(const MeshData& mesh, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    file << "ply\nformat binary_little_endian 1.0\nelement vertex " << mesh.nVertices()
+         << "\nproperty float x\nproperty float y\nproperty float z\nelement face " << mesh.nTriangles()
+         << "\nproperty list uchar int vertex_indices\nend_header\n";
+    for (int i = 0; i < mesh.nVertices(); i++) {
+        float vertex[3] = {mesh.x[i], mesh.y[i], mesh.z[i]};
+        file.write(reinterpret_cast<const char*>(vertex), sizeof(vertex));
+    }
+    for (int i = 0; i < mesh.nTriangles(); i++) {
+        char three = 3;
+        file.write(&three, 1);
+        file.write(reinterpret_cast<const char*>(&mesh.indices[3 * i]), 3 * sizeof(int));
+    }
+}
+
+int main() {
+    PCG pcg;
+    std::vector<Ray> rays, shadowRays;
+    for (int i = 0; i < 200000; i++) {
+        // from a sphere of radius 3 towards a random point near the centre
+        Point3 origin = Point3() + 3.0f * pcg.randomVersor();
+        Point3 target(pcg.random(-0.8, 0.8), pcg.random(-0.8, 0.8), pcg.random(-0.8, 0.8));
+        rays.emplace_back(origin, target - origin);
+        shadowRays.emplace_back(origin, target - origin, RAY_MIN, 1.0f);
+    }
+
+    cout << std::setw(11) << "triangles" << std::setw(12) << "build [s]" << std::setw(13) << "memory [MB]"
+         << std::setw(14) << "hit [ray/s]" << std::setw(16) << "shadow [ray/s]" << endl;
+
+    MeshData biggest;
+    for (int rings : {100, 300, 1000}) {
+        MeshData data = bumpySphere(rings, 2 * rings);
+        auto start = std::chrono::steady_clock::now();
+        TriangleMesh mesh(material, data);
+        double build = seconds(start);
+
+        double hit = raysPerSecond(rays, [&](const Ray& ray) { HitRecord rec; return mesh.isHit(ray, rec); });
+        double shadow = raysPerSecond(shadowRays, [&](const Ray& ray) { return mesh.quickIsHit(ray); });
+
+        cout << std::setw(11) << mesh.nTriangles() << std::fixed << std::setprecision(3) << std::setw(12) << build
+             << std::setprecision(1) << std::setw(13) << mesh.memoryUsage() / 1e6
+             << std::setprecision(0) << std::setw(14) << hit << std::setw(16) << shadow << endl;
+        biggest = std::move(data);
+    }
+
+    cout << "\n" << std::setw(11) << "format" << std::setw(11) << "size [MB]" << std::setw(11) << "read [s]" << endl;
+    for (std::string path : {"benchMesh.obj", "benchMesh.ply"}) {
+        if (path.ends_with(".obj")) writeOBJ(biggest, path);
+        else writePLY(biggest, path);
+
+        auto start = std::chrono::steady_clock::now();
+        MeshData read = readMesh(path);
+        double elapsed = seconds(start);
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        cout << std::setw(11) << path.substr(path.size() - 3) << std::setprecision(1) << std::setw(11) << file.tellg() / 1e6
+             << std::setprecision(3) << std::setw(11) << elapsed << endl;
+        if (read.nTriangles() != biggest.nTriangles()) cout << "ERROR: wrong number of triangles read" << endl;
+        std::remove(path.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include "HDRImage.hpp"
+#include "simd.hpp"
+
+// Reading a 100 MB PFM image: the old way, one readFloat per channel and setPixel per pixel,
+// against the bulk reader, for both byte orders. Then writing it, one byte at a time with << as writePFM did,
+// against one write per row. Then reading it and computing its luminosity, against mapping it. Then the byte swap alone, in memory, with every instruction set.
+// Last, writing and reading the same pixels as PFM, RGBE and OpenEXR half floats, and the size of the files, for noise
+// and for a smoother image with a uniform background, as a render of a few objects.
+
+using std::cout, std::endl;
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the reader before the bulk one
+HDRImage readPerFloat(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    readLine(input);
+    auto [width, height] = parseImageSize(readLine(input));
+    Endianness endianness = parseEndianness(readLine(input));
+    HDRImage image(width, height);
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            float r = readFloat(input, endianness), g = readFloat(input, endianness), b = readFloat(input, endianness);
+            image.setPixel(i, j, Color(r, g, b));
+        }
+    }
+    return image;
+}
+
+// the writer before the bulk one
+void writePerByte(const HDRImage& image, const std::string& path) {
+    std::ofstream output(path, std::ios::binary);
+    output << "PF\n" << image._width << " " << image._height << "\n-1.0\n";
+    for (int j = image._height - 1; j >= 0; j--) {
+        for (int i = 0; i < image._width; i++) {
+            Color pixel = image.getPixel(i, j);
+            for (float value : {pixel.r, pixel.g, pixel.b}) {
+                auto bytes = reinterpret_cast<const unsigned char*>(&value);
+                for (int k = 0; k < 4; k++) output << bytes[k];
+            }
+        }
+    }
+}
+
+void writeImage(const std::string& path, int width, int height, Endianness endianness) {
+    PCG pcg;
+    std::vector<float> row(3 * width);
+    std::ofstream output(path, std::ios::binary);
+    output << "PF\n" << width << " " << height << "\n" << (endianness == Endianness::LITTLE ? "-1.0" : "1.0") << "\n";
+    for (int j = 0; j < height; j++) {
+        for (float& value : row) value = pcg.random();
+        if (endianness != NATIVE_ENDIANNESS) swapBytes32(row.data(), row.size());
+        output.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+}
+
+int main() {
+    const int width = 3000, height = 2800; // 100.8 MB of pixels
+    double megabytes = 12.0 * width * height / 1e6;
+    std::string path = "benchPFM.pfm";
+
+    cout << std::setw(8) << "order" << std::setw(18) << "per float [MB/s]" << std::setw(13) << "bulk [MB/s]" << std::setw(10) << "speedup" << endl;
+    for (Endianness endianness : {Endianness::LITTLE, Endianness::BIG}) {
+        writeImage(path, width, height, endianness);
+
+        auto start = std::chrono::steady_clock::now();
+        HDRImage reference = readPerFloat(path);
+        double perFloat = seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        HDRImage image(path);
+        double bulk = seconds(start);
+
+        cout << std::setw(8) << (endianness == Endianness::LITTLE ? "little" : "big") << std::fixed << std::setprecision(0)
+             << std::setw(18) << megabytes / perFloat << std::setw(13) << megabytes / bulk
+             << std::setprecision(1) << std::setw(9) << perFloat / bulk << "x" << endl;
+        if (!image.getPixel(width - 1, 0).isClose(reference.getPixel(width - 1, 0))) cout << "ERROR: different pixels read" << endl;
+    }
+
+    HDRImage image(path);
+    cout << "\n" << std::setw(8) << "open" << std::setw(18) << "+ luminosity [s]" << endl;
+    for (bool mapped : {false, true}) {
+        auto start = std::chrono::steady_clock::now();
+        HDRImage opened = mapped ? HDRImage::map(path) : HDRImage(path);
+        float luminosity = opened.averageLuminosity();
+        cout << std::setw(8) << (mapped ? "map" : "read") << std::setprecision(3) << std::setw(18) << seconds(start) << endl;
+        if (luminosity != image.averageLuminosity()) cout << "ERROR: different luminosity" << endl;
+    }
+    std::remove(path.c_str());
+
+    cout << "\n" << std::setw(8) << "write" << std::setw(18) << "per byte [MB/s]" << std::setw(13) << "bulk [MB/s]" << std::setw(10) << "speedup" << endl;
+    auto start = std::chrono::steady_clock::now();
+    writePerByte(image, path);
+    double perByte = seconds(start);
+    std::remove(path.c_str());
+
+    start = std::chrono::steady_clock::now();
+    image.save(path);
+    double bulk = seconds(start);
+    cout << std::setw(8) << "little" << std::setprecision(0) << std::setw(18) << megabytes / perByte << std::setw(13) << megabytes / bulk
+         << std::setprecision(1) << std::setw(9) << perByte / bulk << "x" << endl;
+    if (!HDRImage(path).getPixel(width - 1, 0).isClose(image.getPixel(width - 1, 0))) cout << "ERROR: different pixels written" << endl;
+    std::remove(path.c_str());
+
+    std::vector<float> data(3 * width * height, 1.0f);
+    cout << "\nbyte swap in memory:" << endl;
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE4, SimdLevel::AVX2}) {
+        if (level > bestSimdLevel()) continue;
+        auto start = std::chrono::steady_clock::now();
+        for (int k = 0; k < 10; k++) swapBytes32(data.data(), data.size(), level);
+        cout << std::setw(8) << simdLevelName(level) << std::setprecision(0) << std::setw(10) << 10 * megabytes / seconds(start) << " MB/s" << endl;
+    }
+    if (data[0] != 1.0f) cout << "ERROR: the bytes were not swapped back" << endl;
+
+    HDRImage smooth(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            float x = static_cast<float>(i) / width - 0.5f, y = static_cast<float>(j) / height - 0.5f;
+            if (x * x + y * y < 0.1f) smooth.setPixel(i, j, Color(1.0f + x, 2.0f * (0.5f + y), 0.3f) * (1.0f + 0.05f * image.getPixel(i, j).r));
+        }
+    }
+    cout << "\n" << std::setw(8) << "image" << std::setw(8) << "format" << std::setw(14) << "write [MB/s]" << std::setw(13) << "read [MB/s]"
+         << std::setw(16) << "bytes / pixel" << endl;
+    for (HDRImage* source : {&image, &smooth}) {
+        for (const char* format : {"pfm", "hdr", "exr"}) {
+            std::string file = std::string("benchPFM.") + format;
+            auto start = std::chrono::steady_clock::now();
+            source->save(file);
+            double write = seconds(start);
+
+            start = std::chrono::steady_clock::now();
+            HDRImage read(file);
+            double readTime = seconds(start);
+
+            std::ifstream opened(file, std::ios::binary | std::ios::ate);
+            double bytesPerPixel = static_cast<double>(opened.tellg()) / (static_cast<double>(width) * height);
+            cout << std::setw(8) << (source == &image ? "noise" : "smooth") << std::setw(8) << format << std::setprecision(0) << std::setw(14) << megabytes / write
+                 << std::setw(13) << megabytes / readTime << std::setprecision(2) << std::setw(16) << bytesPerPixel << endl;
+            if (!read.getPixel(width / 2, height / 2).isClose(source->getPixel(width / 2, height / 2), 0.02f)) cout << "ERROR: different pixels read" << endl;
+            std::remove(file.c_str());
+        }
+    }
+
+    return 0;
+}
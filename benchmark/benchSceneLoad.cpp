@@ -0,0 +1,82 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include "scenefile.hpp"
+
+// Reading scenes of more and more random spheres: parsing the text, compiling it,
+// and loading the compiled file, without building the BVH, with the size of both files.
+
+using std::cout, std::endl;
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void writeScene(int nSpheres, const std::string& path) {
+    PCG pcg;
+    std::ofstream file(path);
+    file << "material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+            "material mirror(specular(uniform(<0.8, 0.8, 0.8>), uniform(<0, 0, 0>), 0.0, 45))\n"
+            "plane(red, translation([0, 0, -100]))\n"
+            "camera(perspective, 1.0, 100, 1.0, translation([-200, 0, 0]))\n"
+            "pointLight([0, 0, 200], <1, 1, 1>, 0)\n";
+    for (int i = 0; i < nSpheres; i++) {
+        file << "sphere(" << (i % 2 ? "red" : "mirror") << ", translation([" << pcg.random(-100, 100) << ", " << pcg.random(-100, 100)
+             << ", " << pcg.random(-100, 100) << "]) * scaling([0.3, 0.3, 0.3]))\n";
+    }
+}
+
+size_t fileSize(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file.tellg();
+}
+
+int main() {
+    std::string textPath = "benchSceneLoad.txt", compiledPath = "benchSceneLoad.rtscene";
+
+    cout << std::setw(9) << "spheres" << std::setw(12) << "text [MB]" << std::setw(11) << "parse [s]" << std::setw(13) << "compile [s]"
+         << std::setw(16) << "compiled [MB]" << std::setw(10) << "load [s]" << endl;
+
+    for (int nSpheres : {10000, 100000, 1000000}) {
+        writeScene(nSpheres, textPath);
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::ifstream file(textPath);
+            InputStream stream(file, textPath);
+            Scene scene;
+            scene.buildWorld = false;
+            scene.parse(stream);
+        }
+        double parse = seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        {
+            std::ifstream file(textPath);
+            InputStream stream(file, textPath);
+            Scene scene;
+            scene.buildWorld = false;
+            scene.compiled = std::make_shared<CompiledScene>();
+            scene.parse(stream);
+            scene.compiled->save(compiledPath);
+        }
+        double compile = seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        Scene scene;
+        scene.buildWorld = false;
+        CompiledScene::load(compiledPath, scene);
+        double load = seconds(start);
+
+        cout << std::setw(9) << nSpheres << std::fixed << std::setprecision(1) << std::setw(12) << fileSize(textPath) / 1e6
+             << std::setprecision(3) << std::setw(11) << parse << std::setw(13) << compile << std::setprecision(1)
+             << std::setw(16) << fileSize(compiledPath) / 1e6 << std::setprecision(3) << std::setw(10) << load << endl;
+        if (scene.world._shapes.size() != static_cast<size_t>(nSpheres + 1)) cout << "ERROR: wrong number of shapes loaded" << endl;
+    }
+
+    std::remove(textPath.c_str());
+    std::remove(compiledPath.c_str());
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "World.hpp"
+#include "simd.hpp"
+
+// Compares the old sphere-by-sphere loop (virtual Sphere::isHit) with the packed kernels,
+// on scenes with thousands of randomly placed spheres.
+
+using std::cout, std::endl;
+
+auto material = std::make_shared<DiffuseMaterial>();
+
+template <typename Function>
+double raysPerSecond(const std::vector<Ray>& rays, Function function) {
+    int hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Ray& ray : rays) hits += function(ray);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (hits < 0) cout << hits; // keep the compiler from removing the loop
+    return rays.size() / seconds;
+}
+
+int main() {
+    PCG pcg;
+    cout << "best instruction set: " << simdLevelName(bestSimdLevel()) << "\n" << endl;
+    cout << std::setw(8) << "spheres" << std::setw(14) << "loop [ray/s]" << std::setw(14) << "scalar"
+         << std::setw(14) << "SSE4.1" << std::setw(14) << "AVX2" << std::setw(10) << "speedup" << endl;
+
+    for (int nSpheres : {100, 1000, 4000, 16000}) {
+        std::vector<std::shared_ptr<Shape>> spheres;
+        SpherePack pack;
+        for (int i = 0; i < nSpheres; i++) {
+            Transformation t = translation(pcg.random(-50., 50.), pcg.random(-50., 50.), pcg.random(-50., 50.)) * scaling(pcg.random(0.2, 1.));
+            spheres.push_back(std::make_shared<Sphere>(material, t));
+            pack.add(t);
+        }
+
+        std::vector<Ray> rays;
+        int nRays = 20000000 / nSpheres;
+        for (int i = 0; i < nRays; i++) rays.emplace_back(Point3(pcg.random(-50., 50.), pcg.random(-50., 50.), pcg.random(-50., 50.)), pcg.randomVersor());
+
+        double loop = raysPerSecond(rays, [&](const Ray& ray) {
+            HitRecord rec, closest;
+            bool hit = false;
+            for (const auto& shape : spheres)
+                if (shape->isHit(ray, rec) && (!hit || rec.t < closest.t)) hit = true, closest = rec;
+            return hit;
+        });
+
+        double perLevel[3] = {0., 0., 0.};
+        for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE4, SimdLevel::AVX2}) {
+            if (level > bestSimdLevel()) continue;
+            perLevel[static_cast<int>(level)] = raysPerSecond(rays, [&](const Ray& ray) { float t; return pack.closestHit(ray, t, level) >= 0; });
+        }
+
+        cout << std::setw(8) << nSpheres << std::fixed << std::setprecision(0) << std::setw(14) << loop
+             << std::setw(14) << perLevel[0] << std::setw(14) << perLevel[1] << std::setw(14) << perLevel[2]
+             << std::setprecision(1) << std::setw(9) << perLevel[static_cast<int>(bestSimdLevel())] / loop << "x" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <fstream>
+#include <cstdio>
+#include "HDRImage.hpp"
+#include "ThreadPool.hpp"
+#include "simd.hpp"
+
+// Tone mapping a 4000 x 3000 rendered image to 8-bit pixels, as render does before saving a PNG: the old way,
+// a pass for the luminosity with log10 per pixel, one to normalize, one to clamp and one with std::pow per channel,
+// against the luminosity reduction and the fused toneMap pass, with every instruction set, then on every thread.
+// The old luminosity was summed in single precision, the bytes differing from it are mostly due to that.
+// Last, saving it as PNG and JPEG with saveToneMapped, on one thread and with a strip per thread encoded at the same time.
+
+using std::cout, std::endl;
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the passes before the fused one, on a copy of the image
+std::vector<uint8_t> toneMapPasses(HDRImage image, float a, float gamma) {
+    float sum = 0.0f;
+    for (int j = 0; j < image._height; j++) {
+        for (int i = 0; i < image._width; i++) sum += std::log10(image.getPixel(i, j).luminosity() + 1e-10f);
+    }
+    float luminosity = std::pow(10.0f, sum / (static_cast<float>(image._width) * image._height));
+    image.normalize(a, luminosity);
+    image.clamp();
+
+    std::vector<uint8_t> bytes(3 * static_cast<size_t>(image._width) * image._height);
+    for (int j = 0; j < image._height; j++) {
+        for (int i = 0; i < image._width; i++) {
+            Color color = image.getPixel(i, j);
+            size_t index = 3 * image.pixelIndex(i, j);
+            bytes[index] = 255 * std::pow(color.r, 1.0f / gamma);
+            bytes[index + 1] = 255 * std::pow(color.g, 1.0f / gamma);
+            bytes[index + 2] = 255 * std::pow(color.b, 1.0f / gamma);
+        }
+    }
+    return bytes;
+}
+
+// the fused pass, on the rows of pixels as averageLuminosity and writeStrips go through them
+std::vector<uint8_t> toneMapFused(const std::vector<Color>& pixels, int width, int height, float a, float gamma, SimdLevel level, ThreadPool& pool) {
+    std::vector<double> partials((height + 15) / 16, 0.0);
+    pool.parallelFor(0, height, 16, [&](int begin, int end) {
+        for (int j = begin; j < end; j++) partials[j / 16] += sumLogLuminosity(&pixels[static_cast<size_t>(j) * width], width, 1e-10f, level);
+    });
+    double sum = std::accumulate(partials.begin(), partials.end(), 0.0);
+    float luminosity = static_cast<float>(std::pow(10.0, sum / (static_cast<double>(width) * height)));
+
+    std::vector<uint8_t> bytes(3 * pixels.size());
+    pool.parallelFor(0, height, 4, [&](int begin, int end) {
+        for (int j = begin; j < end; j++) {
+            size_t index = static_cast<size_t>(j) * width;
+            toneMap(&pixels[index], 3 * static_cast<size_t>(width), a / luminosity, true, 1.0f / gamma, &bytes[3 * index], level);
+        }
+    });
+    return bytes;
+}
+
+int main() {
+    const int width = 4000, height = 3000;
+    const float a = 0.5f, gamma = 2.2f;
+    PCG pcg;
+    HDRImage image(width, height);
+    std::vector<Color> pixels(static_cast<size_t>(width) * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            pixels[image.pixelIndex(i, j)] = Color(std::exp(pcg.random(-5.0f, 3.0f)), std::exp(pcg.random(-5.0f, 3.0f)), std::exp(pcg.random(-5.0f, 3.0f)));
+            image.setPixel(i, j, pixels[image.pixelIndex(i, j)]);
+        }
+    }
+
+    cout << std::setw(12) << "version" << std::setw(8) << "threads" << std::setw(12) << "time [s]" << std::setw(10) << "speedup" << std::setw(12) << "different" << endl;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> reference = toneMapPasses(image, a, gamma);
+    double passes = seconds(start);
+    cout << std::setw(12) << "4 passes" << std::setw(8) << 1 << std::fixed << std::setprecision(3) << std::setw(12) << passes << endl;
+
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (bestSimdLevel() >= SimdLevel::SSE4) levels.push_back(SimdLevel::SSE4);
+    if (bestSimdLevel() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+    ThreadPool serial(1), parallel(0);
+    for (ThreadPool* pool : {&serial, &parallel}) {
+        if (pool == &parallel && parallel.size() == 1) break;
+        for (SimdLevel level : levels) {
+            start = std::chrono::steady_clock::now();
+            std::vector<uint8_t> bytes = toneMapFused(pixels, width, height, a, gamma, level, *pool);
+            double fused = seconds(start);
+
+            size_t different = 0;
+            for (size_t k = 0; k < bytes.size(); k++) different += bytes[k] != reference[k];
+            cout << std::setw(12) << simdLevelName(level) << std::setw(8) << pool->size() << std::setprecision(3) << std::setw(12) << fused
+                 << std::setprecision(1) << std::setw(9) << passes / fused << "x" << std::setprecision(3) << std::setw(11) << 100.0 * different / bytes.size() << "%" << endl;
+        }
+    }
+
+    cout << "\n" << std::setw(12) << "format" << std::setw(8) << "threads" << std::setw(12) << "save [s]" << std::setw(10) << "speedup" << endl;
+    for (const char* format : {"png", "jpg"}) {
+        std::string file = std::string("benchToneMap.") + format, serialBytes;
+        double serialTime = 0.0;
+        for (ThreadPool* pool : {static_cast<ThreadPool*>(nullptr), &parallel}) {
+            start = std::chrono::steady_clock::now();
+            image.saveToneMapped(file, a / 0.5f, gamma, pool);
+            double save = seconds(start);
+
+            std::ifstream saved(file, std::ios::binary);
+            std::string bytes((std::istreambuf_iterator<char>(saved)), std::istreambuf_iterator<char>());
+            if (pool == nullptr) serialTime = save, serialBytes = bytes;
+            else if (bytes != serialBytes) cout << "ERROR: different files saved" << endl;
+            cout << std::setw(12) << format << std::setw(8) << (pool == nullptr ? 1 : pool->size()) << std::setprecision(3) << std::setw(12) << save
+                 << std::setprecision(1) << std::setw(9) << serialTime / save << "x" << endl;
+        }
+        std::remove(file.c_str());
+    }
+
+    return 0;
+}
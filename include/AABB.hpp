@@ -0,0 +1,107 @@
+#ifndef __AABB__
+#define __AABB__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Point3.hpp"
+#include "Vec3.hpp"
+#include "Ray.hpp"
+#include "Transformation.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief Axis-aligned bounding box, used to build acceleration structures.
+ *
+ * The default box is empty (min = +inf, max = -inf), so growing it with a point gives a box around that point.
+ * Unbounded shapes (like planes) have infinite boxes.
+ */
+struct AABB {
+    // exit distances of the slab test are multiplied by this, the bound of their rounding error:
+    // rays through an edge or a corner of the box hit it, instead of missing by an ulp (Ize, 2013)
+    static constexpr float SLAB_ROUNDING = 1.0f + 2.0f * (3.0f * 0.5f * std::numeric_limits<float>::epsilon())
+                                                  / (1.0f - 3.0f * 0.5f * std::numeric_limits<float>::epsilon());
+
+    Point3 min, max;
+
+    AABB() : min(INF, INF, INF), max(-INF, -INF, -INF) {}
+    AABB(const Point3& min, const Point3& max) : min(min), max(max) {}
+
+    static AABB infinite() { return AABB(Point3(-INF, -INF, -INF), Point3(INF, INF, INF)); }
+
+    bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    bool isFinite() const {
+        return std::isfinite(min.x) && std::isfinite(min.y) && std::isfinite(min.z) &&
+               std::isfinite(max.x) && std::isfinite(max.y) && std::isfinite(max.z);
+    }
+
+    void grow(const Point3& p) {
+        min = Point3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Point3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+
+    void grow(const AABB& other) {
+        min = Point3(std::min(min.x, other.min.x), std::min(min.y, other.min.y), std::min(min.z, other.min.z));
+        max = Point3(std::max(max.x, other.max.x), std::max(max.y, other.max.y), std::max(max.z, other.max.z));
+    }
+
+    Vec3 extent() const { return max - min; }
+
+    Point3 centroid() const { return Point3(0.5f * (min.x + max.x), 0.5f * (min.y + max.y), 0.5f * (min.z + max.z)); }
+
+    float surfaceArea() const {
+        if (isEmpty()) return 0.0f;
+        Vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // 0 for x, 1 for y, 2 for z
+    int largestAxis() const {
+        Vec3 e = extent();
+        return (e.x >= e.y && e.x >= e.z) ? 0 : (e.y >= e.z ? 1 : 2);
+    }
+
+    bool contains(const AABB& other, float epsilon = 1e-4f) const {
+        return other.min.x >= min.x - epsilon && other.min.y >= min.y - epsilon && other.min.z >= min.z - epsilon &&
+               other.max.x <= max.x + epsilon && other.max.y <= max.y + epsilon && other.max.z <= max.z + epsilon;
+    }
+
+    /**
+     * @brief Box containing this one after a transformation, from its 8 transformed corners.
+     */
+    AABB transform(const Transformation& transformation) const {
+        AABB result;
+        for (int k = 0; k < 8; k++) {
+            result.grow(transformation * Point3((k & 1) ? max.x : min.x, (k & 2) ? max.y : min.y, (k & 4) ? max.z : min.z));
+        }
+        return result;
+    }
+
+    /**
+     * @brief Slab test, checks if the ray crosses the box inside (ray.tmin, ray.tmax).
+     *
+     * @param ray
+     * @param tEnter Holds the distance where the ray enters the box (or ray.tmin, if it starts inside).
+     * @return true If the box is hit.
+     */
+    bool isHit(const Ray& ray, float& tEnter) const {
+        float tNear = ray.tmin, tFar = ray.tmax;
+        const float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+        const float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+        const float low[3] = {min.x, min.y, min.z}, high[3] = {max.x, max.y, max.z};
+
+        for (int k = 0; k < 3; k++) {
+            float inverse = 1.0f / direction[k];
+            float t1 = (low[k] - origin[k]) * inverse, t2 = (high[k] - origin[k]) * inverse;
+            if (t1 > t2) std::swap(t1, t2);
+            tNear = std::max(tNear, t1), tFar = std::min(tFar, t2 * SLAB_ROUNDING);
+        }
+
+        tEnter = tNear;
+        return tNear <= tFar;
+    }
+};
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef __Accelerator__
+#define __Accelerator__
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+
+#include "shapes.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "HitRecord.hpp"
+#include "simd.hpp"
+#include "BVH.hpp"
+#include "QuantizedBVH.hpp"
+#include "Grid.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief The bounded shapes of a World, called primitives, as seen by an Accelerator.
+ *
+ * Primitives are numbered in the order of the boxes given to Accelerator::build.
+ * Spheres are tested with the SpherePack, which only gives their distance, the other shapes with their own isHit.
+ * Compact spheres (see World::BuildSettings::compactShapes) have no Shape object and no place in shapes:
+ * they are numbered from COMPACT_SPHERE on, by their index in spherePack, wherever an index in shapes is expected.
+ */
+struct Primitives {
+    // index of the first compact sphere, after those of all the shapes
+    static constexpr int COMPACT_SPHERE = 1 << 30;
+
+    const std::vector<std::shared_ptr<Shape>>& shapes;
+    const SpherePack& spherePack;
+    const std::vector<int>& spheres;   // index in shapes of every sphere in spherePack
+    const std::vector<int>& bounded;   // index in shapes of every primitive
+    const std::vector<int>& packIndex; // for every shape, its index in spherePack, -1 if it's not a sphere
+    const std::vector<int>& others;    // index in shapes of the primitives that are not spheres
+    const std::vector<uint32_t>& sphereMaterials;             // for every sphere in spherePack, its index in materials
+    const std::vector<std::shared_ptr<Material>>& materials; // of the compact spheres
+
+    // closest hit found so far: the HitRecord of a sphere is computed only once, by finish
+    struct ClosestHit {
+        float t;            // only closer hits are searched
+        HitRecord& record;  // of the closest shape that is not a sphere
+        bool hit = false;   // record is set
+        int sphere = -1;    // index in shapes of the closest shape, if it's a sphere
+    };
+
+    /**
+     * @brief Intersects a primitive, if it's hit closer than closest.t it becomes the closest one.
+     */
+    bool intersect(int primitive, const Ray& ray, ClosestHit& closest) const {
+        int index = bounded[primitive];
+        Ray shortened(ray.origin, ray.direction, ray.tmin, closest.t, ray.depth);
+        if (int sphere = sphereIndex(index); sphere >= 0) {
+            float t = spherePack.distance(sphere, shortened);
+            if (t >= closest.t) return false;
+            closest.t = t, closest.sphere = index;
+            return true;
+        }
+        HitRecord tempRecord;
+        if (!shapes[index]->isHit(shortened, tempRecord)) return false;
+        closest.t = tempRecord.t, closest.sphere = -1, closest.hit = true;
+        closest.record = tempRecord;
+        return true;
+    }
+
+    bool occludes(int primitive, const Ray& ray) const {
+        int index = bounded[primitive];
+        int sphere = sphereIndex(index);
+        return (sphere >= 0) ? spherePack.distance(sphere, ray) < INF : shapes[index]->quickIsHit(ray);
+    }
+
+    // index in spherePack of a shape, -1 if it's not a sphere
+    int sphereIndex(int index) const { return index >= COMPACT_SPHERE ? index - COMPACT_SPHERE : packIndex[index]; }
+
+    /**
+     * @brief Computes the HitRecord of the closest sphere, if it's the closest shape, and normalizes the normal.
+     *
+     * @return true If anything was hit.
+     */
+    bool finish(const Ray& ray, ClosestHit& closest) const {
+        if (closest.sphere >= 0) {
+            HitRecord tempRecord;
+            if (sphereIsHit(closest.sphere, ray, tempRecord)) {
+                closest.hit = true;
+                closest.record = tempRecord;
+            }
+        }
+        if (closest.hit) closest.record.normal = closest.record.normal.normalize();
+        return closest.hit;
+    }
+
+    // full intersection with a sphere, given its index in shapes, even if it's a compact one
+    bool sphereIsHit(int index, const Ray& ray, HitRecord& rec) const {
+        if (index < COMPACT_SPHERE) return shapes[index]->isHit(ray, rec);
+        int sphere = index - COMPACT_SPHERE;
+        return sphereHit(spherePack.transformation(sphere), materials[sphereMaterials[sphere]], ray, rec);
+    }
+};
+
+
+/**
+ * @brief Spatial index over the primitives of a World, chosen at runtime (see World::BuildSettings).
+ *
+ * An accelerator stores only indices of primitives, the shapes stay in the World, which passes them
+ * to every query: so the accelerator doesn't depend on where the World is in memory.
+ * The queries are virtual, the tests of the primitives inside them are not.
+ */
+class Accelerator {
+public:
+    enum class Type { Linear, BVH, Grid };
+
+    virtual ~Accelerator() = default;
+
+    virtual Type type() const = 0;
+
+    /**
+     * @brief Indexes the primitives.
+     *
+     * @param boxes One box per primitive.
+     * @param pool If not null, can be used to build in parallel.
+     */
+    virtual void build(const std::vector<AABB>& boxes, ThreadPool* pool) = 0;
+
+    /**
+     * @brief Brings the index up to date after the primitives moved, by default it's built again.
+     */
+    virtual void refit(const std::vector<AABB>& boxes, ThreadPool* pool) { build(boxes, pool); }
+
+    // see BVH::sahCost, 0 for accelerators without one
+    virtual float sahCost() const { return 0.0f; }
+
+    // bytes used by the index
+    virtual size_t memoryUsage() const = 0;
+
+    /**
+     * @brief Finds the closest primitive hit by the ray, closer than closest.t.
+     *
+     * @return true If a primitive closer than closest.t was found, closest is updated then.
+     */
+    virtual bool closestHit(const Primitives& primitives, const Ray& ray, Primitives::ClosestHit& closest) const = 0;
+
+    /**
+     * @brief Finds any primitive hit by the ray inside (ray.tmin, ray.tmax).
+     *
+     * @return int The index in primitives.shapes of the shape hit, -1 if there is none.
+     */
+    virtual int anyHit(const Primitives& primitives, const Ray& ray) const = 0;
+
+    /**
+     * @brief Adds the primitives that can be hit by a packet to spheres (indices in the SpherePack) and others (indices in the shapes).
+     */
+    virtual void cull(const Primitives& primitives, const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) const = 0;
+
+    static std::string name(Type type) {
+        switch (type) {
+            case Type::Linear: return "linear";
+            case Type::BVH: return "bvh";
+            case Type::Grid: return "grid";
+        }
+        return "";
+    }
+
+protected:
+    // the queries for BVH, QuantizedBVH and Grid, which have the same interface
+
+    template <typename Tree>
+    static bool closestHitTree(const Tree& tree, const Primitives& primitives, const Ray& ray, Primitives::ClosestHit& closest) {
+        // closest.t is also the tmax of the traversal, intersect shrinks it
+        return tree.closestHit(ray, closest.t, [&](int primitive, float&) { return primitives.intersect(primitive, ray, closest); });
+    }
+
+    template <typename Tree>
+    static int anyHitTree(const Tree& tree, const Primitives& primitives, const Ray& ray) {
+        int occluder = -1;
+        tree.anyHit(ray, [&](int primitive) {
+            if (!primitives.occludes(primitive, ray)) return false;
+            occluder = primitives.bounded[primitive];
+            return true;
+        });
+        return occluder;
+    }
+
+    template <typename Tree>
+    static void cullTree(const Tree& tree, const Primitives& primitives, const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) {
+        tree.cull(packet, [&](int primitive) {
+            int index = primitives.bounded[primitive];
+            int sphere = primitives.sphereIndex(index);
+            if (sphere >= 0) spheres.push_back(sphere);
+            else others.push_back(index);
+        });
+    }
+};
+
+
+/**
+ * @brief No index: spheres are tested 8 at a time with the SpherePack kernels, the other shapes one by one.
+ *
+ * Best for a few tens of shapes, and what a World uses before build() is called.
+ */
+class LinearAccelerator : public Accelerator {
+public:
+    Type type() const override { return Type::Linear; }
+
+    void build(const std::vector<AABB>&, ThreadPool*) override {}
+
+    size_t memoryUsage() const override { return 0; }
+
+    bool closestHit(const Primitives& primitives, const Ray& ray, Primitives::ClosestHit& closest) const override {
+        bool hit = false;
+        for (int index : primitives.others) {
+            HitRecord tempRecord;
+            if (primitives.shapes[index]->isHit(Ray(ray.origin, ray.direction, ray.tmin, closest.t, ray.depth), tempRecord)) {
+                closest.t = tempRecord.t, closest.sphere = -1, closest.hit = hit = true;
+                closest.record = tempRecord;
+            }
+        }
+
+        // the kernel only finds the closest sphere, the hit record is computed at the end
+        float t;
+        int sphere = primitives.spherePack.closestHit(Ray(ray.origin, ray.direction, ray.tmin, closest.t, ray.depth), t);
+        if (sphere >= 0 && t < closest.t) {
+            closest.t = t, closest.sphere = primitives.spheres[sphere];
+            hit = true;
+        }
+        return hit;
+    }
+
+    int anyHit(const Primitives& primitives, const Ray& ray) const override {
+        for (int index : primitives.others) {
+            if (primitives.shapes[index]->quickIsHit(ray)) return index;
+        }
+        int sphere = primitives.spherePack.anyHit(ray);
+        return sphere >= 0 ? primitives.spheres[sphere] : -1;
+    }
+
+    void cull(const Primitives& primitives, const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) const override {
+        if (spheres.empty()) {
+            primitives.spherePack.cull(packet, spheres);
+        } else { // SpherePack::cull clears its output
+            std::vector<int> culled;
+            primitives.spherePack.cull(packet, culled);
+            spheres.insert(spheres.end(), culled.begin(), culled.end());
+        }
+        others.insert(others.end(), primitives.others.begin(), primitives.others.end());
+    }
+};
+
+
+/**
+ * @brief A BVH, or a QuantizedBVH if compact is set, see their documentation.
+ *
+ * The BVH can be saved to a file and mapped from it the next time, see BVH::load.
+ */
+class BVHAccelerator : public Accelerator {
+public:
+    /**
+     * @brief Construct a new BVHAccelerator object.
+     *
+     * @param preset How the BVH is built.
+     * @param compact Keep only a QuantizedBVH, half the size.
+     * @param cachePath File where the BVH is saved, and loaded from when the boxes match, empty for no cache.
+     */
+    BVHAccelerator(BVH::Preset preset = BVH::Preset::SAH, bool compact = false, const std::string& cachePath = "")
+        : _preset(preset), _compact(compact), _cachePath(cachePath) {}
+
+    Type type() const override { return Type::BVH; }
+
+    void build(const std::vector<AABB>& boxes, ThreadPool* pool) override {
+        uint64_t key = _cachePath.empty() ? 0 : BVH::key(boxes, _preset);
+        _cached = !_cachePath.empty() && _bvh.load(_cachePath, key);
+        if (!_cached) {
+            _bvh.build(boxes, _preset, pool);
+            if (!_cachePath.empty()) _bvh.save(_cachePath, key); // failing to save is not an error
+        }
+        _quantized.clear();
+
+        if (_compact) {
+            _quantized.build(_bvh);
+            _bvh.clear();
+        }
+    }
+
+    // in linear time, see BVH::refit
+    void refit(const std::vector<AABB>& boxes, ThreadPool*) override {
+        if (_compact) _quantized.refit(boxes);
+        else _bvh.refit(boxes);
+    }
+
+    float sahCost() const override { return _compact ? _quantized.sahCost() : _bvh.sahCost(); }
+
+    size_t memoryUsage() const override { return _bvh.memoryUsage() + _quantized.memoryUsage(); }
+
+    bool closestHit(const Primitives& primitives, const Ray& ray, Primitives::ClosestHit& closest) const override {
+        return _compact ? closestHitTree(_quantized, primitives, ray, closest) : closestHitTree(_bvh, primitives, ray, closest);
+    }
+
+    int anyHit(const Primitives& primitives, const Ray& ray) const override {
+        return _compact ? anyHitTree(_quantized, primitives, ray) : anyHitTree(_bvh, primitives, ray);
+    }
+
+    void cull(const Primitives& primitives, const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) const override {
+        if (_compact) cullTree(_quantized, primitives, packet, spheres, others);
+        else cullTree(_bvh, primitives, packet, spheres, others);
+    }
+
+    // true if the last build mapped the BVH from the cache file
+    bool isCached() const { return _cached; }
+
+    const BVH& bvh() const { return _bvh; }
+
+    const QuantizedBVH& quantizedBVH() const { return _quantized; }
+
+private:
+    BVH::Preset _preset;
+    bool _compact;
+    std::string _cachePath;
+    bool _cached = false;
+    BVH _bvh;                // empty if compact is set
+    QuantizedBVH _quantized; // empty if compact is not set
+};
+
+
+/**
+ * @brief A uniform Grid, see its documentation.
+ *
+ * Moving primitives are handled building the grid again, which takes linear time.
+ */
+class GridAccelerator : public Accelerator {
+public:
+    explicit GridAccelerator(float density = Grid::DENSITY) : _density(density) {}
+
+    Type type() const override { return Type::Grid; }
+
+    void build(const std::vector<AABB>& boxes, ThreadPool*) override { _grid.build(boxes, _density); }
+
+    size_t memoryUsage() const override { return _grid.memoryUsage(); }
+
+    bool closestHit(const Primitives& primitives, const Ray& ray, Primitives::ClosestHit& closest) const override {
+        return closestHitTree(_grid, primitives, ray, closest);
+    }
+
+    int anyHit(const Primitives& primitives, const Ray& ray) const override {
+        return anyHitTree(_grid, primitives, ray);
+    }
+
+    // primitives in many cells are listed once
+    void cull(const Primitives& primitives, const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) const override {
+        size_t firstSphere = spheres.size(), firstOther = others.size();
+        cullTree(_grid, primitives, packet, spheres, others);
+        auto unique = [](std::vector<int>& indices, size_t first) {
+            std::sort(indices.begin() + first, indices.end());
+            indices.erase(std::unique(indices.begin() + first, indices.end()), indices.end());
+        };
+        unique(spheres, firstSphere), unique(others, firstOther);
+    }
+
+    const Grid& grid() const { return _grid; }
+
+private:
+    float _density;
+    Grid _grid;
+};
+
+#endif
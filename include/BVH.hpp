@@ -0,0 +1,357 @@
+#ifndef __BVH__
+#define __BVH__
+
+#include <vector>
+#include <cstdint>
+#include <span>
+#include <memory>
+#include <string>
+
+#include "AABB.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "simd.hpp"
+#include "MappedFile.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief Traversal (and SAH cost) of 4-wide trees, shared by BVH and QuantizedBVH.
+ *
+ * A Tree must provide hitChildren(node, ray, tmax, tNear, level), returning the bit mask
+ * of the children hit, child(node, k), count(node, k), isEmpty(node, k), childBox(node, k) and primitives(),
+ * with the meaning of BVH::Node. The root is node 0.
+ */
+namespace bvhTraversal {
+
+constexpr int WIDTH = 4;
+constexpr int MAX_DEPTH = 96; // depth of the binary tree built before the collapse, bounds the stack
+constexpr int STACK_SIZE = (WIDTH - 1) * MAX_DEPTH + 2;
+constexpr float TRAVERSAL_COST = 1.0f; // of a node, relative to the cost of intersecting a primitive
+
+struct StackEntry {
+    int index, count; // like BVH::Node::child and BVH::Node::count
+    float t;          // distance where the ray enters the box
+};
+
+// origin, inverse of the direction, tmin, padding
+inline void setRayData(const Ray& ray, float* data) {
+    data[0] = ray.origin.x, data[1] = ray.origin.y, data[2] = ray.origin.z;
+    data[3] = 1.0f / ray.direction.x, data[4] = 1.0f / ray.direction.y, data[5] = 1.0f / ray.direction.z;
+    data[6] = ray.tmin, data[7] = 0.0f;
+}
+
+template <typename Tree, typename Intersect>
+bool closestHit(const Tree& tree, const Ray& ray, float& tmax, const Intersect& intersect) {
+    if (tree.isEmpty()) return false;
+
+    alignas(16) float rayData[8];
+    setRayData(ray, rayData);
+    SimdLevel level = bestSimdLevel();
+    const auto& primitives = tree.primitives();
+
+    StackEntry stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = {0, 0, ray.tmin};
+    bool hit = false;
+
+    while (size > 0) {
+        StackEntry entry = stack[--size];
+        if (entry.t > tmax) continue; // something closer was found after this was pushed
+
+        if (entry.count > 0) {
+            for (int p = entry.index; p < entry.index + entry.count; p++) {
+                if (intersect(primitives[p], tmax)) hit = true;
+            }
+            continue;
+        }
+
+        alignas(16) float tNear[WIDTH];
+        int mask = tree.hitChildren(entry.index, rayData, tmax, tNear, level);
+
+        // push the children from the farthest to the closest, so the closest is popped first
+        StackEntry children[WIDTH];
+        int nChildren = 0;
+        for (int k = 0; k < WIDTH; k++) {
+            if (!(mask & (1 << k))) continue;
+            int i = nChildren++;
+            for (; i > 0 && children[i - 1].t < tNear[k]; i--) children[i] = children[i - 1];
+            children[i] = {tree.child(entry.index, k), tree.count(entry.index, k), tNear[k]};
+        }
+        for (int i = 0; i < nChildren; i++) stack[size++] = children[i];
+    }
+
+    return hit;
+}
+
+template <typename Tree, typename Occluded>
+bool anyHit(const Tree& tree, const Ray& ray, const Occluded& occluded) {
+    if (tree.isEmpty()) return false;
+
+    alignas(16) float rayData[8];
+    setRayData(ray, rayData);
+    SimdLevel level = bestSimdLevel();
+    const auto& primitives = tree.primitives();
+
+    StackEntry stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = {0, 0, ray.tmin};
+
+    while (size > 0) {
+        StackEntry entry = stack[--size];
+
+        if (entry.count > 0) {
+            for (int p = entry.index; p < entry.index + entry.count; p++) {
+                if (occluded(primitives[p])) return true;
+            }
+            continue;
+        }
+
+        alignas(16) float tNear[WIDTH];
+        int mask = tree.hitChildren(entry.index, rayData, ray.tmax, tNear, level);
+        for (int k = 0; k < WIDTH; k++) {
+            if (mask & (1 << k)) stack[size++] = {tree.child(entry.index, k), tree.count(entry.index, k), tNear[k]};
+        }
+    }
+
+    return false;
+}
+
+// see BVH::sahCost
+template <typename Tree>
+float sahCost(const Tree& tree) {
+    float cost = 0.0f;
+    AABB root;
+    for (int n = 0; n < static_cast<int>(tree.nodes().size()); n++) {
+        AABB box;
+        for (int k = 0; k < WIDTH; k++) {
+            if (tree.isEmpty(n, k)) continue;
+            AABB child = tree.childBox(n, k);
+            box.grow(child);
+            if (tree.count(n, k) > 0) cost += child.surfaceArea() * tree.count(n, k);
+        }
+        cost += TRAVERSAL_COST * box.surfaceArea();
+        if (n == 0) root = box;
+    }
+    return root.surfaceArea() > 0.0f ? cost / root.surfaceArea() : 0.0f;
+}
+
+template <typename Tree, typename Leaf>
+void cull(const Tree& tree, const RayPacket& packet, const Leaf& leaf) {
+    if (tree.isEmpty()) return;
+    const auto& primitives = tree.primitives();
+
+    int stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+
+    while (size > 0) {
+        int node = stack[--size];
+        for (int k = WIDTH - 1; k >= 0; k--) {
+            if (tree.isEmpty(node, k) || packet.isBoxOutside(tree.childBox(node, k))) continue;
+            int child = tree.child(node, k), count = tree.count(node, k);
+            if (count > 0) {
+                for (int p = child; p < child + count; p++) leaf(primitives[p]);
+            } else {
+                stack[size++] = child;
+            }
+        }
+    }
+}
+
+}
+
+
+
+/**
+ * @brief Bounding volume hierarchy with 4 children per node, over a generic set of primitives.
+ *
+ * The tree knows nothing about the primitives, only their boxes: the traversal functions call back
+ * the caller with the index of every primitive they reach, so the same class can index the shapes
+ * of a World, or anything else with a bounding box.
+ *
+ * The boxes of the 4 children of a node are stored in a structure of arrays,
+ * so a ray is tested against all of them with a single SIMD kernel (boxesHit4).
+ * The children hit are visited from the closest to the farthest, and the ones
+ * farther than the closest hit found so far are skipped.
+ * Nodes are stored in depth-first order, the first child of a node right after it.
+ */
+class BVH {
+public:
+    static constexpr int WIDTH = bvhTraversal::WIDTH;
+    static constexpr int MAX_LEAF_SIZE = 8;
+    static constexpr int MAX_DEPTH = bvhTraversal::MAX_DEPTH;
+
+    // how the tree is built: SAH gives better trees, LBVH (sorting by Morton code) is faster to build
+    enum class Preset { SAH, LBVH };
+
+    struct Node {
+        alignas(16) float bounds[24]; // min x, y, z, then max x, y, z of the children, 4 floats each
+        int32_t child[WIDTH];         // index of the child node, or of the first primitive of a leaf, -1 if the slot is empty
+        int32_t count[WIDTH];         // number of primitives in a leaf, 0 for inner nodes
+
+        bool isLeaf(int k) const { return count[k] > 0; }
+        bool isEmpty(int k) const { return child[k] < 0; }
+
+        AABB childBox(int k) const {
+            return AABB(Point3(bounds[k], bounds[4 + k], bounds[8 + k]), Point3(bounds[12 + k], bounds[16 + k], bounds[20 + k]));
+        }
+
+        void setChildBox(int k, const AABB& box) {
+            bounds[k] = box.min.x, bounds[4 + k] = box.min.y, bounds[8 + k] = box.min.z;
+            bounds[12 + k] = box.max.x, bounds[16 + k] = box.max.y, bounds[20 + k] = box.max.z;
+        }
+
+        int validMask() const {
+            return (child[0] >= 0) | (child[1] >= 0) << 1 | (child[2] >= 0) << 2 | (child[3] >= 0) << 3;
+        }
+    };
+
+    BVH() = default;
+
+    /**
+     * @brief Builds the tree over the given boxes.
+     *
+     * With Preset::SAH the primitives are split with the surface area heuristic, evaluated on 16 bins
+     * along the largest axis. With Preset::LBVH they are sorted along a Morton curve through their centroids,
+     * then split where the codes change, a few times faster but giving slower trees.
+     * The resulting tree does not depend on the number of threads.
+     *
+     * @param boxes One box per primitive, the index in this vector is the one passed to the callbacks.
+     * @param preset
+     * @param pool If not null, big subtrees are built in parallel, and so are the bins of big nodes.
+     */
+    void build(const std::vector<AABB>& boxes, Preset preset = Preset::SAH, ThreadPool* pool = nullptr);
+
+    void clear() { _nodes.clear(), _primitives.clear(), _file.reset(); }
+
+    bool isEmpty() const { return nodes().empty(); }
+
+    int size() const { return static_cast<int>(primitives().size()); }
+
+    std::span<const Node> nodes() const { return _file ? _mappedNodes : std::span<const Node>(_nodes); }
+
+    // primitive indices, the leaves point to ranges of this array
+    std::span<const int> primitives() const { return _file ? _mappedPrimitives : std::span<const int>(_primitives); }
+
+    /**
+     * @brief Writes the tree to a file, that load can map in memory later.
+     *
+     * @param path
+     * @param key Identifies the primitives the tree was built on, see key.
+     * @return false If the file can't be written.
+     */
+    bool save(const std::string& path, uint64_t key) const;
+
+    /**
+     * @brief Uses the tree saved in a file, mapped in memory instead of built: it's ready after a single check
+     *        of the nodes, in a few milliseconds even for millions of primitives.
+     *
+     * The size of the file and the key are checked, then every node is read once to check that the children
+     * and the ranges of primitives are inside the arrays, so that a damaged file can't be traversed out of them.
+     * The tree is copied in memory only if it's modified (refit).
+     *
+     * @param path
+     * @param key Must be the same one given to save.
+     * @return false If the file doesn't exist, isn't a valid tree, or has another key. The tree is not changed then.
+     */
+    bool load(const std::string& path, uint64_t key);
+
+    // true if the tree is mapped from a file by load
+    bool isMapped() const { return _file != nullptr; }
+
+    /**
+     * @brief Hash of the boxes and the preset, the same ones always give the same tree.
+     */
+    static uint64_t key(const std::vector<AABB>& boxes, Preset preset);
+
+    AABB bounds() const;
+
+    /**
+     * @brief Expected cost of a random ray crossing the tree, following the surface area heuristic.
+     *
+     * Each node costs 1 and each primitive 1, weighted by the probability of hitting their box
+     * (the ratio of its area with the one of the root). Lower is better, useful to compare the presets.
+     */
+    float sahCost() const { return _file ? _mappedSahCost : bvhTraversal::sahCost(*this); }
+
+    /**
+     * @brief Recomputes the boxes of the nodes, from the leaves up, keeping the structure of the tree.
+     *
+     * Much faster than a new build, for primitives that moved a little: the tree stays correct,
+     * but gets slower as they move away from where they were when it was built (see sahCost).
+     *
+     * @param boxes The new boxes of the primitives, in the same order as the ones given to build.
+     */
+    void refit(const std::vector<AABB>& boxes);
+
+    /**
+     * @brief Bytes used by the nodes and the primitive indices.
+     */
+    size_t memoryUsage() const { return nodes().size() * sizeof(Node) + primitives().size() * sizeof(int); }
+
+    /**
+     * @brief Finds the closest primitive hit by the ray.
+     *
+     * @tparam Intersect
+     * @param ray
+     * @param tmax Distance of the closest hit so far, only primitives closer than this are searched.
+     * @param intersect Called as intersect(int primitive, float& tmax), returns true and updates tmax
+     *                  if the primitive is hit closer than tmax.
+     * @return true If any call to intersect returned true.
+     */
+    template <typename Intersect>
+    bool closestHit(const Ray& ray, float& tmax, const Intersect& intersect) const {
+        return bvhTraversal::closestHit(*this, ray, tmax, intersect);
+    }
+
+    /**
+     * @brief Checks if any primitive is hit by the ray, exiting on the first one.
+     *
+     * @tparam Occluded
+     * @param ray
+     * @param occluded Called as occluded(int primitive), returns true if the primitive is hit.
+     * @return true If a primitive was hit.
+     */
+    template <typename Occluded>
+    bool anyHit(const Ray& ray, const Occluded& occluded) const {
+        return bvhTraversal::anyHit(*this, ray, occluded);
+    }
+
+    /**
+     * @brief Calls leaf(int primitive) for all the primitives inside the frustum of the packet.
+     *
+     * Whole subtrees outside one of the planes of the frustum are skipped.
+     *
+     * @tparam Leaf
+     * @param packet Must have a frustum.
+     * @param leaf
+     */
+    template <typename Leaf>
+    void cull(const RayPacket& packet, const Leaf& leaf) const {
+        bvhTraversal::cull(*this, packet, leaf);
+    }
+
+    // interface used by the traversal functions in bvhTraversal
+
+    int hitChildren(int node, const float* ray, float tmax, float* tNear, SimdLevel level) const {
+        const Node& n = nodes()[node];
+        return boxesHit4(n.bounds, ray, tmax, tNear, level) & n.validMask();
+    }
+    int child(int node, int k) const { return nodes()[node].child[k]; }
+    int count(int node, int k) const { return nodes()[node].count[k]; }
+    bool isEmpty(int node, int k) const { return nodes()[node].isEmpty(k); }
+    AABB childBox(int node, int k) const { return nodes()[node].childBox(k); }
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<int> _primitives;
+
+    // set by load, the tree is in the file instead of the vectors
+    std::shared_ptr<const MappedFile> _file;
+    std::span<const Node> _mappedNodes;
+    std::span<const int> _mappedPrimitives;
+    float _mappedSahCost = 0.0f;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define __Camera__
 
 #include <utility>
+#include <type_traits>
 
 #include "Point3.hpp"
 #include "Vec3.hpp"
@@ -157,6 +158,98 @@ public:
                   << std::chrono::duration<float>(end - start).count() << " s                 " << std::endl;
     }
 
+    /**
+     * @brief Same as render, but the first rays are cast and intersected in packets, one for each square tile of the image.
+     *
+     * For every sample, the rays through all the pixels of a tile are collected in a RayPacket
+     * and intersected together by World::isHit, using the frustum of the tile to skip the objects outside it.
+     * The rest of the computation, secondary rays included, is done one ray at a time by "shader".
+     *
+     * @tparam Function 
+     * @tparam Args 
+     * @param shader Algorithm used to render the image, it takes the first intersection as parameters, see Renderers::FromHit.
+     *               If it takes no HitRecord, the packets are only tested with World::occluded.
+     * @param side Side of the tiles in pixels, at most 8.
+     * @param AASamples Number of samples per pixel used for anti-aliasing.
+     * @param world The World to render.
+     * @param args Additional arguments needed by "shader", after the World.
+     */
+    template <typename Function, typename... Args>
+    void renderPackets(const Function& shader, int side, int AASamples, const World& world, Args&&... args) {
+        int AASamplesRoot = std::round(std::sqrt(AASamples));
+        bool squareAA = (AASamplesRoot * AASamplesRoot == AASamples);
+
+        RayPacket packet;
+        HitRecord records[RayPacket::MAX_SIZE];
+        bool hits[RayPacket::MAX_SIZE];
+        Color sums[RayPacket::MAX_SIZE];
+
+        auto start = std::chrono::steady_clock::now();
+        auto lastFlush = start;
+        float timeSinceLastFlush = 1.0f;
+
+        for (int j0 = 0; j0 < imageHeight; j0 += side) {
+
+            // print progress every 0.5 s
+            if (timeSinceLastFlush > 0.5f) {
+                std::cout << "\rdrawing row " << j0 + 1 << "/" << imageHeight << std::flush;
+                lastFlush = std::chrono::steady_clock::now();
+            }
+            timeSinceLastFlush = std::chrono::duration<float>(std::chrono::steady_clock::now() - lastFlush).count();
+
+            int j1 = std::min(j0 + side, imageHeight) - 1;
+
+            for (int i0 = 0; i0 < imageWidth; i0 += side) {
+                int i1 = std::min(i0 + side, imageWidth) - 1;
+
+                // the corners of the tile, every sample of every pixel is inside
+                Ray corners[4] = {castRay(i0, j0, 0.0f, 0.0f), castRay(i1, j0, 1.0f, 0.0f),
+                                  castRay(i1, j1, 1.0f, 1.0f), castRay(i0, j1, 0.0f, 1.0f)};
+                packet.setFrustum(corners);
+
+                for (int r = 0; r < (i1 - i0 + 1) * (j1 - j0 + 1); r++) sums[r] = Color();
+
+                for (int sample = 0; sample < AASamples; sample++) {
+                    packet.clear();
+
+                    for (int j = j0; j <= j1; j++) {
+                        for (int i = i0; i <= i1; i++) {
+                            float uPixel = 0.5f, vPixel = 0.5f;
+                            if (AASamples > 1 && squareAA) { // same cells as stratifiedSampling
+                                uPixel = (sample % AASamplesRoot + pcg.random()) / AASamplesRoot;
+                                vPixel = (sample / AASamplesRoot + pcg.random()) / AASamplesRoot;
+                            } else if (AASamples > 1) {
+                                uPixel = pcg.random(), vPixel = pcg.random();
+                            }
+                            packet.add(castRay(i, j, uPixel, vPixel));
+                        }
+                    }
+
+                    if constexpr (std::is_invocable_v<const Function&, const Ray&, bool, const World&, Args...>) {
+                        world.occluded(packet, hits);
+                        for (int r = 0; r < packet.size; r++) {
+                            sums[r] += shader(packet.rays[r], hits[r], world, std::forward<Args>(args)...);
+                        }
+                    } else {
+                        world.isHit(packet, records, hits);
+                        for (int r = 0; r < packet.size; r++) {
+                            sums[r] += shader(packet.rays[r], hits[r], records[r], world, std::forward<Args>(args)...);
+                        }
+                    }
+                }
+
+                for (int j = j0, r = 0; j <= j1; j++) {
+                    for (int i = i0; i <= i1; i++, r++) image.setPixel(i, j, sums[r] * (1.0f / AASamples));
+                }
+            }
+        }
+
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << "\rimage drawn in " << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<float>(end - start).count() << " s                 " << std::endl;
+    }
+
 private:
     float _distance;
     _CastRay* _castRay;
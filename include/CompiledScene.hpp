@@ -0,0 +1,153 @@
+#ifndef __CompiledScene__
+#define __CompiledScene__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+
+#include "Transformation.hpp"
+
+class Scene;
+class World;
+class Texture;
+
+/**
+ * @brief A scene file reduced to flat records, saved in a binary file that is mapped in memory to render it.
+ *
+ * The text of a scene is lexed one character at a time, and variables and transformations are evaluated
+ * while parsing: for generated scenes with millions of shapes, reading it takes longer than rendering it
+ * at low sample counts. The compile command parses the scene once and saves what it defines,
+ * with every variable already replaced by its value, as arrays of fixed size records:
+ * loading them only walks the arrays and creates the objects, and all the spheres are allocated together.
+ *
+ * The file is a Header followed by the camera record, then the textures, materials, groups, shapes and lights
+ * arrays, and the strings (names and file paths), which the records point to as offset and length.
+ * Textures and materials point to the others by their index; shapes belong to the world (owner 0)
+ * or to a group (owner = index of the group + 1), and come in the order they were defined.
+ * Images and meshes are referenced by the path given in the scene, not copied.
+ * Numbers are saved in the byte order of the machine, files from another one are rejected.
+ */
+class CompiledScene {
+public:
+    static constexpr char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    enum class CameraType : uint32_t { None, Perspective, Orthogonal };
+    enum class TextureType : uint32_t { Uniform, Checkered, Image };
+    enum class MaterialType : uint32_t { Diffuse, Specular, Transparent };
+    enum class ShapeType : uint32_t { Sphere, Plane, Mesh, Instance };
+
+    struct StringRef {
+        uint32_t offset = 0, length = 0;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version, byteOrder;
+        uint32_t nTextures, nMaterials, nGroups, nShapes, nLights;
+        uint32_t stringBytes;
+    };
+
+    struct CameraRecord {
+        CameraType type = CameraType::None;
+        float aspectRatio = 1.0f, distance = 1.0f;
+        int32_t imageWidth = 0;
+        float matrix[16], inverse[16];
+    };
+
+    struct TextureRecord {
+        TextureType type;
+        int32_t steps;              // checkered
+        float color1[3], color2[3]; // the color of uniform, both colors of checkered
+        StringRef path;             // image
+    };
+
+    struct MaterialRecord {
+        MaterialType type;
+        uint32_t texture, emittedRadiance; // indices of the textures
+        float blur, thresholdAngle;        // specular, the angle in degrees as in the scene
+        float refractionIndex;             // transparent
+        StringRef name;
+    };
+
+    struct GroupRecord {
+        StringRef name;
+    };
+
+    struct ShapeRecord {
+        ShapeType type;
+        uint32_t owner;     // 0 for the world, the index of the group + 1 for the shapes in a group
+        uint32_t reference; // index of the material, or of the group for instances
+        StringRef path;     // meshes
+        uint32_t padding = 0;
+        float matrix[16], inverse[16];
+    };
+
+    struct LightRecord {
+        float position[3], color[3], radius;
+    };
+
+    static_assert(std::is_trivially_copyable_v<CameraRecord> && std::is_trivially_copyable_v<ShapeRecord>
+                  && sizeof(Header) % 8 == 0 && sizeof(ShapeRecord) % 8 == 0, "records are copied as bytes");
+
+    CameraRecord camera;
+    std::vector<TextureRecord> textures;
+    std::vector<MaterialRecord> materials;
+    std::vector<GroupRecord> groups;
+    std::vector<ShapeRecord> shapes;
+    std::vector<LightRecord> lights;
+    std::string strings;
+
+    // used by the parser to find the records of what it already read, not saved
+    std::unordered_map<std::string, uint32_t> materialIndex, groupIndex;
+    std::unordered_map<const Texture*, uint32_t> textureIndex;
+    std::unordered_map<const World*, uint32_t> owners;
+
+    StringRef addString(std::string_view s) {
+        StringRef ref{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size())};
+        strings.append(s);
+        return ref;
+    }
+
+    void addShape(ShapeType type, const World& owner, uint32_t reference, const Transformation& t, std::string_view path = {}) {
+        ShapeRecord record{type, ownerIndex(owner), reference, addString(path)};
+        std::copy(t.matrix, t.matrix + 16, record.matrix);
+        std::copy(t.inverseMatrix, t.inverseMatrix + 16, record.inverse);
+        shapes.push_back(record);
+    }
+
+    uint32_t ownerIndex(const World& world) const {
+        auto it = owners.find(&world);
+        return it == owners.end() ? 0 : it->second;
+    }
+
+    /**
+     * @brief Writes the records to a file.
+     *
+     * @param path
+     * @throw std::runtime_error If the file can't be written.
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Checks if a file starts like a compiled scene, without reading the rest.
+     */
+    static bool isCompiled(const std::string& path);
+
+    /**
+     * @brief Maps a compiled scene in memory and creates its camera, materials, groups, shapes and lights in scene,
+     *        as Scene::parse does with the text. The world is built if scene.buildWorld is set.
+     *
+     * @param path
+     * @param scene Should be empty, with the buildSettings of its world already set.
+     * @throw std::runtime_error If the file can't be read, comes from another version or machine, or is corrupted.
+     */
+    static void load(const std::string& path, Scene& scene);
+};
+
+#endif
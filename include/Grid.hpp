@@ -0,0 +1,214 @@
+#ifndef __Grid__
+#define __Grid__
+
+#include <vector>
+#include <algorithm>
+
+#include "AABB.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+
+/**
+ * @brief Uniform grid over a generic set of primitives, an alternative to the BVH.
+ *
+ * The box around all the primitives is split in cells of the same size, about DENSITY cells per primitive,
+ * and every cell lists the primitives whose box overlaps it (so a primitive can be in more than one cell).
+ * Rays walk through the cells they cross in order, with a 3D-DDA, and stop at the first cell
+ * containing a hit. Building is linear and the walk needs no stack: on dense scenes of primitives
+ * of similar size it's faster than a BVH, on sparse or uneven ones it's much slower.
+ * A few primitives much bigger than the others (like a sphere around the scene used as sky) would stretch
+ * the grid and fill all its cells, so they are kept out of it and tested by every ray.
+ *
+ * As the BVH, the grid knows only the boxes of the primitives, and calls back the caller with their indices.
+ * The cells are stored like a sparse matrix: the primitives of cell c are the ones from
+ * primitives()[cellStart[c]] to primitives()[cellStart[c + 1]], with cells in x, then y, then z order.
+ */
+class Grid {
+public:
+    static constexpr float DENSITY = 1.0f;         // cells per primitive
+    static constexpr int MAX_RESOLUTION = 1024;     // cells along each axis
+    static constexpr float LARGE_FRACTION = 0.5f;   // primitives with a box diagonal bigger than this fraction of the one of the scene stay out of the cells
+    static constexpr int MAX_LARGE = 16;            // if there are more, they go in the cells anyway
+
+    Grid() = default;
+
+    /**
+     * @brief Builds the grid over the given boxes, which must be finite.
+     *
+     * @param boxes One box per primitive, the index in this vector is the one passed to the callbacks.
+     * @param density Cells per primitive, more cells mean fewer primitives to test but longer walks.
+     */
+    void build(const std::vector<AABB>& boxes, float density = DENSITY);
+
+    void clear() { _cellStart.clear(), _primitives.clear(), _large.clear(), _box = AABB(); }
+
+    bool isEmpty() const { return _primitives.empty() && _large.empty(); }
+
+    // of the primitives in the cells
+    AABB bounds() const { return _box; }
+
+    // number of cells along x, y and z
+    const int* resolution() const { return _resolution; }
+
+    int nCells() const { return _resolution[0] * _resolution[1] * _resolution[2]; }
+
+    // references to the primitives in the cells, the same primitive can appear more than once
+    const std::vector<int>& primitives() const { return _primitives; }
+
+    // primitives kept out of the cells, see LARGE_FRACTION
+    const std::vector<int>& large() const { return _large; }
+
+    /**
+     * @brief Bytes used by the cells and the primitive indices.
+     */
+    size_t memoryUsage() const { return (_cellStart.size() + _primitives.size() + _large.size()) * sizeof(int); }
+
+    /**
+     * @brief Finds the closest primitive hit by the ray, with the same interface as BVH::closestHit.
+     *
+     * A primitive in many cells can be tested more than once, intersect must only accept hits closer than tmax.
+     */
+    template <typename Intersect>
+    bool closestHit(const Ray& ray, float& tmax, const Intersect& intersect) const {
+        bool hit = false;
+        for (int primitive : _large) {
+            if (intersect(primitive, tmax)) hit = true;
+        }
+
+        Walk walk;
+        if (!start(ray, tmax, walk)) return hit;
+        do {
+            int cell = walk.cell[0] + _resolution[0] * (walk.cell[1] + _resolution[1] * walk.cell[2]);
+            for (int p = _cellStart[cell]; p < _cellStart[cell + 1]; p++) {
+                if (intersect(_primitives[p], tmax)) hit = true;
+            }
+            // a hit inside this cell is closer than anything in the next ones
+            if (tmax <= walk.exit()) return hit;
+        } while (walk.next(tmax));
+
+        return hit;
+    }
+
+    /**
+     * @brief Checks if any primitive is hit by the ray, exiting on the first one, like BVH::anyHit.
+     */
+    template <typename Occluded>
+    bool anyHit(const Ray& ray, const Occluded& occluded) const {
+        for (int primitive : _large) {
+            if (occluded(primitive)) return true;
+        }
+
+        Walk walk;
+        if (!start(ray, ray.tmax, walk)) return false;
+
+        do {
+            int cell = walk.cell[0] + _resolution[0] * (walk.cell[1] + _resolution[1] * walk.cell[2]);
+            for (int p = _cellStart[cell]; p < _cellStart[cell + 1]; p++) {
+                if (occluded(_primitives[p])) return true;
+            }
+        } while (walk.next(ray.tmax));
+
+        return false;
+    }
+
+    /**
+     * @brief Calls leaf(int primitive) for the primitives of the cells inside the frustum of the packet.
+     *
+     * Blocks of cells are split in halves until they are outside the frustum or a single cell,
+     * so the cells far from the packet are skipped together. A primitive in more than one cell
+     * can be passed more than once.
+     */
+    template <typename Leaf>
+    void cull(const RayPacket& packet, const Leaf& leaf) const {
+        for (int primitive : _large) leaf(primitive);
+        if (_primitives.empty()) return;
+
+        struct Block { int low[3], high[3]; }; // cells from low (included) to high (excluded)
+        Block stack[3 * 11 + 2];               // every split halves a side of at most MAX_RESOLUTION cells
+        int size = 0;
+        stack[size++] = {{0, 0, 0}, {_resolution[0], _resolution[1], _resolution[2]}};
+
+        while (size > 0) {
+            Block block = stack[--size];
+            if (packet.isBoxOutside(cellBox(block.low, block.high))) continue;
+
+            int axis = 0;
+            for (int k = 1; k < 3; k++) {
+                if (block.high[k] - block.low[k] > block.high[axis] - block.low[axis]) axis = k;
+            }
+            if (block.high[axis] - block.low[axis] == 1) {
+                int cell = block.low[0] + _resolution[0] * (block.low[1] + _resolution[1] * block.low[2]);
+                for (int p = _cellStart[cell]; p < _cellStart[cell + 1]; p++) leaf(_primitives[p]);
+                continue;
+            }
+
+            Block other = block;
+            block.high[axis] = other.low[axis] = (block.low[axis] + block.high[axis]) / 2;
+            stack[size++] = other;
+            stack[size++] = block;
+        }
+    }
+
+private:
+    AABB _box;
+    int _resolution[3] = {0, 0, 0};
+    float _cellSize[3] = {0.0f, 0.0f, 0.0f};
+    std::vector<int> _cellStart;  // nCells() + 1 offsets in _primitives
+    std::vector<int> _primitives;
+    std::vector<int> _large;
+
+    // state of the 3D-DDA: current cell, and distance of the next cell boundary along each axis
+    struct Walk {
+        int cell[3], step[3], end[3];
+        float tNext[3], tDelta[3];
+
+        float exit() const { return std::min({tNext[0], tNext[1], tNext[2]}); }
+
+        // moves to the next cell, false if it's outside the grid or farther than tmax
+        bool next(float tmax) {
+            int axis = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+            if (tNext[axis] > tmax) return false;
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis]) return false;
+            tNext[axis] += tDelta[axis];
+            return true;
+        }
+    };
+
+    // clips the ray to the box of the grid and finds the first cell, false if the ray misses the grid
+    bool start(const Ray& ray, float tmax, Walk& walk) const {
+        if (_primitives.empty()) return false;
+        float tEnter;
+        Ray clipped(ray.origin, ray.direction, ray.tmin, tmax);
+        if (!_box.isHit(clipped, tEnter)) return false;
+
+        const float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+        const float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+        const float low[3] = {_box.min.x, _box.min.y, _box.min.z};
+        for (int axis = 0; axis < 3; axis++) {
+            float position = origin[axis] + direction[axis] * tEnter;
+            int cell = std::clamp(static_cast<int>((position - low[axis]) / _cellSize[axis]), 0, _resolution[axis] - 1);
+            walk.cell[axis] = cell;
+            if (direction[axis] > 0.0f) {
+                walk.step[axis] = 1, walk.end[axis] = _resolution[axis];
+                walk.tNext[axis] = (low[axis] + (cell + 1) * _cellSize[axis] - origin[axis]) / direction[axis];
+                walk.tDelta[axis] = _cellSize[axis] / direction[axis];
+            } else if (direction[axis] < 0.0f) {
+                walk.step[axis] = -1, walk.end[axis] = -1;
+                walk.tNext[axis] = (low[axis] + cell * _cellSize[axis] - origin[axis]) / direction[axis];
+                walk.tDelta[axis] = -_cellSize[axis] / direction[axis];
+            } else {
+                walk.step[axis] = 0, walk.end[axis] = -1;
+                walk.tNext[axis] = walk.tDelta[axis] = INF;
+            }
+        }
+        return true;
+    }
+
+    AABB cellBox(const int* low, const int* high) const {
+        return AABB(Point3(_box.min.x + low[0] * _cellSize[0], _box.min.y + low[1] * _cellSize[1], _box.min.z + low[2] * _cellSize[2]),
+                    Point3(_box.min.x + high[0] * _cellSize[0], _box.min.y + high[1] * _cellSize[1], _box.min.z + high[2] * _cellSize[2]));
+    }
+};
+
+#endif
@@ -8,21 +8,36 @@
 #include <stdexcept>
 #include <filesystem>
 #include <string>
+#include <memory>
+#include <cstring>
 
 #include "Color.hpp"
 #include "PFMReader.hpp"
 #include "utils.hpp"
 
-#include "stb_image_write.h"
-
+class MappedFile;
+class ThreadPool;
 
 
 /**
  * @class HDRImage
  * @brief Represents a high dynamic range (HDR) image with floating-point color data.
+ *
+ * The pixels are kept in a vector, or, for images opened with map, read in place from the mapped file:
+ * copies of a mapped image share the mapping, and functions changing the pixels copy them in the vector first.
  */
 class HDRImage {
 public:
+    /**
+     * @brief An image file saved by saveToneMapped, possibly together with others.
+     */
+    struct Output {
+        std::string fileName; // the format is chosen by the extension (.pfm, .png, .jpg/.jpeg, .hdr, .exr)
+        float scale = 1.0f;   // the factor normalize would multiply the pixels by, a / luminosity
+        float gamma = 1.0f;   // gamma correction of 8-bit formats
+        bool clamp = true;    // if the channels are clamped as by clamp()
+    };
+
     HDRImage(int width, int height) : _width(width), _height(height) {
         _pixels = std::vector<Color>(_width * _height);
 
@@ -31,14 +46,31 @@ public:
         }
     }
 
+    /**
+     * @brief Reads a PFM, Radiance RGBE (.hdr) or uncompressed OpenEXR (.exr) image, recognized by its first bytes.
+     *
+     * @param input
+     * @throws std::invalid_argument if the format is not supported.
+     * @throws std::runtime_error if the image is shorter than its header says.
+     */
     HDRImage(std::istream& input) {
-        readPFM(input);
+        readImage(input);
     }
 
+    /**
+     * @brief Reads an image file as the stream constructor, "-" reads it from the standard input.
+     *
+     * @param fileName
+     * @throws std::runtime_error if the file can't be opened.
+     */
     HDRImage(const std::string& fileName) {
+        if (fileName == "-") {
+            readStandardInput();
+            return;
+        }
         std::ifstream input(fileName, std::ios::binary);
         if (input.fail()) throw std::runtime_error("ERROR: impossible to open file \"" + fileName + "\"");
-        readPFM(input);
+        readImage(input);
         input.close();
     }
 
@@ -58,13 +90,35 @@ public:
         return;
     }
 
+    /**
+     * @brief Maps a PFM file in memory, its pixels are read from the file only when used.
+     *
+     * The pages of the file are shared with every other process mapping it, and with the page cache.
+     * PFM files with the byte order of the machine are mapped, the others, and the other formats,
+     * are read and converted as by the constructor, as is the standard input ("-").
+     *
+     * @param fileName
+     * @throws std::runtime_error if the file can't be opened or is shorter than its header says.
+     */
+    static HDRImage map(const std::string& fileName);
+
+    bool isMapped() const {
+        return _mappedPixels != nullptr;
+    }
+
+    /**
+     * @brief Starts reading the pixels of a mapped image from disk in the background, does nothing otherwise.
+     */
+    void prefetch() const;
+
     Color getPixel(int i, int j) const {
         checkCoordinates(i, j);
-        return _pixels[pixelIndex(i, j)];
+        return pixel(i, j);
     }
 
     void setPixel(int i, int j, Color color) {
         checkCoordinates(i, j);
+        detach();
         _pixels[pixelIndex(i, j)] = color;
         return;
     }
@@ -73,15 +127,18 @@ public:
      * @brief Computes the average luminosity of the entire image.
      * 
      * Uses logarithmic averaging to avoid skew by very bright pixels.
+     * The logarithms are summed with SIMD instructions, a row at a time, in double precision.
      * 
      * @param delta Small constant added to avoid log(0).
+     * @param pool If given, the rows are split among its threads.
      * @return float
      */
-    float averageLuminosity(float delta = 1e-10f);
+    float averageLuminosity(float delta = 1e-10f, ThreadPool* pool = nullptr) const;
 
     void normalize(float a, float luminosity = 0.0f);
 
     void clamp() {
+        detach();
         for (Color& pixel: _pixels) {
             pixel.r = ::clamp(pixel.r);
             pixel.g = ::clamp(pixel.g);
@@ -90,18 +147,44 @@ public:
     }
 
     /**
-     * @brief Saves the image to a file, with format chosen by the extension (.pfm, .png, .jpg/.jpeg).
+     * @brief Saves the image to a file, with format chosen by the extension (.pfm, .png, .jpg/.jpeg, .hdr, .exr).
      * 
      * @param fileName Output file path.
      * @param gamma Gamma correction to apply (default 1.0).
      * @throws std::invalid_argument if the extension is unsupported.
      */
     void save(std::string fileName, float gamma = 1.0f) {
-        auto extension = std::filesystem::path(fileName).extension();
-        if (extension == ".pfm") {writePFM(fileName); return;}
-        if (extension == ".png") {writePNG(fileName, gamma); return;}
-        if (extension == ".jpg" || extension == ".jpeg") {writeJPG(fileName, gamma); return;}
-        throw std::invalid_argument("ERROR: file extension \"" + extension.string() + "\" is not supported");
+        if (std::filesystem::path(fileName).extension() == ".pfm") {writePFM(fileName); return;}
+        writeStrips({{fileName, 1.0f, gamma, false}});
+    }
+
+    /**
+     * @brief Saves the image as normalize, clamp and save would, without changing it: the pixels are processed
+     *        a strip of rows at a time, and with a mapped image the memory used doesn't depend on its size.
+     *
+     * @param fileName Output file path, the format is chosen by the extension (.pfm, .png, .jpg/.jpeg, .hdr, .exr).
+     * @param scale The factor normalize would multiply the pixels by, a / luminosity.
+     * @param gamma Gamma correction to apply (default 1.0).
+     * @param pool If given, the rows are converted and the strips encoded on its threads.
+     * @throws std::invalid_argument if the extension is unsupported.
+     * @throws std::runtime_error if the file can't be written.
+     */
+    void saveToneMapped(const std::string& fileName, float scale, float gamma = 1.0f, ThreadPool* pool = nullptr) const {
+        writeStrips({{fileName, scale, gamma, true}}, pool);
+    }
+
+    /**
+     * @brief Saves the image to many files at once, each with its own scale and gamma, without changing it:
+     *        each row is read once for all of them, and their strips are encoded at the same time.
+     *
+     * @param outputs Files to write, with different names.
+     * @param pool If given, the rows are converted and the strips of all the files encoded on its threads.
+     * @throws std::invalid_argument if an extension is unsupported.
+     * @throws std::runtime_error if a file can't be written: the other outputs may be left incomplete then,
+     *         except the mapped image itself, which is only replaced once its new content is complete.
+     */
+    void saveToneMapped(const std::vector<Output>& outputs, ThreadPool* pool = nullptr) const {
+        writeStrips(outputs, pool);
     }
 
     int _width, _height;
@@ -109,6 +192,53 @@ public:
 private:
     std::vector<Color> _pixels;
 
+    // mapped images: the file, and its bottom row of pixels, the first one in the file
+    std::shared_ptr<const MappedFile> _file;
+    const std::byte* _mappedPixels = nullptr;
+
+    HDRImage() = default;
+
+    const std::byte* mappedRow(int j) const {
+        return _mappedPixels + sizeof(Color) * static_cast<size_t>(_width) * (_height - 1 - j);
+    }
+
+    // the pixels of a row, from the file or the vector
+    const std::byte* row(int j) const {
+        if (_mappedPixels == nullptr) return reinterpret_cast<const std::byte*>(&_pixels[pixelIndex(0, j)]);
+        return mappedRow(j);
+    }
+
+    // the floats in the file may not be aligned
+    Color pixel(int i, int j) const {
+        if (_mappedPixels == nullptr) return _pixels[pixelIndex(i, j)];
+        Color color;
+        std::memcpy(&color, mappedRow(j) + sizeof(Color) * i, sizeof(Color));
+        return color;
+    }
+
+    /**
+     * @brief Copies the pixels of a mapped image in the vector and releases the mapping, does nothing otherwise.
+     */
+    void detach();
+
+    /**
+     * @brief Reads the three lines of the header of a PFM file and sets the size of the image.
+     *
+     * @param input The input stream, left at the first pixel.
+     * @return Endianness The byte order of the pixels.
+     */
+    Endianness readPFMHeader(std::istream& input);
+
+    /**
+     * @brief Reads an image with the reader of its format, chosen by its first byte.
+     */
+    void readImage(std::istream& input);
+
+    /**
+     * @brief Reads an image from std::cin, in binary mode.
+     */
+    void readStandardInput();
+
     /**
      * @brief Reads a PFM file from a stream and loads the image pixels.
      * 
@@ -117,52 +247,39 @@ private:
     void readPFM(std::istream& input);
 
     /**
-     * @brief Converts HDR pixel data to low dynamic range (LDR) 8-bit per channel format.
-     * 
-     * Must normalize pixels before calling.
-     * 
-     * @param gamma Gamma correction value (default 1.0).
-     * @return std::vector<uint8_t> Vector of bytes representing the LDR pixel data.
+     * @brief Reads a Radiance RGBE file, with rows in any of the run-length encodings, from the top or the bottom one.
+     */
+    void readRGBE(std::istream& input);
+
+    /**
+     * @brief Reads the R, G and B channels of a single part, scan line, uncompressed OpenEXR file, in half or full precision.
      */
-    std::vector<uint8_t> pixelsToLDR(float gamma = 1.0f);
+    void readEXR(std::istream& input);
 
     /**
      * @brief Writes the HDR image to a PFM file.
      * 
-     * Uses little endian byte order.
+     * Uses little endian byte order, each row is written at once.
      * 
-     * @param fileName The output PNG file path.
+     * @param fileName The output PFM file path. Mapped images are copied in memory first, the file could be the one they come from.
+     * @throws std::runtime_error if the file can't be written.
      */
     void writePFM(std::string fileName);
 
     /**
-    * @brief Writes the HDR image to a PNG file applying gamma correction.
-    * 
-    * Uses the stb_image_write library to save the image.
-    * Converts the internal HDR floating-point pixel data to 8-bit per channel LDR format
-    * with gamma correction before writing.
-    * 
-    * @param fileName The output PNG file path.
-    * @param gamma The gamma correction value to apply (default is 1.0, meaning no correction).
-    */
-    void writePNG(std::string fileName, float gamma = 1.0f) {
-        stbi_write_png(fileName.c_str(), _width, _height, 3, &pixelsToLDR(gamma)[0], 3 * _width);
-    }
-
-    /**
-    * @brief Writes the HDR image to a JPEG file applying gamma correction.
-    * 
-    * Uses the stb_image_write library to save the image.
-    * Converts the internal HDR floating-point pixel data to 8-bit per channel LDR format
-    * with gamma correction before writing.
-    * 
-    * @param fileName The output PNG file path.
-    * @param gamma The gamma correction value to apply (default is 1.0, meaning no correction).
-    */
-    void writeJPG(std::string fileName, float gamma = 1.0f) {
-        // the last parameter is image quality, 100 is max
-        stbi_write_jpg(fileName.c_str(), _width, _height, 3, &pixelsToLDR(gamma)[0], 100);
-    }
+     * @brief Writes the image to each output one strip of rows at a time, in the format chosen by the extension.
+     *
+     * Each strip is converted to the type the writer takes: the pixels are multiplied by scale and clamped if required,
+     * then, for PNG and JPEG, gamma corrected and quantized to 8 bits, so the image is not changed or copied.
+     * The 8-bit conversion is a single pass of toneMap over each row. The same rows are converted for all the outputs
+     * going from the top, while they are in the cache, and the bottom ones for PFM files. With a pool, as many strips
+     * of each output as its threads are converted, then the outputs are encoded at the same time.
+     * An output that is the mapped file is written to a temporary file, removed if anything fails.
+     *
+     * @param outputs
+     * @param pool If given, the rows are converted and the strips encoded in parallel.
+     */
+    void writeStrips(const std::vector<Output>& outputs, ThreadPool* pool = nullptr) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+#ifndef __ImageWriter__
+#define __ImageWriter__
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * @brief Writes an image file one strip of rows at a time, so that the whole image is never needed in memory.
+ *
+ * PFM files take the rows as floats, starting from the bottom one; PNG and JPEG files take 8-bit RGB rows,
+ * starting from the top one. Radiance RGBE (.hdr) and OpenEXR (.exr) files take floats from the top row:
+ * RGBE keeps 8 bits of mantissa per channel and a shared exponent, run-length encoded, in 4 bytes per pixel;
+ * OpenEXR keeps half floats, without compression, in 6 bytes per pixel. PNG strips are filtered and deflated on their own, ending with an empty stored block
+ * so that the next one starts on a byte, and go in the same zlib stream. JPEG strips are encoded as separate images
+ * and joined as restart intervals of one image: the decoder resets the DC predictions at each restart marker,
+ * as the encoder did at the start of each strip.
+ *
+ * Each strip is encoded on its own, from its rows and the one above it, so several strips passed to write
+ * together are encoded in parallel on a thread pool, then written in order. The Adler-32 of the PNG stream
+ * is combined from the ones of its strips.
+ */
+class ImageWriter {
+public:
+    /**
+     * @brief Creates the writer for the file extension (.pfm, .png, .jpg/.jpeg, .hdr, .exr) and writes the header.
+     *
+     * The file name "-" writes a PFM image to the standard output, through the buffer std::cout had when the program started:
+     * programs can point std::cout to std::cerr afterwards, to keep their messages out of the image.
+     *
+     * @param fileName
+     * @param width
+     * @param height
+     * @throws std::invalid_argument if the extension is unsupported.
+     * @throws std::runtime_error if the file can't be opened.
+     */
+    static std::unique_ptr<ImageWriter> open(const std::string& fileName, int width, int height);
+
+    virtual ~ImageWriter() = default;
+
+    /**
+     * @brief Rows of each strip passed to write, except the last one which can be shorter.
+     */
+    int stripHeight() const { return _stripHeight; }
+
+    /**
+     * @brief If the rows are written starting from the bottom one, as in PFM files.
+     */
+    virtual bool bottomUp() const { return false; }
+
+    /**
+     * @brief If the rows are 8-bit RGB, otherwise they are 3 floats per pixel.
+     */
+    virtual bool lowDynamicRange() const { return true; }
+
+    /**
+     * @brief Writes the next rows of the image, one or more strips of them.
+     *
+     * @param rows nRows rows of width pixels, in the order of bottomUp and the type of lowDynamicRange.
+     * @param nRows A multiple of stripHeight, or less at the end of the image.
+     * @param pool If given, the strips are encoded in parallel on its threads.
+     * @throws std::runtime_error if the file can't be written or a strip can't be encoded.
+     */
+    void write(const void* rows, int nRows, ThreadPool* pool = nullptr);
+
+    /**
+     * @brief Writes the end of the file, after all the rows, and closes it.
+     *
+     * @throws std::runtime_error if the file can't be written.
+     */
+    virtual void finish();
+
+protected:
+    /**
+     * @brief The bytes of a strip as they go in the file, with the checksum of the data of the formats having one.
+     */
+    struct EncodedStrip {
+        int nRows = 0;
+        std::vector<unsigned char> bytes;
+        uint32_t checksum = 0;
+        size_t checkedBytes = 0;
+    };
+
+    std::string _fileName;
+    std::ofstream _file; // not opened for the standard output
+    std::ostream _output;
+    int _width, _height, _stripHeight;
+    int _rowsWritten = 0;
+
+    ImageWriter(const std::string& fileName, int width, int height, int stripHeight);
+
+    /**
+     * @brief Encodes a strip without changing the writer, so that strips can be encoded at the same time.
+     *
+     * @param rows nRows rows, as passed to write.
+     * @param nRows
+     * @param firstRow Index of the first one among the rows written to the file.
+     * @param above The row written before them, nullptr for the first row of the image.
+     */
+    virtual EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int firstRow, const unsigned char* above) const = 0;
+
+    /**
+     * @brief Writes an encoded strip, called for each strip in order.
+     */
+    virtual void writeStrip(EncodedStrip& strip);
+
+    void writeBytes(const void* data, size_t size);
+
+private:
+    std::vector<unsigned char> _lastRow;
+};
+
+#endif
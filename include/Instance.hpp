@@ -0,0 +1,51 @@
+#ifndef __Instance__
+#define __Instance__
+
+#include <memory>
+#include "shapes.hpp"
+#include "World.hpp"
+
+/**
+ * @brief A group of shapes, shared by all its instances, placed in the scene with a transformation.
+ *
+ * The group is a World built once, with its own BVH (the bottom level). Every instance only holds
+ * a pointer to it and a transformation, and goes in the BVH of the World containing it (the top level),
+ * so memory grows with the number of instances, not with the number of shapes they show.
+ * Rays are brought in the space of the group, as the other shapes do with their unit shape.
+ * Groups can contain instances of other groups.
+ */
+class Instance : public Shape {
+public:
+    Instance(std::shared_ptr<const World> group, const Transformation& t = Transformation())
+        : Shape(nullptr, t), _group(group), _groupBox(group->bounds()) {}
+
+    bool isHit(const Ray& ray, HitRecord& rec) const override {
+        if (!_group->isHit(ray.transform(transformation.inverse()), rec)) return false;
+
+        rec.worldPoint = transformation * rec.worldPoint;
+        rec.normal = transformation * rec.normal;
+        rec.ray = ray;
+        return true;
+    }
+
+    bool quickIsHit(const Ray& ray) const override {
+        return _group->occluded(ray.transform(transformation.inverse()));
+    }
+
+    AABB boundingBox() const override {
+        if (_groupBox.isEmpty()) return AABB();
+        if (!_groupBox.isFinite()) return AABB::infinite();
+        return _groupBox.transform(transformation);
+    }
+
+    // the group is shared by all the instances, it's not counted here
+    size_t memoryUsage() const override { return sizeof(Instance); }
+
+    const World& group() const { return *_group; }
+
+private:
+    std::shared_ptr<const World> _group;
+    AABB _groupBox; // box of the group in its own space, cached to keep boundingBox cheap
+};
+
+#endif
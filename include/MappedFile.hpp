@@ -0,0 +1,47 @@
+#ifndef __MappedFile__
+#define __MappedFile__
+
+#include <string>
+#include <cstddef>
+
+/**
+ * @brief A whole file mapped in memory, read only.
+ *
+ * Pages are read from disk only when they are used, and stay in the page cache of the system
+ * between runs, so big files are available almost immediately.
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Maps the file.
+     *
+     * @param path
+     * @throw std::runtime_error If the file can't be opened or mapped.
+     */
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::byte* data() const { return _data; }
+    size_t size() const { return _size; }
+    const std::string& path() const { return _path; }
+
+    /**
+     * @brief Asks the system to start reading the file from disk, without waiting for it,
+     *        so that the pages are ready when a sequential pass gets to them.
+     */
+    void prefetch() const;
+
+private:
+    std::string _path;
+    const std::byte* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#endif
+};
+
+#endif
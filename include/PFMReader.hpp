@@ -7,9 +7,13 @@
 #include <cstring>
 #include <stdexcept>
 #include <sstream>
+#include <bit>
 
 enum class Endianness {LITTLE, BIG};
 
+// byte order of the machine running the program
+inline constexpr Endianness NATIVE_ENDIANNESS = std::endian::native == std::endian::big ? Endianness::BIG : Endianness::LITTLE;
+
 /**
  * @brief Reads a float value from a stream considering the specified endianness.
  * 
@@ -20,6 +24,19 @@ enum class Endianness {LITTLE, BIG};
  */
 float readFloat(std::istream& stream, Endianness endianness);
 
+/**
+ * @brief Reads many floats at once, with a single read from the stream, then swaps their bytes with SIMD if needed.
+ *
+ * Much faster than calling readFloat for each of them.
+ *
+ * @param stream Input stream to read 4 * count bytes from.
+ * @param values Array of count floats, holds the values read.
+ * @param count
+ * @param endianness Byte order (LITTLE or BIG endian).
+ * @throws std::runtime_error If unable to read 4 * count bytes.
+ */
+void readFloats(std::istream& stream, float* values, size_t count, Endianness endianness);
+
 /**
  * @brief Writes a float to a stream with specified endianness.
  * 
@@ -31,6 +48,16 @@ float readFloat(std::istream& stream, Endianness endianness);
  */
 void writeFloat(std::ostream& stream, float value, Endianness endianness);
 
+/**
+ * @brief Writes many floats at once, with a single write to the stream, swapping their bytes (in a copy) if needed.
+ *
+ * @param stream Output stream to write 4 * count bytes to.
+ * @param values Array of count floats.
+ * @param count
+ * @param endianness Byte order (LITTLE or BIG endian).
+ */
+void writeFloats(std::ostream& stream, const float* values, size_t count, Endianness endianness);
+
 /**
  * @brief Reads a full line from the input stream.
  * 
@@ -0,0 +1,102 @@
+#ifndef __QuantizedBVH__
+#define __QuantizedBVH__
+
+#include <vector>
+#include <cstdint>
+#include <bit>
+#include <span>
+
+#include "BVH.hpp"
+
+/**
+ * @brief Compact copy of a BVH, with one cache line (64 bytes) per node instead of two.
+ *
+ * The boxes of the children are stored with 8 bits per coordinate, relative to the box of the node:
+ * min = origin + low * scale, max = origin + high * scale, with a power of two as scale along each axis.
+ * The quantized boxes are rounded outwards, so they always contain the exact ones: a ray can visit
+ * a few more nodes than with the BVH, but never misses a primitive.
+ * Nodes are in the same depth-first order as the BVH, the first child of a node right after it.
+ */
+class QuantizedBVH {
+public:
+    static constexpr int WIDTH = BVH::WIDTH;
+    static constexpr uint8_t EMPTY = 0xff; // value of count for unused slots
+
+    struct alignas(64) Node {
+        float origin[3];          // min corner of the box of the node
+        int32_t child[WIDTH];     // as in BVH::Node
+        uint8_t low[3 * WIDTH];   // quantized min x of the children, then y and z
+        uint8_t high[3 * WIDTH];  // quantized max, as low
+        uint8_t count[WIDTH];     // primitives in a leaf, 0 for inner nodes, EMPTY for unused slots
+        int8_t exponent[3];       // scale along each axis is 2^exponent
+
+        float scale(int axis) const { return std::bit_cast<float>(static_cast<uint32_t>(exponent[axis] + 127) << 23); }
+    };
+    static_assert(sizeof(Node) == 64, "a node must fill exactly one cache line");
+
+    QuantizedBVH() = default;
+
+    /**
+     * @brief Builds the compact tree from a normal one, the primitives are the same.
+     */
+    void build(const BVH& bvh);
+
+    /**
+     * @brief Like BVH::refit, the boxes are quantized again.
+     */
+    void refit(const std::vector<AABB>& boxes);
+
+    void clear() { _nodes.clear(), _primitives.clear(); }
+
+    bool isEmpty() const { return _nodes.empty(); }
+
+    int size() const { return static_cast<int>(_primitives.size()); }
+
+    const std::vector<Node>& nodes() const { return _nodes; }
+
+    std::span<const int> primitives() const { return _primitives; }
+
+    /**
+     * @brief Bytes used by the nodes and the primitive indices.
+     */
+    size_t memoryUsage() const { return _nodes.size() * sizeof(Node) + _primitives.size() * sizeof(int); }
+
+    // of the quantized boxes, a bit higher than the one of the BVH it comes from
+    float sahCost() const { return bvhTraversal::sahCost(*this); }
+
+    // same as in BVH
+
+    template <typename Intersect>
+    bool closestHit(const Ray& ray, float& tmax, const Intersect& intersect) const {
+        return bvhTraversal::closestHit(*this, ray, tmax, intersect);
+    }
+
+    template <typename Occluded>
+    bool anyHit(const Ray& ray, const Occluded& occluded) const {
+        return bvhTraversal::anyHit(*this, ray, occluded);
+    }
+
+    template <typename Leaf>
+    void cull(const RayPacket& packet, const Leaf& leaf) const {
+        bvhTraversal::cull(*this, packet, leaf);
+    }
+
+    // interface used by the traversal functions in bvhTraversal
+
+    int hitChildren(int node, const float* ray, float tmax, float* tNear, SimdLevel level) const {
+        const Node& n = _nodes[node];
+        alignas(16) float scale[3] = {n.scale(0), n.scale(1), n.scale(2)};
+        int valid = (n.count[0] != EMPTY) | (n.count[1] != EMPTY) << 1 | (n.count[2] != EMPTY) << 2 | (n.count[3] != EMPTY) << 3;
+        return quantizedBoxesHit4(n.origin, scale, n.low, n.high, ray, tmax, tNear, level) & valid;
+    }
+    int child(int node, int k) const { return _nodes[node].child[k]; }
+    int count(int node, int k) const { return _nodes[node].count[k]; }
+    bool isEmpty(int node, int k) const { return _nodes[node].count[k] == EMPTY; }
+    AABB childBox(int node, int k) const;
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<int> _primitives;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef __RayPacket__
+#define __RayPacket__
+
+#include "Ray.hpp"
+#include "Point3.hpp"
+#include "Vec3.hpp"
+#include "AABB.hpp"
+
+/**
+ * @brief A group of up to 64 coherent rays (for example the primary rays of an 8x8 tile),
+ *        stored both as Rays and as a structure of arrays for the vectorized kernels.
+ *
+ * The packet can also store the frustum containing all of its rays,
+ * used to discard whole objects with a single test before intersecting the rays one by one.
+ */
+struct RayPacket {
+    static constexpr int MAX_SIZE = 64;
+
+    int size = 0;
+    Ray rays[MAX_SIZE];
+
+    // rays in SoA layout, the unused slots (up to a multiple of 8) hold rays that can't hit anything
+    alignas(32) float ox[MAX_SIZE], oy[MAX_SIZE], oz[MAX_SIZE];
+    alignas(32) float dx[MAX_SIZE], dy[MAX_SIZE], dz[MAX_SIZE];
+    alignas(32) float tmin[MAX_SIZE], tmax[MAX_SIZE];
+
+    // frustum planes, a point p can be reached by the rays only if dot(normal, p) <= offset for every plane
+    bool hasFrustum = false;
+    Vec3 planeNormals[4];
+    float planeOffsets[4];
+
+    RayPacket() {
+        for (int i = 0; i < MAX_SIZE; i++) {
+            ox[i] = oy[i] = oz[i] = dx[i] = dy[i] = dz[i] = 0.0f;
+            tmin[i] = 0.0f, tmax[i] = -1.0f;
+        }
+    }
+
+    /**
+     * @brief Number of slots to process with 8-wide kernels, "size" rounded up to a multiple of 8.
+     */
+    int paddedSize() const { return (size + 7) & ~7; }
+
+    void add(const Ray& ray) {
+        rays[size] = ray;
+        ox[size] = ray.origin.x, oy[size] = ray.origin.y, oz[size] = ray.origin.z;
+        dx[size] = ray.direction.x, dy[size] = ray.direction.y, dz[size] = ray.direction.z;
+        tmin[size] = ray.tmin, tmax[size] = ray.tmax;
+        size++;
+    }
+
+    /**
+     * @brief Removes all the rays, the frustum is kept.
+     */
+    void clear() {
+        for (int i = 0; i < size; i++) tmin[i] = 0.0f, tmax[i] = -1.0f;
+        size = 0;
+    }
+
+    /**
+     * @brief Sets the frustum from the four rays at its corners, listed going around the packet.
+     *
+     * The side through corners k and k+1 contains the first ray and the vector joining
+     * the two rays at t = 1: this works both for rays with a common origin (perspective camera)
+     * and for parallel rays (orthogonal camera).
+     *
+     * @param corners
+     */
+    void setFrustum(const Ray corners[4]) {
+        Point3 centre;
+        for (int k = 0; k < 4; k++) {
+            Point3 p = corners[k].at(1.0f);
+            centre = Point3(centre.x + 0.25f * p.x, centre.y + 0.25f * p.y, centre.z + 0.25f * p.z);
+        }
+
+        for (int k = 0; k < 4; k++) {
+            const Ray& a = corners[k];
+            const Ray& b = corners[(k + 1) % 4];
+            Vec3 normal = cross(a.direction, b.at(1.0f) - a.at(1.0f));
+            float offset = dot(normal, a.origin.toVec());
+
+            if (dot(normal, centre.toVec()) > offset) normal = -normal, offset = -offset; // make the inside negative
+
+            float norm = normal.norm();
+            planeNormals[k] = (norm > 0.0f) ? normal / norm : Vec3();
+            planeOffsets[k] = (norm > 0.0f) ? offset / norm : 0.0f;
+        }
+        hasFrustum = true;
+    }
+
+    /**
+     * @brief Checks if a sphere lies completely outside the frustum, so no ray in the packet can hit it.
+     *
+     * @param centre
+     * @param radius
+     * @return true If the sphere can be skipped.
+     */
+    bool isSphereOutside(const Point3& centre, float radius) const {
+        if (!hasFrustum) return false;
+        for (int k = 0; k < 4; k++) {
+            if (dot(planeNormals[k], centre.toVec()) - planeOffsets[k] > radius) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Checks if a box lies completely outside one of the planes of the frustum.
+     *
+     * For each plane only the corner of the box closest to the inside is tested.
+     * Boxes crossing the edges of the frustum may be kept even if they're outside, which is safe.
+     *
+     * @param box
+     * @return true If the box can be skipped.
+     */
+    bool isBoxOutside(const AABB& box) const {
+        if (!hasFrustum) return false;
+        for (int k = 0; k < 4; k++) {
+            const Vec3& n = planeNormals[k];
+            Vec3 corner(n.x > 0.0f ? box.min.x : box.max.x, n.y > 0.0f ? box.min.y : box.max.y, n.z > 0.0f ? box.min.z : box.max.z);
+            if (dot(n, corner) > planeOffsets[k]) return true;
+        }
+        return false;
+    }
+};
+
+#endif
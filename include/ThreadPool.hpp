@@ -0,0 +1,136 @@
+#ifndef __ThreadPool__
+#define __ThreadPool__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+/**
+ * @brief A fixed set of worker threads executing tasks from a shared queue.
+ *
+ * Threads waiting for their tasks to finish run other pending tasks in the meantime,
+ * so parallelFor and wait can be called from inside a task without deadlocks.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Construct a new Thread Pool object.
+     *
+     * @param nThreads Number of worker threads, 0 to use one per hardware thread.
+     */
+    explicit ThreadPool(int nThreads = 0) {
+        if (nThreads <= 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < nThreads; i++) {
+            _workers.emplace_back([this]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(_mutex);
+                        _condition.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+                        if (_stop && _tasks.empty()) return;
+                        task = std::move(_tasks.front());
+                        _tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+        for (auto& worker : _workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(_workers.size()); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+        _condition.notify_one();
+    }
+
+    /**
+     * @brief Runs one pending task in the calling thread, if there is any.
+     *
+     * @return true If a task was run.
+     */
+    bool runPendingTask() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_tasks.empty()) return false;
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    /**
+     * @brief Waits until "counter" reaches zero, running pending tasks in the meantime.
+     */
+    void wait(const std::atomic<int>& counter) {
+        while (counter.load() > 0) {
+            if (!runPendingTask()) std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Calls function(begin, end) on chunks of [first, last), in parallel, and waits for all of them.
+     *
+     * The calling thread works on the chunks too, together with at most size() - 1 workers,
+     * so that no more than size() threads are busy.
+     *
+     * @tparam Function
+     * @param first
+     * @param last
+     * @param chunk Size of the chunks, the last one can be smaller.
+     * @param function Called as function(int chunkBegin, int chunkEnd).
+     */
+    template <typename Function>
+    void parallelFor(int first, int last, int chunk, const Function& function) {
+        if (last <= first) return;
+        chunk = std::max(chunk, 1);
+
+        std::atomic<int> next(first);
+        auto work = [&]() {
+            for (int begin = next.fetch_add(chunk); begin < last; begin = next.fetch_add(chunk)) {
+                function(begin, std::min(begin + chunk, last));
+            }
+        };
+
+        int nChunks = (last - first + chunk - 1) / chunk;
+        int helpers = std::min(size() - 1, nChunks - 1);
+        std::atomic<int> running(helpers);
+        for (int i = 0; i < helpers; i++) {
+            submit([&]() { work(); running--; });
+        }
+
+        work();
+        wait(running);
+    }
+
+private:
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop = false;
+};
+
+#endif
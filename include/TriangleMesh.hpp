@@ -0,0 +1,136 @@
+#ifndef __TriangleMesh__
+#define __TriangleMesh__
+
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "shapes.hpp"
+#include "BVH.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief Indexed triangles, as read from a mesh file.
+ *
+ * Vertices are stored as structure of arrays. Normals and texture coordinates are optional:
+ * their arrays are either empty or as long as the positions.
+ */
+struct MeshData {
+    std::vector<float> x, y, z;    // positions
+    std::vector<float> nx, ny, nz; // normals
+    std::vector<float> u, v;       // texture coordinates
+    std::vector<int> indices;      // three vertices per triangle, counter-clockwise seen from outside
+
+    int nVertices() const { return static_cast<int>(x.size()); }
+    int nTriangles() const { return static_cast<int>(indices.size() / 3); }
+    bool hasNormals() const { return !nx.empty(); }
+    bool hasUVs() const { return !u.empty(); }
+};
+
+/**
+ * @brief Reads a Wavefront OBJ mesh.
+ *
+ * Only the geometry is read: v, vt, vn and f, with the v, v/vt, v//vn and v/vt/vn forms and negative
+ * (relative) indices. Polygons are split in a fan of triangles, the other statements are ignored.
+ * Corners with the same position but different normal or texture coordinates become different vertices.
+ *
+ * @param text The content of the file.
+ * @throw std::runtime_error If the file is malformed.
+ */
+MeshData parseOBJ(std::string_view text);
+
+/**
+ * @brief Reads a PLY mesh, in ASCII or binary (little or big endian) format.
+ *
+ * From the vertex element x, y, z, nx, ny, nz, and u, v (or s, t) are read, from the face element
+ * the list vertex_indices (or vertex_index), split in triangles as in parseOBJ. Other properties and elements are skipped.
+ *
+ * @param data The content of the file.
+ * @throw std::runtime_error If the file is malformed.
+ */
+MeshData parsePLY(std::string_view data);
+
+/**
+ * @brief Reads a mesh file, choosing the format from the extension (.obj or .ply).
+ *
+ * @param fileName
+ * @throw std::runtime_error If the file can't be read, its format is unknown or it's malformed.
+ */
+MeshData readMesh(const std::string& fileName);
+
+/**
+ * @brief Triangle mesh shape, with its own BVH over the triangles.
+ *
+ * As the other shapes, the mesh is defined in its own space and placed in the scene by the transformation,
+ * so it goes in the BVH of the World as a single primitive, and the triangles are searched
+ * only by the rays entering its box (a two level hierarchy, as for instances).
+ *
+ * Rays are intersected with the watertight algorithm of Woop, Benthin and Wald (2013): rays through
+ * an edge or a vertex shared by more triangles always hit one of them, so closed meshes have no holes.
+ * The vertices of every triangle are copied next to each other, so intersecting a triangle
+ * reads a single cache line instead of following three indices.
+ *
+ * Normals are interpolated when the mesh has them, otherwise they are the ones of the triangles.
+ * The surface point is given by the texture coordinates, or by the barycentric coordinates
+ * of the second and third vertex if there are none.
+ */
+class TriangleMesh : public Shape {
+public:
+    /**
+     * @brief Builds the mesh and its BVH.
+     *
+     * @param material
+     * @param mesh
+     * @param t
+     * @param pool If not null, the BVH is built in parallel.
+     * @throw std::invalid_argument If an index is out of range.
+     */
+    TriangleMesh(std::shared_ptr<Material> material, MeshData mesh, const Transformation& t = Transformation(), ThreadPool* pool = nullptr);
+
+    bool isHit(const Ray& ray, HitRecord& rec) const override;
+
+    bool quickIsHit(const Ray& ray) const override;
+
+    AABB boundingBox() const override {
+        if (_localBox.isEmpty()) return AABB();
+        return _localBox.transform(transformation);
+    }
+
+    const MeshData& mesh() const { return _mesh; }
+
+    int nTriangles() const { return _mesh.nTriangles(); }
+
+    const BVH& bvh() const { return _bvh; }
+
+    /**
+     * @brief Bytes used by the vertices, the triangles and the BVH.
+     */
+    size_t memoryUsage() const override;
+
+private:
+    struct Triangle {
+        float a[3], b[3], c[3];
+    };
+
+    // the ray sheared and scaled so that it goes along +z from the origin, the same for all the triangles
+    struct WatertightRay {
+        int kx, ky, kz;
+        float sx, sy, sz;
+        float origin[3];
+
+        explicit WatertightRay(const Ray& ray);
+    };
+
+    MeshData _mesh;
+    std::vector<Triangle> _triangles;
+    BVH _bvh;
+    AABB _localBox;
+
+    /**
+     * @brief Intersects a triangle with the ray, if it's hit inside (tmin, tmax) sets t and the barycentric coordinates.
+     */
+    bool intersect(int triangle, const WatertightRay& ray, float tmin, float tmax, float& t, float* barycentric) const;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __WavefrontRenderer__
+#define __WavefrontRenderer__
+
+#include <vector>
+#include <cstdint>
+
+#include "Camera.hpp"
+#include "World.hpp"
+#include "materials.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief State of many light paths in a structure of arrays, the "queues" of the wavefront renderer.
+ *
+ * Slot i holds the current ray, throughput, pixel, depth and random generator of one path,
+ * and the intersection found for the current ray in the last extend stage.
+ */
+struct PathStates {
+    // current ray
+    std::vector<float> ox, oy, oz, dx, dy, dz;
+    std::vector<int> depth;
+    // radiance carried to the pixel, multiplied at every bounce
+    std::vector<float> throughputR, throughputG, throughputB;
+    // index of the pixel inside the block being rendered
+    std::vector<int> pixel;
+    // one PCG per path, so the result doesn't depend on the order the paths are processed
+    std::vector<uint64_t> rngState, rngInc;
+    // intersection of the current ray, material is nullptr for a miss
+    std::vector<Material*> material;
+    std::vector<float> px, py, pz, nx, ny, nz, u, v;
+    std::vector<uint8_t> isInside;
+
+    void resize(int n);
+
+    Ray ray(int i) const {
+        return Ray(Point3(ox[i], oy[i], oz[i]), Vec3(dx[i], dy[i], dz[i]), RAY_MIN, INF, depth[i]);
+    }
+
+    void setRay(int i, const Ray& ray) {
+        ox[i] = ray.origin.x, oy[i] = ray.origin.y, oz[i] = ray.origin.z;
+        dx[i] = ray.direction.x, dy[i] = ray.direction.y, dz[i] = ray.direction.z;
+        depth[i] = ray.depth;
+    }
+
+    PCG rng(int i) const {
+        PCG pcg;
+        pcg.state = rngState[i], pcg.inc = rngInc[i];
+        return pcg;
+    }
+
+    void setRng(int i, const PCG& pcg) { rngState[i] = pcg.state, rngInc[i] = pcg.inc; }
+
+    /**
+     * @brief Rebuilds the HitRecord of the last intersection, without the material.
+     */
+    HitRecord hitRecord(int i) const;
+};
+
+/**
+ * @brief Shadow rays waiting to be traced, with the light they bring to their pixel if they are not blocked.
+ */
+struct ShadowQueue {
+    std::vector<Point3> from, to;
+    std::vector<Color> contribution;
+    std::vector<int> pixel;
+
+    int size() const { return static_cast<int>(pixel.size()); }
+
+    void clear() { from.clear(), to.clear(), contribution.clear(), pixel.clear(); }
+
+    void push(const Point3& start, const Point3& end, const Color& color, int pixelIndex) {
+        from.push_back(start), to.push_back(end), contribution.push_back(color), pixel.push_back(pixelIndex);
+    }
+};
+
+/**
+ * @brief Number of rays traced by the wavefront renderer, to measure its speed.
+ */
+struct RayCounters {
+    int64_t cameraRays = 0, secondaryRays = 0, shadowRays = 0;
+    double extendSeconds = 0.0; // time spent in the extend stage, summed over all threads
+
+    int64_t totalRays() const { return cameraRays + secondaryRays + shadowRays; }
+
+    RayCounters& operator+=(const RayCounters& other) {
+        cameraRays += other.cameraRays, secondaryRays += other.secondaryRays, shadowRays += other.shadowRays;
+        extendSeconds += other.extendSeconds;
+        return *this;
+    }
+};
+
+/**
+ * @brief Path tracer that advances thousands of paths together, one stage at a time (wavefront path tracing).
+ *
+ * Instead of following every sample recursively like Renderers::PathTracer, the image is split in blocks of rows
+ * and every block keeps a queue of active paths, processed by four stages:
+ * - generate: new camera rays fill the free slots of the queue;
+ * - extend: the rays of all the active paths are intersected with the world;
+ * - shade: the hits are grouped by material and shaded together, surviving paths get their next ray,
+ *   and a shadow ray is queued towards every point light of the world;
+ * - shadow: the shadow rays are traced, unblocked ones add the light to their pixel.
+ * Every path follows a single ray per bounce, with russian roulette, so there's no branching.
+ * The blocks are rendered in parallel.
+ *
+ * After the first bounce the rays go in random directions, and tracing them in the order they were generated
+ * jumps all over the scene. With Settings::reorderRays, before every extend stage the rays are sorted
+ * by the octant of their direction and the Morton code of their origin, so that consecutive rays
+ * tend to visit the same objects, and the same memory.
+ */
+class WavefrontRenderer {
+public:
+    struct Settings {
+        int samplesPerPixel = 4;        // if it's a perfect square, samples are stratified
+        int maxDepth = 5;
+        int russianRouletteLimit = 3;
+        int queueSize = 1 << 14;        // maximum number of paths in flight in a block
+        int blockRows = 8;              // rows of pixels rendered by the same thread
+        int nThreads = 0;               // 0 means one per hardware thread
+        uint64_t seed = 42, sequence = 54;
+        bool reorderRays = false;       // sort the rays by direction and origin before tracing them
+    };
+
+    WavefrontRenderer(const World& world, const Settings& settings) : _world(world), _settings(settings) {}
+
+    /**
+     * @brief Renders the world into the image of the camera.
+     *
+     * @param camera
+     * @return RayCounters The rays traced in the whole image.
+     */
+    RayCounters render(Camera& camera) const;
+
+private:
+    const World& _world;
+    Settings _settings;
+
+    void renderBlock(Camera& camera, int firstRow, int lastRow, RayCounters& counters) const;
+
+    void generate(const Camera& camera, int firstRow, PathStates& paths, std::vector<int>& active, std::vector<int>& freeSlots,
+                  int64_t& nextSample, int64_t totalSamples) const;
+    void reorder(const PathStates& paths, std::vector<int>& active, std::vector<uint64_t>& keys) const;
+    void extend(PathStates& paths, const std::vector<int>& active) const;
+    void shade(PathStates& paths, std::vector<int>& active, std::vector<int>& freeSlots, std::vector<Color>& radiance,
+               ShadowQueue& shadowQueue) const;
+    void shadow(const ShadowQueue& shadowQueue, std::vector<Color>& radiance) const;
+};
+
+#endif
@@ -3,10 +3,17 @@
 
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <string>
+#include <filesystem>
+#include <unordered_map>
 #include "shapes.hpp"
 #include "Ray.hpp"
 #include "HitRecord.hpp"
 #include "Point3.hpp"
+#include "simd.hpp"
+#include "Accelerator.hpp"
+#include "ThreadPool.hpp"
 
 
 /**
@@ -23,16 +30,234 @@ struct PointLight {
 
 /**
  * @brief The world contains shapes and lights and handles ray intersections.
+ *
+ * Spheres are also copied in a SpherePack when they are added, so that rays are tested
+ * against 8 of them at once, the other shapes are tested one by one.
+ * After build() is called, the bounded shapes are indexed by an Accelerator instead, a BVH by default,
+ * and only the unbounded ones (planes) are still tested one by one. Adding a shape discards the Accelerator.
+ * The Accelerator and how it's built are chosen with buildSettings: for very big scenes, compact keeps
+ * a QuantizedBVH instead of the BVH, half the size; for dense scenes of shapes of similar size a Grid can be faster.
+ *
+ * Yes/no questions ("does the ray hit anything?") should use occluded, which stops at the first hit
+ * and never builds a HitRecord.
  */
 class World {
 public:
+    struct BuildSettings {
+        Accelerator::Type accelerator = Accelerator::Type::BVH;
+        BVH::Preset preset = BVH::Preset::SAH;
+        bool compact = false; // keep only a QuantizedBVH, using less memory
+        int nThreads = 1;     // 0 for one per hardware thread
+        float rebuildThreshold = 0.3f; // update() builds from scratch when the SAH cost grows more than this, relative to the build
+        std::string cachePath;  // file where the BVH is saved, and loaded from when the boxes match, empty for no cache
+        float gridDensity = Grid::DENSITY; // cells per shape of the grid
+        bool compactShapes = false; // addSphere keeps only a record in the SpherePack and a material index, no Sphere object
+
+        // the same settings for the World of a group, with its BVH cached in a file of its own: "scene.bvh" gives "scene.name.bvh"
+        BuildSettings forGroup(const std::string& name) const {
+            BuildSettings settings = *this;
+            if (cachePath.empty()) return settings;
+            std::filesystem::path path(cachePath);
+            settings.cachePath = path.replace_filename(path.stem().string() + "." + name + path.extension().string()).string();
+            return settings;
+        }
+    };
+
+    struct BuildStats {
+        double seconds = 0.0;      // time spent by the last build() or update(), including the bounding boxes
+        size_t memory = 0;         // bytes used by the accelerator
+        float sahCost = 0.0f;      // of the tree in use, see BVH::sahCost, 0 for the other accelerators
+        float builtSahCost = 0.0f; // right after the last build()
+        int refits = 0;            // calls to update() that didn't build from scratch since then
+        bool cached = false;       // the last build() loaded the BVH from buildSettings.cachePath
+    };
+
+    struct MemoryStats {
+        size_t shapes = 0;           // all of them, compact spheres included
+        size_t compactSpheres = 0;
+        size_t materials = 0;        // different materials of the compact spheres
+        size_t shapeBytes = 0;       // Shape objects and the pointers to them
+        size_t sphereBytes = 0;      // SpherePack and material indices of the spheres
+        size_t indexBytes = 0;       // lists of shape indices kept by the World
+        size_t acceleratorBytes = 0;
+
+        size_t total() const { return shapeBytes + sphereBytes + indexBytes + acceleratorBytes; }
+
+        MemoryStats& operator+=(const MemoryStats& other) {
+            shapes += other.shapes, compactSpheres += other.compactSpheres, materials += other.materials;
+            shapeBytes += other.shapeBytes, sphereBytes += other.sphereBytes;
+            indexBytes += other.indexBytes, acceleratorBytes += other.acceleratorBytes;
+            return *this;
+        }
+    };
+
     Color backgroundColor;
     std::vector<PointLight> pointLights;
+    BuildSettings buildSettings; // used by build()
 
     World() = default;
 
+    // makes room for more shapes, nSpheres of them spheres, to add many without reallocating
+    void reserve(size_t nShapes, size_t nSpheres = 0) {
+        size_t nObjects = buildSettings.compactShapes ? nShapes - nSpheres : nShapes; // compact spheres are not in _shapes
+        _shapes.reserve(nObjects), _packIndex.reserve(nObjects), _bounded.reserve(nShapes);
+        _spheres.reserve(nSpheres), _sphereMaterials.reserve(nSpheres), _spherePack.reserve(static_cast<int>(nSpheres));
+    }
+
     void addShape(std::shared_ptr<Shape> shape) {
+        int index = static_cast<int>(_shapes.size());
         _shapes.push_back(shape);
+
+        if (dynamic_cast<const Sphere*>(shape.get()) != nullptr) {
+            _packIndex.push_back(_spherePack.add(shape->transformation));
+            _spheres.push_back(index);
+            _sphereMaterials.push_back(materialIndex(shape->material()));
+        } else {
+            _packIndex.push_back(-1);
+        }
+
+        if (shape->boundingBox().isFinite()) {
+            _bounded.push_back(index);
+            if (_packIndex.back() < 0) _boundedOthers.push_back(index);
+        } else {
+            _unbounded.push_back(index);
+        }
+
+        _accelerator.reset();
+    }
+
+    /**
+     * @brief Adds a sphere, as addShape(std::make_shared<Sphere>(material, transformation)) does.
+     *
+     * With buildSettings.compactShapes, no Sphere object is created: the sphere is only the record
+     * holding its inverse transformation in the SpherePack, which is all the intersection needs,
+     * and the index of its material in a table shared by all the spheres. It has no place in _shapes:
+     * its index is Primitives::COMPACT_SPHERE plus the one in the SpherePack.
+     * It takes about a third of the memory, but the transformation can't be changed later.
+     */
+    void addSphere(std::shared_ptr<Material> material, const Transformation& transformation) {
+        if (!buildSettings.compactShapes) {
+            addShape(std::make_shared<Sphere>(material, transformation));
+            return;
+        }
+        int index = Primitives::COMPACT_SPHERE + _spherePack.add(transformation);
+        _spheres.push_back(index);
+        _sphereMaterials.push_back(materialIndex(material));
+        _bounded.push_back(index);
+        _nCompactSpheres++;
+        _accelerator.reset();
+    }
+
+    /**
+     * @brief Builds the accelerator over the bounded shapes, following buildSettings. Call it after adding all of them.
+     *
+     * The SpherePack is updated too, in case the transformations changed.
+     * If buildSettings.cachePath is set, the BVH is mapped from there when it was built over the same boxes
+     * with the same preset, otherwise it's built and saved there (failing to save is not an error).
+     */
+    void build() {
+        auto start = std::chrono::steady_clock::now();
+        updateSpherePack();
+        std::unique_ptr<ThreadPool> pool;
+        if (buildSettings.nThreads != 1) pool = std::make_unique<ThreadPool>(buildSettings.nThreads);
+
+        std::vector<AABB> boxes = boundingBoxes(pool.get());
+        _buildStats.cached = false;
+        switch (buildSettings.accelerator) {
+            case Accelerator::Type::Linear:
+                _accelerator = std::make_shared<LinearAccelerator>();
+                break;
+            case Accelerator::Type::Grid:
+                _accelerator = std::make_shared<GridAccelerator>(buildSettings.gridDensity);
+                break;
+            case Accelerator::Type::BVH:
+                _accelerator = std::make_shared<BVHAccelerator>(buildSettings.preset, buildSettings.compact, buildSettings.cachePath);
+                break;
+        }
+        _accelerator->build(boxes, pool.get());
+
+        if (auto bvh = dynamic_cast<const BVHAccelerator*>(_accelerator.get())) _buildStats.cached = bvh->isCached();
+        _buildStats.sahCost = _buildStats.builtSahCost = _accelerator->sahCost();
+        _buildStats.memory = _accelerator->memoryUsage();
+        _buildStats.refits = 0;
+        _buildStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * @brief Brings the SpherePack and the accelerator up to date, after the transformations of some shapes changed.
+     *
+     * A BVH is refitted, in linear time: see BVH::refit. Once its SAH cost grows more than
+     * buildSettings.rebuildThreshold with respect to the last build, it's built from scratch instead.
+     * A Grid is always built again, in linear time too, and that counts as a refit.
+     *
+     * @return true If the BVH was built from scratch.
+     */
+    bool update() {
+        auto start = std::chrono::steady_clock::now();
+        updateSpherePack();
+        if (!isBuilt()) return false;
+
+        std::vector<AABB> boxes = boundingBoxes(nullptr);
+        _accelerator->refit(boxes, nullptr);
+        _buildStats.sahCost = _accelerator->sahCost();
+        _buildStats.memory = _accelerator->memoryUsage();
+
+        if (_buildStats.sahCost > _buildStats.builtSahCost * (1.0f + buildSettings.rebuildThreshold)) {
+            build();
+            return true;
+        }
+        _buildStats.refits++;
+        _buildStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return false;
+    }
+
+    const BuildStats& buildStats() const { return _buildStats; }
+
+    size_t compactSpheres() const { return _nCompactSpheres; }
+
+    /**
+     * @brief Bytes used by the shapes and the accelerator, with the capacity of the arrays, the materials excluded.
+     */
+    MemoryStats memoryStats() const {
+        MemoryStats stats;
+        stats.shapes = _shapes.size() + _nCompactSpheres;
+        stats.compactSpheres = _nCompactSpheres;
+        stats.materials = _materials.size();
+        stats.shapeBytes = _shapes.capacity() * sizeof(std::shared_ptr<Shape>);
+        for (const auto& shape : _shapes) stats.shapeBytes += shape->memoryUsage();
+        stats.sphereBytes = _spherePack.memoryUsage() + _sphereMaterials.capacity() * sizeof(uint32_t)
+                          + _materials.capacity() * sizeof(std::shared_ptr<Material>);
+        stats.indexBytes = (_spheres.capacity() + _packIndex.capacity() + _bounded.capacity() + _boundedOthers.capacity() + _unbounded.capacity()) * sizeof(int);
+        stats.acceleratorBytes = isBuilt() ? _accelerator->memoryUsage() : 0;
+        return stats;
+    }
+
+    /**
+     * @brief Box containing all the shapes, infinite if there is an unbounded one. Cached by build().
+     */
+    AABB bounds() const {
+        if (isBuilt()) return _bounds;
+        AABB box;
+        for (int index : _bounded) box.grow(shapeBox(index));
+        for (int index : _unbounded) box.grow(shapeBox(index));
+        return box;
+    }
+
+    bool isBuilt() const { return _accelerator != nullptr; }
+
+    // the one in use, a LinearAccelerator before build() is called
+    const Accelerator& accelerator() const {
+        static const LinearAccelerator linear;
+        if (_accelerator) return *_accelerator;
+        return linear;
+    }
+
+    /**
+     * @brief Bytes used by the spatial index (nodes and primitive indices) for every bounded shape.
+     */
+    float indexBytesPerShape() const {
+        if (_bounded.empty()) return 0.0f;
+        return static_cast<float>(accelerator().memoryUsage()) / _bounded.size();
     }
 
     void addLight(const PointLight& light) {
@@ -40,43 +265,203 @@ public:
     }
 
     bool isHit(const Ray& ray, HitRecord& rec) const {
-        bool hit = false;
-        float closest = ray.tmax;
-    
-        for (const auto& shape : _shapes) {
+        Primitives::ClosestHit closest{ray.tmax, rec};
+        for (int index : _unbounded) {
             HitRecord tempRecord;
-            if (shape->isHit(ray, tempRecord)) {
-                if (!hit || tempRecord.t < closest) { // if the ray is not const, we could avoid this if by doing ray.tmax = closest
-                    hit = true;
-                    closest = tempRecord.t;
-                    rec = tempRecord;
+            if (_shapes[index]->isHit(ray, tempRecord) && tempRecord.t < closest.t) {
+                closest.t = tempRecord.t, closest.hit = true;
+                rec = tempRecord;
+            }
+        }
+
+        Primitives shapes = primitives();
+        accelerator().closestHit(shapes, ray, closest);
+        return shapes.finish(ray, closest);
+    }
+
+
+    /**
+     * @brief Intersects all the rays of a packet, like calling isHit on each of them.
+     *
+     * Spheres outside the frustum of the packet are discarded at once,
+     * the others are tested against 8 rays at a time.
+     *
+     * @param packet
+     * @param records Array of packet.size elements, holds the hit records.
+     * @param hits Array of packet.size elements, true where a ray hit something.
+     */
+    void isHit(const RayPacket& packet, HitRecord* records, bool* hits) const {
+        alignas(32) float t[RayPacket::MAX_SIZE];
+        alignas(32) int index[RayPacket::MAX_SIZE];
+
+        std::vector<int> candidates, others;
+        cull(packet, candidates, others);
+
+        for (int r = 0; r < packet.paddedSize(); r++) {
+            t[r] = INF, index[r] = -1;
+            if (r >= packet.size) continue;
+
+            hits[r] = false;
+            for (int i : others) {
+                HitRecord tempRecord;
+                if (_shapes[i]->isHit(packet.rays[r], tempRecord) && (!hits[r] || tempRecord.t < t[r])) {
+                    hits[r] = true;
+                    t[r] = tempRecord.t;
+                    records[r] = tempRecord;
                 }
             }
         }
-    
-        if (hit) {
-            rec.normal = rec.normal.normalize();
+
+        _spherePack.closestHits(packet, candidates, t, index);
+
+        for (int r = 0; r < packet.size; r++) {
+            HitRecord tempRecord;
+            if (index[r] >= 0 && primitives().sphereIsHit(_spheres[index[r]], packet.rays[r], tempRecord)) {
+                hits[r] = true;
+                records[r] = tempRecord;
+            }
+            if (hits[r]) records[r].normal = records[r].normal.normalize();
         }
-    
-        return hit;
     }
     
     
+    /**
+     * @brief Checks if the ray hits anything inside (ray.tmin, ray.tmax), exiting on the first hit.
+     *
+     * The last shape found blocking a ray is remembered (one per thread) and tested first:
+     * consecutive shadow rays towards the same light are often blocked by the same object.
+     *
+     * @param ray
+     * @return true If the ray is blocked.
+     */
+    bool occluded(const Ray& ray) const {
+        int& last = lastOccluder();
+        bool known = last < Primitives::COMPACT_SPHERE ? last >= 0 && last < static_cast<int>(_shapes.size())
+                                                       : last - Primitives::COMPACT_SPHERE < _spherePack.size();
+        if (known) {
+            int sphere = primitives().sphereIndex(last);
+            bool blocked = sphere >= 0 ? _spherePack.distance(sphere, ray) < INF : _shapes[last]->quickIsHit(ray);
+            if (blocked) return true;
+        }
+
+        for (int index : _unbounded) {
+            if (_shapes[index]->quickIsHit(ray)) {
+                last = index;
+                return true;
+            }
+        }
+
+        int occluder = accelerator().anyHit(primitives(), ray);
+        if (occluder >= 0) last = occluder;
+        return occluder >= 0;
+    }
+
+    /**
+     * @brief Checks which rays of a packet hit anything, like calling occluded on each of them.
+     *
+     * @param packet
+     * @param hits Array of packet.size elements, true where a ray is blocked.
+     */
+    void occluded(const RayPacket& packet, bool* hits) const {
+        alignas(32) float t[RayPacket::MAX_SIZE];
+        alignas(32) int index[RayPacket::MAX_SIZE];
+
+        std::vector<int> candidates, others;
+        cull(packet, candidates, others);
+
+        for (int r = 0; r < packet.paddedSize(); r++) {
+            t[r] = INF, index[r] = -1;
+            if (r >= packet.size) continue;
+
+            hits[r] = false;
+            for (int i : others) {
+                if (_shapes[i]->quickIsHit(packet.rays[r])) {
+                    hits[r] = true;
+                    break;
+                }
+            }
+        }
+
+        // only the distances are computed, no HitRecord
+        _spherePack.closestHits(packet, candidates, t, index);
+
+        for (int r = 0; r < packet.size; r++) hits[r] = hits[r] || index[r] >= 0;
+    }
+
     bool isPointVisible(const Point3& point, const Point3& observerPos) const {
         Vec3 direction = point - observerPos;
         float dirNorm = direction.norm();
 
-        Ray ray(observerPos, direction, 1e-2f / dirNorm, 1.0f);
-        for (const auto& shape : _shapes) {
-            if (shape->quickIsHit(ray)) {
-                return false;
-            }
+        return !occluded(Ray(observerPos, direction, 1e-2f / dirNorm, 1.0f));
+    }
+
+    std::vector<std::shared_ptr<Shape>> _shapes;
+
+private:
+    // index in _shapes of the last occluder found by this thread, in any World: it's only a guess, checked before use
+    static int& lastOccluder() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    SpherePack _spherePack;  // copies of the sphere transformations, set when the shapes are added
+    std::vector<int> _spheres;     // index in _shapes of every sphere in _spherePack, see Primitives::COMPACT_SPHERE
+    std::vector<int> _packIndex;   // for every shape, its index in _spherePack, -1 if it's not a sphere
+    std::vector<uint32_t> _sphereMaterials; // for every sphere in _spherePack, its index in _materials
+    std::vector<std::shared_ptr<Material>> _materials; // the different materials of the spheres
+    std::unordered_map<const Material*, uint32_t> _materialIndex; // position of every material in _materials
+    size_t _nCompactSpheres = 0;
+
+    std::shared_ptr<Accelerator> _accelerator; // over the bounded shapes, null until build() is called, shared by copies like the shapes
+    BuildStats _buildStats;
+    AABB _bounds;                  // of all the shapes, set by build()
+    std::vector<int> _bounded;     // index in _shapes of every primitive of the accelerator
+    std::vector<int> _boundedOthers; // index in _shapes of the bounded shapes that are not spheres
+    std::vector<int> _unbounded;   // index in _shapes of the shapes that can't go in the accelerator, tested one by one
+
+    // the compact spheres have no transformation to read, they never change
+    void updateSpherePack() {
+        for (int i = 0; i < static_cast<int>(_spheres.size()); i++) {
+            if (_spheres[i] < Primitives::COMPACT_SPHERE) _spherePack.set(i, _shapes[_spheres[i]]->transformation);
         }
+    }
 
-        return true;
+    uint32_t materialIndex(const std::shared_ptr<Material>& material) {
+        auto [it, added] = _materialIndex.try_emplace(material.get(), static_cast<uint32_t>(_materials.size()));
+        if (added) _materials.push_back(material);
+        return it->second;
     }
 
-    std::vector<std::shared_ptr<Shape>> _shapes;
+    AABB shapeBox(int index) const {
+        if (index < Primitives::COMPACT_SPHERE) return _shapes[index]->boundingBox();
+        return sphereBox(_spherePack.transformation(index - Primitives::COMPACT_SPHERE));
+    }
+
+    // boxes of the bounded shapes, from their transformations, also sets _bounds
+    std::vector<AABB> boundingBoxes(ThreadPool* pool) {
+        std::vector<AABB> boxes(_bounded.size());
+        auto computeBoxes = [&](int begin, int end) {
+            for (int i = begin; i < end; i++) boxes[i] = shapeBox(_bounded[i]);
+        };
+        if (pool != nullptr) pool->parallelFor(0, static_cast<int>(boxes.size()), 1 << 14, computeBoxes);
+        else computeBoxes(0, static_cast<int>(boxes.size()));
+
+        _bounds = AABB();
+        for (const AABB& box : boxes) _bounds.grow(box);
+        for (int index : _unbounded) {
+            if (!shapeBox(index).isEmpty()) _bounds = AABB::infinite();
+        }
+        return boxes;
+    }
+
+    Primitives primitives() const { return {_shapes, _spherePack, _spheres, _bounded, _packIndex, _boundedOthers, _sphereMaterials, _materials}; }
+
+    // splits the shapes that can be hit by a packet in spheres (indices in _spherePack) and others (indices in _shapes)
+    void cull(const RayPacket& packet, std::vector<int>& spheres, std::vector<int>& others) const {
+        spheres.clear();
+        others = _unbounded;
+        accelerator().cull(primitives(), packet, spheres, others);
+    }
 };
 
 #endif
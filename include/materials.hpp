@@ -36,6 +36,12 @@ private:
     Color _color;
 };
 
+// black uniform texture shared by all the materials created without a texture or an emitted radiance
+inline std::shared_ptr<Texture> blackTexture() {
+    static const std::shared_ptr<Texture> black = std::make_shared<UniformTexture>(Color());
+    return black;
+}
+
 /**
  * @class CheckeredTexture
  * @brief Texture that generates a 2D checkered pattern.
@@ -59,10 +65,13 @@ private:
 /**
  * @class ImageTexture
  * @brief Texture based on an HDR image.
+ *
+ * Images read from a file are mapped in memory: the normalization and clamping of the colors
+ * are applied when reading each of them, so that the pixels are not copied.
  */
 class ImageTexture : public Texture {
 public:
-    ImageTexture(const std::string& name) : _PFM(name) {_PFM.normalize(1.0f); _PFM.clamp();}
+    ImageTexture(const std::string& name) : _PFM(HDRImage::map(name)), _scale(1.0f / _PFM.averageLuminosity()), _clamp(true) {}
     ImageTexture(const HDRImage& image) : _PFM(image) {}
 
     Color color(const Vec2& uv) const override {
@@ -71,11 +80,15 @@ public:
 
         i -= (i >= _PFM._width), j -= (j >= _PFM._height); // if i >= width then i = i - 1
 
-        return _PFM.getPixel(i, j); // interpolation!
+        Color color = _PFM.getPixel(i, j); // interpolation!
+        if (_clamp) color = Color(::clamp(color.r * _scale), ::clamp(color.g * _scale), ::clamp(color.b * _scale));
+        return color;
     }
 
 private:
     HDRImage _PFM;
+    float _scale = 1.0f;
+    bool _clamp = false;
 };
 
 
@@ -88,13 +101,16 @@ private:
  */
 class Material {
 public:
-    Material() : _texture(std::make_shared<UniformTexture>(Color())), _emittedRadiance(std::make_shared<UniformTexture>(Color())) {};
-    Material(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = std::make_shared<UniformTexture>(Color()))
+    Material() : _texture(blackTexture()), _emittedRadiance(blackTexture()) {};
+    Material(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = blackTexture())
         : _texture(texture), _emittedRadiance(emittedRadiance) {}
     virtual ~Material() = default;
     
     Color color(const Vec2& uv) { return _texture->color(uv); }
     Color emittedColor(const Vec2& uv) { return _emittedRadiance->color(uv); }
+
+    const std::shared_ptr<Texture>& texture() const { return _texture; }
+    const std::shared_ptr<Texture>& emittedRadiance() const { return _emittedRadiance; }
     
     virtual Color eval(const Vec2& uv, float thetaIn, float thetaOut) const = 0;
     virtual Ray scatterRay(PCG& pcg, const HitRecord& rec, int depth) const = 0;
@@ -111,7 +127,7 @@ protected:
 class DiffuseMaterial : public Material {
 public:
     DiffuseMaterial() : Material() {}
-    DiffuseMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = std::make_shared<UniformTexture>(Color()))
+    DiffuseMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = blackTexture())
         : Material(texture, emittedRadiance) {}
 
     Color eval(const Vec2& uv, float, float) const override {
@@ -130,7 +146,7 @@ public:
 class SpecularMaterial : public Material {
 public:
     SpecularMaterial() : Material(), _blur(0.0f), _thresholdAngleRad(PI / 1800.0f) {}
-    SpecularMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = std::make_shared<UniformTexture>(Color()),
+    SpecularMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = blackTexture(),
                      float blur = 0.0f, float thresholdAngleRad = PI / 1800.0f)
         : Material(texture, emittedRadiance), _blur(blur), _thresholdAngleRad(thresholdAngleRad) {}
 
@@ -171,7 +187,7 @@ private:
 class TransparentMaterial : public Material {
 public:
     TransparentMaterial() : Material(), _refractionIndex(1.0f) {}
-    TransparentMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = std::make_shared<UniformTexture>(Color()), float refractionIndex = 1.0f)
+    TransparentMaterial(std::shared_ptr<Texture> texture, std::shared_ptr<Texture> emittedRadiance = blackTexture(), float refractionIndex = 1.0f)
         : Material(texture, emittedRadiance), _refractionIndex(refractionIndex), _inverseRefractionIndex(1.0f / refractionIndex),
           _R0((1.0f - _refractionIndex) / (1.0f + _refractionIndex)) { _R0 *= _R0; }
 
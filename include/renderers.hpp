@@ -7,51 +7,33 @@
 namespace Renderers {
 
 /**
- * @brief Simple on/off renderer: returns white if the ray hits anything, black otherwise.
- * 
- * @param ray Ray to test for intersection.
- * @param world Scene containing objects.
- * @return Color White if hit, black otherwise.
+ * @brief The renderers below, split after the intersection of the first ray.
+ *
+ * They take the result of world.isHit(ray, rec) as parameters, so that the first intersection
+ * can be computed elsewhere, for example for a whole packet of rays in Camera::renderPackets.
+ * The renderers in the outer namespace just call these after World::isHit.
+ * OnOff only needs to know if something was hit, so it takes the result of world.occluded(ray) and no HitRecord.
  */
-auto OnOff = [](const Ray& ray, const World& world) {
-    HitRecord rec;
-    return world.isHit(ray, rec) ? Color(1.0f, 1.0f, 1.0f) : Color(0.0f, 0.0f, 0.0f);
+namespace FromHit {
+
+auto OnOff = [](const Ray&, bool hit, const World&) {
+    return hit ? Color(1.0f, 1.0f, 1.0f) : Color(0.0f, 0.0f, 0.0f);
 };
 
-/**
- * @brief Flat renderer: returns the flat color of the material if hit, otherwise background color.
- * 
- * @param ray Ray to test for intersection.
- * @param world Scene containing objects.
- * @return Color Material color at hit point or background color.
- */
-auto Flat = [](const Ray& ray, const World& world) {
-    HitRecord rec;
-    return world.isHit(ray, rec) ? rec.material->color(rec.surfacePoint) : world.backgroundColor;
+auto Flat = [](const Ray&, bool hit, const HitRecord& rec, const World& world) {
+    return hit ? rec.material->color(rec.surfacePoint) : world.backgroundColor;
 };
 
-/**
- * @brief Path tracer renderer using recursive Monte Carlo integration with Russian roulette termination.
- * 
- * @param ray Ray to trace.
- * @param world Scene containing objects and lights.
- * @param pcg Pseudo-random number generator.
- * @param nRays Number of rays per bounce for Monte Carlo sampling (default 8).
- * @param maxDepth Maximum recursion depth (default 8).
- * @param russianRouletteLimit Recursion depth after which Russian roulette is applied (default 3).
- * @return Color Computed radiance along the ray.
- */
-auto PathTracer = [](const Ray& ray, const World& world, PCG& pcg, int nRays = 8,
+auto PathTracer = [](const Ray& ray, bool hit, const HitRecord& rec, const World& world, PCG& pcg, int nRays = 8,
                      int maxDepth = 8, int russianRouletteLimit = 3) -> Color {
 
     // we need to do this to use recursion without passing the lambda to itself in the parameters of Camera::render
-    auto actualFunction = [](const auto& self, const Ray& ray, const World& world, PCG& pcg, int nRays, // ew
-                             int maxDepth, int russianRouletteLimit) -> Color {
+    auto actualFunction = [](const auto& self, const Ray& ray, bool hit, const HitRecord& rec, const World& world, PCG& pcg, // ew
+                             int nRays, int maxDepth, int russianRouletteLimit) -> Color {
 
         if (ray.depth > maxDepth) { return Color(0.0f, 0.0f, 0.0f); }
 
-        HitRecord rec;
-        if (!world.isHit(ray, rec)) { return world.backgroundColor; }
+        if (!hit) { return world.backgroundColor; }
 
         auto hitMaterial = rec.material;
         Color hitColor = hitMaterial->color(rec.surfacePoint);
@@ -75,7 +57,9 @@ auto PathTracer = [](const Ray& ray, const World& world, PCG& pcg, int nRays = 8
         if (hitColorLuminosity > 0.0f) {  // only do costly recursions if it's worth it
             for (int i = 0; i < nRays; i++) {
                 Ray newRay = hitMaterial->scatterRay(pcg, rec, ray.depth + 1);
-                Color newRadiance = self(self, newRay, world, pcg, nRays, maxDepth, russianRouletteLimit); // recursive call
+                HitRecord newRec;
+                bool newHit = newRay.depth <= maxDepth && world.isHit(newRay, newRec); // secondary rays are traced one by one
+                Color newRadiance = self(self, newRay, newHit, newRec, world, pcg, nRays, maxDepth, russianRouletteLimit); // recursive call
                 totalRadiance += hitColor * newRadiance;
             }
         }
@@ -83,21 +67,12 @@ auto PathTracer = [](const Ray& ray, const World& world, PCG& pcg, int nRays = 8
         return emittedRadiance + totalRadiance * (1.0f / nRays); // no operator / in Color
     };
 
-    return actualFunction(actualFunction, ray, world, pcg, nRays, maxDepth, russianRouletteLimit);
+    return actualFunction(actualFunction, ray, hit, rec, world, pcg, nRays, maxDepth, russianRouletteLimit);
 };
 
-/**
- * @brief Simple point light renderer combining ambient lighting and direct illumination from point lights.
- * 
- * @param ray Ray to trace.
- * @param world Scene containing objects and lights.
- * @param ambientColor Ambient light color added to the final result (default: low gray).
- * @return Color Computed color including ambient and direct lighting.
- */
-auto PointLight = [](const Ray& ray, const World& world,
+auto PointLight = [](const Ray& ray, bool isHit, const HitRecord& hit, const World& world,
                      const Color& ambientColor = Color(0.1f, 0.1f, 0.1f)) {
-    HitRecord hit;
-    if (!world.isHit(ray, hit))
+    if (!isHit)
         return world.backgroundColor;
 
     Color emitted = hit.material->emittedColor(Vec2(0.0f, 0.0f));
@@ -133,4 +108,63 @@ auto PointLight = [](const Ray& ray, const World& world,
 
 }
 
+/**
+ * @brief Simple on/off renderer: returns white if the ray hits anything, black otherwise.
+ * 
+ * @param ray Ray to test for intersection.
+ * @param world Scene containing objects.
+ * @return Color White if hit, black otherwise.
+ */
+auto OnOff = [](const Ray& ray, const World& world) {
+    return FromHit::OnOff(ray, world.occluded(ray), world);
+};
+
+/**
+ * @brief Flat renderer: returns the flat color of the material if hit, otherwise background color.
+ * 
+ * @param ray Ray to test for intersection.
+ * @param world Scene containing objects.
+ * @return Color Material color at hit point or background color.
+ */
+auto Flat = [](const Ray& ray, const World& world) {
+    HitRecord rec;
+    bool hit = world.isHit(ray, rec);
+    return FromHit::Flat(ray, hit, rec, world);
+};
+
+/**
+ * @brief Path tracer renderer using recursive Monte Carlo integration with Russian roulette termination.
+ * 
+ * @param ray Ray to trace.
+ * @param world Scene containing objects and lights.
+ * @param pcg Pseudo-random number generator.
+ * @param nRays Number of rays per bounce for Monte Carlo sampling (default 8).
+ * @param maxDepth Maximum recursion depth (default 8).
+ * @param russianRouletteLimit Recursion depth after which Russian roulette is applied (default 3).
+ * @return Color Computed radiance along the ray.
+ */
+auto PathTracer = [](const Ray& ray, const World& world, PCG& pcg, int nRays = 8,
+                     int maxDepth = 8, int russianRouletteLimit = 3) -> Color {
+    HitRecord rec;
+    bool hit = ray.depth <= maxDepth && world.isHit(ray, rec);
+    return FromHit::PathTracer(ray, hit, rec, world, pcg, nRays, maxDepth, russianRouletteLimit);
+};
+
+/**
+ * @brief Simple point light renderer combining ambient lighting and direct illumination from point lights.
+ * 
+ * @param ray Ray to trace.
+ * @param world Scene containing objects and lights.
+ * @param ambientColor Ambient light color added to the final result (default: low gray).
+ * @return Color Computed color including ambient and direct lighting.
+ */
+auto PointLight = [](const Ray& ray, const World& world,
+                     const Color& ambientColor = Color(0.1f, 0.1f, 0.1f)) {
+    HitRecord hit;
+    bool isHit = world.isHit(ray, hit);
+    return FromHit::PointLight(ray, isHit, hit, world, ambientColor);
+};
+
+}
+
 #endif
\ No newline at end of file
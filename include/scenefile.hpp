@@ -9,12 +9,17 @@
 #include <unordered_map>
 #include <memory>
 #include <set>
+#include <map>
+#include <tuple>
 
 #include "utils.hpp"
 #include "World.hpp"
 #include "Vec3.hpp"
 #include "Transformation.hpp"
 #include "shapes.hpp"
+#include "Instance.hpp"
+#include "TriangleMesh.hpp"
+#include "CompiledScene.hpp"
 #include "materials.hpp"
 #include "Camera.hpp"
 #include "Color.hpp"
@@ -72,7 +77,7 @@ private:
 
 // constants containing accepted symbols and keywords
 
-const std::string SYMBOLS = ",()[]<>*";
+const std::string SYMBOLS = ",()[]<>*{}";
 
 /**
  * @brief Enumeration of all recognized keywords in the scene file format.
@@ -88,7 +93,8 @@ enum class Keywords {
     ROTATION_X, ROTATION_Y, ROTATION_Z,
     SCALING,
     CAMERA, ORTHOGONAL, PERSPECTIVE, // cameras
-    SPHERE, PLANE, POINT_LIGHT, // shapes
+    SPHERE, PLANE, MESH, POINT_LIGHT, // shapes
+    GROUP, INSTANCE,
     MATERIAL,
     UNIFORM, CHECKERED, IMAGE, // textures
     DIFFUSE, SPECULAR, TRANSPARENT // materials
@@ -108,7 +114,10 @@ const std::unordered_map<std::string, Keywords> KEYWORDS {
     {"perspective", Keywords::PERSPECTIVE},
     {"sphere", Keywords::SPHERE},
     {"plane", Keywords::PLANE},
+    {"mesh", Keywords::MESH},
     {"pointLight", Keywords::POINT_LIGHT},
+    {"group", Keywords::GROUP},
+    {"instance", Keywords::INSTANCE},
     {"material", Keywords::MATERIAL},
     {"uniform", Keywords::UNIFORM},
     {"checkered", Keywords::CHECKERED},
@@ -143,7 +152,10 @@ const std::unordered_map<Keywords, std::string, _EnumClassHash> INVERSE_KEYWORDS
     {Keywords::PERSPECTIVE, "perspective"},
     {Keywords::SPHERE, "sphere"},
     {Keywords::PLANE, "plane"},
+    {Keywords::MESH, "mesh"},
     {Keywords::POINT_LIGHT, "pointLight"},
+    {Keywords::GROUP, "group"},
+    {Keywords::INSTANCE, "instance"},
     {Keywords::MATERIAL, "material"},
     {Keywords::UNIFORM, "uniform"},
     {Keywords::CHECKERED, "checkered"},
@@ -400,21 +412,56 @@ public:
     std::unordered_map<std::string, std::shared_ptr<Material>> materials;
     std::unordered_map<std::string, float> floatVariables;
     std::set<std::string> overriddenVariables; // easier to search than a vector
+    std::unordered_map<std::string, std::shared_ptr<World>> groups; // each one is built once, and shared by its instances
+    // build the BVHs of world, of the groups and of the meshes, not needed for scenes only used by animate or compiled:
+    // without it the mesh files are not read, and the meshes are empty
+    bool buildWorld = true;
+    std::shared_ptr<CompiledScene> compiled; // if set before parse, everything read is also recorded here, to be saved
 
     Scene() {}
-    Scene(std::string fileName, const std::unordered_map<std::string, float>& variables = std::unordered_map<std::string, float>()) {
+
+    /**
+     * @brief Reads a scene file, either the text or a compiled one (see CompiledScene), told apart by its first bytes.
+     *
+     * The variables are ignored for compiled scenes, they were replaced by their values when compiling.
+     */
+    Scene(std::string fileName, const std::unordered_map<std::string, float>& variables = std::unordered_map<std::string, float>(),
+          const World::BuildSettings& buildSettings = World::BuildSettings()) {
         std::ifstream file(fileName);
         if (file.fail()) { // in the main we already check using CLI11, but you never know
             std::cout << "ERROR: impossible to open file \"" + fileName + "\"" << std::endl;
             exit(-1);
         }
+        world.buildSettings = buildSettings;
+        if (CompiledScene::isCompiled(fileName)) {
+            CompiledScene::load(fileName, *this);
+            return;
+        }
         InputStream stream(file, fileName);
         parse(stream, variables);
     }
 
     void parse(InputStream& inputFile, const std::unordered_map<std::string, float>& variables = std::unordered_map<std::string, float>());
 
+    /**
+     * @brief Moves the shapes, the lights and the camera to where they are in "next", usually the same file
+     *        parsed with other variables, then updates the world (see World::update), without building it again.
+     *
+     * Only the transformations of the shapes in the world are copied, not the ones inside the groups.
+     *
+     * @param next
+     * @return false If the shapes of "next" are not the same kinds of the ones of this scene, in the same order:
+     *         nothing is changed then.
+     */
+    bool animate(const Scene& next);
+
 private:
+    // textures and materials by their definition: identical ones are created once and shared, even with different names
+    using TextureKey = std::tuple<Keywords, float, float, float, float, float, float, int, std::string>;
+    using MaterialKey = std::tuple<Keywords, const Texture*, const Texture*, float, float, float>;
+    std::map<TextureKey, std::shared_ptr<Texture>> _textureTable;
+    std::map<MaterialKey, std::shared_ptr<Material>> _materialTable;
+
     void expectSymbol(InputStream& inputFile, const char& symbol);
     Keywords expectKeywords(InputStream& inputFile, const std::vector<Keywords>& keywords);
     float expectNumber(InputStream& inputFile);
@@ -426,8 +473,11 @@ private:
     std::shared_ptr<Texture> parseTexture(InputStream& inputFile);
     void parseMaterial(InputStream& inputFile); // directly add the material to the map
     Transformation parseTransformation(InputStream& inputFile);
-    void parseSphere(InputStream& inputFile);   // these functions directly modify world
-    void parsePlane(InputStream& inputFile);
+    void parseSphere(InputStream& inputFile, World& target); // these functions directly add the shape to target
+    void parsePlane(InputStream& inputFile, World& target);
+    void parseMesh(InputStream& inputFile, World& target);
+    void parseInstance(InputStream& inputFile, World& target);
+    void parseGroup(InputStream& inputFile);    // directly add the group to the map
     void parsePointLight(InputStream& inputFile);
     void parseCamera(InputStream& inputFile);   // directly assign camera
 };
@@ -6,6 +6,7 @@
 #include "Transformation.hpp"
 #include "utils.hpp"
 #include "materials.hpp"
+#include "AABB.hpp"
 
 // Helper to compute normal of a unit sphere
 inline Normal3 sphereNormal(const Point3& point, const Vec3& rayDir, HitRecord& rec) {
@@ -22,6 +23,57 @@ inline Vec2 sphereUV(const Point3& point) {
     return Vec2(u, v);
 }
 
+/**
+ * @brief Intersection of a ray with the unit sphere transformed by a transformation, the body of Sphere::isHit.
+ *
+ * Also used by World for the spheres kept only as records (see World::BuildSettings::compactShapes).
+ */
+inline bool sphereHit(const Transformation& transformation, const std::shared_ptr<Material>& material, const Ray& r, HitRecord& rec) {
+    Ray invRay = r.transform(transformation.inverse());
+
+    Vec3 originVec = invRay.origin.toVec();
+    float a = invRay.direction.norm2();
+    float b = dot(originVec, invRay.direction); // actually is b/2
+    float c = originVec.norm2() - 1.0f;
+
+    float delta = b * b - a * c; // delta/4
+    if (delta <= 0.0f) return false;
+
+    float sqrtDelta = std::sqrt(delta);
+    float t1 = (-b - sqrtDelta) / a;
+    float t2 = (-b + sqrtDelta) / a;
+
+    float t = -1.0f;
+    if (t1 > invRay.tmin && t1 < invRay.tmax) {
+        t = t1;
+    } else if (t2 > invRay.tmin && t2 < invRay.tmax) {
+        t = t2;
+    } else {
+        return false;
+    }
+
+    Point3 localHit = invRay.at(t);
+
+    rec.t = t;
+    rec.ray = r;
+    rec.worldPoint = transformation * localHit;
+    rec.normal = transformation * sphereNormal(localHit, invRay.direction, rec);
+    rec.surfacePoint = sphereUV(localHit);
+    rec.material = material;
+
+    return true;
+}
+
+// exact box of the ellipsoid: along each axis, the half side is the norm of the corresponding row of the linear part
+inline AABB sphereBox(const Transformation& transformation) {
+    const float* m = transformation.matrix;
+    Vec3 half(std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]),
+              std::sqrt(m[4] * m[4] + m[5] * m[5] + m[6] * m[6]),
+              std::sqrt(m[8] * m[8] + m[9] * m[9] + m[10] * m[10]));
+    Point3 centre(m[3], m[7], m[11]);
+    return AABB(centre - half, centre + half);
+}
+
 class Shape {
 public:
     Transformation transformation;
@@ -31,10 +83,24 @@ public:
 
     virtual bool isHit(const Ray& r, HitRecord& rec) const = 0;
 
-    virtual bool quickIsHit(const Ray& r) const {
-        HitRecord dummy;
-        return isHit(r, dummy);
-    }
+    /**
+     * @brief Checks if the ray hits the shape inside (ray.tmin, ray.tmax), without computing a HitRecord.
+     *
+     * Used by the occlusion queries (shadow rays, on/off renderer), every shape must implement it.
+     */
+    virtual bool quickIsHit(const Ray& r) const = 0;
+
+    /**
+     * @brief Box containing the shape in world coordinates, AABB::infinite() if the shape is unbounded.
+     */
+    virtual AABB boundingBox() const = 0;
+
+    /**
+     * @brief Bytes used by the shape object and what it owns, without the material, which is shared.
+     */
+    virtual size_t memoryUsage() const = 0;
+
+    const std::shared_ptr<Material>& material() const { return _material; }
 
 protected:
     std::shared_ptr<Material> _material;
@@ -46,43 +112,8 @@ protected:
 class Sphere : public Shape {
 public:
     Sphere(std::shared_ptr<Material> material = std::make_shared<DiffuseMaterial>(DiffuseMaterial()), const Transformation& t = Transformation()) : Shape(material, t) {}
-    
-    bool isHit(const Ray& r, HitRecord& rec) const override {
-            
-        Ray invRay = r.transform(transformation.inverse());
-    
-        Vec3 originVec = invRay.origin.toVec();
-        float a = invRay.direction.norm2();
-        float b = dot(originVec, invRay.direction); // actually is b/2
-        float c = originVec.norm2() - 1.0f;
 
-        float delta = b * b - a * c; // delta/4
-        if (delta <= 0.0f) return false;
-
-        float sqrtDelta = std::sqrt(delta);
-        float t1 = (-b - sqrtDelta) / a;
-        float t2 = (-b + sqrtDelta) / a;
-    
-        float t = -1.0f;
-        if (t1 > invRay.tmin && t1 < invRay.tmax) {
-            t = t1;
-        } else if (t2 > invRay.tmin && t2 < invRay.tmax) {
-            t = t2;
-        } else {
-            return false;
-        }
-    
-        Point3 localHit = invRay.at(t);
-    
-        rec.t = t;
-        rec.ray = r;
-        rec.worldPoint = transformation * localHit;
-        rec.normal = transformation * sphereNormal(localHit, invRay.direction, rec);
-        rec.surfacePoint = sphereUV(localHit);
-        rec.material = _material;
-    
-        return true;
-    }
+    bool isHit(const Ray& r, HitRecord& rec) const override { return sphereHit(transformation, _material, r, rec); }
 
     bool quickIsHit(const Ray& ray) const override {
         Ray invRay = ray.transform(transformation.inverse());
@@ -100,6 +131,10 @@ public:
 
         return (invRay.tmin < tmin && invRay.tmax > tmin) || (invRay.tmin < tmax && invRay.tmax > tmax);
     }
+
+    AABB boundingBox() const override { return sphereBox(transformation); }
+
+    size_t memoryUsage() const override { return sizeof(Sphere); }
 };
 
 /**
@@ -141,6 +176,10 @@ public:
         float t = -invRay.origin.z / invRay.direction.z;
         return t > invRay.tmin && t < invRay.tmax;
     }
+
+    AABB boundingBox() const override { return AABB::infinite(); }
+
+    size_t memoryUsage() const override { return sizeof(Plane); }
 };
 
 #endif
@@ -0,0 +1,228 @@
+#ifndef __simd__
+#define __simd__
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "Transformation.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAYTRACER_X86
+#endif
+
+/**
+ * @brief Instruction sets used by the vectorized kernels, from the slowest to the fastest.
+ */
+enum class SimdLevel {SCALAR, SSE4, AVX2};
+
+/**
+ * @brief Returns the best instruction set supported by the CPU running the program.
+ *
+ * The check is done once, using CPUID, the result is cached.
+ * On non-x86 CPUs it's always SimdLevel::SCALAR.
+ *
+ * @return SimdLevel
+ */
+SimdLevel bestSimdLevel();
+
+std::string simdLevelName(SimdLevel level);
+
+/**
+ * @brief Tests one ray against 4 boxes at once, the kernel of the BVH traversal.
+ *
+ * @param boxes 24 floats aligned to 16 bytes: the min x, y, z and then the max x, y, z of the 4 boxes, 4 floats each.
+ * @param ray 7 floats: origin x, y, z, inverse of the direction x, y, z, tmin.
+ * @param tmax The boxes must be entered before this distance.
+ * @param tNear Holds the distance where the ray enters each box.
+ * @param level Instruction set used.
+ * @return int Bit mask of the boxes hit.
+ */
+int boxesHit4(const float* boxes, const float* ray, float tmax, float* tNear, SimdLevel level);
+
+/**
+ * @brief Same as boxesHit4, for boxes quantized to 8 bits: min = origin + low * scale, max = origin + high * scale.
+ *
+ * @param origin 3 floats.
+ * @param scale 3 floats.
+ * @param low 12 bytes, the x of the 4 boxes, then y and z.
+ * @param high 12 bytes, as low.
+ * @param ray 7 floats, as in boxesHit4.
+ * @param tmax
+ * @param tNear Holds the distance where the ray enters each box.
+ * @param level Instruction set used.
+ * @return int Bit mask of the boxes hit.
+ */
+int quantizedBoxesHit4(const float* origin, const float* scale, const uint8_t* low, const uint8_t* high,
+                       const float* ray, float tmax, float* tNear, SimdLevel level);
+
+
+/**
+ * @brief Reverses the order of the bytes of 32-bit words in place, to convert floats read or written in the other byte order.
+ *
+ * @param words
+ * @param count Number of words, they don't need to be aligned.
+ * @param level Instruction set used, defaults to the best available.
+ */
+void swapBytes32(void* words, size_t count, SimdLevel level = bestSimdLevel());
+
+
+/**
+ * @brief Sum of log10(luminosity + delta) over many pixels, the reduction of HDRImage::averageLuminosity.
+ *
+ * The vectorized versions compute the logarithm with a polynomial approximation, within a couple of ulps,
+ * and every version accumulates in double precision.
+ *
+ * @param pixels count pixels, 3 floats each, they don't need to be aligned.
+ * @param count
+ * @param delta Added to the luminosities, to avoid log(0).
+ * @param level Instruction set used, defaults to the best available.
+ * @return double
+ */
+double sumLogLuminosity(const void* pixels, size_t count, float delta, SimdLevel level = bestSimdLevel());
+
+/**
+ * @brief Maps floats to 8-bit values: each is multiplied by scale, clamped to x / (1 + x) if required,
+ *        raised to invGamma, multiplied by 255 and truncated, saturating at 0 and 255.
+ *
+ * The scalar version uses std::pow, the vectorized ones compute exp(invGamma * log(x)) with polynomial
+ * approximations, within a couple of ulps: the results differ only when the value is that close to an integer.
+ *
+ * @param values count floats, they don't need to be aligned.
+ * @param count
+ * @param scale
+ * @param clamp
+ * @param invGamma
+ * @param bytes Holds count values.
+ * @param level Instruction set used, defaults to the best available.
+ */
+void toneMap(const void* values, size_t count, float scale, bool clamp, float invGamma, uint8_t* bytes, SimdLevel level = bestSimdLevel());
+
+/**
+ * @brief Converts floats to IEEE half precision, rounding to the nearest even, as F16C would but without needing it.
+ *
+ * Values too big become infinities, too small ones denormals or zeros, NaNs stay NaNs.
+ *
+ * @param values count floats.
+ * @param count
+ * @param halves Holds count values.
+ * @param level Instruction set used, defaults to the best available.
+ */
+void floatsToHalves(const float* values, size_t count, uint16_t* halves, SimdLevel level = bestSimdLevel());
+
+/**
+ * @brief Converts IEEE half precision values to floats, exactly.
+ *
+ * @param halves count values.
+ * @param count
+ * @param values Holds count floats.
+ * @param level Instruction set used, defaults to the best available.
+ */
+void halvesToFloats(const uint16_t* halves, size_t count, float* values, SimdLevel level = bestSimdLevel());
+
+
+/**
+ * @brief Sphere data packed 8 at a time in a structure of arrays, used to test one ray against many spheres at once.
+ *
+ * Every sphere is stored as the first three rows of its inverse transformation,
+ * which is all we need to bring a ray in the reference frame of the unit sphere.
+ * The arrays are padded to a multiple of 8 with spheres that can never be hit.
+ * Only the distance along the ray is computed here, the full HitRecord is left to Sphere::isHit.
+ */
+class SpherePack {
+public:
+    static constexpr int WIDTH = 8;
+
+    /**
+     * @brief Adds a sphere, given its transformation.
+     *
+     * @param transformation The transformation of the unit sphere.
+     * @return int The index of the sphere inside the pack.
+     */
+    int add(const Transformation& transformation);
+
+    /**
+     * @brief Changes the transformation of the sphere with the given index.
+     */
+    void set(int index, const Transformation& transformation);
+
+    void clear() { _size = 0; _bounds.clear(); for (auto& row : _inverse) row.clear(); }
+
+    // makes room for a number of spheres, to add them without reallocating
+    void reserve(int nSpheres);
+
+    int size() const { return _size; }
+
+    /**
+     * @brief The transformation of a sphere, rebuilt from its inverse: the matrix is computed again, up to rounding.
+     */
+    Transformation transformation(int index) const;
+
+    /**
+     * @brief Bytes used by the arrays, their unused capacity included.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Finds the closest sphere hit by the ray, inside (ray.tmin, ray.tmax).
+     *
+     * @param ray
+     * @param t Holds the distance of the closest hit, untouched if nothing is hit.
+     * @param level Instruction set used, defaults to the best available.
+     * @return int Index of the sphere hit, -1 if there's none.
+     */
+    int closestHit(const Ray& ray, float& t, SimdLevel level = bestSimdLevel()) const;
+
+    /**
+     * @brief Checks if the ray hits any sphere inside (ray.tmin, ray.tmax), exiting on the first hit.
+     *
+     * @param ray
+     * @param level Instruction set used, defaults to the best available.
+     * @return int Index of a sphere hit by the ray, -1 if there's none.
+     */
+    int anyHit(const Ray& ray, SimdLevel level = bestSimdLevel()) const;
+
+    /**
+     * @brief Distance of the hit between the ray and a single sphere, inside (ray.tmin, ray.tmax).
+     *
+     * @return float INF if the sphere is not hit.
+     */
+    float distance(int index, const Ray& ray) const;
+
+    /**
+     * @brief Finds the closest sphere hit by every ray of a packet, among the given spheres.
+     *
+     * The rays are processed 8 (or 4) at a time, each sphere is tested against all of them.
+     * "t" and "index" must have packet.paddedSize() elements, and are only updated
+     * for the rays that hit a sphere closer than the current "t".
+     *
+     * @param packet
+     * @param spheres Indices of the spheres to test, for example the output of cull().
+     * @param t Per ray, distance of the closest hit.
+     * @param index Per ray, index of the closest sphere.
+     * @param level Instruction set used, defaults to the best available.
+     */
+    void closestHits(const RayPacket& packet, const std::vector<int>& spheres, float* t, int* index, SimdLevel level = bestSimdLevel()) const;
+
+    /**
+     * @brief Lists the spheres whose bounding sphere is not completely outside the frustum of the packet.
+     *
+     * @param packet
+     * @param spheres Holds the indices of the spheres that could be hit.
+     */
+    void cull(const RayPacket& packet, std::vector<int>& spheres) const;
+
+private:
+    struct BoundingSphere {
+        Point3 centre;
+        float radius;
+    };
+
+    int _size = 0;
+    std::vector<float> _inverse[12]; // rows 0, 1, 2 of the inverse matrices, one array per element
+    std::vector<BoundingSphere> _bounds;
+};
+
+#endif
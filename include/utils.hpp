@@ -44,6 +44,27 @@ inline bool areClose(const T1& v, const T1& u, float epsilon = 1e-5f) {
 Vec3 reflect(const Vec3& v, const Normal3& n);
 Vec3 refract(const Vec3& v, const Normal3& n, float refractionIndexRatio);
 
+/**
+ * @brief Spreads the lowest 10 bits of x, leaving two zeros between each of them.
+ */
+inline uint32_t expandBits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+/**
+ * @brief Morton code (Z-order curve) of a point on a 1024x1024x1024 grid, 30 bits long.
+ *
+ * Points close in space have close codes, so sorting by Morton code groups nearby points together.
+ */
+inline uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
 // utility for the lexer
 inline bool isCharSkippable(const char& c) {
     return (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '#');
@@ -60,6 +81,39 @@ inline bool isCharSkippable(const char& c) {
  */
 void validateFloatVariable(std::string& s, std::unordered_map<std::string, float>& floatVariables);
 
+/**
+ * @brief Reads a float variable changing during an animation, with the syntax name:start:end.
+ *
+ * @param s String to validate.
+ * @param name
+ * @param start Value in the first frame.
+ * @param end Value in the last frame.
+ */
+void validateAnimation(const std::string& s, std::string& name, float& start, float& end);
+
+/**
+ * @brief Reads an output image with the syntax file[:normalization[:gamma]], the numbers must be positive.
+ *
+ * Only the numbers after the last colons are read, so colons in the file name are allowed.
+ *
+ * @param s String to validate.
+ * @param fileName
+ * @param a Normalization factor, unchanged if not given.
+ * @param gamma Gamma correction, unchanged if not given.
+ */
+void validateOutputTarget(const std::string& s, std::string& fileName, float& a, float& gamma);
+
+/**
+ * @brief Largest resident memory used by the process so far, in bytes, 0 where it can't be measured.
+ */
+size_t peakMemoryUsage();
+
+/**
+ * @brief Name for a temporary file next to path, to be renamed to path once complete: "dir/name.ext" gives
+ *        "dir/name.tmp<process>-<count>.ext", different for every call and every process, with the same extension.
+ */
+std::string temporaryPath(const std::string& path);
+
 
 
 /**
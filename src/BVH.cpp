@@ -0,0 +1,485 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <filesystem>
+#include "ThreadPool.hpp"
+#include "utils.hpp"
+
+namespace {
+
+constexpr int N_BINS = 16;
+using bvhTraversal::TRAVERSAL_COST;
+constexpr int LBVH_LEAF_SIZE = 4;      // the Morton builder doesn't look at costs, it stops at this size
+
+// below these sizes, a thread pool is not worth it
+constexpr int PARALLEL_BINNING = 1 << 16; // primitives in a node to bin it in parallel
+constexpr int PARALLEL_CHUNK = 1 << 14;   // primitives binned by a single task
+constexpr int PARALLEL_SUBTREE = 1 << 12; // primitives in a node to build its children in parallel
+
+// Files written by BVH::save: the header, the nodes, then the primitives, in the byte order of the machine.
+// Change the version when the layout of the nodes or the build change.
+constexpr char CACHE_MAGIC[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+constexpr uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version, nodeSize;
+    uint64_t key, nNodes, nPrimitives;
+    float sahCost;
+    uint8_t padding[20]; // the nodes start 64 bytes after the start of the file, aligned like in memory
+};
+static_assert(sizeof(CacheHeader) == 64);
+
+// checks a tree read from a file in one pass, so that a traversal of it can't go out of its arrays or its stack:
+// children come after their parent, as the build lays them out, and no deeper than the build goes
+bool isValidTree(std::span<const BVH::Node> nodes, std::span<const int> primitives) {
+    int64_t nNodes = static_cast<int64_t>(nodes.size()), nPrimitives = static_cast<int64_t>(primitives.size());
+    for (int index : primitives) {
+        if (index < 0 || index >= nPrimitives) return false;
+    }
+    std::vector<uint8_t> depth(nodes.size(), 0);
+    for (int64_t i = 0; i < nNodes; i++) {
+        const BVH::Node& node = nodes[i];
+        for (int k = 0; k < bvhTraversal::WIDTH; k++) {
+            if (node.isEmpty(k)) continue;
+            if (node.isLeaf(k)) {
+                if (static_cast<int64_t>(node.child[k]) + node.count[k] > nPrimitives) return false;
+            } else {
+                if (node.count[k] < 0 || node.child[k] <= i || node.child[k] >= nNodes || depth[i] >= bvhTraversal::MAX_DEPTH) return false;
+                depth[node.child[k]] = depth[i] + 1;
+            }
+        }
+    }
+    return true;
+}
+
+// binary tree, collapsed into the 4-wide one at the end of the build
+struct BuildNode {
+    AABB box;
+    int left = -1, right = -1; // children, -1 for leaves
+    int first = 0, count = 0;  // range of primitives of a leaf
+};
+
+struct Bins {
+    AABB boxes[N_BINS];
+    int counts[N_BINS] = {0};
+};
+
+struct RangeBounds {
+    AABB box, centroids; // boxes of the primitives and of their centroids
+};
+
+/**
+ * Builds a binary tree. A binary tree with n leaves has 2n - 1 nodes, so they are allocated at the start
+ * and every node takes the next free index: parallel tasks never resize the vector.
+ * Tasks work on disjoint ranges of the primitives.
+ */
+class Builder {
+public:
+    Builder(const std::vector<AABB>& boxes, ThreadPool* pool) : _boxes(boxes), _pool(pool) {
+        int n = static_cast<int>(boxes.size());
+        _centroids.resize(n);
+        _primitives.resize(n);
+        forChunks(0, n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) _centroids[i] = boxes[i].centroid(), _primitives[i] = i;
+        });
+    }
+
+    std::vector<BuildNode> nodes;
+
+    void build(BVH::Preset preset) {
+        int n = static_cast<int>(_boxes.size());
+        nodes.resize(2 * n - 1);
+        if (preset == BVH::Preset::LBVH) {
+            sortByMortonCode();
+            buildMorton(0, n);
+        } else {
+            buildSAH(0, n, 0);
+        }
+        nodes.resize(_nNodes.load());
+    }
+
+    std::vector<int>& primitives() { return _primitives; }
+
+private:
+    const std::vector<AABB>& _boxes;
+    ThreadPool* _pool;
+    std::vector<Point3> _centroids;
+    std::vector<int> _primitives;
+    std::vector<uint32_t> _codes; // Morton codes, in the same order as _primitives
+    std::atomic<int> _nNodes = 0;
+
+    static float coordinate(const Point3& p, int axis) { return axis == 0 ? p.x : (axis == 1 ? p.y : p.z); }
+
+    // calls function(begin, end) on chunks of [first, last), in parallel if the range is big
+    template <typename Function>
+    void forChunks(int first, int last, const Function& function) {
+        if (_pool != nullptr && last - first >= PARALLEL_BINNING) _pool->parallelFor(first, last, PARALLEL_CHUNK, function);
+        else function(first, last);
+    }
+
+    // like forChunks, with a partial result for every chunk, merged in order so the result doesn't depend on the threads
+    template <typename Result, typename Accumulate, typename Merge>
+    Result reduce(int first, int last, const Accumulate& accumulate, const Merge& merge) {
+        int chunk = (_pool != nullptr && last - first >= PARALLEL_BINNING) ? PARALLEL_CHUNK : last - first;
+        std::vector<Result> partial((last - first + chunk - 1) / chunk);
+        forChunks(first, last, [&](int begin, int end) {
+            for (int b = begin; b < end; b += chunk) {
+                Result& result = partial[(b - first) / chunk];
+                for (int i = b; i < std::min(b + chunk, end); i++) accumulate(result, _primitives[i]);
+            }
+        });
+        for (size_t k = 1; k < partial.size(); k++) merge(partial[0], partial[k]);
+        return partial[0];
+    }
+
+    RangeBounds bounds(int first, int last) {
+        return reduce<RangeBounds>(first, last,
+            [&](RangeBounds& r, int primitive) { r.box.grow(_boxes[primitive]), r.centroids.grow(_centroids[primitive]); },
+            [](RangeBounds& r, const RangeBounds& other) { r.box.grow(other.box), r.centroids.grow(other.centroids); });
+    }
+
+    // builds the two children, the first in another task if the range is big
+    template <typename Recurse>
+    void buildChildren(int index, int first, int middle, int last, const Recurse& recurse) {
+        int left;
+        if (_pool != nullptr && last - first >= PARALLEL_SUBTREE) {
+            std::atomic<int> pending(1);
+            _pool->submit([&]() { left = recurse(first, middle); pending--; });
+            nodes[index].right = recurse(middle, last);
+            _pool->wait(pending);
+        } else {
+            left = recurse(first, middle);
+            nodes[index].right = recurse(middle, last);
+        }
+        nodes[index].left = left;
+    }
+
+    int buildSAH(int first, int last, int depth) {
+        int index = _nNodes++;
+        RangeBounds range = bounds(first, last);
+        const AABB& box = range.box;
+        nodes[index].box = box;
+
+        int count = last - first;
+        if (count <= 1) return makeLeaf(index, first, count);
+
+        int middle = -1;
+        float leafCost = static_cast<float>(count);
+        float splitCost = INF;
+        int axis = range.centroids.largestAxis();
+        float low = coordinate(range.centroids.min, axis), high = coordinate(range.centroids.max, axis);
+
+        // a spread so small that its inverse is not a float is the same as none: the centroids at low would get NaN bins
+        float scale = high > low ? N_BINS / (high - low) : INF;
+
+        // below depth MAX_DEPTH - 32 there are only splits in half, so the depth can't exceed MAX_DEPTH with less than 2^31 primitives
+        if (std::isfinite(scale) && depth < BVH::MAX_DEPTH - 32) {
+            // bins along the largest axis of the centroids
+            auto binOf = [&](int primitive) {
+                return std::min(N_BINS - 1, static_cast<int>((coordinate(_centroids[primitive], axis) - low) * scale));
+            };
+
+            Bins bins = reduce<Bins>(first, last,
+                [&](Bins& bins, int primitive) {
+                    int bin = binOf(primitive);
+                    bins.boxes[bin].grow(_boxes[primitive]);
+                    bins.counts[bin]++;
+                },
+                [](Bins& bins, const Bins& other) {
+                    for (int b = 0; b < N_BINS; b++) bins.boxes[b].grow(other.boxes[b]), bins.counts[b] += other.counts[b];
+                });
+
+            // sweep from the right, then from the left, to get the cost of every split between two bins
+            float rightAreas[N_BINS];
+            int rightCounts[N_BINS];
+            AABB accumulated;
+            int accumulatedCount = 0;
+            for (int b = N_BINS - 1; b > 0; b--) {
+                accumulated.grow(bins.boxes[b]), accumulatedCount += bins.counts[b];
+                rightAreas[b] = accumulated.surfaceArea(), rightCounts[b] = accumulatedCount;
+            }
+
+            int bestSplit = -1;
+            accumulated = AABB(), accumulatedCount = 0;
+            float inverseArea = 1.0f / std::max(box.surfaceArea(), 1e-20f);
+            for (int b = 1; b < N_BINS; b++) {
+                accumulated.grow(bins.boxes[b - 1]), accumulatedCount += bins.counts[b - 1];
+                if (accumulatedCount == 0 || rightCounts[b] == 0) continue;
+                float cost = TRAVERSAL_COST + (accumulated.surfaceArea() * accumulatedCount + rightAreas[b] * rightCounts[b]) * inverseArea;
+                if (cost < splitCost) splitCost = cost, bestSplit = b;
+            }
+
+            if (bestSplit > 0 && (splitCost < leafCost || count > BVH::MAX_LEAF_SIZE)) {
+                middle = static_cast<int>(std::partition(_primitives.begin() + first, _primitives.begin() + last,
+                                                         [&](int primitive) { return binOf(primitive) < bestSplit; })
+                                          - _primitives.begin());
+            }
+        }
+
+        if (middle < 0) {
+            if (count <= BVH::MAX_LEAF_SIZE) return makeLeaf(index, first, count);
+            // all the centroids are in the same place (or the tree is too deep): split in half
+            middle = first + count / 2;
+        }
+
+        buildChildren(index, first, middle, last, [&](int begin, int end) { return buildSAH(begin, end, depth + 1); });
+        return index;
+    }
+
+    // sorts the primitives by the Morton code of their centroid, with 10 bits per axis
+    void sortByMortonCode() {
+        int n = static_cast<int>(_primitives.size());
+        AABB centroids = bounds(0, n).centroids;
+        Vec3 extent = centroids.extent();
+        // an extent so small that its inverse is not a float is the same as none, as in buildSAH
+        auto axisScale = [](float extent) {
+            float scale = extent > 0.0f ? 1023.0f / extent : 0.0f;
+            return std::isfinite(scale) ? scale : 0.0f;
+        };
+        float scale[3] = {axisScale(extent.x), axisScale(extent.y), axisScale(extent.z)};
+
+        // code in the high bits, primitive in the low ones, so sorting the keys sorts both
+        std::vector<uint64_t> keys(n);
+        forChunks(0, n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                Point3 c = _centroids[i];
+                uint32_t code = mortonCode(static_cast<uint32_t>((c.x - centroids.min.x) * scale[0]),
+                                           static_cast<uint32_t>((c.y - centroids.min.y) * scale[1]),
+                                           static_cast<uint32_t>((c.z - centroids.min.z) * scale[2]));
+                keys[i] = static_cast<uint64_t>(code) << 32 | static_cast<uint32_t>(i);
+            }
+        });
+
+        // sort chunks in parallel, then merge them in pairs
+        int chunk = (_pool != nullptr && n >= PARALLEL_BINNING) ? PARALLEL_CHUNK : n;
+        forChunks(0, n, [&](int begin, int end) {
+            for (int b = begin; b < end; b += chunk) std::sort(keys.begin() + b, keys.begin() + std::min(b + chunk, end));
+        });
+        for (int width = chunk; width < n; width *= 2) {
+            int nPairs = (n + 2 * width - 1) / (2 * width);
+            auto mergePairs = [&](int begin, int end) {
+                for (int pair = begin; pair < end; pair++) {
+                    int b = pair * 2 * width, m = std::min(b + width, n), e = std::min(b + 2 * width, n);
+                    std::inplace_merge(keys.begin() + b, keys.begin() + m, keys.begin() + e);
+                }
+            };
+            if (_pool != nullptr) _pool->parallelFor(0, nPairs, 1, mergePairs);
+            else mergePairs(0, nPairs);
+        }
+
+        _codes.resize(n);
+        forChunks(0, n, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) _primitives[i] = static_cast<int>(keys[i] & 0xffffffff), _codes[i] = static_cast<uint32_t>(keys[i] >> 32);
+        });
+    }
+
+    // splits where the highest bit that differs in the range changes, the boxes are set on the way back
+    int buildMorton(int first, int last) {
+        int index = _nNodes++;
+        int count = last - first;
+
+        int middle;
+        if (count <= LBVH_LEAF_SIZE) {
+            middle = -1;
+        } else if (_codes[first] == _codes[last - 1]) {
+            // same code: leaf, or split in half if there are too many
+            middle = count <= BVH::MAX_LEAF_SIZE ? -1 : first + count / 2;
+        } else {
+            uint32_t bit = 1u << (31 - std::countl_zero(_codes[first] ^ _codes[last - 1]));
+            middle = static_cast<int>(std::partition_point(_codes.begin() + first, _codes.begin() + last,
+                                                           [&](uint32_t code) { return !(code & bit); })
+                                      - _codes.begin());
+        }
+
+        if (middle < 0) {
+            AABB box;
+            for (int i = first; i < last; i++) box.grow(_boxes[_primitives[i]]);
+            nodes[index].box = box;
+            return makeLeaf(index, first, count);
+        }
+
+        buildChildren(index, first, middle, last, [&](int begin, int end) { return buildMorton(begin, end); });
+        nodes[index].box = nodes[nodes[index].left].box;
+        nodes[index].box.grow(nodes[nodes[index].right].box);
+        return index;
+    }
+
+    int makeLeaf(int index, int first, int count) {
+        nodes[index].first = first, nodes[index].count = count;
+        return index;
+    }
+};
+
+}
+
+void BVH::build(const std::vector<AABB>& boxes, Preset preset, ThreadPool* pool) {
+    clear();
+    if (boxes.empty()) return;
+
+    Builder builder(boxes, pool);
+    builder.build(preset);
+    const std::vector<BuildNode>& binary = builder.nodes;
+    _primitives = std::move(builder.primitives());
+
+    // Collapse the binary tree: the children of a node are the two binary children,
+    // then the inner child with the largest area is replaced by its own children, until there are 4.
+    // Nodes are created in depth-first order.
+    auto collapse = [&](const auto& self, int binaryIndex) -> int {
+        int children[WIDTH] = {binary[binaryIndex].left, binary[binaryIndex].right, -1, -1};
+        int nChildren = 2;
+        if (children[0] < 0) children[0] = binaryIndex, nChildren = 1; // the root is a leaf
+
+        while (nChildren < WIDTH) {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (int k = 0; k < nChildren; k++) {
+                const BuildNode& child = binary[children[k]];
+                if (child.left >= 0 && child.box.surfaceArea() > largestArea) largest = k, largestArea = child.box.surfaceArea();
+            }
+            if (largest < 0) break;
+
+            int opened = children[largest];
+            children[largest] = binary[opened].left;
+            children[nChildren++] = binary[opened].right;
+        }
+
+        int index = static_cast<int>(_nodes.size());
+        _nodes.emplace_back();
+        for (int k = 0; k < WIDTH; k++) {
+            _nodes[index].child[k] = -1, _nodes[index].count[k] = 0;
+            _nodes[index].setChildBox(k, AABB());
+        }
+
+        for (int k = 0; k < nChildren; k++) {
+            const BuildNode& child = binary[children[k]];
+            _nodes[index].setChildBox(k, child.box);
+            if (child.left < 0) {
+                _nodes[index].child[k] = child.first, _nodes[index].count[k] = child.count;
+            } else {
+                int childIndex = self(self, children[k]); // may reallocate _nodes
+                _nodes[index].child[k] = childIndex;
+            }
+        }
+        return index;
+    };
+
+    _nodes.reserve(binary.size() / 2 + 1);
+    collapse(collapse, 0);
+}
+
+AABB BVH::bounds() const {
+    AABB box;
+    if (isEmpty()) return box;
+    for (int k = 0; k < WIDTH; k++) {
+        if (!nodes()[0].isEmpty(k)) box.grow(nodes()[0].childBox(k));
+    }
+    return box;
+}
+
+void BVH::refit(const std::vector<AABB>& boxes) {
+    if (_file) { // the mapped tree is read only, copy it
+        _nodes.assign(_mappedNodes.begin(), _mappedNodes.end());
+        _primitives.assign(_mappedPrimitives.begin(), _mappedPrimitives.end());
+        _file.reset();
+    }
+
+    // children come after their parent, so going backwards they are always up to date
+    for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; n--) {
+        Node& node = _nodes[n];
+        for (int k = 0; k < WIDTH; k++) {
+            if (node.isEmpty(k)) continue;
+            AABB box;
+            if (node.isLeaf(k)) {
+                for (int p = node.child[k]; p < node.child[k] + node.count[k]; p++) box.grow(boxes[_primitives[p]]);
+            } else {
+                const Node& child = _nodes[node.child[k]];
+                for (int c = 0; c < WIDTH; c++) {
+                    if (!child.isEmpty(c)) box.grow(child.childBox(c));
+                }
+            }
+            node.setChildBox(k, box);
+        }
+    }
+}
+
+uint64_t BVH::key(const std::vector<AABB>& boxes, Preset preset) {
+    // FNV-1a, on 32 bit words
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&](uint32_t word) { hash = (hash ^ word) * 0x100000001b3ull; };
+
+    add(CACHE_VERSION), add(static_cast<uint32_t>(preset)), add(MAX_LEAF_SIZE);
+    add(static_cast<uint32_t>(boxes.size()));
+    for (const AABB& box : boxes) {
+        add(std::bit_cast<uint32_t>(box.min.x)), add(std::bit_cast<uint32_t>(box.min.y)), add(std::bit_cast<uint32_t>(box.min.z));
+        add(std::bit_cast<uint32_t>(box.max.x)), add(std::bit_cast<uint32_t>(box.max.y)), add(std::bit_cast<uint32_t>(box.max.z));
+    }
+    return hash;
+}
+
+bool BVH::save(const std::string& path, uint64_t key) const {
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION, header.nodeSize = sizeof(Node);
+    header.key = key, header.nNodes = nodes().size(), header.nPrimitives = primitives().size();
+    header.sahCost = sahCost();
+
+    // written to another file first, so a file with the right name is always complete,
+    // with a name of its own, so that two processes saving the same tree don't write the same file
+    std::string temporary = temporaryPath(path);
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file) return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(nodes().data()), nodes().size_bytes());
+        file.write(reinterpret_cast<const char*>(primitives().data()), primitives().size_bytes());
+        if (!file) {
+            file.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename doesn't overwrite there
+#endif
+    std::error_code error; // replaces the old file at once on POSIX systems
+    std::filesystem::rename(temporary, path, error);
+    if (error) std::remove(temporary.c_str());
+    return !error;
+}
+
+bool BVH::load(const std::string& path, uint64_t key) {
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<const MappedFile>(path);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    CacheHeader header;
+    if (file->size() < sizeof(header)) return false;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION
+        || header.nodeSize != sizeof(Node) || header.key != key) return false;
+    if (header.nNodes > INT32_MAX || header.nPrimitives > INT32_MAX) return false;
+    if (file->size() != sizeof(header) + header.nNodes * sizeof(Node) + header.nPrimitives * sizeof(int)) return false;
+
+    // mmap gives page-aligned memory, so the nodes are aligned
+    const std::byte* data = file->data() + sizeof(header);
+    std::span<const Node> nodes(reinterpret_cast<const Node*>(data), header.nNodes);
+    std::span<const int> primitives(reinterpret_cast<const int*>(data + header.nNodes * sizeof(Node)), header.nPrimitives);
+    if (!isValidTree(nodes, primitives)) return false;
+
+    clear();
+    _mappedNodes = nodes;
+    _mappedPrimitives = primitives;
+    _mappedSahCost = header.sahCost;
+    _file = std::move(file);
+    return true;
+}
@@ -0,0 +1,181 @@
+#include "CompiledScene.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+#include "scenefile.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+template <typename Record>
+void writeRecords(std::ofstream& file, const std::vector<Record>& records) {
+    file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+}
+
+std::runtime_error corrupted(const std::string& path, const std::string& reason) {
+    return std::runtime_error("ERROR: compiled scene \"" + path + "\" is not valid: " + reason);
+}
+
+} // namespace
+
+void CompiledScene::save(const std::string& path) const {
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION, header.byteOrder = BYTE_ORDER_MARK;
+    header.nTextures = static_cast<uint32_t>(textures.size());
+    header.nMaterials = static_cast<uint32_t>(materials.size());
+    header.nGroups = static_cast<uint32_t>(groups.size());
+    header.nShapes = static_cast<uint32_t>(shapes.size());
+    header.nLights = static_cast<uint32_t>(lights.size());
+    header.stringBytes = static_cast<uint32_t>(strings.size());
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error("ERROR: impossible to write file \"" + path + "\"");
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(&camera), sizeof(camera));
+    writeRecords(file, textures);
+    writeRecords(file, materials);
+    writeRecords(file, groups);
+    writeRecords(file, shapes);
+    writeRecords(file, lights);
+    file.write(strings.data(), strings.size());
+    if (!file) throw std::runtime_error("ERROR: impossible to write file \"" + path + "\"");
+}
+
+bool CompiledScene::isCompiled(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void CompiledScene::load(const std::string& path, Scene& scene) {
+    MappedFile file(path);
+    const std::byte* data = file.data();
+
+    // the header, then the size of the file must match the counts in it
+    Header header;
+    if (file.size() < sizeof(Header)) throw corrupted(path, "too short");
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) throw corrupted(path, "not a compiled scene");
+    if (header.byteOrder != BYTE_ORDER_MARK) throw corrupted(path, "compiled on a machine with another byte order");
+    if (header.version != VERSION) throw corrupted(path, "compiled by another version, compile it again");
+
+    size_t offset = sizeof(Header);
+    auto table = [&](uint32_t count, size_t recordSize) {
+        const std::byte* start = data + offset;
+        offset += count * recordSize;
+        return start;
+    };
+    auto camera = reinterpret_cast<const CameraRecord*>(table(1, sizeof(CameraRecord)));
+    auto textures = reinterpret_cast<const TextureRecord*>(table(header.nTextures, sizeof(TextureRecord)));
+    auto materials = reinterpret_cast<const MaterialRecord*>(table(header.nMaterials, sizeof(MaterialRecord)));
+    auto groups = reinterpret_cast<const GroupRecord*>(table(header.nGroups, sizeof(GroupRecord)));
+    auto shapes = reinterpret_cast<const ShapeRecord*>(table(header.nShapes, sizeof(ShapeRecord)));
+    auto lights = reinterpret_cast<const LightRecord*>(table(header.nLights, sizeof(LightRecord)));
+    auto strings = reinterpret_cast<const char*>(table(header.stringBytes, 1));
+    if (offset != file.size()) throw corrupted(path, "wrong size");
+
+    auto string = [&](StringRef ref) {
+        if (static_cast<size_t>(ref.offset) + ref.length > header.stringBytes) throw corrupted(path, "string out of range");
+        return std::string(strings + ref.offset, ref.length);
+    };
+    auto index = [&](uint32_t i, uint32_t count, const char* what) {
+        if (i >= count) throw corrupted(path, std::string(what) + " index out of range");
+        return i;
+    };
+    auto color = [](const float* c) { return Color(c[0], c[1], c[2]); };
+
+    // the few objects shared by the shapes
+    std::vector<std::shared_ptr<Texture>> textureObjects(header.nTextures);
+    for (uint32_t i = 0; i < header.nTextures; i++) {
+        const TextureRecord& t = textures[i];
+        if (t.type == TextureType::Uniform) textureObjects[i] = std::make_shared<UniformTexture>(color(t.color1));
+        else if (t.type == TextureType::Checkered) textureObjects[i] = std::make_shared<CheckeredTexture>(color(t.color1), color(t.color2), t.steps);
+        else if (t.type == TextureType::Image) textureObjects[i] = std::make_shared<ImageTexture>(HDRImage::map(string(t.path)));
+        else throw corrupted(path, "unknown texture");
+    }
+
+    // materials with the same definition and different names are the same object, as when parsing
+    std::vector<std::shared_ptr<Material>> materialObjects(header.nMaterials);
+    std::map<std::tuple<MaterialType, uint32_t, uint32_t, float, float, float>, std::shared_ptr<Material>> definitions;
+    for (uint32_t i = 0; i < header.nMaterials; i++) {
+        const MaterialRecord& m = materials[i];
+        auto& material = definitions[{m.type, m.texture, m.emittedRadiance, m.blur, m.thresholdAngle, m.refractionIndex}];
+        if (material == nullptr) {
+            auto texture = textureObjects[index(m.texture, header.nTextures, "texture")];
+            auto emitted = textureObjects[index(m.emittedRadiance, header.nTextures, "texture")];
+            if (m.type == MaterialType::Diffuse) material = std::make_shared<DiffuseMaterial>(texture, emitted);
+            else if (m.type == MaterialType::Specular) material = std::make_shared<SpecularMaterial>(texture, emitted, m.blur, degToRad(m.thresholdAngle));
+            else if (m.type == MaterialType::Transparent) material = std::make_shared<TransparentMaterial>(texture, emitted, m.refractionIndex);
+            else throw corrupted(path, "unknown material");
+        }
+        materialObjects[i] = material;
+        scene.materials[string(m.name)] = material;
+    }
+
+    std::vector<std::shared_ptr<World>> groupObjects(header.nGroups);
+    for (uint32_t i = 0; i < header.nGroups; i++) {
+        groupObjects[i] = std::make_shared<World>();
+        groupObjects[i]->buildSettings = scene.world.buildSettings.forGroup(string(groups[i].name));
+        scene.groups[string(groups[i].name)] = groupObjects[i];
+    }
+
+    // shapes: the spheres, usually most of them, are allocated in a single block, or kept as compact records
+    size_t nSpheres = 0, nWorldShapes = 0, nWorldSpheres = 0;
+    for (uint32_t i = 0; i < header.nShapes; i++) {
+        nSpheres += shapes[i].type == ShapeType::Sphere;
+        nWorldShapes += shapes[i].owner == 0;
+        nWorldSpheres += shapes[i].owner == 0 && shapes[i].type == ShapeType::Sphere;
+    }
+    bool compact = scene.world.buildSettings.compactShapes;
+    auto spheres = std::make_shared<std::vector<Sphere>>();
+    if (!compact) spheres->reserve(nSpheres);
+    scene.world.reserve(nWorldShapes, nWorldSpheres);
+
+    std::unique_ptr<ThreadPool> pool; // for the BVHs of the meshes
+    for (uint32_t i = 0; i < header.nShapes; i++) {
+        const ShapeRecord& s = shapes[i];
+        World& owner = (s.owner == 0) ? scene.world : *groupObjects[index(s.owner - 1, header.nGroups, "group")];
+        Transformation transformation(s.matrix, s.inverse);
+
+        if (s.type == ShapeType::Sphere && compact) {
+            owner.addSphere(materialObjects[index(s.reference, header.nMaterials, "material")], transformation);
+        } else if (s.type == ShapeType::Sphere) {
+            spheres->emplace_back(materialObjects[index(s.reference, header.nMaterials, "material")], transformation);
+            owner.addShape(std::shared_ptr<Shape>(spheres, &spheres->back()));
+        } else if (s.type == ShapeType::Plane) {
+            owner.addShape(std::make_shared<Plane>(materialObjects[index(s.reference, header.nMaterials, "material")], transformation));
+        } else if (s.type == ShapeType::Mesh) {
+            if (pool == nullptr && scene.world.buildSettings.nThreads != 1) pool = std::make_unique<ThreadPool>(scene.world.buildSettings.nThreads);
+            owner.addShape(std::make_shared<TriangleMesh>(materialObjects[index(s.reference, header.nMaterials, "material")],
+                                                          readMesh(string(s.path)), transformation, pool.get()));
+        } else if (s.type == ShapeType::Instance) {
+            // groups can only contain instances of the ones defined before them
+            uint32_t group = index(s.reference, s.owner == 0 ? header.nGroups : s.owner - 1, "group");
+            if (!groupObjects[group]->isBuilt()) groupObjects[group]->build(); // its shapes are all before the first instance
+            owner.addShape(std::make_shared<Instance>(groupObjects[group], transformation));
+        } else {
+            throw corrupted(path, "unknown shape");
+        }
+    }
+    for (auto& group : groupObjects) {
+        if (!group->isBuilt()) group->build();
+    }
+
+    for (uint32_t i = 0; i < header.nLights; i++) {
+        const LightRecord& l = lights[i];
+        scene.world.addLight(PointLight(Point3(l.position[0], l.position[1], l.position[2]), color(l.color), l.radius));
+    }
+
+    if (camera->type != CameraType::None) {
+        scene.camera = std::make_shared<Camera>(camera->type == CameraType::Perspective ? "perspective" : "orthogonal", camera->aspectRatio,
+                                                camera->imageWidth, camera->distance, Transformation(camera->matrix, camera->inverse));
+    }
+
+    if (scene.buildWorld) scene.world.build();
+}
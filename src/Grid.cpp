@@ -0,0 +1,73 @@
+#include "Grid.hpp"
+
+#include <cmath>
+
+void Grid::build(const std::vector<AABB>& boxes, float density) {
+    clear();
+    if (boxes.empty()) return;
+
+    for (const AABB& box : boxes) _box.grow(box);
+
+    // a few huge primitives are tested apart, the cells are made for the others
+    float sceneDiagonal = _box.extent().norm();
+    for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+        if (boxes[i].extent().norm() > LARGE_FRACTION * sceneDiagonal) _large.push_back(i);
+    }
+    if (static_cast<int>(_large.size()) > MAX_LARGE || _large.size() == boxes.size()) _large.clear();
+    std::vector<bool> isLarge(boxes.size(), false);
+    if (!_large.empty()) {
+        _box = AABB();
+        for (int i : _large) isLarge[i] = true;
+        for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+            if (!isLarge[i]) _box.grow(boxes[i]);
+        }
+    }
+    int nCelled = static_cast<int>(boxes.size() - _large.size());
+
+    // flat scenes (all the primitives on a plane) still need cells with some thickness
+    Vec3 extent = _box.extent();
+    float largest = std::max({extent.x, extent.y, extent.z, 1e-6f});
+    float minimum = 1e-3f * largest;
+    _box.grow(_box.min + Vec3(std::max(extent.x, minimum), std::max(extent.y, minimum), std::max(extent.z, minimum)));
+    extent = _box.extent();
+
+    // cubic cells, about density * nCelled of them
+    const float sides[3] = {extent.x, extent.y, extent.z};
+    float cellsPerUnit = std::cbrt(density * nCelled / (sides[0] * sides[1] * sides[2]));
+    for (int axis = 0; axis < 3; axis++) {
+        _resolution[axis] = std::clamp(static_cast<int>(std::ceil(sides[axis] * cellsPerUnit)), 1, MAX_RESOLUTION);
+        _cellSize[axis] = sides[axis] / _resolution[axis];
+    }
+
+    // the cells overlapped by a box, from low to high included
+    const float origin[3] = {_box.min.x, _box.min.y, _box.min.z};
+    auto range = [&](const AABB& box, int* low, int* high) {
+        const float boxMin[3] = {box.min.x, box.min.y, box.min.z}, boxMax[3] = {box.max.x, box.max.y, box.max.z};
+        for (int axis = 0; axis < 3; axis++) {
+            low[axis] = std::clamp(static_cast<int>((boxMin[axis] - origin[axis]) / _cellSize[axis]), 0, _resolution[axis] - 1);
+            high[axis] = std::clamp(static_cast<int>((boxMax[axis] - origin[axis]) / _cellSize[axis]), 0, _resolution[axis] - 1);
+        }
+    };
+    auto forCells = [&](const AABB& box, auto function) {
+        int low[3], high[3];
+        range(box, low, high);
+        for (int z = low[2]; z <= high[2]; z++) {
+            for (int y = low[1]; y <= high[1]; y++) {
+                for (int x = low[0]; x <= high[0]; x++) function(x + _resolution[0] * (y + _resolution[1] * z));
+            }
+        }
+    };
+
+    // count the primitives of every cell, then place them: the same order as the boxes inside a cell
+    _cellStart.assign(nCells() + 1, 0);
+    for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+        if (!isLarge[i]) forCells(boxes[i], [&](int cell) { _cellStart[cell + 1]++; });
+    }
+    for (int c = 0; c < nCells(); c++) _cellStart[c + 1] += _cellStart[c];
+
+    _primitives.resize(_cellStart.back());
+    std::vector<int> next(_cellStart.begin(), _cellStart.end() - 1);
+    for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+        if (!isLarge[i]) forCells(boxes[i], [&](int cell) { _primitives[next[cell]++] = i; });
+    }
+}
@@ -1,16 +1,44 @@
 #include "HDRImage.hpp"
-#define STB_IMAGE_WRITE_IMPLEMENTATION // needed ONCE for stb
-#include "stb_image_write.h"
+#include "MappedFile.hpp"
+#include "ImageWriter.hpp"
+#include "ThreadPool.hpp"
+#include "simd.hpp"
+#include "utils.hpp"
 
-float HDRImage::averageLuminosity(float delta) {
-    float sum = 0.0f;
-    for (const Color& pixel : _pixels) {
-        sum += std::log10(pixel.luminosity() + delta);
-    }
+#include <algorithm>
+#include <sstream>
+#include <array>
+#include <bit>
+#include <numeric>
+#include <exception>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace {
+
+// calls function(begin, end) on chunks of rows, in parallel if there is a pool
+template <typename Function>
+void forRows(ThreadPool* pool, int first, int last, int chunk, const Function& function) {
+    if (pool == nullptr) function(first, last);
+    else pool->parallelFor(first, last, chunk, function);
+}
+
+} // namespace
+
+float HDRImage::averageLuminosity(float delta, ThreadPool* pool) const {
+    // one partial sum per chunk of 16 rows, added in order so the result doesn't depend on the threads
+    constexpr int CHUNK = 16;
+    std::vector<double> partials((_height + CHUNK - 1) / CHUNK, 0.0);
+    forRows(pool, 0, _height, CHUNK, [&](int begin, int end) {
+        for (int j = begin; j < end; j++) partials[j / CHUNK] += sumLogLuminosity(row(j), _width, delta);
+    });
 
-    sum /= _pixels.size();
+    double sum = std::accumulate(partials.begin(), partials.end(), 0.0);
+    sum /= static_cast<double>(_width) * _height;
 
-    return std::pow(10.0f, sum);
+    return static_cast<float>(std::pow(10.0, sum));
 }
 
 void HDRImage::normalize(float a, float luminosity) {
@@ -21,12 +49,13 @@ void HDRImage::normalize(float a, float luminosity) {
     // calculate the scale factor
     float scale = a / luminosity;
 
+    detach();
     for (Color& pixel: _pixels) {
         pixel = pixel * scale;
     }
 }
 
-void HDRImage::readPFM(std::istream& input) {
+Endianness HDRImage::readPFMHeader(std::istream& input) {
     // magic
     std::string magic = readLine(input);
     if (magic != "PF") {
@@ -38,45 +67,365 @@ void HDRImage::readPFM(std::istream& input) {
     _width = width, _height = height;
 
     // endianness
-    auto endianness = parseEndianness(readLine(input));
-    
-    // fill the image
-    _pixels = std::vector<Color>(_width * _height);
+    return parseEndianness(readLine(input));
+}
+
+void HDRImage::readImage(std::istream& input) {
+    int first = input.peek();
+    if (first == '#') readRGBE(input);
+    else if (first == 0x76) readEXR(input);
+    else readPFM(input); // fails on the magic string for unknown formats
+}
+
+void HDRImage::readStandardInput() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    readImage(std::cin);
+}
+
+void HDRImage::readPFM(std::istream& input) {
+    auto endianness = readPFMHeader(input);
+    _file.reset(), _mappedPixels = nullptr;
+
+    // fill the image, one read per row straight into the pixels, starting from the bottom row as in the file
+    static_assert(sizeof(Color) == 3 * sizeof(float), "pixels are read as arrays of floats");
+    _pixels = std::vector<Color>(static_cast<size_t>(_width) * _height);
     for (int j = _height - 1; j >= 0; j--) {
+        readFloats(input, reinterpret_cast<float*>(&_pixels[pixelIndex(0, j)]), 3 * static_cast<size_t>(_width), endianness);
+    }
+}
+
+namespace {
+
+void readBytes(std::streambuf& buffer, void* data, size_t size) {
+    auto read = buffer.sgetn(static_cast<char*>(data), static_cast<std::streamsize>(size));
+    if (read != static_cast<std::streamsize>(size)) {
+        throw std::runtime_error("ERROR: impossible to read " + std::to_string(size) + " bytes, only " + std::to_string(read) + " available");
+    }
+}
+
+uint8_t readByte(std::streambuf& buffer) {
+    int byte = buffer.sbumpc();
+    if (byte == std::char_traits<char>::eof()) throw std::runtime_error("ERROR: impossible to read 1 byte, the file ended");
+    return static_cast<uint8_t>(byte);
+}
+
+uint32_t readLittleEndian32(std::streambuf& buffer) {
+    uint8_t bytes[4];
+    readBytes(buffer, bytes, 4);
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+// the names in OpenEXR headers end with a 0 and have at most 255 characters
+std::string readName(std::streambuf& buffer) {
+    std::string name;
+    for (uint8_t c = readByte(buffer); c != 0; c = readByte(buffer)) {
+        name.push_back(static_cast<char>(c));
+        if (name.size() > 255) throw std::invalid_argument("ERROR: invalid OpenEXR header");
+    }
+    return name;
+}
+
+// one row of RGBE pixels, interleaved
+void readRGBERow(std::streambuf& buffer, uint8_t* rgbe, int width) {
+    readBytes(buffer, rgbe, 4);
+    if (width >= 8 && width < 32768 && rgbe[0] == 2 && rgbe[1] == 2 && (rgbe[2] & 0x80) == 0) {
+        // the four components one after the other, in runs (128 + length, value) and dumps (length, values)
+        if ((rgbe[2] << 8 | rgbe[3]) != width) throw std::invalid_argument("ERROR: RGBE row of the wrong length");
+        std::vector<uint8_t> planes(4 * static_cast<size_t>(width));
+        for (int c = 0; c < 4; c++) {
+            uint8_t* plane = &planes[static_cast<size_t>(c) * width];
+            for (int i = 0; i < width;) {
+                int count = readByte(buffer);
+                bool run = count > 128;
+                if (run) count -= 128;
+                if (count == 0 || i + count > width) throw std::invalid_argument("ERROR: invalid run-length encoding of an RGBE row");
+                if (run) std::memset(plane + i, readByte(buffer), count);
+                else readBytes(buffer, plane + i, count);
+                i += count;
+            }
+        }
+        for (int i = 0; i < width; i++) {
+            for (int c = 0; c < 4; c++) rgbe[4 * i + c] = planes[static_cast<size_t>(c) * width + i];
+        }
+        return;
+    }
+
+    // flat pixels, where (1, 1, 1, n) repeats the previous one n times, shifted by 8 bits for each repetition before
+    int shift = 0;
+    for (int i = 1; i < width;) {
+        uint8_t* pixel = rgbe + 4 * i;
+        readBytes(buffer, pixel, 4);
+        if (pixel[0] == 1 && pixel[1] == 1 && pixel[2] == 1) {
+            size_t count = static_cast<size_t>(pixel[3]) << shift;
+            if (i + count > static_cast<size_t>(width)) throw std::invalid_argument("ERROR: invalid run-length encoding of an RGBE row");
+            for (size_t k = 0; k < count; k++, i++) std::memcpy(rgbe + 4 * i, rgbe + 4 * (i - 1), 4);
+            shift += 8;
+        } else {
+            i++, shift = 0;
+        }
+    }
+}
+
+} // namespace
+
+void HDRImage::readRGBE(std::istream& input) {
+    // the header lines end with an empty one, then the resolution line
+    if (readLine(input).rfind("#?", 0) != 0) throw std::invalid_argument("ERROR: invalid RGBE file, it must start with \"#?\"");
+    for (std::string line = readLine(input); !line.empty(); line = readLine(input)) {
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+            throw std::invalid_argument("ERROR: unsupported RGBE format \"" + line.substr(7) + "\"");
+        }
+    }
+    std::string resolution = readLine(input), y, x;
+    std::istringstream stream(resolution);
+    int width = 0, height = 0;
+    if (!(stream >> y >> height >> x >> width) || (y != "-Y" && y != "+Y") || x != "+X" || width <= 0 || height <= 0) {
+        throw std::invalid_argument("ERROR: unsupported RGBE resolution \"" + resolution + "\"");
+    }
+    _width = width, _height = height;
+    _file.reset(), _mappedPixels = nullptr;
+
+    // 2^(exponent - 128) / 256 for each exponent, 0 is black
+    static const auto scales = []() {
+        std::array<float, 256> scales{};
+        for (int e = 1; e < 256; e++) scales[e] = std::ldexp(1.0f, e - 136);
+        return scales;
+    }();
+
+    std::streambuf& buffer = *input.rdbuf(); // read a byte at a time in the run-length encoded rows
+    _pixels = std::vector<Color>(static_cast<size_t>(_width) * _height);
+    std::vector<uint8_t> rgbe(4 * static_cast<size_t>(_width));
+    for (int row = 0; row < _height; row++) {
+        readRGBERow(buffer, rgbe.data(), _width);
+        Color* pixels = &_pixels[pixelIndex(0, y == "-Y" ? row : _height - 1 - row)];
         for (int i = 0; i < _width; i++) {
-            float r = readFloat(input, endianness), g = readFloat(input, endianness), b = readFloat(input, endianness);
-            setPixel(i, j, Color(r, g, b)); // readFloat can't be called inside the constructor because r, g, b are not evaluated in order
+            float scale = scales[rgbe[4 * i + 3]];
+            pixels[i] = Color(rgbe[4 * i] * scale, rgbe[4 * i + 1] * scale, rgbe[4 * i + 2] * scale);
         }
     }
 }
 
-std::vector<uint8_t> HDRImage::pixelsToLDR(float gamma) {
-    int length = _width * _height;
-    std::vector<uint8_t> data(3 * length);
-    float invGamma = 1.0f / gamma;
-    
-    for (int i = 0; i < length; i++) {
-        data[3 * i] = (255 * std::pow(_pixels[i].r, invGamma));
-        data[3 * i + 1] = (255 * std::pow(_pixels[i].g, invGamma));
-        data[3 * i + 2] = (255 * std::pow(_pixels[i].b, invGamma));
+void HDRImage::readEXR(std::istream& input) {
+    std::streambuf& buffer = *input.rdbuf();
+    if (readLittleEndian32(buffer) != 20000630) throw std::invalid_argument("ERROR: invalid OpenEXR magic number");
+    uint32_t version = readLittleEndian32(buffer);
+    if ((version & 0xff) != 2 || (version & 0x1a00) != 0) { // tiled, deep or multi-part
+        throw std::invalid_argument("ERROR: only single part scan line OpenEXR files are supported");
     }
 
-    return data;
+    // the attributes until an empty name, only the channels, the compression and the data window are used
+    enum : uint32_t { UINT = 0, HALF = 1, FLOAT = 2 };
+    struct Channel { std::string name; uint32_t type; };
+    std::vector<Channel> channels;
+    int compression = -1;
+    int32_t window[4] = {0, 0, -1, -1};
+    for (std::string name = readName(buffer); !name.empty(); name = readName(buffer)) {
+        std::string type = readName(buffer);
+        uint32_t size = readLittleEndian32(buffer);
+        if (size > (1u << 24)) throw std::invalid_argument("ERROR: invalid OpenEXR header");
+        std::vector<uint8_t> value(size);
+        readBytes(buffer, value.data(), size);
+        auto word = [&](size_t position) {
+            if (position + 4 > value.size()) throw std::invalid_argument("ERROR: invalid OpenEXR attribute \"" + name + "\"");
+            return value[position] | value[position + 1] << 8 | value[position + 2] << 16 | static_cast<uint32_t>(value[position + 3]) << 24;
+        };
+
+        if (name == "channels") {
+            for (size_t position = 0; position < value.size() && value[position] != 0;) {
+                size_t end = std::find(value.begin() + position, value.end(), 0) - value.begin();
+                Channel channel{std::string(value.begin() + position, value.begin() + end), word(end + 1)};
+                if (channel.type > FLOAT || word(end + 9) != 1 || word(end + 13) != 1) {
+                    throw std::invalid_argument("ERROR: unsupported OpenEXR channel \"" + channel.name + "\"");
+                }
+                channels.push_back(channel);
+                position = end + 17;
+            }
+        } else if (name == "compression" && size == 1) {
+            compression = value[0];
+        } else if (name == "dataWindow") {
+            for (int k = 0; k < 4; k++) window[k] = static_cast<int32_t>(word(4 * k));
+        }
+    }
+    if (compression != 0) throw std::invalid_argument("ERROR: compressed OpenEXR files are not supported");
+    if (window[2] < window[0] || window[3] < window[1]) throw std::invalid_argument("ERROR: invalid OpenEXR data window");
+    _width = window[2] - window[0] + 1, _height = window[3] - window[1] + 1;
+    _file.reset(), _mappedPixels = nullptr;
+
+    // the offsets of the rows, not needed since they come in order after them
+    std::vector<uint8_t> offsets(8 * static_cast<size_t>(_height));
+    readBytes(buffer, offsets.data(), offsets.size());
+
+    // each row: its y, the size of its data, then each channel in the order of the list
+    size_t width = static_cast<size_t>(_width), rowBytes = 0;
+    for (const Channel& channel : channels) rowBytes += width * (channel.type == HALF ? 2 : 4);
+    _pixels = std::vector<Color>(width * _height);
+    std::vector<uint8_t> data(rowBytes);
+    std::vector<uint16_t> halves(width);
+    std::vector<float> values(width);
+    for (int row = 0; row < _height; row++) {
+        int j = static_cast<int32_t>(readLittleEndian32(buffer)) - window[1];
+        if (j < 0 || j >= _height || readLittleEndian32(buffer) != rowBytes) throw std::invalid_argument("ERROR: invalid OpenEXR row");
+        readBytes(buffer, data.data(), rowBytes);
+
+        const uint8_t* channelData = data.data();
+        for (const Channel& channel : channels) {
+            size_t bytes = width * (channel.type == HALF ? 2 : 4);
+            int component = channel.name == "R" ? 0 : channel.name == "G" ? 1 : channel.name == "B" ? 2 : -1;
+            if (component >= 0) {
+                if (channel.type == HALF) {
+                    std::memcpy(halves.data(), channelData, bytes);
+                    if constexpr (NATIVE_ENDIANNESS == Endianness::BIG) {
+                        for (uint16_t& half : halves) half = static_cast<uint16_t>(half << 8 | half >> 8);
+                    }
+                    halvesToFloats(halves.data(), width, values.data());
+                } else {
+                    std::memcpy(values.data(), channelData, bytes);
+                    if (NATIVE_ENDIANNESS == Endianness::BIG) swapBytes32(values.data(), width);
+                    if (channel.type == UINT) {
+                        for (float& value : values) value = static_cast<float>(std::bit_cast<uint32_t>(value));
+                    }
+                }
+                float* pixels = reinterpret_cast<float*>(&_pixels[pixelIndex(0, j)]);
+                for (size_t i = 0; i < width; i++) pixels[3 * i + component] = values[i];
+            }
+            channelData += bytes;
+        }
+    }
+}
+
+HDRImage HDRImage::map(const std::string& fileName) {
+    if (fileName == "-") return HDRImage(fileName);
+    HDRImage image;
+    auto file = std::make_shared<const MappedFile>(fileName);
+    if (file->size() < 2 || std::memcmp(file->data(), "PF", 2) != 0) return HDRImage(fileName);
+
+    // the header is three short lines
+    std::istringstream header(std::string(reinterpret_cast<const char*>(file->data()), std::min<size_t>(file->size(), 256)));
+    auto endianness = image.readPFMHeader(header);
+    if (endianness != NATIVE_ENDIANNESS) return HDRImage(fileName);
+
+    auto position = header.tellg(); // -1 if the header is the whole file
+    size_t offset = position < 0 ? header.str().size() : static_cast<size_t>(position);
+    size_t bytes = sizeof(Color) * static_cast<size_t>(image._width) * image._height;
+    if (file->size() - offset < bytes) {
+        throw std::runtime_error("ERROR: file \"" + fileName + "\" has " + std::to_string(file->size() - offset)
+                                 + " bytes of pixels, " + std::to_string(bytes) + " expected");
+    }
+
+    image._mappedPixels = file->data() + offset;
+    image._file = std::move(file);
+    return image;
+}
+
+void HDRImage::prefetch() const {
+    if (_file != nullptr) _file->prefetch();
+}
+
+void HDRImage::detach() {
+    if (_mappedPixels == nullptr) return;
+
+    std::vector<Color> pixels(static_cast<size_t>(_width) * _height);
+    for (int j = 0; j < _height; j++) {
+        std::memcpy(&pixels[pixelIndex(0, j)], mappedRow(j), sizeof(Color) * _width);
+    }
+    _pixels = std::move(pixels);
+    _file.reset(), _mappedPixels = nullptr;
+}
+
+void HDRImage::writeStrips(const std::vector<Output>& outputs, ThreadPool* pool) const {
+    // opening a file truncates it: if it's the mapped one, its pages would disappear while they are read,
+    // so it's written to a temporary file with the same extension and a unique name, renamed over it at the end
+    std::vector<std::string> temporaryFiles(outputs.size());
+    for (size_t t = 0; t < outputs.size(); t++) {
+        std::error_code error;
+        if (_file != nullptr && outputs[t].fileName != "-" && std::filesystem::equivalent(outputs[t].fileName, _file->path(), error)) {
+            temporaryFiles[t] = temporaryPath(outputs[t].fileName);
+        }
+    }
+
+    std::vector<std::unique_ptr<ImageWriter>> writers;
+    try {
+        int stripHeight = 1; // of all the writers
+        for (size_t t = 0; t < outputs.size(); t++) {
+            writers.push_back(ImageWriter::open(temporaryFiles[t].empty() ? outputs[t].fileName : temporaryFiles[t], _width, _height));
+            stripHeight = std::lcm(stripHeight, writers.back()->stripHeight());
+        }
+
+        // a strip for each thread, encoded at the same time
+        int batchHeight = std::min(stripHeight * (pool != nullptr ? pool->size() : 1), _height);
+        std::vector<std::vector<Color>> colors(outputs.size());
+        std::vector<std::vector<uint8_t>> bytes(outputs.size());
+        for (size_t t = 0; t < outputs.size(); t++) {
+            if (writers[t]->lowDynamicRange()) bytes[t].resize(3 * static_cast<size_t>(batchHeight) * _width);
+            else colors[t].resize(static_cast<size_t>(batchHeight) * _width);
+        }
+        std::vector<std::exception_ptr> errors(outputs.size());
+
+        for (int first = 0; first < _height; first += batchHeight) {
+            int nRows = std::min(batchHeight, _height - first);
+            forRows(pool, 0, nRows, 4, [&](int begin, int end) {
+                for (int k = begin; k < end; k++) {
+                    size_t index = static_cast<size_t>(k) * _width;
+                    for (size_t t = 0; t < outputs.size(); t++) {
+                        const Output& output = outputs[t];
+                        int j = writers[t]->bottomUp() ? _height - 1 - (first + k) : first + k;
+                        if (writers[t]->lowDynamicRange()) {
+                            toneMap(row(j), 3 * static_cast<size_t>(_width), output.scale, output.clamp, 1.0f / output.gamma, &bytes[t][3 * index]);
+                            continue;
+                        }
+                        for (int i = 0; i < _width; i++) {
+                            Color color = pixel(i, j) * output.scale;
+                            if (output.clamp) color = Color(::clamp(color.r), ::clamp(color.g), ::clamp(color.b));
+                            colors[t][index + i] = color;
+                        }
+                    }
+                }
+            });
+
+            // the errors are thrown from this thread
+            forRows(pool, 0, static_cast<int>(outputs.size()), 1, [&](int begin, int end) {
+                for (int t = begin; t < end; t++) {
+                    try {
+                        writers[t]->write(writers[t]->lowDynamicRange() ? static_cast<const void*>(bytes[t].data()) : colors[t].data(), nRows, pool);
+                    } catch (...) {
+                        errors[t] = std::current_exception();
+                    }
+                }
+            });
+            for (const auto& error : errors) {
+                if (error) std::rethrow_exception(error);
+            }
+        }
+        for (size_t t = 0; t < outputs.size(); t++) {
+            writers[t]->finish();
+            if (!temporaryFiles[t].empty()) std::filesystem::rename(temporaryFiles[t], outputs[t].fileName);
+        }
+    } catch (...) {
+        // the other outputs are left as far as they were written, the temporary files are removed
+        writers.clear();
+        for (const std::string& temporary : temporaryFiles) {
+            std::error_code error;
+            if (!temporary.empty()) std::filesystem::remove(temporary, error);
+        }
+        throw;
+    }
 }
 
 void HDRImage::writePFM(std::string fileName) {
+    detach(); // opening the file truncates it, if it's the mapped one its pages would disappear
     std::ofstream output(fileName, std::ios::binary);
+    if (output.fail()) throw std::runtime_error("ERROR: impossible to write file \"" + fileName + "\"");
 
     // write header, always little endian
     output << "PF\n" << _width << " " << _height << "\n-1.0\n";
 
-    // write pixels
+    // write pixels, one row at a time straight from memory, starting from the bottom one
     for (int j = _height - 1; j >= 0; j--) {
-        for (int i = 0; i < _width; i++) {
-            auto pixel = getPixel(i, j);
-            writeFloat(output, pixel.r, Endianness::LITTLE);
-            writeFloat(output, pixel.g, Endianness::LITTLE);
-            writeFloat(output, pixel.b, Endianness::LITTLE);
-        }
+        writeFloats(output, reinterpret_cast<const float*>(&_pixels[pixelIndex(0, j)]), 3 * static_cast<size_t>(_width), Endianness::LITTLE);
     }
+
+    output.flush();
+    if (output.fail()) throw std::runtime_error("ERROR: impossible to write file \"" + fileName + "\"");
 }
\ No newline at end of file
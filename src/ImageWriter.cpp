@@ -0,0 +1,508 @@
+#include "ImageWriter.hpp"
+
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <bit>
+#include <exception>
+#include <iostream>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "PFMReader.hpp"
+#include "ThreadPool.hpp"
+#include "simd.hpp"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION // needed ONCE for stb, the PNG writer uses its internals
+#include "stb_image_write.h"
+
+namespace {
+
+// initialized after std::cout, before main can redirect it
+std::streambuf* standardOutput = std::cout.rdbuf();
+
+// about 256 KB of 8-bit pixels, a multiple of the 16 rows of the biggest JPEG blocks
+int defaultStripHeight(int width) {
+    int rows = (1 << 18) / (3 * width);
+    return std::max(16, (rows + 15) / 16 * 16);
+}
+
+void putBigEndian32(std::vector<unsigned char>& data, size_t position, uint32_t value) {
+    for (int k = 0; k < 4; k++) data[position + k] = static_cast<unsigned char>(value >> (24 - 8 * k));
+}
+
+// integers of size bytes, as OpenEXR stores them on every machine
+void appendLittleEndian(std::vector<unsigned char>& data, uint64_t value, int size) {
+    for (int k = 0; k < size; k++) data.push_back(static_cast<unsigned char>(value >> (8 * k)));
+}
+
+// Adler-32 of the data alone, in blocks short enough for the sums not to overflow before the modulo
+uint32_t adler32(const unsigned char* data, size_t size) {
+    uint32_t sum1 = 1, sum2 = 0;
+    while (size > 0) {
+        size_t block = std::min<size_t>(size, 5552);
+        for (size_t k = 0; k < block; k++) sum1 += data[k], sum2 += sum1;
+        sum1 %= 65521, sum2 %= 65521;
+        data += block, size -= block;
+    }
+    return sum2 << 16 | sum1;
+}
+
+// Adler-32 of two pieces of data one after the other, from the ones of each, as adler32_combine in zlib
+uint32_t combineAdler32(uint32_t first, uint32_t second, size_t secondSize) {
+    const uint32_t base = 65521;
+    uint32_t remainder = static_cast<uint32_t>(secondSize % base);
+    uint32_t sum1 = first & 0xffff;
+    uint32_t sum2 = remainder * sum1 % base;
+    sum1 += (second & 0xffff) + base - 1;
+    sum2 += (first >> 16) + (second >> 16) + base - remainder;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= 2 * base) sum2 -= 2 * base;
+    if (sum2 >= base) sum2 -= base;
+    return sum2 << 16 | sum1;
+}
+
+void appendBytes(void* context, void* data, int size) {
+    auto bytes = static_cast<unsigned char*>(data);
+    static_cast<std::vector<unsigned char>*>(context)->insert(static_cast<std::vector<unsigned char>*>(context)->end(), bytes, bytes + size);
+}
+
+// stbi_zlib_compress without the zlib header and checksum, for one strip of a longer stream: the last strip
+// ends the stream, the others end with an empty stored block, so that the next one starts on a byte
+void deflateStrip(unsigned char* data, int data_len, bool last, std::vector<unsigned char>& result) {
+    static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+    static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+    static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+    static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+    unsigned int bitbuf = 0;
+    int i, j, bitcount = 0;
+    unsigned char* out = NULL;
+    std::vector<unsigned char**> hash_table(stbiw__ZHASH, nullptr);
+    int quality = std::max(stbi_write_png_compression_level, 5);
+
+    stbiw__zlib_add(last ? 1 : 0, 1); // BFINAL
+    stbiw__zlib_add(1, 2);            // BTYPE = 1 -- fixed huffman
+
+    i = 0;
+    while (i < data_len - 3) {
+        // hash next 3 bytes of data to be compressed
+        int h = stbiw__zhash(data + i) & (stbiw__ZHASH - 1), best = 3;
+        unsigned char* bestloc = 0;
+        unsigned char** hlist = hash_table[h];
+        int n = stbiw__sbcount(hlist);
+        for (j = 0; j < n; ++j) {
+            if (hlist[j] - data > i - 32768) { // if entry lies within window
+                int d = stbiw__zlib_countm(hlist[j], data + i, data_len - i);
+                if (d >= best) { best = d; bestloc = hlist[j]; }
+            }
+        }
+        // when hash table entry is too long, delete half the entries
+        if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2 * quality) {
+            STBIW_MEMMOVE(hash_table[h], hash_table[h] + quality, sizeof(hash_table[h][0]) * quality);
+            stbiw__sbn(hash_table[h]) = quality;
+        }
+        stbiw__sbpush(hash_table[h], data + i);
+
+        if (bestloc) {
+            // "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
+            h = stbiw__zhash(data + i + 1) & (stbiw__ZHASH - 1);
+            hlist = hash_table[h];
+            n = stbiw__sbcount(hlist);
+            for (j = 0; j < n; ++j) {
+                if (hlist[j] - data > i - 32767) {
+                    int e = stbiw__zlib_countm(hlist[j], data + i + 1, data_len - i - 1);
+                    if (e > best) { // if next match is better, bail on current match
+                        bestloc = NULL;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (bestloc) {
+            int d = (int) (data + i - bestloc); // distance back
+            for (j = 0; best > lengthc[j + 1] - 1; ++j);
+            stbiw__zlib_huff(j + 257);
+            if (lengtheb[j]) stbiw__zlib_add(best - lengthc[j], lengtheb[j]);
+            for (j = 0; d > distc[j + 1] - 1; ++j);
+            stbiw__zlib_add(stbiw__zlib_bitrev(j, 5), 5);
+            if (disteb[j]) stbiw__zlib_add(d - distc[j], disteb[j]);
+            i += best;
+        } else {
+            stbiw__zlib_huffb(data[i]);
+            ++i;
+        }
+    }
+    // write out final bytes
+    for (; i < data_len; ++i) stbiw__zlib_huffb(data[i]);
+    stbiw__zlib_huff(256); // end of block
+    if (!last) { // header of an empty stored block, its length comes after the padding
+        stbiw__zlib_add(0, 1);
+        stbiw__zlib_add(0, 2);
+    }
+    // pad with 0 bits to byte boundary
+    while (bitcount) stbiw__zlib_add(0, 1);
+    if (!last) {
+        stbiw__sbpush(out, 0x00), stbiw__sbpush(out, 0x00); // LEN
+        stbiw__sbpush(out, 0xff), stbiw__sbpush(out, 0xff); // NLEN
+    }
+
+    for (auto& list : hash_table) (void) stbiw__sbfree(list);
+
+    // store uncompressed instead if compression was worse, stored blocks end on a byte
+    if (stbiw__sbn(out) > data_len + ((data_len + 32766) / 32767) * 5) {
+        stbiw__sbn(out) = 0;
+        for (j = 0; j < data_len;) {
+            int blocklen = std::min(data_len - j, 32767);
+            stbiw__sbpush(out, last && data_len - j == blocklen); // BFINAL = ?, BTYPE = 0 -- no compression
+            stbiw__sbpush(out, STBIW_UCHAR(blocklen)); // LEN
+            stbiw__sbpush(out, STBIW_UCHAR(blocklen >> 8));
+            stbiw__sbpush(out, STBIW_UCHAR(~blocklen)); // NLEN
+            stbiw__sbpush(out, STBIW_UCHAR(~blocklen >> 8));
+            result.insert(result.end(), out, out + stbiw__sbn(out));
+            result.insert(result.end(), data + j, data + j + blocklen);
+            stbiw__sbn(out) = 0;
+            j += blocklen;
+        }
+    } else {
+        result.insert(result.end(), out, out + stbiw__sbn(out));
+    }
+    (void) stbiw__sbfree(out);
+}
+
+class PFMWriter : public ImageWriter {
+public:
+    PFMWriter(const std::string& fileName, int width, int height) : ImageWriter(fileName, width, height, defaultStripHeight(width)) {
+        _output << "PF\n" << width << " " << height << "\n-1.0\n"; // always little endian
+    }
+
+    bool bottomUp() const override { return true; }
+    bool lowDynamicRange() const override { return false; }
+
+protected:
+    EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int, const unsigned char*) const override {
+        EncodedStrip strip;
+        strip.bytes.assign(rows, rows + 12 * static_cast<size_t>(_width) * nRows);
+        if constexpr (NATIVE_ENDIANNESS == Endianness::BIG) {
+            for (size_t k = 0; k < strip.bytes.size(); k += 4) std::reverse(&strip.bytes[k], &strip.bytes[k + 4]);
+        }
+        return strip;
+    }
+};
+
+class PNGWriter : public ImageWriter {
+public:
+    PNGWriter(const std::string& fileName, int width, int height) : ImageWriter(fileName, width, height, defaultStripHeight(width)), _stride(3 * width) {
+        static const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+        writeBytes(signature, sizeof(signature));
+
+        std::vector<unsigned char> chunk = startChunk("IHDR");
+        chunk.resize(chunk.size() + 8);
+        putBigEndian32(chunk, 8, width), putBigEndian32(chunk, 12, height);
+        chunk.insert(chunk.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, deflate, adaptive filters, not interlaced
+        endChunk(chunk);
+        writeBytes(chunk.data(), chunk.size());
+    }
+
+    void finish() override {
+        static const unsigned char end[] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82}; // empty, and its CRC
+        writeBytes(end, sizeof(end));
+        ImageWriter::finish();
+    }
+
+protected:
+    EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int firstRow, const unsigned char* above) const override {
+        // the row above, then the strip, for the filters looking at it
+        std::vector<unsigned char> pixels((nRows + 1) * _stride);
+        if (above != nullptr) std::memcpy(&pixels[0], above, _stride);
+        std::memcpy(&pixels[_stride], rows, nRows * _stride);
+        std::vector<unsigned char> filtered(nRows * (_stride + 1));
+        std::vector<signed char> lineBuffer(_stride);
+        for (int k = 0; k < nRows; k++) {
+            filterRow(above == nullptr ? &pixels[_stride] : &pixels[0], above == nullptr ? k : k + 1, &filtered[k * (_stride + 1)], lineBuffer);
+        }
+
+        EncodedStrip strip;
+        strip.checksum = adler32(filtered.data(), filtered.size());
+        strip.checkedBytes = filtered.size();
+        strip.bytes = startChunk("IDAT");
+        if (firstRow == 0) strip.bytes.insert(strip.bytes.end(), {0x78, 0x5e}); // zlib header: deflate, 32K window
+        bool last = (firstRow + nRows == _height);
+        deflateStrip(filtered.data(), static_cast<int>(filtered.size()), last, strip.bytes);
+        if (!last) endChunk(strip.bytes); // the last one ends with the Adler-32 of the whole stream
+        return strip;
+    }
+
+    void writeStrip(EncodedStrip& strip) override {
+        _adler = combineAdler32(_adler, strip.checksum, strip.checkedBytes);
+        if (_rowsWritten + strip.nRows == _height) {
+            strip.bytes.resize(strip.bytes.size() + 4);
+            putBigEndian32(strip.bytes, strip.bytes.size() - 4, _adler);
+            endChunk(strip.bytes);
+        }
+        writeBytes(strip.bytes.data(), strip.bytes.size());
+    }
+
+private:
+    int _stride;
+    uint32_t _adler = 1; // of the data written so far
+
+    // the filter with the smallest sum of the absolute values of its output, as stbi_write_png_to_mem chooses
+    void filterRow(unsigned char* pixels, int y, unsigned char* output, std::vector<signed char>& lineBuffer) const {
+        int bestFilter = 0, bestValue = 0x7fffffff;
+        for (int filter = 0; filter < 5; filter++) {
+            stbiw__encode_png_line(pixels, _stride, _width, _height, y, 3, filter, lineBuffer.data());
+            int value = 0;
+            for (signed char c : lineBuffer) value += std::abs(c);
+            if (value < bestValue) bestValue = value, bestFilter = filter;
+        }
+        stbiw__encode_png_line(pixels, _stride, _width, _height, y, 3, bestFilter, lineBuffer.data());
+        output[0] = static_cast<unsigned char>(bestFilter);
+        std::memcpy(output + 1, lineBuffer.data(), _stride);
+    }
+
+    // length (filled by endChunk) and type
+    static std::vector<unsigned char> startChunk(const char* type) {
+        std::vector<unsigned char> chunk(4);
+        chunk.insert(chunk.end(), type, type + 4);
+        return chunk;
+    }
+
+    // length and CRC
+    static void endChunk(std::vector<unsigned char>& chunk) {
+        putBigEndian32(chunk, 0, static_cast<uint32_t>(chunk.size() - 8));
+        chunk.resize(chunk.size() + 4);
+        putBigEndian32(chunk, chunk.size() - 4, stbiw__crc32(chunk.data() + 4, static_cast<int>(chunk.size() - 8)));
+    }
+};
+
+class JPEGWriter : public ImageWriter {
+public:
+    static constexpr int QUALITY = 100; // stb uses 8x8 blocks without chroma subsampling above 90
+    static constexpr int BLOCK = QUALITY > 90 ? 8 : 16;
+
+    JPEGWriter(const std::string& fileName, int width, int height) : ImageWriter(fileName, width, height, stripHeight(width)) {}
+
+    void finish() override {
+        const unsigned char endOfImage[] = {0xff, 0xd9};
+        writeBytes(endOfImage, sizeof(endOfImage));
+        ImageWriter::finish();
+    }
+
+protected:
+    EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int firstRow, const unsigned char*) const override {
+        std::vector<unsigned char> encoded;
+        if (!stbi_write_jpg_to_func(appendBytes, &encoded, _width, nRows, 3, rows, QUALITY)) {
+            throw std::runtime_error("ERROR: impossible to encode file \"" + _fileName + "\"");
+        }
+
+        // segments up to the start of scan, then the entropy coded data up to the end of image marker
+        size_t position = 2, scan = 0;
+        while (position + 4 <= encoded.size() && encoded[position] == 0xff && scan == 0) {
+            if (encoded[position + 1] == 0xda) scan = position;
+            position += 2 + (encoded[position + 2] << 8 | encoded[position + 3]);
+        }
+        if (scan == 0 || position > encoded.size() - 2) throw std::runtime_error("ERROR: unexpected JPEG encoding of file \"" + _fileName + "\"");
+
+        EncodedStrip strip;
+        if (firstRow == 0) {
+            // the header of the first strip, with the height of the image and the restart interval of a strip
+            for (size_t k = 2; k < scan; k += 2 + (encoded[k + 2] << 8 | encoded[k + 3])) {
+                if (encoded[k + 1] == 0xc0) encoded[k + 5] = static_cast<unsigned char>(_height >> 8), encoded[k + 6] = static_cast<unsigned char>(_height);
+            }
+            // from the strip height before it's limited to the image, a single strip can have any height
+            int interval = (_width + BLOCK - 1) / BLOCK * (stripHeight(_width) / BLOCK);
+            strip.bytes.assign(encoded.begin(), encoded.begin() + scan);
+            strip.bytes.insert(strip.bytes.end(), {0xff, 0xdd, 0, 4, static_cast<unsigned char>(interval >> 8), static_cast<unsigned char>(interval)});
+            strip.bytes.insert(strip.bytes.end(), encoded.begin() + scan, encoded.begin() + position);
+        } else {
+            // the markers count the strips before this one, modulo 8
+            strip.bytes = {0xff, static_cast<unsigned char>(0xd0 + (firstRow / _stripHeight - 1) % 8)};
+        }
+        strip.bytes.insert(strip.bytes.end(), encoded.begin() + position, encoded.end() - 2);
+        return strip;
+    }
+
+private:
+
+    // the restart interval, in blocks, is a 16-bit number
+    static int stripHeight(int width) {
+        int blocksPerRow = (width + BLOCK - 1) / BLOCK;
+        return std::max(16, std::min(defaultStripHeight(width), 65535 / blocksPerRow * BLOCK / 16 * 16));
+    }
+};
+
+class RGBEWriter : public ImageWriter {
+public:
+    RGBEWriter(const std::string& fileName, int width, int height) : ImageWriter(fileName, width, height, defaultStripHeight(width)) {
+        _output << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+    }
+
+    bool lowDynamicRange() const override { return false; }
+
+protected:
+    // each row as stbi_write_hdr does, run-length encoded unless it's too short or too long
+    EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int, const unsigned char*) const override {
+        EncodedStrip strip;
+        std::vector<unsigned char> scratch(4 * static_cast<size_t>(_width));
+        stbi__write_context context = {};
+        stbi__start_write_callbacks(&context, appendBytes, &strip.bytes);
+        for (int k = 0; k < nRows; k++) {
+            float* row = const_cast<float*>(reinterpret_cast<const float*>(rows)) + 3 * static_cast<size_t>(_width) * k; // only read
+            stbiw__write_hdr_scanline(&context, _width, 3, scratch.data(), row);
+        }
+        return strip;
+    }
+};
+
+class EXRWriter : public ImageWriter {
+public:
+    EXRWriter(const std::string& fileName, int width, int height) : ImageWriter(fileName, width, height, defaultStripHeight(width)) {
+        std::vector<unsigned char> header = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0}; // magic, version 2, single part scan lines
+        auto attribute = [&](const char* name, const char* type, std::vector<unsigned char> value) {
+            header.insert(header.end(), name, name + std::strlen(name) + 1);
+            header.insert(header.end(), type, type + std::strlen(type) + 1);
+            appendLittleEndian(header, value.size(), 4);
+            header.insert(header.end(), value.begin(), value.end());
+        };
+        auto values = [](std::initializer_list<uint32_t> words) {
+            std::vector<unsigned char> bytes;
+            for (uint32_t word : words) appendLittleEndian(bytes, word, 4);
+            return bytes;
+        };
+
+        // B, G and R in alphabetical order, as half floats (type 1) sampled on every pixel
+        std::vector<unsigned char> channels;
+        for (char name : {'B', 'G', 'R'}) {
+            channels.insert(channels.end(), {static_cast<unsigned char>(name), 0});
+            std::vector<unsigned char> channel = values({1, 0, 1, 1}); // type, linear and reserved bytes, x and y sampling
+            channels.insert(channels.end(), channel.begin(), channel.end());
+        }
+        channels.push_back(0);
+        uint32_t one = std::bit_cast<uint32_t>(1.0f);
+        attribute("channels", "chlist", channels);
+        attribute("compression", "compression", {0});
+        attribute("dataWindow", "box2i", values({0, 0, static_cast<uint32_t>(width - 1), static_cast<uint32_t>(height - 1)}));
+        attribute("displayWindow", "box2i", values({0, 0, static_cast<uint32_t>(width - 1), static_cast<uint32_t>(height - 1)}));
+        attribute("lineOrder", "lineOrder", {0}); // increasing y
+        attribute("pixelAspectRatio", "float", values({one}));
+        attribute("screenWindowCenter", "v2f", values({0, 0}));
+        attribute("screenWindowWidth", "float", values({one}));
+        header.push_back(0);
+
+        // the offset of each row, one per chunk, all of the same size without compression
+        uint64_t chunk = 8 + 6 * static_cast<uint64_t>(width), first = header.size() + 8 * static_cast<uint64_t>(height);
+        for (int j = 0; j < height; j++) appendLittleEndian(header, first + j * chunk, 8);
+        writeBytes(header.data(), header.size());
+    }
+
+    bool lowDynamicRange() const override { return false; }
+
+protected:
+    // each row is a chunk: its y, the size of the data, then the blue, green and red halves of the row
+    EncodedStrip encodeStrip(const unsigned char* rows, int nRows, int firstRow, const unsigned char*) const override {
+        size_t width = static_cast<size_t>(_width);
+        std::vector<float> planes(3 * width);
+        std::vector<uint16_t> halves(3 * width);
+        EncodedStrip strip;
+        strip.bytes.reserve(nRows * (8 + 6 * width));
+        for (int k = 0; k < nRows; k++) {
+            const float* row = reinterpret_cast<const float*>(rows) + 3 * width * k;
+            for (size_t i = 0; i < width; i++) {
+                planes[i] = row[3 * i + 2], planes[width + i] = row[3 * i + 1], planes[2 * width + i] = row[3 * i];
+            }
+            floatsToHalves(planes.data(), planes.size(), halves.data());
+
+            appendLittleEndian(strip.bytes, static_cast<uint32_t>(firstRow + k), 4);
+            appendLittleEndian(strip.bytes, 6 * width, 4);
+            if constexpr (NATIVE_ENDIANNESS == Endianness::LITTLE) {
+                auto bytes = reinterpret_cast<const unsigned char*>(halves.data());
+                strip.bytes.insert(strip.bytes.end(), bytes, bytes + 2 * halves.size());
+            } else {
+                for (uint16_t half : halves) appendLittleEndian(strip.bytes, half, 2);
+            }
+        }
+        return strip;
+    }
+};
+
+} // namespace
+
+ImageWriter::ImageWriter(const std::string& fileName, int width, int height, int stripHeight)
+    : _fileName(fileName), _output(nullptr), _width(width), _height(height), _stripHeight(std::min(stripHeight, height)) {
+    if (fileName == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        _output.rdbuf(standardOutput);
+    } else {
+        _file.open(fileName, std::ios::binary);
+        _output.rdbuf(_file.rdbuf());
+    }
+    if (_file.fail() || _output.fail()) throw std::runtime_error("ERROR: impossible to write file \"" + fileName + "\"");
+}
+
+std::unique_ptr<ImageWriter> ImageWriter::open(const std::string& fileName, int width, int height) {
+    auto extension = std::filesystem::path(fileName).extension();
+    if (fileName == "-" || extension == ".pfm") return std::make_unique<PFMWriter>(fileName, width, height);
+    if (extension == ".png") return std::make_unique<PNGWriter>(fileName, width, height);
+    if (extension == ".jpg" || extension == ".jpeg") return std::make_unique<JPEGWriter>(fileName, width, height);
+    if (extension == ".hdr") return std::make_unique<RGBEWriter>(fileName, width, height);
+    if (extension == ".exr") return std::make_unique<EXRWriter>(fileName, width, height);
+    throw std::invalid_argument("ERROR: file extension \"" + extension.string() + "\" is not supported");
+}
+
+void ImageWriter::write(const void* rows, int nRows, ThreadPool* pool) {
+    auto bytes = static_cast<const unsigned char*>(rows);
+    size_t rowBytes = (lowDynamicRange() ? 3 : 3 * sizeof(float)) * static_cast<size_t>(_width);
+    int nStrips = (nRows + _stripHeight - 1) / _stripHeight;
+
+    // encoded at the same time, the errors are thrown from this thread
+    std::vector<EncodedStrip> strips(nStrips);
+    std::vector<std::exception_ptr> errors(nStrips);
+    auto encode = [&](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            int first = s * _stripHeight;
+            const unsigned char* above = first > 0 ? bytes + (first - 1) * rowBytes : _rowsWritten > 0 ? _lastRow.data() : nullptr;
+            try {
+                strips[s] = encodeStrip(bytes + first * rowBytes, std::min(_stripHeight, nRows - first), _rowsWritten + first, above);
+                strips[s].nRows = std::min(_stripHeight, nRows - first);
+            } catch (...) {
+                errors[s] = std::current_exception();
+            }
+        }
+    };
+    if (pool != nullptr && nStrips > 1) pool->parallelFor(0, nStrips, 1, encode);
+    else encode(0, nStrips);
+
+    for (int s = 0; s < nStrips; s++) {
+        if (errors[s]) std::rethrow_exception(errors[s]);
+        writeStrip(strips[s]);
+        _rowsWritten += strips[s].nRows;
+    }
+    if (nRows > 0) _lastRow.assign(bytes + (nRows - 1) * rowBytes, bytes + nRows * rowBytes);
+}
+
+void ImageWriter::writeStrip(EncodedStrip& strip) {
+    writeBytes(strip.bytes.data(), strip.bytes.size());
+}
+
+void ImageWriter::writeBytes(const void* data, size_t size) {
+    _output.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (_output.fail()) throw std::runtime_error("ERROR: impossible to write file \"" + _fileName + "\"");
+}
+
+void ImageWriter::finish() {
+    if (_rowsWritten != _height) {
+        throw std::runtime_error("ERROR: only " + std::to_string(_rowsWritten) + " rows of " + std::to_string(_height) + " written to \"" + _fileName + "\"");
+    }
+    _output.flush();
+    if (_file.is_open()) _file.close();
+    if (_output.fail() || _file.fail()) throw std::runtime_error("ERROR: impossible to write file \"" + _fileName + "\"");
+}
@@ -0,0 +1,81 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) : _path(path) {
+    _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        _file = nullptr;
+        throw std::runtime_error("impossible to open file \"" + path + "\"");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size)) {
+        CloseHandle(_file);
+        throw std::runtime_error("impossible to read the size of file \"" + path + "\"");
+    }
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0) return; // empty files can't be mapped
+
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping != nullptr) _data = static_cast<const std::byte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr) {
+        if (_mapping != nullptr) CloseHandle(_mapping);
+        CloseHandle(_file);
+        throw std::runtime_error("impossible to map file \"" + path + "\"");
+    }
+}
+
+void MappedFile::prefetch() const {} // the system reads ahead on its own when the pages are used in order
+
+MappedFile::~MappedFile() {
+    if (_data != nullptr) UnmapViewOfFile(_data);
+    if (_mapping != nullptr) CloseHandle(_mapping);
+    if (_file != nullptr) CloseHandle(_file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) : _path(path) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) throw std::runtime_error("impossible to open file \"" + path + "\"");
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0) {
+        close(descriptor);
+        throw std::runtime_error("impossible to read the size of file \"" + path + "\"");
+    }
+    _size = static_cast<size_t>(info.st_size);
+    if (_size == 0) { // empty files can't be mapped
+        close(descriptor);
+        return;
+    }
+
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor); // the mapping keeps the file open
+    if (data == MAP_FAILED) throw std::runtime_error("impossible to map file \"" + path + "\"");
+    _data = static_cast<const std::byte*>(data);
+}
+
+void MappedFile::prefetch() const {
+    if (_data != nullptr) madvise(const_cast<std::byte*>(_data), _size, MADV_WILLNEED);
+}
+
+MappedFile::~MappedFile() {
+    if (_data != nullptr) munmap(const_cast<std::byte*>(_data), _size);
+}
+
+#endif
@@ -1,4 +1,8 @@
 #include "PFMReader.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cstring>
 
 float readFloat(std::istream& stream, Endianness endianness) {
     uint8_t bytes[4];
@@ -21,6 +25,17 @@ float readFloat(std::istream& stream, Endianness endianness) {
     return result;
 }
 
+void readFloats(std::istream& stream, float* values, size_t count, Endianness endianness) {
+    std::streamsize bytes = static_cast<std::streamsize>(count * sizeof(float));
+    stream.read(reinterpret_cast<char*>(values), bytes);
+
+    if (stream.gcount() != bytes) {
+        throw std::runtime_error("ERROR: impossible to read " + std::to_string(bytes) + " bytes, only " + std::to_string(stream.gcount()) + " available");
+    }
+
+    if (endianness != NATIVE_ENDIANNESS) swapBytes32(values, count);
+}
+
 void writeFloat(std::ostream& stream, float value, Endianness endianness) {
     // Convert "value" in a sequence of 32 bit
     uint32_t doubleWord{*((uint32_t*) &value)};
@@ -33,13 +48,24 @@ void writeFloat(std::ostream& stream, float value, Endianness endianness) {
         static_cast<uint8_t>((doubleWord >> 24) & 0xff), // Most significant byte
     };
   
-    switch (endianness) {
-    case Endianness::LITTLE:
-        for (int i{}; i < 4; ++i) stream << bytes[i]; // Forward loop 
-        break;
-    case Endianness::BIG:
-        for (int i{3}; i >= 0; --i) stream << bytes[i]; // Backward loop
-        break;
+    if (endianness == Endianness::BIG) std::swap(bytes[0], bytes[3]), std::swap(bytes[1], bytes[2]);
+    stream.write(reinterpret_cast<const char*>(bytes), 4); // unformatted, << would go through the locale for every byte
+}
+
+void writeFloats(std::ostream& stream, const float* values, size_t count, Endianness endianness) {
+    if (endianness == NATIVE_ENDIANNESS) {
+        stream.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(count * sizeof(float)));
+        return;
+    }
+
+    // swapped in blocks of 64 KiB, the values can't be changed
+    constexpr size_t BLOCK = 1 << 14;
+    float buffer[BLOCK];
+    for (size_t first = 0; first < count; first += BLOCK) {
+        size_t n = std::min(BLOCK, count - first);
+        std::memcpy(buffer, values + first, n * sizeof(float));
+        swapBytes32(buffer, n);
+        stream.write(reinterpret_cast<const char*>(buffer), static_cast<std::streamsize>(n * sizeof(float)));
     }
 }
 
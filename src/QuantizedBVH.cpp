@@ -0,0 +1,90 @@
+#include "QuantizedBVH.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+// same operations as quantizedBoxesHit4, so the boxes checked here are the ones used in the traversal
+static inline float decode(uint8_t q, float scale, float origin) { return q * scale + origin; }
+
+// sets the origin, scales and quantized boxes of a node, whose child and count are already set
+static void quantize(QuantizedBVH::Node& node, const AABB* children) {
+    AABB box;
+    for (int k = 0; k < QuantizedBVH::WIDTH; k++) {
+        if (node.count[k] != QuantizedBVH::EMPTY) box.grow(children[k]);
+    }
+    const float boxMin[3] = {box.min.x, box.min.y, box.min.z}, boxMax[3] = {box.max.x, box.max.y, box.max.z};
+
+    for (int axis = 0; axis < 3; axis++) {
+        node.origin[axis] = boxMin[axis];
+        // smallest power of two fitting the extent in 254 steps, the last one is left for the rounding
+        int exponent;
+        std::frexp(std::max((boxMax[axis] - boxMin[axis]) / 254.0f, 1e-30f), &exponent);
+        node.exponent[axis] = static_cast<int8_t>(std::clamp(exponent, -126, 127));
+    }
+
+    for (int k = 0; k < QuantizedBVH::WIDTH; k++) {
+        if (node.count[k] == QuantizedBVH::EMPTY) {
+            for (int axis = 0; axis < 3; axis++) node.low[4 * axis + k] = node.high[4 * axis + k] = 0;
+            continue;
+        }
+
+        const AABB& child = children[k];
+        const float childMin[3] = {child.min.x, child.min.y, child.min.z}, childMax[3] = {child.max.x, child.max.y, child.max.z};
+        for (int axis = 0; axis < 3; axis++) {
+            float scale = node.scale(axis), origin = node.origin[axis];
+            int low = std::clamp(static_cast<int>(std::floor((childMin[axis] - origin) / scale)), 0, 255);
+            int high = std::clamp(static_cast<int>(std::ceil((childMax[axis] - origin) / scale)), 0, 255);
+            // fix the rounding errors of the subtraction, so the box is never smaller than the exact one
+            while (low > 0 && decode(low, scale, origin) > childMin[axis]) low--;
+            while (high < 255 && decode(high, scale, origin) < childMax[axis]) high++;
+            node.low[4 * axis + k] = static_cast<uint8_t>(low);
+            node.high[4 * axis + k] = static_cast<uint8_t>(high);
+        }
+    }
+}
+
+void QuantizedBVH::build(const BVH& bvh) {
+    clear();
+    _primitives.assign(bvh.primitives().begin(), bvh.primitives().end());
+    _nodes.resize(bvh.nodes().size());
+
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        const BVH::Node& source = bvh.nodes()[i];
+        AABB children[WIDTH];
+        for (int k = 0; k < WIDTH; k++) {
+            _nodes[i].child[k] = source.child[k];
+            _nodes[i].count[k] = source.isEmpty(k) ? EMPTY : static_cast<uint8_t>(source.count[k]);
+            if (!source.isEmpty(k)) children[k] = source.childBox(k);
+        }
+        quantize(_nodes[i], children);
+    }
+}
+
+void QuantizedBVH::refit(const std::vector<AABB>& boxes) {
+    // exact box of every node, computed going backwards like in BVH::refit, before it's quantized
+    std::vector<AABB> exact(_nodes.size());
+    for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; n--) {
+        Node& node = _nodes[n];
+        AABB children[WIDTH];
+        for (int k = 0; k < WIDTH; k++) {
+            if (isEmpty(n, k)) continue;
+            if (node.count[k] > 0) {
+                for (int p = node.child[k]; p < node.child[k] + node.count[k]; p++) children[k].grow(boxes[_primitives[p]]);
+            } else {
+                children[k] = exact[node.child[k]];
+            }
+            exact[n].grow(children[k]);
+        }
+        quantize(node, children);
+    }
+}
+
+AABB QuantizedBVH::childBox(int node, int k) const {
+    const Node& n = _nodes[node];
+    float low[3], high[3];
+    for (int axis = 0; axis < 3; axis++) {
+        low[axis] = decode(n.low[4 * axis + k], n.scale(axis), n.origin[axis]);
+        high[axis] = decode(n.high[4 * axis + k], n.scale(axis), n.origin[axis]);
+    }
+    return AABB(Point3(low[0], low[1], low[2]), Point3(high[0], high[1], high[2]));
+}
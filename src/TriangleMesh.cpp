@@ -0,0 +1,540 @@
+#include "TriangleMesh.hpp"
+
+#include <stdexcept>
+#include <charconv>
+#include <cstring>
+#include <bit>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+
+#include "MappedFile.hpp"
+
+// loading
+
+namespace {
+
+// reads words and numbers from a piece of text, whitespace separated
+struct TextCursor {
+    const char* p;
+    const char* end;
+
+    bool isSpace(char c) const { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    void skipSpaces() { while (p < end && isSpace(*p)) p++; }
+
+    bool atEnd() { skipSpaces(); return p >= end; }
+
+    std::string_view word() {
+        skipSpaces();
+        const char* start = p;
+        while (p < end && !isSpace(*p)) p++;
+        return std::string_view(start, p - start);
+    }
+
+    template <typename T>
+    bool number(T& value) {
+        skipSpaces();
+        if (p < end && *p == '+') p++; // from_chars doesn't accept it
+        auto [next, error] = std::from_chars(p, end, value);
+        if (error != std::errc()) return false;
+        p = next;
+        return true;
+    }
+};
+
+struct Corner {
+    int v, vt, vn;
+    bool operator==(const Corner&) const = default;
+};
+
+struct CornerHash {
+    size_t operator()(const Corner& c) const {
+        uint64_t h = static_cast<uint32_t>(c.v);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(c.vt);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(c.vn);
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+};
+
+// adds the triangles of a fan around the first vertex of the polygon
+template <typename T>
+void triangulate(const std::vector<T>& polygon, std::vector<T>& triangles) {
+    for (size_t k = 2; k < polygon.size(); k++) {
+        triangles.push_back(polygon[0]);
+        triangles.push_back(polygon[k - 1]);
+        triangles.push_back(polygon[k]);
+    }
+}
+
+} // namespace
+
+MeshData parseOBJ(std::string_view text) {
+    std::vector<float> positions, normals, uvs;
+    std::vector<Corner> polygon, corners;
+    int line = 0;
+
+    auto error = [&](const std::string& message) {
+        return std::runtime_error("ERROR: line " + std::to_string(line) + " of OBJ file: " + message);
+    };
+
+    // OBJ indices start from 1, negative ones count back from the last element read
+    auto resolve = [&](int index, size_t count, const char* what) {
+        int resolved = (index > 0) ? index - 1 : static_cast<int>(count) + index;
+        if (index == 0 || resolved < 0 || resolved >= static_cast<int>(count))
+            throw error(std::string(what) + " index " + std::to_string(index) + " out of range");
+        return resolved;
+    };
+
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) lineEnd = end;
+        TextCursor cursor{p, lineEnd};
+        p = lineEnd + 1;
+        line++;
+
+        std::string_view keyword = cursor.word();
+        if (keyword == "v" || keyword == "vn") {
+            std::vector<float>& target = (keyword == "v") ? positions : normals;
+            for (int k = 0; k < 3; k++) {
+                float value;
+                if (!cursor.number(value)) throw error("expected three coordinates");
+                target.push_back(value);
+            }
+        } else if (keyword == "vt") {
+            for (int k = 0; k < 2; k++) {
+                float value = 0.0f;
+                if (!cursor.number(value) && k == 0) throw error("expected texture coordinates");
+                uvs.push_back(value);
+            }
+        } else if (keyword == "f") {
+            polygon.clear();
+            while (!cursor.atEnd()) {
+                Corner corner{0, -1, -1};
+                if (!cursor.number(corner.v)) throw error("expected a vertex index");
+                corner.v = resolve(corner.v, positions.size() / 3, "vertex");
+                if (cursor.p < cursor.end && *cursor.p == '/') {
+                    cursor.p++;
+                    if (cursor.p < cursor.end && *cursor.p != '/') {
+                        if (!cursor.number(corner.vt)) throw error("expected a texture coordinate index");
+                        corner.vt = resolve(corner.vt, uvs.size() / 2, "texture coordinate");
+                    }
+                    if (cursor.p < cursor.end && *cursor.p == '/') {
+                        cursor.p++;
+                        if (!cursor.number(corner.vn)) throw error("expected a normal index");
+                        corner.vn = resolve(corner.vn, normals.size() / 3, "normal");
+                    }
+                }
+                polygon.push_back(corner);
+            }
+            if (polygon.size() < 3) throw error("a face needs at least three vertices");
+            triangulate(polygon, corners);
+        } // other statements (groups, materials, smoothing, lines...) don't change the geometry
+    }
+
+    // normals and texture coordinates are used only if every corner has them
+    bool withNormals = !corners.empty(), withUVs = !corners.empty();
+    for (const Corner& corner : corners) {
+        withNormals = withNormals && corner.vn >= 0;
+        withUVs = withUVs && corner.vt >= 0;
+    }
+
+    MeshData mesh;
+    if (!withNormals && !withUVs) {
+        size_t nVertices = positions.size() / 3;
+        mesh.x.resize(nVertices), mesh.y.resize(nVertices), mesh.z.resize(nVertices);
+        for (size_t i = 0; i < nVertices; i++) {
+            mesh.x[i] = positions[3 * i], mesh.y[i] = positions[3 * i + 1], mesh.z[i] = positions[3 * i + 2];
+        }
+        mesh.indices.reserve(corners.size());
+        for (const Corner& corner : corners) mesh.indices.push_back(corner.v);
+        return mesh;
+    }
+
+    // a vertex for every different combination of position, normal and texture coordinates
+    std::unordered_map<Corner, int, CornerHash> vertices;
+    mesh.indices.reserve(corners.size());
+    for (Corner corner : corners) {
+        if (!withNormals) corner.vn = -1;
+        if (!withUVs) corner.vt = -1;
+        auto [it, inserted] = vertices.try_emplace(corner, mesh.nVertices());
+        if (inserted) {
+            mesh.x.push_back(positions[3 * corner.v]), mesh.y.push_back(positions[3 * corner.v + 1]), mesh.z.push_back(positions[3 * corner.v + 2]);
+            if (withNormals) {
+                mesh.nx.push_back(normals[3 * corner.vn]), mesh.ny.push_back(normals[3 * corner.vn + 1]), mesh.nz.push_back(normals[3 * corner.vn + 2]);
+            }
+            if (withUVs) mesh.u.push_back(uvs[2 * corner.vt]), mesh.v.push_back(uvs[2 * corner.vt + 1]);
+        }
+        mesh.indices.push_back(it->second);
+    }
+    return mesh;
+}
+
+namespace {
+
+enum class PLYType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    bool isList = false;
+    PLYType countType = PLYType::UInt8; // of lists
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> properties;
+
+    int find(std::initializer_list<std::string_view> names) const {
+        for (int k = 0; k < static_cast<int>(properties.size()); k++) {
+            if (std::find(names.begin(), names.end(), properties[k].name) != names.end()) return k;
+        }
+        return -1;
+    }
+};
+
+PLYType plyType(std::string_view name) {
+    if (name == "char" || name == "int8") return PLYType::Int8;
+    if (name == "uchar" || name == "uint8") return PLYType::UInt8;
+    if (name == "short" || name == "int16") return PLYType::Int16;
+    if (name == "ushort" || name == "uint16") return PLYType::UInt16;
+    if (name == "int" || name == "int32") return PLYType::Int32;
+    if (name == "uint" || name == "uint32") return PLYType::UInt32;
+    if (name == "float" || name == "float32") return PLYType::Float32;
+    if (name == "double" || name == "float64") return PLYType::Float64;
+    throw std::runtime_error("ERROR: unknown property type \"" + std::string(name) + "\" in PLY file");
+}
+
+// reads the values of the body, in any of the three formats
+class PLYReader {
+public:
+    enum class Format { ASCII, LittleEndian, BigEndian };
+
+    PLYReader(const char* begin, const char* end, Format format) : _cursor{begin, end}, _format(format) {}
+
+    double read(PLYType type) {
+        if (_format == Format::ASCII) {
+            double value;
+            if (!_cursor.number(value)) throw std::runtime_error("ERROR: expected a number in PLY file");
+            return value;
+        }
+        switch (type) {
+            case PLYType::Int8: return binary<int8_t>();
+            case PLYType::UInt8: return binary<uint8_t>();
+            case PLYType::Int16: return binary<int16_t>();
+            case PLYType::UInt16: return binary<uint16_t>();
+            case PLYType::Int32: return binary<int32_t>();
+            case PLYType::UInt32: return binary<uint32_t>();
+            case PLYType::Float32: return binary<float>();
+            default: return binary<double>();
+        }
+    }
+
+    // reads a property, returning its value, or the first one of a list (whose length goes in count)
+    double read(const PLYProperty& property, size_t& count) {
+        if (!property.isList) {
+            count = 1;
+            return read(property.type);
+        }
+        count = static_cast<size_t>(read(property.countType));
+        double first = 0.0;
+        for (size_t k = 0; k < count; k++) {
+            double value = read(property.type);
+            if (k == 0) first = value;
+        }
+        return first;
+    }
+
+    // reads the list of the property, the count included
+    void readList(const PLYProperty& property, std::vector<int>& values) {
+        size_t count = static_cast<size_t>(read(property.countType));
+        values.resize(count);
+        for (size_t k = 0; k < count; k++) values[k] = static_cast<int>(read(property.type));
+    }
+
+private:
+    TextCursor _cursor;
+    Format _format;
+
+    template <typename T>
+    T binary() {
+        if (static_cast<size_t>(_cursor.end - _cursor.p) < sizeof(T)) throw std::runtime_error("ERROR: unexpected end of PLY file");
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, _cursor.p, sizeof(T));
+        _cursor.p += sizeof(T);
+        bool swap = (_format == Format::LittleEndian) != (std::endian::native == std::endian::little);
+        if (swap) std::reverse(bytes, bytes + sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+};
+
+} // namespace
+
+MeshData parsePLY(std::string_view data) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+
+    // header
+    std::vector<PLYElement> elements;
+    PLYReader::Format format = PLYReader::Format::ASCII;
+    bool hasFormat = false, first = true;
+    while (true) {
+        if (p >= end) throw std::runtime_error("ERROR: PLY header without end_header");
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) lineEnd = end;
+        TextCursor line{p, lineEnd};
+        p = std::min(lineEnd + 1, end);
+
+        std::string_view keyword = line.word();
+        if (first) {
+            if (keyword != "ply") throw std::runtime_error("ERROR: not a PLY file");
+            first = false;
+        } else if (keyword == "format") {
+            std::string_view name = line.word();
+            if (name == "ascii") format = PLYReader::Format::ASCII;
+            else if (name == "binary_little_endian") format = PLYReader::Format::LittleEndian;
+            else if (name == "binary_big_endian") format = PLYReader::Format::BigEndian;
+            else throw std::runtime_error("ERROR: unknown PLY format \"" + std::string(name) + "\"");
+            hasFormat = true;
+        } else if (keyword == "element") {
+            PLYElement element;
+            element.name = line.word();
+            if (!line.number(element.count)) throw std::runtime_error("ERROR: element without count in PLY file");
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty()) throw std::runtime_error("ERROR: property outside an element in PLY file");
+            PLYProperty property;
+            std::string_view type = line.word();
+            if (type == "list") {
+                property.isList = true;
+                property.countType = plyType(line.word());
+                type = line.word();
+            }
+            property.type = plyType(type);
+            property.name = line.word();
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        } // comments and obj_info
+    }
+    if (!hasFormat) throw std::runtime_error("ERROR: PLY file without format");
+
+    // body
+    MeshData mesh;
+    PLYReader reader(p, end, format);
+    std::vector<int> polygon, triangles;
+    for (const PLYElement& element : elements) {
+        if (element.name == "vertex") {
+            // where every property goes, -1 to skip it
+            std::vector<float>* targets[] = {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz, &mesh.u, &mesh.v};
+            int slots[8] = {element.find({"x"}), element.find({"y"}), element.find({"z"}),
+                            element.find({"nx"}), element.find({"ny"}), element.find({"nz"}),
+                            element.find({"u", "s", "texture_u", "texture_s"}), element.find({"v", "t", "texture_v", "texture_t"})};
+            if (slots[0] < 0 || slots[1] < 0 || slots[2] < 0) throw std::runtime_error("ERROR: PLY vertices without x, y and z");
+            if (slots[3] < 0 || slots[4] < 0 || slots[5] < 0) slots[3] = slots[4] = slots[5] = -1;
+            if (slots[6] < 0 || slots[7] < 0) slots[6] = slots[7] = -1;
+
+            std::vector<std::vector<float>*> byProperty(element.properties.size(), nullptr);
+            for (int k = 0; k < 8; k++) {
+                if (slots[k] >= 0) {
+                    byProperty[slots[k]] = targets[k];
+                    targets[k]->reserve(element.count);
+                }
+            }
+
+            for (size_t i = 0; i < element.count; i++) {
+                for (size_t k = 0; k < element.properties.size(); k++) {
+                    size_t count;
+                    float value = static_cast<float>(reader.read(element.properties[k], count));
+                    if (byProperty[k] != nullptr) byProperty[k]->push_back(value);
+                }
+            }
+        } else if (element.name == "face") {
+            int indices = element.find({"vertex_indices", "vertex_index"});
+            if (indices < 0 || !element.properties[indices].isList) throw std::runtime_error("ERROR: PLY faces without vertex_indices");
+
+            triangles.reserve(3 * element.count);
+            for (size_t i = 0; i < element.count; i++) {
+                for (int k = 0; k < static_cast<int>(element.properties.size()); k++) {
+                    size_t count;
+                    if (k == indices) reader.readList(element.properties[k], polygon);
+                    else reader.read(element.properties[k], count);
+                }
+                if (polygon.size() < 3) throw std::runtime_error("ERROR: PLY face with less than three vertices");
+                triangulate(polygon, triangles);
+            }
+        } else {
+            for (size_t i = 0; i < element.count; i++) {
+                for (const PLYProperty& property : element.properties) {
+                    size_t count;
+                    reader.read(property, count);
+                }
+            }
+        }
+    }
+    mesh.indices = std::move(triangles);
+    return mesh;
+}
+
+MeshData readMesh(const std::string& fileName) {
+    std::string extension = fileName.substr(std::min(fileName.find_last_of('.'), fileName.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (extension != ".obj" && extension != ".ply")
+        throw std::runtime_error("ERROR: unknown mesh format of file \"" + fileName + "\", expected .obj or .ply");
+
+    MappedFile file(fileName);
+    std::string_view content(reinterpret_cast<const char*>(file.data()), file.size());
+    return (extension == ".obj") ? parseOBJ(content) : parsePLY(content);
+}
+
+// TriangleMesh
+
+TriangleMesh::TriangleMesh(std::shared_ptr<Material> material, MeshData mesh, const Transformation& t, ThreadPool* pool)
+    : Shape(material, t), _mesh(std::move(mesh)) {
+    int nVertices = _mesh.nVertices();
+    if (static_cast<int>(_mesh.y.size()) != nVertices || static_cast<int>(_mesh.z.size()) != nVertices)
+        throw std::invalid_argument("ERROR: mesh positions of different lengths");
+    if (_mesh.hasNormals() && (static_cast<int>(_mesh.nx.size()) != nVertices || static_cast<int>(_mesh.ny.size()) != nVertices || static_cast<int>(_mesh.nz.size()) != nVertices))
+        throw std::invalid_argument("ERROR: mesh with a different number of normals and vertices");
+    if (_mesh.hasUVs() && (static_cast<int>(_mesh.u.size()) != nVertices || static_cast<int>(_mesh.v.size()) != nVertices))
+        throw std::invalid_argument("ERROR: mesh with a different number of texture coordinates and vertices");
+    if (_mesh.indices.size() % 3 != 0) throw std::invalid_argument("ERROR: mesh indices are not a multiple of three");
+
+    int nTriangles = _mesh.nTriangles();
+    _triangles.resize(nTriangles);
+    std::vector<AABB> boxes(nTriangles);
+    for (int i = 0; i < nTriangles; i++) {
+        float* corners[3] = {_triangles[i].a, _triangles[i].b, _triangles[i].c};
+        for (int k = 0; k < 3; k++) {
+            int index = _mesh.indices[3 * i + k];
+            if (index < 0 || index >= nVertices) throw std::invalid_argument("ERROR: mesh vertex index " + std::to_string(index) + " out of range");
+            corners[k][0] = _mesh.x[index], corners[k][1] = _mesh.y[index], corners[k][2] = _mesh.z[index];
+            boxes[i].grow(Point3(_mesh.x[index], _mesh.y[index], _mesh.z[index]));
+        }
+        _localBox.grow(boxes[i]);
+    }
+
+    _bvh.build(boxes, BVH::Preset::SAH, pool);
+}
+
+TriangleMesh::WatertightRay::WatertightRay(const Ray& ray) {
+    const float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    origin[0] = ray.origin.x, origin[1] = ray.origin.y, origin[2] = ray.origin.z;
+
+    // z is the largest component of the direction, x and y keep the winding
+    kz = 0;
+    if (std::abs(direction[1]) > std::abs(direction[kz])) kz = 1;
+    if (std::abs(direction[2]) > std::abs(direction[kz])) kz = 2;
+    kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    if (direction[kz] < 0.0f) std::swap(kx, ky);
+
+    sx = direction[kx] / direction[kz];
+    sy = direction[ky] / direction[kz];
+    sz = 1.0f / direction[kz];
+}
+
+bool TriangleMesh::intersect(int triangle, const WatertightRay& ray, float tmin, float tmax, float& t, float* barycentric) const {
+    const Triangle& tri = _triangles[triangle];
+
+    // vertices relative to the origin, sheared so that the ray goes along z
+    const float a[3] = {tri.a[0] - ray.origin[0], tri.a[1] - ray.origin[1], tri.a[2] - ray.origin[2]};
+    const float b[3] = {tri.b[0] - ray.origin[0], tri.b[1] - ray.origin[1], tri.b[2] - ray.origin[2]};
+    const float c[3] = {tri.c[0] - ray.origin[0], tri.c[1] - ray.origin[1], tri.c[2] - ray.origin[2]};
+    float ax = a[ray.kx] - ray.sx * a[ray.kz], ay = a[ray.ky] - ray.sy * a[ray.kz];
+    float bx = b[ray.kx] - ray.sx * b[ray.kz], by = b[ray.ky] - ray.sy * b[ray.kz];
+    float cx = c[ray.kx] - ray.sx * c[ray.kz], cy = c[ray.ky] - ray.sy * c[ray.kz];
+
+    // scaled barycentric coordinates, the edge functions of the 2D triangle at the origin
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+
+    // on an edge the single precision result can't be trusted, double precision is exact there
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+        v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+        w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+    }
+
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+    float det = u + v + w;
+    if (det == 0.0f) return false;
+
+    float az = ray.sz * a[ray.kz], bz = ray.sz * b[ray.kz], cz = ray.sz * c[ray.kz];
+    float hit = (u * az + v * bz + w * cz) / det;
+    if (hit <= tmin || hit >= tmax) return false;
+
+    t = hit;
+    barycentric[0] = u / det, barycentric[1] = v / det, barycentric[2] = w / det;
+    return true;
+}
+
+bool TriangleMesh::isHit(const Ray& ray, HitRecord& rec) const {
+    Ray invRay = ray.transform(transformation.inverse());
+    WatertightRay watertight(invRay);
+
+    int closest = -1;
+    float tmax = invRay.tmax, t, barycentric[3];
+    _bvh.closestHit(invRay, tmax, [&](int triangle, float& tClosest) {
+        float tHit, b[3];
+        if (!intersect(triangle, watertight, invRay.tmin, tClosest, tHit, b)) return false;
+        tClosest = t = tHit, closest = triangle;
+        barycentric[0] = b[0], barycentric[1] = b[1], barycentric[2] = b[2];
+        return true;
+    });
+    if (closest < 0) return false;
+
+    const Triangle& tri = _triangles[closest];
+    const int* index = &_mesh.indices[3 * closest];
+    Point3 localHit(barycentric[0] * tri.a[0] + barycentric[1] * tri.b[0] + barycentric[2] * tri.c[0],
+                    barycentric[0] * tri.a[1] + barycentric[1] * tri.b[1] + barycentric[2] * tri.c[1],
+                    barycentric[0] * tri.a[2] + barycentric[1] * tri.b[2] + barycentric[2] * tri.c[2]);
+
+    // the geometric normal tells the side, the interpolated one (if any) the shading
+    Vec3 geometric = cross(Vec3(tri.b[0] - tri.a[0], tri.b[1] - tri.a[1], tri.b[2] - tri.a[2]),
+                           Vec3(tri.c[0] - tri.a[0], tri.c[1] - tri.a[1], tri.c[2] - tri.a[2]));
+    rec.isInside = dot(geometric, invRay.direction) > 0.0f;
+    if (rec.isInside) geometric = -geometric;
+
+    Vec3 normal = geometric;
+    if (_mesh.hasNormals()) {
+        Vec3 interpolated(0.0f, 0.0f, 0.0f);
+        for (int k = 0; k < 3; k++) interpolated = interpolated + Vec3(_mesh.nx[index[k]], _mesh.ny[index[k]], _mesh.nz[index[k]]) * barycentric[k];
+        if (interpolated.norm2() > 0.0f) normal = (dot(interpolated, geometric) < 0.0f) ? -interpolated : interpolated;
+    }
+
+    rec.t = t;
+    rec.ray = ray;
+    rec.worldPoint = transformation * localHit;
+    rec.normal = transformation * Normal3(normal);
+    if (_mesh.hasUVs()) {
+        rec.surfacePoint = Vec2(barycentric[0] * _mesh.u[index[0]] + barycentric[1] * _mesh.u[index[1]] + barycentric[2] * _mesh.u[index[2]],
+                                barycentric[0] * _mesh.v[index[0]] + barycentric[1] * _mesh.v[index[1]] + barycentric[2] * _mesh.v[index[2]]);
+    } else {
+        rec.surfacePoint = Vec2(barycentric[1], barycentric[2]);
+    }
+    rec.material = _material;
+
+    return true;
+}
+
+bool TriangleMesh::quickIsHit(const Ray& ray) const {
+    Ray invRay = ray.transform(transformation.inverse());
+    WatertightRay watertight(invRay);
+
+    return _bvh.anyHit(invRay, [&](int triangle) {
+        float t, barycentric[3];
+        return intersect(triangle, watertight, invRay.tmin, invRay.tmax, t, barycentric);
+    });
+}
+
+size_t TriangleMesh::memoryUsage() const {
+    size_t vertexFloats = _mesh.x.size() * 3 + _mesh.nx.size() * 3 + _mesh.u.size() * 2;
+    return sizeof(TriangleMesh) + vertexFloats * sizeof(float) + _mesh.indices.size() * sizeof(int) + _triangles.size() * sizeof(Triangle) + _bvh.memoryUsage();
+}
@@ -0,0 +1,265 @@
+#include "WavefrontRenderer.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <cmath>
+
+// PathStates
+
+void PathStates::resize(int n) {
+    for (auto* array : {&ox, &oy, &oz, &dx, &dy, &dz, &throughputR, &throughputG, &throughputB, &px, &py, &pz, &nx, &ny, &nz, &u, &v})
+        array->resize(n);
+    depth.resize(n), pixel.resize(n);
+    rngState.resize(n), rngInc.resize(n);
+    material.resize(n), isInside.resize(n);
+}
+
+HitRecord PathStates::hitRecord(int i) const {
+    HitRecord rec;
+    rec.worldPoint = Point3(px[i], py[i], pz[i]);
+    rec.normal = Normal3(nx[i], ny[i], nz[i]);
+    rec.surfacePoint = Vec2(u[i], v[i]);
+    rec.ray = ray(i);
+    rec.isInside = isInside[i];
+    return rec;
+}
+
+
+
+// WavefrontRenderer
+
+RayCounters WavefrontRenderer::render(Camera& camera) const {
+    ThreadPool pool(_settings.nThreads);
+    int nBlocks = (camera.imageHeight + _settings.blockRows - 1) / _settings.blockRows;
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastFlush = start;
+    std::mutex printMutex;
+    int blocksDone = 0;
+    RayCounters counters;
+
+    pool.parallelFor(0, nBlocks, 1, [&](int first, int last) {
+        for (int b = first; b < last; b++) {
+            RayCounters blockCounters;
+            renderBlock(camera, b * _settings.blockRows, std::min((b + 1) * _settings.blockRows, camera.imageHeight), blockCounters);
+
+            // print progress every 0.5 s
+            std::lock_guard<std::mutex> lock(printMutex);
+            counters += blockCounters;
+            blocksDone++;
+            if (std::chrono::duration<float>(std::chrono::steady_clock::now() - lastFlush).count() > 0.5f) {
+                std::cout << "\rdrawn " << blocksDone << "/" << nBlocks << " blocks of rows" << std::flush;
+                lastFlush = std::chrono::steady_clock::now();
+            }
+        }
+    });
+
+    auto end = std::chrono::steady_clock::now();
+    float seconds = std::chrono::duration<float>(end - start).count();
+
+    std::cout << "\rimage drawn in " << std::fixed << std::setprecision(2) << seconds << " s using " << pool.size() << " threads                 \n"
+              << "traced " << counters.cameraRays << " camera, " << counters.secondaryRays << " secondary and " << counters.shadowRays << " shadow rays, "
+              << counters.totalRays() * 1e-6f / seconds << " Mrays/s overall, "
+              << (counters.cameraRays + counters.secondaryRays) * 1e-6 / std::max(counters.extendSeconds, 1e-9) << " Mrays/s per thread in the extend stage"
+              << (_settings.reorderRays ? " (rays reordered)" : "") << std::endl;
+
+    return counters;
+}
+
+void WavefrontRenderer::renderBlock(Camera& camera, int firstRow, int lastRow, RayCounters& counters) const {
+    int nPixels = (lastRow - firstRow) * camera.imageWidth;
+    int64_t totalSamples = static_cast<int64_t>(nPixels) * _settings.samplesPerPixel;
+    int capacity = static_cast<int>(std::min<int64_t>(_settings.queueSize, totalSamples));
+
+    PathStates paths;
+    paths.resize(capacity);
+
+    std::vector<int> active, freeSlots(capacity);
+    for (int i = 0; i < capacity; i++) freeSlots[i] = capacity - 1 - i; // the first slots are used first
+    active.reserve(capacity);
+
+    ShadowQueue shadowQueue;
+    std::vector<Color> radiance(nPixels);
+    std::vector<uint64_t> keys;
+    int64_t nextSample = 0;
+
+    while (nextSample < totalSamples || !active.empty()) {
+        int nActive = static_cast<int>(active.size());
+        generate(camera, firstRow, paths, active, freeSlots, nextSample, totalSamples);
+        counters.cameraRays += static_cast<int64_t>(active.size()) - nActive;
+        counters.secondaryRays += nActive;
+
+        auto start = std::chrono::steady_clock::now();
+        if (_settings.reorderRays) reorder(paths, active, keys);
+        extend(paths, active);
+        counters.extendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        shade(paths, active, freeSlots, radiance, shadowQueue);
+        shadow(shadowQueue, radiance);
+        counters.shadowRays += shadowQueue.size();
+    }
+
+    for (int p = 0; p < nPixels; p++) {
+        camera.image.setPixel(p % camera.imageWidth, firstRow + p / camera.imageWidth, radiance[p] * (1.0f / _settings.samplesPerPixel));
+    }
+}
+
+void WavefrontRenderer::generate(const Camera& camera, int firstRow, PathStates& paths, std::vector<int>& active, std::vector<int>& freeSlots,
+                                 int64_t& nextSample, int64_t totalSamples) const {
+    int spp = _settings.samplesPerPixel;
+    int root = std::round(std::sqrt(spp));
+    bool stratified = (root * root == spp);
+
+    while (!freeSlots.empty() && nextSample < totalSamples) {
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        int pixel = static_cast<int>(nextSample / spp), sample = static_cast<int>(nextSample % spp);
+        int i = pixel % camera.imageWidth, j = firstRow + pixel / camera.imageWidth;
+        nextSample++;
+
+        // seeded with the global index of the sample, so the image doesn't depend on how it's split in blocks
+        PCG pcg(_settings.seed + (static_cast<uint64_t>(j) * camera.imageWidth + i) * spp + sample, _settings.sequence);
+
+        float uPixel = 0.5f, vPixel = 0.5f;
+        if (spp > 1 && stratified) {
+            uPixel = (sample % root + pcg.random()) / root;
+            vPixel = (sample / root + pcg.random()) / root;
+        } else if (spp > 1) {
+            uPixel = pcg.random(), vPixel = pcg.random();
+        }
+
+        paths.setRay(slot, camera.castRay(i, j, uPixel, vPixel));
+        paths.throughputR[slot] = paths.throughputG[slot] = paths.throughputB[slot] = 1.0f;
+        paths.pixel[slot] = pixel;
+        paths.setRng(slot, pcg);
+        active.push_back(slot);
+    }
+}
+
+void WavefrontRenderer::reorder(const PathStates& paths, std::vector<int>& active, std::vector<uint64_t>& keys) const {
+    if (active.size() < 2) return;
+
+    // the origins are quantized inside their bounding box, so the Morton codes use all of their bits
+    float min[3] = {INF, INF, INF}, max[3] = {-INF, -INF, -INF};
+    for (int i : active) {
+        min[0] = std::min(min[0], paths.ox[i]), max[0] = std::max(max[0], paths.ox[i]);
+        min[1] = std::min(min[1], paths.oy[i]), max[1] = std::max(max[1], paths.oy[i]);
+        min[2] = std::min(min[2], paths.oz[i]), max[2] = std::max(max[2], paths.oz[i]);
+    }
+    float scale[3];
+    for (int k = 0; k < 3; k++) scale[k] = (max[k] > min[k]) ? 1023.0f / (max[k] - min[k]) : 0.0f;
+
+    // key: 3 bits of direction octant, 30 bits of Morton code, then 31 bits of slot index to sort everything in one go
+    keys.clear();
+    for (int i : active) {
+        uint64_t octant = (paths.dx[i] < 0.0f) << 2 | (paths.dy[i] < 0.0f) << 1 | (paths.dz[i] < 0.0f);
+        uint32_t code = mortonCode(static_cast<uint32_t>((paths.ox[i] - min[0]) * scale[0]),
+                                   static_cast<uint32_t>((paths.oy[i] - min[1]) * scale[1]),
+                                   static_cast<uint32_t>((paths.oz[i] - min[2]) * scale[2]));
+        keys.push_back((octant << 61) | (static_cast<uint64_t>(code) << 31) | static_cast<uint64_t>(i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (size_t k = 0; k < keys.size(); k++) active[k] = static_cast<int>(keys[k] & 0x7fffffffu);
+}
+
+void WavefrontRenderer::extend(PathStates& paths, const std::vector<int>& active) const {
+    for (int i : active) {
+        HitRecord rec;
+        if (!_world.isHit(paths.ray(i), rec)) {
+            paths.material[i] = nullptr;
+            continue;
+        }
+
+        paths.material[i] = rec.material.get();
+        paths.px[i] = rec.worldPoint.x, paths.py[i] = rec.worldPoint.y, paths.pz[i] = rec.worldPoint.z;
+        paths.nx[i] = rec.normal.x, paths.ny[i] = rec.normal.y, paths.nz[i] = rec.normal.z;
+        paths.u[i] = rec.surfacePoint.u, paths.v[i] = rec.surfacePoint.v;
+        paths.isInside[i] = rec.isInside;
+    }
+}
+
+void WavefrontRenderer::shade(PathStates& paths, std::vector<int>& active, std::vector<int>& freeSlots, std::vector<Color>& radiance,
+                              ShadowQueue& shadowQueue) const {
+    // group the paths by material (misses first), so that each material is shaded in one go
+    std::sort(active.begin(), active.end(), [&paths](int a, int b) { return std::less<Material*>()(paths.material[a], paths.material[b]); });
+
+    int survivors = 0;
+    shadowQueue.clear();
+
+    for (int i : active) {
+        Color throughput(paths.throughputR[i], paths.throughputG[i], paths.throughputB[i]);
+        Material* material = paths.material[i];
+
+        if (material == nullptr) {
+            radiance[paths.pixel[i]] += throughput * _world.backgroundColor;
+            freeSlots.push_back(i);
+            continue;
+        }
+
+        Vec2 uv(paths.u[i], paths.v[i]);
+        Color hitColor = material->color(uv);
+        radiance[paths.pixel[i]] += throughput * material->emittedColor(uv);
+
+        // direct light from the point lights, same as Renderers::PointLight
+        Point3 hitPoint(paths.px[i], paths.py[i], paths.pz[i]);
+        Normal3 normal(paths.nx[i], paths.ny[i], paths.nz[i]);
+        for (const auto& light : _world.pointLights) {
+            Vec3 distanceVec = hitPoint - light.position;
+            float distance = distanceVec.norm();
+            float cosTheta = dot(normal, -distanceVec / distance);
+            if (cosTheta <= 0.0f) continue;
+
+            float distanceFactor = (light.linearRadius > 0.0f) ? (light.linearRadius / distance) * (light.linearRadius / distance) : 1.0f;
+            float thetaIn = std::acos(cosTheta);
+            float thetaOut = std::acos(dot(normal, -Vec3(paths.dx[i], paths.dy[i], paths.dz[i]).normalize()));
+
+            Color brdf = material->eval(uv, thetaIn, thetaOut);
+            shadowQueue.push(hitPoint, light.position, throughput * brdf * light.color * cosTheta * distanceFactor, paths.pixel[i]);
+        }
+
+        float hitColorLuminosity = std::max({hitColor.r, hitColor.g, hitColor.b});
+        int depth = paths.depth[i];
+        PCG pcg = paths.rng(i);
+
+        // russian roulette
+        if (depth >= _settings.russianRouletteLimit) {
+            float q = std::max(0.05f, 1.0f - hitColorLuminosity);
+            if (pcg.random() > q) {
+                hitColor *= 1.0f / (1.0f - q);
+            } else {
+                freeSlots.push_back(i);
+                continue;
+            }
+        }
+
+        if (hitColorLuminosity <= 0.0f || depth + 1 > _settings.maxDepth) {
+            freeSlots.push_back(i);
+            continue;
+        }
+
+        Ray newRay = material->scatterRay(pcg, paths.hitRecord(i), depth + 1);
+        paths.setRay(i, newRay);
+        throughput = throughput * hitColor;
+        paths.throughputR[i] = throughput.r, paths.throughputG[i] = throughput.g, paths.throughputB[i] = throughput.b;
+        paths.setRng(i, pcg);
+
+        active[survivors++] = i; // compact the queue in place, survivors are never ahead of i
+    }
+
+    active.resize(survivors);
+}
+
+void WavefrontRenderer::shadow(const ShadowQueue& shadowQueue, std::vector<Color>& radiance) const {
+    for (int k = 0; k < shadowQueue.size(); k++) {
+        if (_world.isPointVisible(shadowQueue.to[k], shadowQueue.from[k])) {
+            radiance[shadowQueue.pixel[k]] += shadowQueue.contribution[k];
+        }
+    }
+}
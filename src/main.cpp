@@ -1,14 +1,34 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
 #include "Camera.hpp"
 #include "World.hpp"
 #include "renderers.hpp"
 #include "scenefile.hpp"
+#include "WavefrontRenderer.hpp"
+#include "ThreadPool.hpp"
 #include "CLI11.hpp"
 
 
 
 // Render command to generate images from scene files, see below for implementation
-void render(const  std::string& input, const std::string& output, int width, float aspectRatio, float a, float gamma, float luminosity, uint64_t seed, uint64_t sequence,
-            const std::vector<std::string>& floatBuffer, const std::string& algorithm, int AAsamples, int nRays, int maxDepth, int russianRouletteLimit);
+void render(const  std::string& input, const std::vector<std::string>& outputs, int width, float aspectRatio, float a, float gamma, float luminosity, uint64_t seed, uint64_t sequence,
+            const std::vector<std::string>& floatBuffer, const std::string& algorithm, int AAsamples, int nRays, int maxDepth, int russianRouletteLimit,
+            int packetSide, int nThreads, bool reorderRays, bool compactBVH, bool compactShapes, bool bvhCache, bool printStats, const std::string& bvhPreset, const std::string& accel, int nFrames, const std::string& animation, const std::string& hdrFormat);
+
+// Memory used by the shapes of a scene, see below for implementation
+void printMemoryStats(const Scene& scene);
+
+// Compile command to save scene files in binary form, see below for implementation
+void compile(const std::string& input, std::string output, const std::vector<std::string>& floatBuffer);
+
+// Convert command to tone map one or many PFM files, see below for implementation
+bool convert(const std::vector<std::string>& inputs, const std::string& output, float a, float gamma, float luminosity, bool sameLuminosity, int nThreads);
 
 
 
@@ -17,27 +37,39 @@ int main(int argc, char* argv[]) {
 
     std::string inputFile, outputFile = "image.png";
     float a = 1.0f, gamma = 1.0f, luminosity = 0.0f;
+    int nThreads = 0;
 
     // Convert Command
-    auto convertCommand = app.add_subcommand("convert", "Convert a .pfm file to another format.");
-    convertCommand->add_option("input,-i,--input", inputFile, "Input .pfm file.")->required()->check(CLI::ExistingPath);
-    convertCommand->add_option("a,-a,--normalization", a, "Normalization factor.")->required()->check(CLI::PositiveNumber);
-    convertCommand->add_option("gamma,-g,--gamma", gamma, "Gamma correction factor.")->required()->check(CLI::PositiveNumber);
-    convertCommand->add_option("output,-o,--output", outputFile, "Output image file.")->required();
+    std::vector<std::string> inputFiles;
+    bool sameLuminosity = false;
+    auto convertCommand = app.add_subcommand("convert", "Convert HDR images to another format: convert <inputs...> <normalization> <gamma> <output>.");
+    convertCommand->add_option("input,-i,--input", inputFiles, "Input .pfm, .hdr (RGBE) or .exr (uncompressed OpenEXR) files, or patterns in quotes with * and ? in the file name, as \"frames/*.pfm\", "
+                               "followed by the normalization, gamma and output not given with their options.")->required();
+    auto normalizationOption = convertCommand->add_option("-a,--normalization", a, "Normalization factor.")->check(CLI::PositiveNumber);
+    auto gammaOption = convertCommand->add_option("-g,--gamma", gamma, "Gamma correction factor.")->check(CLI::PositiveNumber);
+    auto outputOption = convertCommand->add_option("-o,--output", outputFile, "Output image file. With many inputs, {} is replaced by the name of each one without the extension, as in \"png/{}.png\".");
     convertCommand->add_option("-l,--luminosity", luminosity, "Manually set the luminosity of the image, useful if it's dark.")->check(CLI::NonNegativeNumber);
+    convertCommand->add_option("-t,--threads", nThreads, "Number of files converted at the same time, and of threads used for the luminosity and the tone mapping, defaults to 0 (one per hardware thread).")->check(CLI::NonNegativeNumber);
+    convertCommand->add_flag("--same-luminosity", sameLuminosity, "With many inputs, normalize all of them with the average luminosity of the whole set, as for the frames of an animation, instead of each with its own.");
 
     // Render Command
     int nRays = 3, maxDepth = 5, russianRouletteLimit = 3, AAsamples = 4;
-    std::string algorithm = "path";
+    std::string algorithm = "path", bvhPreset = "sah", accel = "bvh", hdrFormat = "pfm";
     int imageWidth = 0;
     float aspectRatio = 0.0f;
-    std::vector<std::string> floatBuffer{};
+    std::vector<std::string> floatBuffer{}, outputTargets;
+    std::string animation;
     std::unordered_map<std::string, float> floatVariables;
     uint64_t seed = 42, sequence = 54;
+    int packetSide = 0, nFrames = 1;
+    bool reorderRays = false, compactBVH = false, compactShapes = false, bvhCache = false, printStats = false;
 
     auto renderCommand = app.add_subcommand("render", "Generate a ray-traced image.");
-    renderCommand->add_option("input,-i,--input", inputFile, "Input .txt file describing the scene to render.")->required()->check(CLI::ExistingPath);
-    renderCommand->add_option("output,-o,--output", outputFile, "Output file for the rendered .png or .jpeg image, a .pfm image with the same file name is always saved.");
+    renderCommand->add_option("input,-i,--input", inputFile, "Input .txt file describing the scene to render, or the same scene compiled with the compile command.")->required()->check(CLI::ExistingPath);
+    renderCommand->add_option("output,-o,--output", outputTargets, "Output images, defaults to image.png. Each one is file[:normalization[:gamma]], the numbers default to the ones of -a and -g, and \"-\" is a PFM image on the standard output; "
+                                                                  ".png and .jpg images are normalized, clamped and gamma corrected, .pfm, .hdr and .exr ones are saved as rendered, unless a normalization is given for them. "
+                                                                  "All of them are written from a single pass over the rendered image, at the same time. Without HDR outputs, one with the name of the first output is saved too (see --hdr-format).");
+    renderCommand->add_option("--hdr-format", hdrFormat, "Format of the HDR image saved with the outputs if none of them is: \"pfm\" (default, 12 bytes per pixel), \"hdr\" (Radiance RGBE, at most 4 bytes per pixel) or \"exr\" (OpenEXR half floats, 6 bytes per pixel).")->check(CLI::IsMember({"pfm", "hdr", "exr"}));
     renderCommand->add_option("-w,--width", imageWidth, "Width of the output image in pixels, overwrites the one defined for the camera.")->check(CLI::PositiveNumber);
     renderCommand->add_option("-r,--aspect-ratio", aspectRatio, "Aspect ratio of the output image, overwrites the one defined for the camera.")->check(CLI::PositiveNumber);
     renderCommand->add_option("-a,--norm", a, "Output image normalization factor, defaults to 1.")->check(CLI::PositiveNumber);
@@ -47,26 +79,72 @@ int main(int argc, char* argv[]) {
     renderCommand->add_option("-n,--ray-number", nRays, "Path tracer only, number of rays sent from every hit point, defaults to 3.")->check(CLI::PositiveNumber);
     renderCommand->add_option("-d,--max-depth", maxDepth, "Path tracer only, maximum ray depth, defaults to 5.")->check(CLI::PositiveNumber);
     renderCommand->add_option("-L,--rr-limit", russianRouletteLimit, "Path tracer only, ray depth where russian roulette starts. If it's bigger the max-depth, russian roulette will never start. Defaults to 3.")->check(CLI::NonNegativeNumber);
-    renderCommand->add_option("-R,--algo", algorithm, "Algorithm to use for rendering: \"path\" (path tracing, default), \"onoff\", \"flat\", \"light\" (point light tracer).")->check(CLI::IsMember({"path", "onoff", "flat", "light"}));
+    renderCommand->add_option("-R,--algo", algorithm, "Algorithm to use for rendering: \"path\" (path tracing, default), \"onoff\", \"flat\", \"light\" (point light tracer), \"wavefront\" (path tracing on many threads, with AA-samples * ray-number single-ray paths per pixel and direct light from the point lights).")->check(CLI::IsMember({"path", "onoff", "flat", "light", "wavefront"}));
     renderCommand->add_option("-f,--float", floatBuffer, "Declare named float variables, overwrites the ones with the same name in the input file. Syntax: name:value.");
     renderCommand->add_option("--seed", seed, "Seed of the random number generator, defaults to 42.")->check(CLI::NonNegativeNumber);
     renderCommand->add_option("--sequence", sequence, "Sequence identifier of the random number generator, defaults to 54.")->check(CLI::NonNegativeNumber);
+    renderCommand->add_option("-P,--packets", packetSide, "Trace the first rays in packets, one for each square tile of this side in pixels (4 or 8). Defaults to 0, rays are traced one by one.")->check(CLI::IsMember({0, 4, 8}));
+    renderCommand->add_option("-t,--threads", nThreads, "Number of threads used by the wavefront renderer, to build the accelerator and for the tone mapping, defaults to 0 (one per hardware thread).")->check(CLI::NonNegativeNumber);
+    renderCommand->add_flag("--reorder", reorderRays, "Wavefront only, sort the rays by direction and origin before tracing them, to make memory accesses more coherent.");
+    renderCommand->add_flag("--compact-bvh", compactBVH, "Use a BVH with quantized boxes, taking about half the memory.");
+    renderCommand->add_flag("--compact-shapes", compactShapes, "Keep the spheres as compact records instead of objects, taking about a third of the memory, for scenes with millions of them. They can't be animated.");
+    renderCommand->add_flag("--stats", printStats, "Print the memory used by the shapes and the accelerator, in bytes per shape, and the peak memory used.");
+    renderCommand->add_flag("--bvh-cache", bvhCache, "Save the BVH next to the input file, with the .bvh extension added, and load it from there the next time if the shapes and the BVH preset didn't change.");
+    renderCommand->add_option("--frames", nFrames, "Number of frames to render, saved with the frame number after the file name. The scene file is read again for every frame, without reading the meshes or building their BVHs and the ones of the groups, then the BVH is refitted instead of built again. Defaults to 1.")->check(CLI::PositiveNumber);
+    renderCommand->add_option("--animate", animation, "Float variable changing from the first to the last frame, overwrites the one with the same name in the input file. Syntax: name:start:end.");
+    renderCommand->add_option("--bvh", bvhPreset, "How to build the BVH: \"sah\" (surface area heuristic, default) or \"lbvh\" (sorting by Morton code, faster to build, slower to render).")->check(CLI::IsMember({"sah", "lbvh"}));
+    renderCommand->add_option("--accel", accel, "Spatial index of the shapes: \"bvh\" (default), \"grid\" (uniform grid, can be faster on dense scenes of shapes of similar size) or \"linear\" (none, for a few shapes). The build time and the memory used are printed.")->check(CLI::IsMember({"linear", "bvh", "grid"}));
+
+
+
+    // Compile Command
+    std::string compiledFile;
+    auto compileCommand = app.add_subcommand("compile", "Save a scene file in binary form, much faster to read for big scenes. The result can be given to render instead of the .txt file.");
+    compileCommand->add_option("input,-i,--input", inputFile, "Input .txt file describing the scene.")->required()->check(CLI::ExistingPath);
+    compileCommand->add_option("output,-o,--output", compiledFile, "Output file, defaults to the input file with the .rtscene extension.");
+    compileCommand->add_option("-f,--float", floatBuffer, "Declare named float variables, overwrites the ones with the same name in the input file. Syntax: name:value. The values are fixed in the compiled scene.");
 
 
 
     CLI11_PARSE(app, argc, argv);
 
     if (*convertCommand) {
-        HDRImage image(inputFile);
-        image.normalize(a, luminosity);
-        image.clamp();
-        image.save(outputFile, gamma);
+        // the positional normalization, gamma and output come after any number of inputs, so they are taken from the end
+        auto positional = [&](CLI::Option* option) {
+            if (option->count() > 0) return false;
+            if (inputFiles.size() < 2) {
+                std::cout << option->get_name() << " is required\nRun with --help for more information." << std::endl;
+                exit(-1);
+            }
+            return true;
+        };
+        auto positiveNumber = [&](float& value, CLI::Option* option) {
+            if (!positional(option)) return;
+            if (!CLI::detail::lexical_cast(inputFiles.back(), value) || !(value > 0.0f)) {
+                std::cout << option->get_name() << ": \"" << inputFiles.back() << "\" is not a positive number" << std::endl;
+                exit(-1);
+            }
+            inputFiles.pop_back();
+        };
+        if (positional(outputOption)) outputFile = inputFiles.back(), inputFiles.pop_back();
+        positiveNumber(gamma, gammaOption);
+        positiveNumber(a, normalizationOption);
+
+        // with the image on the standard output, the messages go to the standard error
+        if (outputFile == "-") std::cout.rdbuf(std::cerr.rdbuf());
+
+        if (!convert(inputFiles, outputFile, a, gamma, luminosity, sameLuminosity, nThreads)) return 1;
     }
     else if (*renderCommand) {
-        render(inputFile, outputFile, imageWidth, aspectRatio, a, gamma, luminosity, seed, sequence, floatBuffer, algorithm, AAsamples, nRays, maxDepth, russianRouletteLimit);
+        if (outputTargets.empty()) outputTargets.push_back(outputFile);
+        render(inputFile, outputTargets, imageWidth, aspectRatio, a, gamma, luminosity, seed, sequence, floatBuffer, algorithm, AAsamples, nRays, maxDepth, russianRouletteLimit,
+               packetSide, nThreads, reorderRays, compactBVH, compactShapes, bvhCache, printStats, bvhPreset, accel, nFrames, animation, hdrFormat);
+    }
+    else if (*compileCommand) {
+        compile(inputFile, compiledFile, floatBuffer);
     }
     else {
-        std::cout << "Program usage: " << argv[0] << " [render or convert]\n"
+        std::cout << "Program usage: " << argv[0] << " [render, convert or compile]\n"
                   << "Run with --help for more information." << std::endl; 
     }
 
@@ -75,19 +153,91 @@ int main(int argc, char* argv[]) {
 
 
 
-void render(const  std::string& input, const std::string& output, int width, float aspectRatio, float a, float gamma, float luminosity, uint64_t seed, uint64_t sequence,
-            const std::vector<std::string>& floatBuffer, const std::string& algorithm, int AAsamples, int nRays, int maxDepth, int russianRouletteLimit) {
+void render(const  std::string& input, const std::vector<std::string>& outputs, int width, float aspectRatio, float a, float gamma, float luminosity, uint64_t seed, uint64_t sequence,
+            const std::vector<std::string>& floatBuffer, const std::string& algorithm, int AAsamples, int nRays, int maxDepth, int russianRouletteLimit,
+            int packetSide, int nThreads, bool reorderRays, bool compactBVH, bool compactShapes, bool bvhCache, bool printStats, const std::string& bvhPreset, const std::string& accel, int nFrames, const std::string& animation, const std::string& hdrFormat) {
 
     std::unordered_map<std::string, float> floatVariables;
     for (auto s : floatBuffer) {
         validateFloatVariable(s, floatVariables);
     }
 
-    Scene scene(input, floatVariables);
+    std::string animated;
+    float start = 0.0f, end = 0.0f;
+    if (!animation.empty()) {
+        validateAnimation(animation, animated, start, end);
+        floatVariables[animated] = start;
+    }
+
+    // the output images, with their normalization (0 for the one of -a, or for none in HDR formats) and gamma
+    struct Target {
+        std::filesystem::path path;
+        float a, gamma;
+        bool highDynamicRange;
+    };
+    std::vector<Target> targets;
+    bool anyHighDynamicRange = false;
+    for (const auto& output : outputs) {
+        std::string fileName;
+        Target target{"", 0.0f, gamma, false};
+        validateOutputTarget(output, fileName, target.a, target.gamma);
+        target.path = fileName;
+
+        std::string extension = (fileName == "-") ? ".pfm" : target.path.extension().string(); // a PFM image on the standard output
+        if (extension != ".png" && extension != ".jpg" && extension != ".jpeg" && extension != ".pfm" && extension != ".hdr" && extension != ".exr") {
+            std::cout << "ERROR: file extension \"" << extension << "\" of \"" << fileName << "\" is not supported, use .png, .jpg, .pfm, .hdr or .exr" << std::endl;
+            exit(-1);
+        }
+        for (const auto& other : targets) {
+            if (other.path == target.path) {
+                std::cout << "ERROR: \"" << fileName << "\" is given as output more than once" << std::endl;
+                exit(-1);
+            }
+        }
+        target.highDynamicRange = (extension == ".pfm" || extension == ".hdr" || extension == ".exr");
+        anyHighDynamicRange = anyHighDynamicRange || target.highDynamicRange;
+        targets.push_back(target);
+    }
+
+    // with an image on the standard output, the messages go to the standard error
+    if (std::any_of(targets.begin(), targets.end(), [](const Target& target) { return target.path == "-"; })) std::cout.rdbuf(std::cerr.rdbuf());
+
+    World::BuildSettings buildSettings;
+    buildSettings.accelerator = accel == "grid" ? Accelerator::Type::Grid : accel == "linear" ? Accelerator::Type::Linear : Accelerator::Type::BVH;
+    buildSettings.preset = bvhPreset == "lbvh" ? BVH::Preset::LBVH : BVH::Preset::SAH;
+    buildSettings.compact = compactBVH;
+    buildSettings.compactShapes = compactShapes;
+    buildSettings.nThreads = nThreads;
+    if (bvhCache) buildSettings.cachePath = input + ".bvh";
+
+    if (compactShapes && nFrames > 1) {
+        std::cout << "ERROR: compact shapes can't be animated" << std::endl;
+        exit(-1);
+    }
+    bool compiled = CompiledScene::isCompiled(input);
+    if (compiled && nFrames > 1) {
+        std::cout << "ERROR: animations need the text of the scene, not a compiled one" << std::endl;
+        exit(-1);
+    }
+    if (compiled && !floatVariables.empty())
+        std::cout << "WARNING: the float variables are ignored, the values in a compiled scene are fixed when compiling" << std::endl;
+
+    auto readStart = std::chrono::steady_clock::now();
+    Scene scene(input, floatVariables, buildSettings);
+    double readSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - readStart).count() - scene.world.buildStats().seconds;
+    std::cout << (compiled ? "compiled scene" : "scene") << " read in " << readSeconds << " s" << std::endl;
+    if (scene.world.isBuilt()) {
+        const World::BuildStats& stats = scene.world.buildStats();
+        if (accel == "bvh") std::cout << "BVH (" << bvhPreset << ") " << (stats.cached ? "loaded from cache" : "built");
+        else std::cout << "accelerator \"" << accel << "\" built";
+        std::cout << " in " << stats.seconds << " s, " << stats.memory / 1e6 << " MB";
+        if (accel == "bvh") std::cout << ", SAH cost " << stats.sahCost;
+        std::cout << std::endl;
+    }
+    if (printStats) printMemoryStats(scene);
 
     if (scene.camera == nullptr) // default camera
         scene.camera = std::make_shared<Camera>("perspective", 1., 100, 1., translation(-1., 0., 0.));
-    scene.camera->pcg = PCG(seed, sequence);
 
     // reshape the image from terminal
     if (aspectRatio > 0.) scene.camera->aspectRatio = aspectRatio;
@@ -97,22 +247,270 @@ void render(const  std::string& input, const std::string& output, int width, flo
         scene.camera->image = HDRImage(scene.camera->imageWidth, scene.camera->imageHeight);
     }
 
-    if (algorithm == "path")
-        scene.camera->render(Renderers::PathTracer, AAsamples, scene.world, scene.camera->pcg, nRays, maxDepth, russianRouletteLimit);
-    else if (algorithm == "onoff")
-        scene.camera->render(Renderers::OnOff, AAsamples, scene.world);
-    else if (algorithm == "flat")
-        scene.camera->render(Renderers::Flat, AAsamples, scene.world);
-    else if (algorithm == "light")
-        scene.camera->render(Renderers::PointLight, AAsamples, scene.world);
-    else {
-        std::cout << "ERROR: \"" + algorithm + "\" is not a supported rendering algorithm\n" +
-                     "supported algorithms are: \"path\", \"onoff\", \"flat\", \"light\", see --help for more information" << std::endl;
-        exit(-1);
+    for (int frame = 0; frame < nFrames; frame++) {
+        if (frame > 0) {
+            // read the scene again with the new value, and move the shapes of the old one
+            if (!animated.empty()) floatVariables[animated] = start + (end - start) * frame / (nFrames - 1);
+            auto begin = std::chrono::steady_clock::now();
+
+            std::ifstream file(input);
+            InputStream stream(file, input);
+            Scene next;
+            next.buildWorld = false;
+            next.parse(stream, floatVariables);
+            if (!scene.animate(next)) {
+                std::cout << "ERROR: the shapes in the scene changed in frame " << frame << ", only their transformations can change" << std::endl;
+                exit(-1);
+            }
+
+            std::cout << "frame " << frame << ": scene updated in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() << " s ("
+                      << (scene.world.buildStats().refits > 0 ? "accelerator refitted" : "accelerator built again") << ", "
+                      << 1000.0 * scene.world.buildStats().seconds << " ms), SAH cost " << scene.world.buildStats().sahCost << std::endl;
+            scene.camera->image = HDRImage(scene.camera->imageWidth, scene.camera->imageHeight);
+        }
+        scene.camera->pcg = PCG(seed, sequence);
+        auto renderStart = std::chrono::steady_clock::now();
+
+        if (algorithm == "wavefront") {
+            WavefrontRenderer::Settings settings;
+            settings.samplesPerPixel = AAsamples * nRays;
+            settings.maxDepth = maxDepth;
+            settings.russianRouletteLimit = russianRouletteLimit;
+            settings.nThreads = nThreads;
+            settings.seed = seed, settings.sequence = sequence;
+            settings.reorderRays = reorderRays;
+            WavefrontRenderer(scene.world, settings).render(*scene.camera);
+        }
+        else if (packetSide > 0) {
+            if (algorithm == "path")
+                scene.camera->renderPackets(Renderers::FromHit::PathTracer, packetSide, AAsamples, scene.world, scene.camera->pcg, nRays, maxDepth, russianRouletteLimit);
+            else if (algorithm == "onoff")
+                scene.camera->renderPackets(Renderers::FromHit::OnOff, packetSide, AAsamples, scene.world);
+            else if (algorithm == "flat")
+                scene.camera->renderPackets(Renderers::FromHit::Flat, packetSide, AAsamples, scene.world);
+            else if (algorithm == "light")
+                scene.camera->renderPackets(Renderers::FromHit::PointLight, packetSide, AAsamples, scene.world);
+        }
+        else if (algorithm == "path")
+            scene.camera->render(Renderers::PathTracer, AAsamples, scene.world, scene.camera->pcg, nRays, maxDepth, russianRouletteLimit);
+        else if (algorithm == "onoff")
+            scene.camera->render(Renderers::OnOff, AAsamples, scene.world);
+        else if (algorithm == "flat")
+            scene.camera->render(Renderers::Flat, AAsamples, scene.world);
+        else if (algorithm == "light")
+            scene.camera->render(Renderers::PointLight, AAsamples, scene.world);
+        else {
+            std::cout << "ERROR: \"" + algorithm + "\" is not a supported rendering algorithm\n" +
+                         "supported algorithms are: \"path\", \"onoff\", \"flat\", \"light\", \"wavefront\", see --help for more information" << std::endl;
+            exit(-1);
+        }
+
+        double renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+        std::cout << "rendered in " << renderSeconds << " s, " << 1e-6 * scene.camera->imageWidth * scene.camera->imageHeight * AAsamples / renderSeconds
+                  << " M camera rays/s" << std::endl;
+
+        // image_0001.png, ... for animations
+        auto framePath = [&](std::filesystem::path path) {
+            if (nFrames > 1 && path != "-") { // the frames follow one another on the standard output
+                std::ostringstream number;
+                number << "_" << std::setw(4) << std::setfill('0') << frame;
+                path.replace_filename(path.stem().string() + number.str() + path.extension().string());
+            }
+            return path;
+        };
+
+        // all the outputs from a single pass over the rendered image, which is left as it is:
+        // the 8-bit ones are normalized, clamped and quantized, the HDR ones normalized only if asked to
+        HDRImage& image = scene.camera->image;
+        ThreadPool pool(nThreads);
+        float frameLuminosity = 0.0f;
+        auto scale = [&](float targetA) {
+            if (frameLuminosity == 0.0f) frameLuminosity = (luminosity == 0.0f) ? image.averageLuminosity(1e-10f, &pool) : luminosity;
+            return targetA / frameLuminosity;
+        };
+        std::vector<HDRImage::Output> imageOutputs;
+        if (!anyHighDynamicRange) imageOutputs.push_back({framePath(targets[0].path).stem().string() + "." + hdrFormat, 1.0f, 1.0f, false});
+        for (const auto& target : targets) {
+            if (target.highDynamicRange) imageOutputs.push_back({framePath(target.path).string(), target.a > 0.0f ? scale(target.a) : 1.0f, target.gamma, false});
+            else imageOutputs.push_back({framePath(target.path).string(), scale(target.a > 0.0f ? target.a : a), target.gamma, true});
+        }
+        image.saveToneMapped(imageOutputs, &pool);
+    }
+}
+
+
+
+void compile(const std::string& input, std::string output, const std::vector<std::string>& floatBuffer) {
+    std::unordered_map<std::string, float> floatVariables;
+    for (auto s : floatBuffer) {
+        validateFloatVariable(s, floatVariables);
+    }
+    if (output.empty()) output = std::filesystem::path(input).replace_extension(".rtscene").string();
+
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream file(input);
+    InputStream stream(file, input);
+    Scene scene;
+    scene.buildWorld = false;
+    scene.compiled = std::make_shared<CompiledScene>();
+    scene.parse(stream, floatVariables);
+    scene.compiled->save(output);
+
+    std::cout << "compiled " << scene.compiled->shapes.size() << " shapes, " << scene.compiled->materials.size() << " materials, "
+              << scene.compiled->groups.size() << " groups and " << scene.compiled->lights.size() << " lights to \"" << output << "\" in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+}
+
+
+
+// matches a file name against a pattern with * (any characters) and ? (one character)
+bool matchesPattern(const std::string& name, const std::string& pattern) {
+    size_t n = 0, p = 0, starName = std::string::npos, star = std::string::npos;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) n++, p++;
+        else if (p < pattern.size() && pattern[p] == '*') star = p++, starName = n;
+        else if (star != std::string::npos) p = star + 1, n = ++starName; // the last * takes one more character
+        else return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+}
+
+// the files matching the patterns in the file names, in alphabetical order, the other inputs as they are
+std::vector<std::string> expandPatterns(const std::vector<std::string>& inputs) {
+    std::vector<std::string> files;
+    for (const auto& input : inputs) {
+        std::filesystem::path path(input);
+        std::string pattern = path.filename().string();
+        if (pattern.find_first_of("*?") == std::string::npos) {
+            files.push_back(input);
+            continue;
+        }
+
+        std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        std::vector<std::string> matches;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+            if (entry.is_regular_file() && matchesPattern(entry.path().filename().string(), pattern)) {
+                matches.push_back((path.has_parent_path() ? entry.path() : entry.path().filename()).string());
+            }
+        }
+        if (matches.empty()) std::cout << "WARNING: no file matches \"" << input << "\"" << std::endl;
+        std::sort(matches.begin(), matches.end());
+        files.insert(files.end(), matches.begin(), matches.end());
+    }
+    return files;
+}
+
+
+
+bool convert(const std::vector<std::string>& inputs, const std::string& output, float a, float gamma, float luminosity, bool sameLuminosity, int nThreads) {
+    std::vector<std::string> files = expandPatterns(inputs);
+    if (files.empty()) return false;
+
+    // {} in the output is replaced by the name of each input, the outputs must be different
+    std::vector<std::string> outputs;
+    std::set<std::string> names;
+    for (const auto& file : files) {
+        std::string name = output;
+        size_t position = name.find("{}");
+        if (position != std::string::npos) name.replace(position, 2, file == "-" ? "stdin" : std::filesystem::path(file).stem().string());
+        if (!names.insert(name).second) {
+            std::cout << "ERROR: more than one input would be saved to \"" << name << "\", put {} in the output to use their names" << std::endl;
+            return false;
+        }
+        outputs.push_back(name);
+    }
+
+    // the files are converted by the workers of the pool at the same time, so that while some wait for the disk
+    // the others use the processor; one file alone is split in rows among all of them
+    ThreadPool pool(nThreads);
+    std::mutex mutex;
+    std::vector<std::string> errors;
+    std::vector<char> failed(files.size(), false);
+    std::atomic<size_t> bytes(0), converted(0);
+    auto forFiles = [&](auto&& function) {
+        pool.parallelFor(0, static_cast<int>(files.size()), 1, [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                if (failed[k]) continue;
+                try {
+                    function(k);
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed[k] = true;
+                    errors.push_back("\"" + files[k] + "\": " + e.what());
+                }
+            }
+        });
+    };
+
+    // the standard input can't be mapped, it's read once and kept for both passes
+    if (std::count(files.begin(), files.end(), "-") > 1) {
+        std::cout << "ERROR: the standard input (\"-\") can be read only once" << std::endl;
+        return false;
+    }
+    std::optional<HDRImage> standardInput;
+    auto open = [&](int k, std::optional<HDRImage>& mapped) -> const HDRImage& {
+        if (files[k] == "-") {
+            if (!standardInput) standardInput.emplace(files[k]);
+            return *standardInput;
+        }
+        mapped.emplace(HDRImage::map(files[k]));
+        mapped->prefetch();
+        return *mapped;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if (sameLuminosity && luminosity == 0.0f) {
+        // the average of the logarithms over all the pixels, from the average of each file,
+        // added in the order of the files so that the result doesn't depend on the threads
+        std::vector<double> logs(files.size(), 0.0), pixels(files.size(), 0.0);
+        forFiles([&](int k) {
+            std::optional<HDRImage> mapped;
+            const HDRImage& image = open(k, mapped);
+            double n = static_cast<double>(image._width) * image._height;
+            logs[k] = n * std::log10(image.averageLuminosity(1e-10f, &pool)), pixels[k] = n;
+        });
+        double sum = std::accumulate(logs.begin(), logs.end(), 0.0);
+        luminosity = static_cast<float>(std::pow(10.0, sum / std::max(std::accumulate(pixels.begin(), pixels.end(), 0.0), 1.0)));
     }
+    forFiles([&](int k) {
+        std::optional<HDRImage> mapped;
+        const HDRImage& image = open(k, mapped);
+        float fileLuminosity = (luminosity == 0.0f) ? image.averageLuminosity(1e-10f, &pool) : luminosity;
+        image.saveToneMapped(outputs[k], a / fileLuminosity, gamma, &pool);
+        bytes += sizeof(Color) * static_cast<size_t>(image._width) * image._height;
+        converted++;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    scene.camera->image.save(std::filesystem::path(output).stem().string() + ".pfm"); // saves the rendered pfm
-    scene.camera->image.normalize(a, luminosity);
-    scene.camera->image.clamp();
-    scene.camera->image.save(output, gamma);
-}
\ No newline at end of file
+    for (const auto& error : errors) std::cout << "ERROR: " << error << std::endl;
+    std::cout << "converted " << converted << " of " << files.size() << " files, " << 1e-6 * bytes << " MB of pixels, in " << seconds << " s ("
+              << converted / seconds << " files/s, " << 1e-6 * bytes / seconds << " MB/s, " << pool.size() << " threads)" << std::endl;
+    return errors.empty();
+}
+
+
+
+void printMemoryStats(const Scene& scene) {
+    World::MemoryStats stats = scene.world.memoryStats();
+    for (const auto& [name, group] : scene.groups) stats += group->memoryStats();
+
+    std::set<const Material*> materials;
+    std::set<const Texture*> textures;
+    for (const auto& [name, material] : scene.materials) {
+        materials.insert(material.get());
+        textures.insert(material->texture().get()), textures.insert(material->emittedRadiance().get());
+    }
+
+    double perShape = 1.0 / std::max<size_t>(stats.shapes, 1);
+    std::cout << std::fixed << std::setprecision(1)
+              << "memory: " << stats.shapes << " shapes (" << stats.compactSpheres << " compact spheres), "
+              << stats.total() * perShape << " bytes per shape: " << stats.shapeBytes * perShape << " shape objects, "
+              << stats.sphereBytes * perShape << " sphere records, " << stats.indexBytes * perShape << " indices, "
+              << stats.acceleratorBytes * perShape << " accelerator" << std::endl
+              << "        " << materials.size() << " materials and " << textures.size() << " textures for " << scene.materials.size() << " names";
+    if (peakMemoryUsage() > 0) std::cout << ", peak resident memory " << peakMemoryUsage() / 1e6 << " MB";
+    std::cout << std::defaultfloat << std::endl;
+}
@@ -1,5 +1,10 @@
 #include "scenefile.hpp"
 
+#include <typeinfo>
+
+#include "ThreadPool.hpp"
+#include "MappedFile.hpp"
+
 // InputStream
 
 char InputStream::read() {
@@ -213,25 +218,47 @@ std::shared_ptr<Texture> Scene::parseTexture(InputStream& inputFile) {
 
     expectSymbol(inputFile, '(');
 
-    std::shared_ptr<Texture> result;
-
+    Color c1, c2;
+    int steps = 0;
+    std::string filename;
     if (kw == Keywords::UNIFORM) {
-        Color color = Scene::parseColor(inputFile);
-        result = std::make_shared<UniformTexture>(color);
+        c1 = Scene::parseColor(inputFile);
     } else if (kw == Keywords::CHECKERED) {
-        Color c1 = Scene::parseColor(inputFile);
+        c1 = Scene::parseColor(inputFile);
         expectSymbol(inputFile, ',');
-        Color c2 = Scene::parseColor(inputFile);
+        c2 = Scene::parseColor(inputFile);
         expectSymbol(inputFile, ',');
-        int steps = (int) expectNumber(inputFile);
-        result = std::make_shared<CheckeredTexture>(c1, c2, steps);
+        steps = (int) expectNumber(inputFile);
     } else {
-        std::string filename = expectString(inputFile);
-        result = std::make_shared<ImageTexture>(HDRImage(filename));
+        filename = expectString(inputFile);
     }
-
     expectSymbol(inputFile, ')');
-    return result;
+
+    // the same texture defined again is shared, an image is read only once
+    auto [it, added] = _textureTable.try_emplace({kw, c1.r, c1.g, c1.b, c2.r, c2.g, c2.b, steps, filename});
+    if (!added) return it->second;
+
+    CompiledScene::TextureRecord record{};
+    if (kw == Keywords::UNIFORM) {
+        it->second = std::make_shared<UniformTexture>(c1);
+        record = {CompiledScene::TextureType::Uniform, 0, {c1.r, c1.g, c1.b}};
+    } else if (kw == Keywords::CHECKERED) {
+        it->second = std::make_shared<CheckeredTexture>(c1, c2, steps);
+        record = {CompiledScene::TextureType::Checkered, steps, {c1.r, c1.g, c1.b}, {c2.r, c2.g, c2.b}};
+    } else {
+        try {
+            it->second = std::make_shared<ImageTexture>(HDRImage::map(filename));
+        } catch (...) {
+            _textureTable.erase(it);
+            throw;
+        }
+        if (compiled) record = {CompiledScene::TextureType::Image, 0, {}, {}, compiled->addString(filename)};
+    }
+    if (compiled) {
+        compiled->textureIndex[it->second.get()] = static_cast<uint32_t>(compiled->textures.size());
+        compiled->textures.push_back(record);
+    }
+    return it->second;
 }
 
 void Scene::parseMaterial(InputStream& inputFile) {
@@ -246,7 +273,7 @@ void Scene::parseMaterial(InputStream& inputFile) {
     std::shared_ptr<Texture> emittedRadiance = parseTexture(inputFile);
 
     float blur = 0.0f, thresholdAngle = 0.1f; // specular, default threshold is pi/1800 rad
-    float refractionIndex;                    // transparent
+    float refractionIndex = 1.0f;             // transparent
 
     if (kw == Keywords::SPECULAR) { // blur and trhreshold are not mandatory
         Token t = inputFile.readToken();
@@ -269,12 +296,25 @@ void Scene::parseMaterial(InputStream& inputFile) {
 
     expectSymbol(inputFile, ')'); // close the identifier
 
-    if (kw == Keywords::DIFFUSE)
-        materials[name] = std::make_shared<DiffuseMaterial>(texture, emittedRadiance);
-    else if (kw == Keywords::SPECULAR)
-        materials[name] = std::make_shared<SpecularMaterial>(texture, emittedRadiance, blur, degToRad(thresholdAngle));
-    else if (kw == Keywords::TRANSPARENT)
-        materials[name] = std::make_shared<TransparentMaterial>(texture, emittedRadiance, refractionIndex);
+    // materials defined in the same way share the same object, whatever their name
+    auto [it, added] = _materialTable.try_emplace({kw, texture.get(), emittedRadiance.get(), blur, thresholdAngle, refractionIndex});
+    if (added) {
+        if (kw == Keywords::DIFFUSE)
+            it->second = std::make_shared<DiffuseMaterial>(texture, emittedRadiance);
+        else if (kw == Keywords::SPECULAR)
+            it->second = std::make_shared<SpecularMaterial>(texture, emittedRadiance, blur, degToRad(thresholdAngle));
+        else if (kw == Keywords::TRANSPARENT)
+            it->second = std::make_shared<TransparentMaterial>(texture, emittedRadiance, refractionIndex);
+    }
+    materials[name] = it->second;
+
+    if (compiled) {
+        auto type = kw == Keywords::DIFFUSE ? CompiledScene::MaterialType::Diffuse
+                  : kw == Keywords::SPECULAR ? CompiledScene::MaterialType::Specular : CompiledScene::MaterialType::Transparent;
+        compiled->materialIndex[name] = static_cast<uint32_t>(compiled->materials.size());
+        compiled->materials.push_back({type, compiled->textureIndex[texture.get()], compiled->textureIndex[emittedRadiance.get()],
+                                       blur, thresholdAngle, refractionIndex, compiled->addString(name)});
+    }
 }
 
 Transformation Scene::parseTransformation(InputStream& inputFile) {
@@ -318,7 +358,7 @@ Transformation Scene::parseTransformation(InputStream& inputFile) {
     return result;
 }
 
-void Scene::parseSphere(InputStream& inputFile) {
+void Scene::parseSphere(InputStream& inputFile, World& target) {
     expectSymbol(inputFile, '(');
     std::string material = expectIdentifier(inputFile);
 
@@ -330,10 +370,11 @@ void Scene::parseSphere(InputStream& inputFile) {
     Transformation transf = parseTransformation(inputFile);
     expectSymbol(inputFile, ')');
 
-    world.addShape(std::make_shared<Sphere>(materials[material], transf));
+    target.addSphere(materials[material], transf);
+    if (compiled) compiled->addShape(CompiledScene::ShapeType::Sphere, target, compiled->materialIndex[material], transf);
 }
 
-void Scene::parsePlane(InputStream& inputFile) {
+void Scene::parsePlane(InputStream& inputFile, World& target) {
     expectSymbol(inputFile, '(');
     std::string material = expectIdentifier(inputFile);
 
@@ -345,7 +386,87 @@ void Scene::parsePlane(InputStream& inputFile) {
     Transformation transf = parseTransformation(inputFile);
     expectSymbol(inputFile, ')');
 
-    world.addShape(std::make_shared<Plane>(materials[material], transf));
+    target.addShape(std::make_shared<Plane>(materials[material], transf));
+    if (compiled) compiled->addShape(CompiledScene::ShapeType::Plane, target, compiled->materialIndex[material], transf);
+}
+
+void Scene::parseMesh(InputStream& inputFile, World& target) {
+    expectSymbol(inputFile, '(');
+    std::string material = expectIdentifier(inputFile);
+
+    if (!materials.contains(material)) { // c++20
+        throw GrammarError(inputFile._location, "unknown material: \"" + material + "\"");
+    }
+
+    expectSymbol(inputFile, ',');
+    std::string fileName = expectString(inputFile);
+    SourceLocation location = inputFile._location;
+    expectSymbol(inputFile, ',');
+    Transformation transf = parseTransformation(inputFile);
+    expectSymbol(inputFile, ')');
+
+    // a scene that is not built (see buildWorld) gets an empty mesh in its place, the file is only opened
+    MeshData mesh;
+    try {
+        if (buildWorld) mesh = readMesh(fileName);
+        else MappedFile file(fileName);
+    } catch (const std::runtime_error& e) {
+        throw GrammarError(location, e.what());
+    }
+
+    // the BVH of the triangles is built here, with the threads used for the one of the scene
+    std::unique_ptr<ThreadPool> pool;
+    if (buildWorld && world.buildSettings.nThreads != 1) pool = std::make_unique<ThreadPool>(world.buildSettings.nThreads);
+    target.addShape(std::make_shared<TriangleMesh>(materials[material], std::move(mesh), transf, pool.get()));
+    if (compiled) compiled->addShape(CompiledScene::ShapeType::Mesh, target, compiled->materialIndex[material], transf, fileName);
+}
+
+void Scene::parseInstance(InputStream& inputFile, World& target) {
+    expectSymbol(inputFile, '(');
+    std::string group = expectIdentifier(inputFile);
+
+    if (!groups.contains(group)) { // c++20
+        throw GrammarError(inputFile._location, "unknown group: \"" + group + "\"");
+    }
+
+    expectSymbol(inputFile, ',');
+    Transformation transf = parseTransformation(inputFile);
+    expectSymbol(inputFile, ')');
+
+    target.addShape(std::make_shared<Instance>(groups[group], transf));
+    if (compiled) compiled->addShape(CompiledScene::ShapeType::Instance, target, compiled->groupIndex[group], transf);
+}
+
+void Scene::parseGroup(InputStream& inputFile) {
+    std::string name = expectIdentifier(inputFile);
+    SourceLocation location = inputFile._location;
+    if (groups.contains(name)) // c++20
+        throw GrammarError(location, "redefinition of group \"" + name + "\"");
+
+    auto group = std::make_shared<World>();
+    group->buildSettings = world.buildSettings.forGroup(name);
+    if (compiled) {
+        uint32_t index = static_cast<uint32_t>(compiled->groups.size());
+        compiled->groups.push_back({compiled->addString(name)});
+        compiled->groupIndex[name] = index;
+        compiled->owners[group.get()] = index + 1;
+    }
+
+    expectSymbol(inputFile, '{');
+    while (true) {
+        Token t = inputFile.readToken();
+        if (t.tag == TokenTags::SYMBOL && t.value.symbol == '}') break;
+        inputFile.unreadToken(t);
+
+        Keywords kw = expectKeywords(inputFile, {Keywords::SPHERE, Keywords::PLANE, Keywords::MESH, Keywords::INSTANCE});
+        if (kw == Keywords::SPHERE) parseSphere(inputFile, *group);
+        else if (kw == Keywords::PLANE) parsePlane(inputFile, *group);
+        else if (kw == Keywords::MESH) parseMesh(inputFile, *group);
+        else parseInstance(inputFile, *group);
+    }
+
+    if (buildWorld) group->build(); // the bottom level, shared by all the instances
+    groups[name] = group;
 }
 
 void Scene::parsePointLight(InputStream& inputFile) {
@@ -358,6 +479,7 @@ void Scene::parsePointLight(InputStream& inputFile) {
     expectSymbol(inputFile, ')');
 
     world.addLight(PointLight(Point3(position.x, position.y, position.z), color, radius));
+    if (compiled) compiled->lights.push_back({{position.x, position.y, position.z}, {color.r, color.g, color.b}, radius});
 }
 
 void Scene::parseCamera(InputStream& inputFile) {
@@ -377,6 +499,13 @@ void Scene::parseCamera(InputStream& inputFile) {
         camera = std::make_shared<Camera>("perspective", aspectRatio, (int)imageWidth, distance, transf);
     else
         camera = std::make_shared<Camera>("orthogonal", aspectRatio, (int)imageWidth, distance, transf);
+
+    if (compiled) {
+        compiled->camera = {kw == Keywords::PERSPECTIVE ? CompiledScene::CameraType::Perspective : CompiledScene::CameraType::Orthogonal,
+                            aspectRatio, distance, (int)imageWidth};
+        std::copy(transf.matrix, transf.matrix + 16, compiled->camera.matrix);
+        std::copy(transf.inverseMatrix, transf.inverseMatrix + 16, compiled->camera.inverse);
+    }
 }
 
 void Scene::parse(InputStream& inputFile, const std::unordered_map<std::string, float>& variables) {
@@ -411,10 +540,19 @@ void Scene::parse(InputStream& inputFile, const std::unordered_map<std::string,
 
                 break;
             case Keywords::SPHERE:
-                parseSphere(inputFile);
+                parseSphere(inputFile, world);
                 break;
             case Keywords::PLANE:
-                parsePlane(inputFile);
+                parsePlane(inputFile, world);
+                break;
+            case Keywords::MESH:
+                parseMesh(inputFile, world);
+                break;
+            case Keywords::GROUP:
+                parseGroup(inputFile);
+                break;
+            case Keywords::INSTANCE:
+                parseInstance(inputFile, world);
                 break;
             case Keywords::CAMERA:
                 if (camera != nullptr)
@@ -433,4 +571,24 @@ void Scene::parse(InputStream& inputFile, const std::unordered_map<std::string,
                 throw GrammarError(token.location, "unexpected keyword");
         }
     }
+
+    if (buildWorld) world.build(); // all the shapes are known now
+}
+
+bool Scene::animate(const Scene& next) {
+    const auto& shapes = world._shapes;
+    const auto& nextShapes = next.world._shapes;
+    if (world.compactSpheres() > 0 || next.world.compactSpheres() > 0) return false; // compact spheres can't move
+    if (shapes.size() != nextShapes.size()) return false;
+    for (size_t i = 0; i < shapes.size(); i++) {
+        const Shape &shape = *shapes[i], &nextShape = *nextShapes[i];
+        if (typeid(shape) != typeid(nextShape)) return false;
+    }
+
+    for (size_t i = 0; i < shapes.size(); i++) shapes[i]->transformation = nextShapes[i]->transformation;
+    world.pointLights = next.world.pointLights;
+    if (camera != nullptr && next.camera != nullptr) camera->transformation = next.camera->transformation;
+
+    world.update();
+    return true;
 }
\ No newline at end of file
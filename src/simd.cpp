@@ -0,0 +1,992 @@
+#include "simd.hpp"
+#include "AABB.hpp"
+
+#include <bit>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef RAYTRACER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Kernels for a specific instruction set are compiled with the matching target attribute,
+// so the rest of the code doesn't need any special compiler flags and runs on every x86 CPU.
+// MSVC doesn't need (nor supports) the attribute to use intrinsics.
+#if defined(RAYTRACER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE4
+#define TARGET_AVX2
+#endif
+
+// CPU detection
+
+static SimdLevel detectSimdLevel() {
+#ifdef RAYTRACER_X86
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE4;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse4 = info[2] & (1 << 19);
+    bool osAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6); // OSXSAVE, AVX, saved YMM registers
+
+    if (osAVX && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) return SimdLevel::AVX2;
+    }
+    if (sse4) return SimdLevel::SSE4;
+#endif
+#endif
+    return SimdLevel::SCALAR;
+}
+
+SimdLevel bestSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+std::string simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2: return "AVX2";
+        case SimdLevel::SSE4: return "SSE4.1";
+        default: return "scalar";
+    }
+}
+
+
+
+// kernels, m[k] points to the k-th element of the inverse matrices
+
+// same math as Sphere::quickIsHit, returns the smallest valid t or INF
+static inline float sphereDistance(const float* const* m, int i, const Ray& ray) {
+    const Point3& o = ray.origin;
+    const Vec3& d = ray.direction;
+
+    float ox = m[0][i] * o.x + m[1][i] * o.y + m[2][i] * o.z + m[3][i];
+    float oy = m[4][i] * o.x + m[5][i] * o.y + m[6][i] * o.z + m[7][i];
+    float oz = m[8][i] * o.x + m[9][i] * o.y + m[10][i] * o.z + m[11][i];
+    float dx = m[0][i] * d.x + m[1][i] * d.y + m[2][i] * d.z;
+    float dy = m[4][i] * d.x + m[5][i] * d.y + m[6][i] * d.z;
+    float dz = m[8][i] * d.x + m[9][i] * d.y + m[10][i] * d.z;
+
+    float a = dx * dx + dy * dy + dz * dz;
+    float b = ox * dx + oy * dy + oz * dz;
+    float c = ox * ox + oy * oy + oz * oz - 1.0f;
+
+    float delta = b * b - a * c;
+    if (delta <= 0.0f) return INF;
+
+    float sqrtDelta = std::sqrt(delta);
+    float t1 = (-b - sqrtDelta) / a;
+    float t2 = (-b + sqrtDelta) / a;
+
+    if (t1 > ray.tmin && t1 < ray.tmax) return t1;
+    if (t2 > ray.tmin && t2 < ray.tmax) return t2;
+    return INF;
+}
+
+static int closestHitScalar(const float* const* m, int n, const Ray& ray, float& t) {
+    int index = -1;
+    float closest = INF;
+    for (int i = 0; i < n; i++) {
+        float distance = sphereDistance(m, i, ray);
+        if (distance < closest) closest = distance, index = i;
+    }
+    if (index >= 0) t = closest;
+    return index;
+}
+
+static int anyHitScalar(const float* const* m, int n, const Ray& ray) {
+    for (int i = 0; i < n; i++) {
+        if (sphereDistance(m, i, ray) < INF) return i;
+    }
+    return -1;
+}
+
+static void closestHitsScalar(const float* const* m, const std::vector<int>& spheres, const RayPacket& packet, float* t, int* index) {
+    for (int r = 0; r < packet.size; r++) {
+        for (int i : spheres) {
+            float distance = sphereDistance(m, i, packet.rays[r]);
+            if (distance < t[r]) t[r] = distance, index[r] = i;
+        }
+    }
+}
+
+#ifdef RAYTRACER_X86
+
+// The two functions below are the same code written with different register widths.
+// Every lane computes the same quantities as sphereDistance, the lanes that miss hold INF.
+// The lanes can be different spheres hit by the same ray, or different rays hitting the same sphere.
+
+TARGET_SSE4 static inline __m128 sphereDistanceSSE4(const __m128* m, const __m128* o, const __m128* d, __m128 tmin, __m128 tmax) {
+    __m128 lox = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], o[0]), _mm_mul_ps(m[1], o[1])), _mm_mul_ps(m[2], o[2])), m[3]);
+    __m128 loy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[4], o[0]), _mm_mul_ps(m[5], o[1])), _mm_mul_ps(m[6], o[2])), m[7]);
+    __m128 loz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[8], o[0]), _mm_mul_ps(m[9], o[1])), _mm_mul_ps(m[10], o[2])), m[11]);
+    __m128 ldx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], d[0]), _mm_mul_ps(m[1], d[1])), _mm_mul_ps(m[2], d[2]));
+    __m128 ldy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[4], d[0]), _mm_mul_ps(m[5], d[1])), _mm_mul_ps(m[6], d[2]));
+    __m128 ldz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[8], d[0]), _mm_mul_ps(m[9], d[1])), _mm_mul_ps(m[10], d[2]));
+
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ldx, ldx), _mm_mul_ps(ldy, ldy)), _mm_mul_ps(ldz, ldz));
+    __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lox, ldx), _mm_mul_ps(loy, ldy)), _mm_mul_ps(loz, ldz));
+    __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lox, lox), _mm_mul_ps(loy, loy)), _mm_mul_ps(loz, loz)), _mm_set1_ps(1.0f));
+
+    __m128 delta = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+    __m128 hit = _mm_cmpgt_ps(delta, _mm_setzero_ps());
+
+    __m128 sqrtDelta = _mm_sqrt_ps(_mm_max_ps(delta, _mm_setzero_ps()));
+    __m128 minusB = _mm_sub_ps(_mm_setzero_ps(), b);
+    __m128 t1 = _mm_div_ps(_mm_sub_ps(minusB, sqrtDelta), a);
+    __m128 t2 = _mm_div_ps(_mm_add_ps(minusB, sqrtDelta), a);
+
+    __m128 valid1 = _mm_and_ps(_mm_cmpgt_ps(t1, tmin), _mm_cmplt_ps(t1, tmax));
+    __m128 valid2 = _mm_and_ps(_mm_cmpgt_ps(t2, tmin), _mm_cmplt_ps(t2, tmax));
+
+    __m128 inf = _mm_set1_ps(INF);
+    __m128 t = _mm_blendv_ps(_mm_blendv_ps(inf, t2, valid2), t1, valid1);
+    return _mm_blendv_ps(inf, t, hit);
+}
+
+TARGET_AVX2 static inline __m256 sphereDistanceAVX2(const __m256* m, const __m256* o, const __m256* d, __m256 tmin, __m256 tmax) {
+    __m256 lox = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], o[0]), _mm256_mul_ps(m[1], o[1])), _mm256_mul_ps(m[2], o[2])), m[3]);
+    __m256 loy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[4], o[0]), _mm256_mul_ps(m[5], o[1])), _mm256_mul_ps(m[6], o[2])), m[7]);
+    __m256 loz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[8], o[0]), _mm256_mul_ps(m[9], o[1])), _mm256_mul_ps(m[10], o[2])), m[11]);
+    __m256 ldx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], d[0]), _mm256_mul_ps(m[1], d[1])), _mm256_mul_ps(m[2], d[2]));
+    __m256 ldy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[4], d[0]), _mm256_mul_ps(m[5], d[1])), _mm256_mul_ps(m[6], d[2]));
+    __m256 ldz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[8], d[0]), _mm256_mul_ps(m[9], d[1])), _mm256_mul_ps(m[10], d[2]));
+
+    __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ldx, ldx), _mm256_mul_ps(ldy, ldy)), _mm256_mul_ps(ldz, ldz));
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lox, ldx), _mm256_mul_ps(loy, ldy)), _mm256_mul_ps(loz, ldz));
+    __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lox, lox), _mm256_mul_ps(loy, loy)), _mm256_mul_ps(loz, loz)), _mm256_set1_ps(1.0f));
+
+    __m256 delta = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+    __m256 hit = _mm256_cmp_ps(delta, _mm256_setzero_ps(), _CMP_GT_OQ);
+
+    __m256 sqrtDelta = _mm256_sqrt_ps(_mm256_max_ps(delta, _mm256_setzero_ps()));
+    __m256 minusB = _mm256_sub_ps(_mm256_setzero_ps(), b);
+    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(minusB, sqrtDelta), a);
+    __m256 t2 = _mm256_div_ps(_mm256_add_ps(minusB, sqrtDelta), a);
+
+    __m256 valid1 = _mm256_and_ps(_mm256_cmp_ps(t1, tmin, _CMP_GT_OQ), _mm256_cmp_ps(t1, tmax, _CMP_LT_OQ));
+    __m256 valid2 = _mm256_and_ps(_mm256_cmp_ps(t2, tmin, _CMP_GT_OQ), _mm256_cmp_ps(t2, tmax, _CMP_LT_OQ));
+
+    __m256 inf = _mm256_set1_ps(INF);
+    __m256 t = _mm256_blendv_ps(_mm256_blendv_ps(inf, t2, valid2), t1, valid1);
+    return _mm256_blendv_ps(inf, t, hit);
+}
+
+// one ray, 4 or 8 spheres starting from index k
+TARGET_SSE4 static inline __m128 sphereDistanceSSE4(const float* const* m, int k, const Ray& ray) {
+    __m128 mv[12];
+    for (int e = 0; e < 12; e++) mv[e] = _mm_loadu_ps(m[e] + k);
+    __m128 o[3] = {_mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z)};
+    __m128 d[3] = {_mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y), _mm_set1_ps(ray.direction.z)};
+    return sphereDistanceSSE4(mv, o, d, _mm_set1_ps(ray.tmin), _mm_set1_ps(ray.tmax));
+}
+
+TARGET_AVX2 static inline __m256 sphereDistanceAVX2(const float* const* m, int k, const Ray& ray) {
+    __m256 mv[12];
+    for (int e = 0; e < 12; e++) mv[e] = _mm256_loadu_ps(m[e] + k);
+    __m256 o[3] = {_mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z)};
+    __m256 d[3] = {_mm256_set1_ps(ray.direction.x), _mm256_set1_ps(ray.direction.y), _mm256_set1_ps(ray.direction.z)};
+    return sphereDistanceAVX2(mv, o, d, _mm256_set1_ps(ray.tmin), _mm256_set1_ps(ray.tmax));
+}
+
+// reduces the per-lane minima, ties go to the lowest index like in the scalar loop
+static int reduceClosest(const float* best, const int* bestIndex, int lanes, float& t) {
+    int index = -1;
+    float closest = INF;
+    for (int l = 0; l < lanes; l++) {
+        if (best[l] < closest || (best[l] == closest && best[l] < INF && bestIndex[l] < index)) {
+            closest = best[l], index = bestIndex[l];
+        }
+    }
+    if (index >= 0) t = closest;
+    return index;
+}
+
+TARGET_SSE4 static int closestHitSSE4(const float* const* m, int n, const Ray& ray, float& t) {
+    __m128 best = _mm_set1_ps(INF);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+
+    for (int k = 0; k < n; k += 4) {
+        __m128 distance = sphereDistanceSSE4(m, k, ray);
+        __m128 closer = _mm_cmplt_ps(distance, best);
+        best = _mm_blendv_ps(best, distance, closer);
+        bestIndex = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(bestIndex), _mm_castsi128_ps(index), closer));
+        index = _mm_add_epi32(index, step);
+    }
+
+    alignas(16) float bestArray[4];
+    alignas(16) int indexArray[4];
+    _mm_store_ps(bestArray, best);
+    _mm_store_si128(reinterpret_cast<__m128i*>(indexArray), bestIndex);
+    return reduceClosest(bestArray, indexArray, 4, t);
+}
+
+TARGET_SSE4 static int anyHitSSE4(const float* const* m, int n, const Ray& ray) {
+    const __m128 inf = _mm_set1_ps(INF);
+    for (int k = 0; k < n; k += 4) {
+        int mask = _mm_movemask_ps(_mm_cmplt_ps(sphereDistanceSSE4(m, k, ray), inf));
+        if (mask) return k + std::countr_zero(static_cast<unsigned>(mask));
+    }
+    return -1;
+}
+
+TARGET_AVX2 static int closestHitAVX2(const float* const* m, int n, const Ray& ray, float& t) {
+    __m256 best = _mm256_set1_ps(INF);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+
+    for (int k = 0; k < n; k += 8) {
+        __m256 distance = sphereDistanceAVX2(m, k, ray);
+        __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+        best = _mm256_blendv_ps(best, distance, closer);
+        bestIndex = _mm256_blendv_epi8(bestIndex, index, _mm256_castps_si256(closer));
+        index = _mm256_add_epi32(index, step);
+    }
+
+    alignas(32) float bestArray[8];
+    alignas(32) int indexArray[8];
+    _mm256_store_ps(bestArray, best);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indexArray), bestIndex);
+    return reduceClosest(bestArray, indexArray, 8, t);
+}
+
+// many rays, one sphere at a time: the rays stay in registers while the spheres are broadcast
+TARGET_SSE4 static void closestHitsSSE4(const float* const* m, const std::vector<int>& spheres, const RayPacket& packet, float* t, int* index) {
+    for (int r = 0; r < packet.paddedSize(); r += 4) {
+        __m128 o[3] = {_mm_load_ps(packet.ox + r), _mm_load_ps(packet.oy + r), _mm_load_ps(packet.oz + r)};
+        __m128 d[3] = {_mm_load_ps(packet.dx + r), _mm_load_ps(packet.dy + r), _mm_load_ps(packet.dz + r)};
+        __m128 tmin = _mm_load_ps(packet.tmin + r), tmax = _mm_load_ps(packet.tmax + r);
+        __m128 best = _mm_loadu_ps(t + r);
+        __m128 bestIndex = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(index + r)));
+
+        for (int i : spheres) {
+            __m128 mv[12];
+            for (int e = 0; e < 12; e++) mv[e] = _mm_set1_ps(m[e][i]);
+            __m128 distance = sphereDistanceSSE4(mv, o, d, tmin, tmax);
+            __m128 closer = _mm_cmplt_ps(distance, best);
+            best = _mm_blendv_ps(best, distance, closer);
+            bestIndex = _mm_blendv_ps(bestIndex, _mm_castsi128_ps(_mm_set1_epi32(i)), closer);
+        }
+
+        _mm_storeu_ps(t + r, best);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(index + r), _mm_castps_si128(bestIndex));
+    }
+}
+
+TARGET_AVX2 static void closestHitsAVX2(const float* const* m, const std::vector<int>& spheres, const RayPacket& packet, float* t, int* index) {
+    for (int r = 0; r < packet.paddedSize(); r += 8) {
+        __m256 o[3] = {_mm256_load_ps(packet.ox + r), _mm256_load_ps(packet.oy + r), _mm256_load_ps(packet.oz + r)};
+        __m256 d[3] = {_mm256_load_ps(packet.dx + r), _mm256_load_ps(packet.dy + r), _mm256_load_ps(packet.dz + r)};
+        __m256 tmin = _mm256_load_ps(packet.tmin + r), tmax = _mm256_load_ps(packet.tmax + r);
+        __m256 best = _mm256_loadu_ps(t + r);
+        __m256i bestIndex = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + r));
+
+        for (int i : spheres) {
+            __m256 mv[12];
+            for (int e = 0; e < 12; e++) mv[e] = _mm256_set1_ps(m[e][i]);
+            __m256 distance = sphereDistanceAVX2(mv, o, d, tmin, tmax);
+            __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+            best = _mm256_blendv_ps(best, distance, closer);
+            bestIndex = _mm256_blendv_epi8(bestIndex, _mm256_set1_epi32(i), _mm256_castps_si256(closer));
+        }
+
+        _mm256_storeu_ps(t + r, best);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(index + r), bestIndex);
+    }
+}
+
+TARGET_AVX2 static int anyHitAVX2(const float* const* m, int n, const Ray& ray) {
+    const __m256 inf = _mm256_set1_ps(INF);
+    for (int k = 0; k < n; k += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(sphereDistanceAVX2(m, k, ray), inf, _CMP_LT_OQ));
+        if (mask) return k + std::countr_zero(static_cast<unsigned>(mask));
+    }
+    return -1;
+}
+
+#endif
+
+
+
+// boxes
+
+// the exit distances are stretched by AABB::SLAB_ROUNDING, so rays through an edge or a corner don't miss
+constexpr float SLAB_ROUNDING = AABB::SLAB_ROUNDING;
+
+static int boxesHit4Scalar(const float* boxes, const float* ray, float tmax, float* tNear) {
+    int mask = 0;
+    for (int k = 0; k < 4; k++) {
+        float nearest = ray[6], farthest = tmax;
+        for (int axis = 0; axis < 3; axis++) {
+            float t1 = (boxes[4 * axis + k] - ray[axis]) * ray[3 + axis];
+            float t2 = (boxes[12 + 4 * axis + k] - ray[axis]) * ray[3 + axis];
+            nearest = std::max(nearest, std::min(t1, t2));
+            farthest = std::min(farthest, std::max(t1, t2) * SLAB_ROUNDING);
+        }
+        tNear[k] = nearest;
+        if (nearest <= farthest) mask |= 1 << k;
+    }
+    return mask;
+}
+
+#ifdef RAYTRACER_X86
+
+// slab test on the 4 boxes, one per lane
+TARGET_SSE4 static int boxesHit4SSE4(const float* boxes, const float* ray, float tmax, float* tNear) {
+    __m128 nearest = _mm_set1_ps(ray[6]), farthest = _mm_set1_ps(tmax), rounding = _mm_set1_ps(SLAB_ROUNDING);
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 origin = _mm_set1_ps(ray[axis]), inverse = _mm_set1_ps(ray[3 + axis]);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxes + 4 * axis), origin), inverse);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxes + 12 + 4 * axis), origin), inverse);
+        nearest = _mm_max_ps(nearest, _mm_min_ps(t1, t2));
+        farthest = _mm_min_ps(farthest, _mm_mul_ps(_mm_max_ps(t1, t2), rounding));
+    }
+    _mm_storeu_ps(tNear, nearest);
+    return _mm_movemask_ps(_mm_cmple_ps(nearest, farthest));
+}
+
+#endif
+
+static int quantizedBoxesHit4Scalar(const float* origin, const float* scale, const uint8_t* low, const uint8_t* high,
+                                    const float* ray, float tmax, float* tNear) {
+    alignas(16) float boxes[24];
+    for (int axis = 0; axis < 3; axis++) {
+        for (int k = 0; k < 4; k++) {
+            boxes[4 * axis + k] = low[4 * axis + k] * scale[axis] + origin[axis];
+            boxes[12 + 4 * axis + k] = high[4 * axis + k] * scale[axis] + origin[axis];
+        }
+    }
+    return boxesHit4Scalar(boxes, ray, tmax, tNear);
+}
+
+#ifdef RAYTRACER_X86
+
+// 4 bytes to 4 floats
+TARGET_SSE4 static inline __m128 bytesToFloats(const uint8_t* bytes) {
+    int32_t packed;
+    std::memcpy(&packed, bytes, 4);
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+// the boxes are decoded with the same operations as the scalar code, so they are exactly the same
+TARGET_SSE4 static int quantizedBoxesHit4SSE4(const float* origin, const float* scale, const uint8_t* low, const uint8_t* high,
+                                              const float* ray, float tmax, float* tNear) {
+    __m128 nearest = _mm_set1_ps(ray[6]), farthest = _mm_set1_ps(tmax), rounding = _mm_set1_ps(SLAB_ROUNDING);
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 o = _mm_set1_ps(ray[axis]), inverse = _mm_set1_ps(ray[3 + axis]);
+        __m128 s = _mm_set1_ps(scale[axis]), base = _mm_set1_ps(origin[axis]);
+        __m128 minimum = _mm_add_ps(_mm_mul_ps(bytesToFloats(low + 4 * axis), s), base);
+        __m128 maximum = _mm_add_ps(_mm_mul_ps(bytesToFloats(high + 4 * axis), s), base);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(minimum, o), inverse);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(maximum, o), inverse);
+        nearest = _mm_max_ps(nearest, _mm_min_ps(t1, t2));
+        farthest = _mm_min_ps(farthest, _mm_mul_ps(_mm_max_ps(t1, t2), rounding));
+    }
+    _mm_storeu_ps(tNear, nearest);
+    return _mm_movemask_ps(_mm_cmple_ps(nearest, farthest));
+}
+
+#endif
+
+int quantizedBoxesHit4(const float* origin, const float* scale, const uint8_t* low, const uint8_t* high,
+                       const float* ray, float tmax, float* tNear, SimdLevel level) {
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::SSE4) return quantizedBoxesHit4SSE4(origin, scale, low, high, ray, tmax, tNear);
+#endif
+    (void)level;
+    return quantizedBoxesHit4Scalar(origin, scale, low, high, ray, tmax, tNear);
+}
+
+int boxesHit4(const float* boxes, const float* ray, float tmax, float* tNear, SimdLevel level) {
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::SSE4) return boxesHit4SSE4(boxes, ray, tmax, tNear);
+#endif
+    (void)level;
+    return boxesHit4Scalar(boxes, ray, tmax, tNear);
+}
+
+
+
+// byte order
+
+static void swapBytes32Scalar(uint8_t* bytes, size_t count) {
+    for (size_t i = 0; i < count; i++, bytes += 4) {
+        std::swap(bytes[0], bytes[3]);
+        std::swap(bytes[1], bytes[2]);
+    }
+}
+
+#ifdef RAYTRACER_X86
+
+// the shuffle reverses every group of 4 bytes, pshufb is SSSE3, included in SSE4.1
+TARGET_SSE4 static size_t swapBytes32SSE4(uint8_t* bytes, size_t count) {
+    const __m128i reverse = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* block = reinterpret_cast<__m128i*>(bytes + 4 * i);
+        _mm_storeu_si128(block, _mm_shuffle_epi8(_mm_loadu_si128(block), reverse));
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t swapBytes32AVX2(uint8_t* bytes, size_t count) {
+    const __m256i reverse = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                             3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) { // two registers per iteration
+        __m256i* block = reinterpret_cast<__m256i*>(bytes + 4 * i);
+        __m256i first = _mm256_loadu_si256(block), second = _mm256_loadu_si256(block + 1);
+        _mm256_storeu_si256(block, _mm256_shuffle_epi8(first, reverse));
+        _mm256_storeu_si256(block + 1, _mm256_shuffle_epi8(second, reverse));
+    }
+    return i;
+}
+
+#endif
+
+void swapBytes32(void* words, size_t count, SimdLevel level) {
+    uint8_t* bytes = static_cast<uint8_t*>(words);
+    size_t done = 0;
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::AVX2) done = swapBytes32AVX2(bytes, count);
+    if (level >= SimdLevel::SSE4) done += swapBytes32SSE4(bytes + 4 * done, count - done);
+#endif
+    (void)level;
+    swapBytes32Scalar(bytes + 4 * done, count - done);
+}
+
+
+
+// tone mapping
+
+static float loadFloat(const uint8_t* bytes) {
+    float value;
+    std::memcpy(&value, bytes, sizeof(float));
+    return value;
+}
+
+static double sumLogLuminosityScalar(const uint8_t* pixels, size_t count, float delta) {
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++, pixels += 12) {
+        float r = loadFloat(pixels), g = loadFloat(pixels + 4), b = loadFloat(pixels + 8);
+        sum += std::log10((std::max({r, g, b}) + std::min({r, g, b})) * 0.5f + delta);
+    }
+    return sum;
+}
+
+static uint8_t toneMapScalar(float value, float scale, bool clamp, float invGamma) {
+    value *= scale;
+    if (clamp) value = value / (1 + value);
+    if (!(value > 0.0f)) return 0;
+    return static_cast<uint8_t>(std::min(255.0f, 255 * std::pow(value, invGamma)));
+}
+
+#ifdef RAYTRACER_X86
+
+// The natural logarithm and exponential of the Cephes library, as vectorized in sse_mathfun by Julien Pommier,
+// written once per register width. log splits x in mantissa and exponent, exp splits it in integer and fractional
+// part of x / ln(2), then both use a polynomial; log of non-positive numbers is -87.3 (of the smallest normal float).
+
+#define LOG_POLYNOMIAL 7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f, \
+                       -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f
+#define EXP_POLYNOMIAL 1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f
+static constexpr float LN2_HIGH = 0.693359375f, LN2_LOW = -2.12194440e-4f, EXP_LIMIT = 88.3762626647949f;
+
+TARGET_SSE4 static inline __m128 logSSE4(__m128 x) {
+    static const float polynomial[] = {LOG_POLYNOMIAL};
+    x = _mm_max_ps(x, _mm_set1_ps(1.17549435e-38f));
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(0x7e));
+    x = _mm_or_ps(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))), _mm_set1_ps(0.5f)); // in [0.5, 1)
+    __m128 e = _mm_cvtepi32_ps(exponent);
+
+    // x < sqrt(1/2) becomes 2x, so that x - 1 is in [-0.29, 0.41]
+    __m128 small = _mm_cmplt_ps(x, _mm_set1_ps(0.707106781186547524f));
+    e = _mm_sub_ps(e, _mm_and_ps(small, _mm_set1_ps(1.0f)));
+    x = _mm_add_ps(_mm_sub_ps(x, _mm_set1_ps(1.0f)), _mm_and_ps(x, small));
+
+    __m128 z = _mm_mul_ps(x, x), y = _mm_set1_ps(polynomial[0]);
+    for (int k = 1; k < 9; k++) y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(polynomial[k]));
+    y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LN2_LOW)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    return _mm_add_ps(_mm_add_ps(x, y), _mm_mul_ps(e, _mm_set1_ps(LN2_HIGH)));
+}
+
+TARGET_SSE4 static inline __m128 expSSE4(__m128 x) {
+    static const float polynomial[] = {EXP_POLYNOMIAL};
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-EXP_LIMIT)), _mm_set1_ps(EXP_LIMIT));
+    __m128 n = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f)));
+    x = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(LN2_HIGH))), _mm_mul_ps(n, _mm_set1_ps(LN2_LOW)));
+
+    __m128 z = _mm_mul_ps(x, x), y = _mm_set1_ps(polynomial[0]);
+    for (int k = 1; k < 6; k++) y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(polynomial[k]));
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), _mm_set1_ps(1.0f));
+    __m128i power = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(0x7f)), 23); // 2^n
+    return _mm_mul_ps(y, _mm_castsi128_ps(power));
+}
+
+TARGET_AVX2 static inline __m256 logAVX2(__m256 x) {
+    static const float polynomial[] = {LOG_POLYNOMIAL};
+    x = _mm256_max_ps(x, _mm256_set1_ps(1.17549435e-38f));
+    __m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(0x7e));
+    x = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff))), _mm256_set1_ps(0.5f));
+    __m256 e = _mm256_cvtepi32_ps(exponent);
+
+    __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+    x = _mm256_add_ps(_mm256_sub_ps(x, _mm256_set1_ps(1.0f)), _mm256_and_ps(x, small));
+
+    __m256 z = _mm256_mul_ps(x, x), y = _mm256_set1_ps(polynomial[0]);
+    for (int k = 1; k < 9; k++) y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(polynomial[k]));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+    y = _mm256_add_ps(_mm256_mul_ps(e, _mm256_set1_ps(LN2_LOW)), y);
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    return _mm256_add_ps(_mm256_mul_ps(e, _mm256_set1_ps(LN2_HIGH)), _mm256_add_ps(x, y));
+}
+
+TARGET_AVX2 static inline __m256 expAVX2(__m256 x) {
+    static const float polynomial[] = {EXP_POLYNOMIAL};
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-EXP_LIMIT)), _mm256_set1_ps(EXP_LIMIT));
+    __m256 n = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f)));
+    x = _mm256_sub_ps(_mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(LN2_HIGH))), _mm256_mul_ps(n, _mm256_set1_ps(LN2_LOW)));
+
+    __m256 z = _mm256_mul_ps(x, x), y = _mm256_set1_ps(polynomial[0]);
+    for (int k = 1; k < 6; k++) y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(polynomial[k]));
+    y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+    __m256i power = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(0x7f)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(power));
+}
+
+// 4 pixels: the channels are gathered from the 12 floats, lanes past count repeat the first pixel
+TARGET_SSE4 static inline __m128 logLuminositySSE4(const uint8_t* pixels, size_t count, float delta) {
+    float v[12];
+    for (int k = 0; k < 4; k++) std::memcpy(v + 3 * k, pixels + 12 * (k < static_cast<int>(count) ? k : 0), 12);
+    __m128 r = _mm_setr_ps(v[0], v[3], v[6], v[9]), g = _mm_setr_ps(v[1], v[4], v[7], v[10]), b = _mm_setr_ps(v[2], v[5], v[8], v[11]);
+    __m128 luminosity = _mm_mul_ps(_mm_add_ps(_mm_max_ps(r, _mm_max_ps(g, b)), _mm_min_ps(r, _mm_min_ps(g, b))), _mm_set1_ps(0.5f));
+    return _mm_mul_ps(logSSE4(_mm_add_ps(luminosity, _mm_set1_ps(delta))), _mm_set1_ps(0.434294481903251828f)); // log10(e)
+}
+
+TARGET_SSE4 static double sumLogLuminositySSE4(const uint8_t* pixels, size_t count, float delta) {
+    __m128d sum = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 logs = logLuminositySSE4(pixels + 12 * i, 4, delta);
+        sum = _mm_add_pd(sum, _mm_add_pd(_mm_cvtps_pd(logs), _mm_cvtps_pd(_mm_movehl_ps(logs, logs))));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    double total = lanes[0] + lanes[1];
+    if (i < count) {
+        float logs[4];
+        _mm_storeu_ps(logs, logLuminositySSE4(pixels + 12 * i, count - i, delta));
+        for (size_t k = 0; k < count - i; k++) total += logs[k];
+    }
+    return total;
+}
+
+TARGET_AVX2 static inline __m256 logLuminosityAVX2(const uint8_t* pixels, size_t count, float delta) {
+    float v[24];
+    const float* channels = reinterpret_cast<const float*>(pixels);
+    if (count < 8) { // the gathers would read past the end
+        for (int k = 0; k < 8; k++) std::memcpy(v + 3 * k, pixels + 12 * (k < static_cast<int>(count) ? k : 0), 12);
+        channels = v;
+    }
+    const __m256i index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    __m256 r = _mm256_i32gather_ps(channels, index, 4), g = _mm256_i32gather_ps(channels + 1, index, 4), b = _mm256_i32gather_ps(channels + 2, index, 4);
+    __m256 luminosity = _mm256_mul_ps(_mm256_add_ps(_mm256_max_ps(r, _mm256_max_ps(g, b)), _mm256_min_ps(r, _mm256_min_ps(g, b))), _mm256_set1_ps(0.5f));
+    return _mm256_mul_ps(logAVX2(_mm256_add_ps(luminosity, _mm256_set1_ps(delta))), _mm256_set1_ps(0.434294481903251828f));
+}
+
+TARGET_AVX2 static double sumLogLuminosityAVX2(const uint8_t* pixels, size_t count, float delta) {
+    __m256d sum = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 logs = logLuminosityAVX2(pixels + 12 * i, 8, delta);
+        sum = _mm256_add_pd(sum, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(logs)), _mm256_cvtps_pd(_mm256_extractf128_ps(logs, 1))));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    if (i < count) {
+        float logs[8];
+        _mm256_storeu_ps(logs, logLuminosityAVX2(pixels + 12 * i, count - i, delta));
+        for (size_t k = 0; k < count - i; k++) total += logs[k];
+    }
+    return total;
+}
+
+// 4 or 8 values, as toneMapScalar; the conversion of NaN gives INT_MIN, which saturates to 0
+TARGET_SSE4 static inline void toneMap4SSE4(const uint8_t* values, float scale, bool clamp, float invGamma, uint8_t* bytes) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(reinterpret_cast<const float*>(values)), _mm_set1_ps(scale));
+    if (clamp) x = _mm_div_ps(x, _mm_add_ps(x, _mm_set1_ps(1.0f)));
+    __m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+    x = _mm_and_ps(expSSE4(_mm_mul_ps(logSSE4(x), _mm_set1_ps(invGamma))), positive);
+    __m128i integers = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(x, _mm_set1_ps(255.0f)), _mm_set1_ps(255.0f)));
+    __m128i packed = _mm_packus_epi16(_mm_packus_epi32(integers, integers), _mm_setzero_si128());
+    int result = _mm_cvtsi128_si32(packed);
+    std::memcpy(bytes, &result, 4);
+}
+
+TARGET_AVX2 static inline void toneMap8AVX2(const uint8_t* values, float scale, bool clamp, float invGamma, uint8_t* bytes) {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(values)), _mm256_set1_ps(scale));
+    if (clamp) x = _mm256_div_ps(x, _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+    __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+    x = _mm256_and_ps(expAVX2(_mm256_mul_ps(logAVX2(x), _mm256_set1_ps(invGamma))), positive);
+    __m256i integers = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(x, _mm256_set1_ps(255.0f)), _mm256_set1_ps(255.0f)));
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(bytes), _mm_packus_epi16(words, words));
+}
+
+// the last values go through a padded copy, so that they are computed as the others
+TARGET_SSE4 static void toneMapSSE4(const uint8_t* values, size_t count, float scale, bool clamp, float invGamma, uint8_t* bytes) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) toneMap4SSE4(values + 4 * i, scale, clamp, invGamma, bytes + i);
+    if (i < count) {
+        float last[4] = {};
+        uint8_t lastBytes[4];
+        std::memcpy(last, values + 4 * i, 4 * (count - i));
+        toneMap4SSE4(reinterpret_cast<const uint8_t*>(last), scale, clamp, invGamma, lastBytes);
+        std::memcpy(bytes + i, lastBytes, count - i);
+    }
+}
+
+TARGET_AVX2 static void toneMapAVX2(const uint8_t* values, size_t count, float scale, bool clamp, float invGamma, uint8_t* bytes) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) toneMap8AVX2(values + 4 * i, scale, clamp, invGamma, bytes + i);
+    if (i < count) {
+        float last[8] = {};
+        uint8_t lastBytes[8];
+        std::memcpy(last, values + 4 * i, 4 * (count - i));
+        toneMap8AVX2(reinterpret_cast<const uint8_t*>(last), scale, clamp, invGamma, lastBytes);
+        std::memcpy(bytes + i, lastBytes, count - i);
+    }
+}
+
+#endif
+
+double sumLogLuminosity(const void* pixels, size_t count, float delta, SimdLevel level) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(pixels);
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::AVX2) return sumLogLuminosityAVX2(bytes, count, delta);
+    if (level >= SimdLevel::SSE4) return sumLogLuminositySSE4(bytes, count, delta);
+#endif
+    (void)level;
+    return sumLogLuminosityScalar(bytes, count, delta);
+}
+
+void toneMap(const void* values, size_t count, float scale, bool clamp, float invGamma, uint8_t* bytes, SimdLevel level) {
+    const uint8_t* input = static_cast<const uint8_t*>(values);
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::AVX2) return toneMapAVX2(input, count, scale, clamp, invGamma, bytes);
+    if (level >= SimdLevel::SSE4) return toneMapSSE4(input, count, scale, clamp, invGamma, bytes);
+#endif
+    (void)level;
+    for (size_t i = 0; i < count; i++) bytes[i] = toneMapScalar(loadFloat(input + 4 * i), scale, clamp, invGamma);
+}
+
+
+
+// half precision floats
+
+// The conversions of Fabian Giesen ("float->half variants", 2016): the exponent is rebiased with integer additions,
+// denormals are rounded by adding a magic float whose mantissa takes exactly the bits kept, and normal numbers
+// are rounded to even by adding 0xfff plus the lowest bit kept. The vector versions do the same with masks.
+
+static constexpr uint32_t F32_INFINITY = 255u << 23, F16_OVERFLOW = (127u + 16) << 23, F16_DENORMALS = 113u << 23;
+static constexpr uint32_t DENORMAL_MAGIC = ((127u - 15) + (23 - 10) + 1) << 23, REBIAS = static_cast<uint32_t>(15 - 127) << 23;
+
+static uint16_t floatToHalf(float value) {
+    uint32_t f = std::bit_cast<uint32_t>(value);
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint32_t half;
+    if (f >= F16_OVERFLOW) {
+        half = (f > F32_INFINITY) ? 0x7e00 : 0x7c00; // NaN, infinity
+    } else if (f < F16_DENORMALS) {
+        half = std::bit_cast<uint32_t>(std::bit_cast<float>(f) + std::bit_cast<float>(DENORMAL_MAGIC)) - DENORMAL_MAGIC;
+    } else {
+        uint32_t odd = (f >> 13) & 1;
+        half = (f + REBIAS + 0xfff + odd) >> 13;
+    }
+    return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+static float halfToFloat(uint16_t half) {
+    uint32_t f = static_cast<uint32_t>(half & 0x7fff) << 13;
+    uint32_t exponent = f & (0x7c00u << 13);
+    f += (127u - 15) << 23;
+    if (exponent == 0x7c00u << 13) f += (128u - 16) << 23; // infinity, NaN
+    else if (exponent == 0) f = std::bit_cast<uint32_t>(std::bit_cast<float>(f + (1u << 23)) - std::bit_cast<float>(F16_DENORMALS)); // denormal
+    return std::bit_cast<float>(f | static_cast<uint32_t>(half & 0x8000) << 16);
+}
+
+#ifdef RAYTRACER_X86
+
+TARGET_SSE4 static inline __m128i floatsToHalvesSSE4(__m128 values) {
+    __m128i f = _mm_castps_si128(values);
+    __m128i sign = _mm_and_si128(f, _mm_set1_epi32(static_cast<int>(0x80000000u)));
+    f = _mm_xor_si128(f, sign);
+
+    // as signed integers, all the values compared are positive
+    __m128i nan = _mm_cmpgt_epi32(f, _mm_set1_epi32(F32_INFINITY));
+    __m128i overflow = _mm_cmpgt_epi32(f, _mm_set1_epi32(F16_OVERFLOW - 1));
+    __m128i denormal = _mm_cmplt_epi32(f, _mm_set1_epi32(F16_DENORMALS));
+
+    __m128i special = _mm_blendv_epi8(_mm_set1_epi32(0x7c00), _mm_set1_epi32(0x7e00), nan);
+    __m128i small = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), _mm_castsi128_ps(_mm_set1_epi32(DENORMAL_MAGIC)))),
+                                  _mm_set1_epi32(DENORMAL_MAGIC));
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(f, _mm_set1_epi32(REBIAS + 0xfff)), odd), 13);
+
+    __m128i half = _mm_blendv_epi8(_mm_blendv_epi8(normal, small, denormal), special, overflow);
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+TARGET_SSE4 static inline __m128 halvesToFloatsSSE4(__m128i halves) {
+    __m128i f = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x7fff)), 13);
+    __m128i exponent = _mm_and_si128(f, _mm_set1_epi32(0x7c00 << 13));
+    f = _mm_add_epi32(f, _mm_set1_epi32((127 - 15) << 23));
+
+    __m128i special = _mm_cmpeq_epi32(exponent, _mm_set1_epi32(0x7c00 << 13));
+    __m128i denormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+    __m128i large = _mm_add_epi32(f, _mm_set1_epi32((128 - 16) << 23));
+    __m128i small = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(f, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(_mm_set1_epi32(F16_DENORMALS))));
+    f = _mm_blendv_epi8(_mm_blendv_epi8(f, large, special), small, denormal);
+    return _mm_castsi128_ps(_mm_or_si128(f, _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16)));
+}
+
+TARGET_AVX2 static inline __m256i floatsToHalvesAVX2(__m256 values) {
+    __m256i f = _mm256_castps_si256(values);
+    __m256i sign = _mm256_and_si256(f, _mm256_set1_epi32(static_cast<int>(0x80000000u)));
+    f = _mm256_xor_si256(f, sign);
+
+    __m256i nan = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(F32_INFINITY));
+    __m256i overflow = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(F16_OVERFLOW - 1));
+    __m256i denormal = _mm256_cmpgt_epi32(_mm256_set1_epi32(F16_DENORMALS), f);
+
+    __m256i special = _mm256_blendv_epi8(_mm256_set1_epi32(0x7c00), _mm256_set1_epi32(0x7e00), nan);
+    __m256i small = _mm256_sub_epi32(_mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(f), _mm256_castsi256_ps(_mm256_set1_epi32(DENORMAL_MAGIC)))),
+                                     _mm256_set1_epi32(DENORMAL_MAGIC));
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(f, 13), _mm256_set1_epi32(1));
+    __m256i normal = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(f, _mm256_set1_epi32(REBIAS + 0xfff)), odd), 13);
+
+    __m256i half = _mm256_blendv_epi8(_mm256_blendv_epi8(normal, small, denormal), special, overflow);
+    return _mm256_or_si256(half, _mm256_srli_epi32(sign, 16));
+}
+
+TARGET_AVX2 static inline __m256 halvesToFloatsAVX2(__m256i halves) {
+    __m256i f = _mm256_slli_epi32(_mm256_and_si256(halves, _mm256_set1_epi32(0x7fff)), 13);
+    __m256i exponent = _mm256_and_si256(f, _mm256_set1_epi32(0x7c00 << 13));
+    f = _mm256_add_epi32(f, _mm256_set1_epi32((127 - 15) << 23));
+
+    __m256i special = _mm256_cmpeq_epi32(exponent, _mm256_set1_epi32(0x7c00 << 13));
+    __m256i denormal = _mm256_cmpeq_epi32(exponent, _mm256_setzero_si256());
+    __m256i large = _mm256_add_epi32(f, _mm256_set1_epi32((128 - 16) << 23));
+    __m256i small = _mm256_castps_si256(_mm256_sub_ps(_mm256_castsi256_ps(_mm256_add_epi32(f, _mm256_set1_epi32(1 << 23))),
+                                                      _mm256_castsi256_ps(_mm256_set1_epi32(F16_DENORMALS))));
+    f = _mm256_blendv_epi8(_mm256_blendv_epi8(f, large, special), small, denormal);
+    return _mm256_castsi256_ps(_mm256_or_si256(f, _mm256_slli_epi32(_mm256_and_si256(halves, _mm256_set1_epi32(0x8000)), 16)));
+}
+
+// 8 values per iteration, the halves are packed to 16 bits without saturation (they are all below 0x10000)
+TARGET_SSE4 static size_t floatsToHalvesSSE4(const float* values, size_t count, uint16_t* halves) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i low = floatsToHalvesSSE4(_mm_loadu_ps(values + i)), high = floatsToHalvesSSE4(_mm_loadu_ps(values + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(halves + i), _mm_packus_epi32(low, high));
+    }
+    return i;
+}
+
+TARGET_SSE4 static size_t halvesToFloatsSSE4(const uint16_t* halves, size_t count, float* values) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(halves + i));
+        _mm_storeu_ps(values + i, halvesToFloatsSSE4(_mm_cvtepu16_epi32(packed)));
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t floatsToHalvesAVX2(const float* values, size_t count, uint16_t* halves) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i low = floatsToHalvesAVX2(_mm256_loadu_ps(values + i)), high = floatsToHalvesAVX2(_mm256_loadu_ps(values + i + 8));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xd8); // the pack works within 128-bit lanes
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(halves + i), packed);
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t halvesToFloatsAVX2(const uint16_t* halves, size_t count, float* values) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + i));
+        _mm256_storeu_ps(values + i, halvesToFloatsAVX2(_mm256_cvtepu16_epi32(packed)));
+    }
+    return i;
+}
+
+#endif
+
+void floatsToHalves(const float* values, size_t count, uint16_t* halves, SimdLevel level) {
+    size_t done = 0;
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::AVX2) done = floatsToHalvesAVX2(values, count, halves);
+    else if (level >= SimdLevel::SSE4) done = floatsToHalvesSSE4(values, count, halves);
+#endif
+    (void)level;
+    for (size_t i = done; i < count; i++) halves[i] = floatToHalf(values[i]);
+}
+
+void halvesToFloats(const uint16_t* halves, size_t count, float* values, SimdLevel level) {
+    size_t done = 0;
+#ifdef RAYTRACER_X86
+    if (level >= SimdLevel::AVX2) done = halvesToFloatsAVX2(halves, count, values);
+    else if (level >= SimdLevel::SSE4) done = halvesToFloatsSSE4(halves, count, values);
+#endif
+    (void)level;
+    for (size_t i = done; i < count; i++) values[i] = halfToFloat(halves[i]);
+}
+
+
+
+// SpherePack
+
+int SpherePack::add(const Transformation& transformation) {
+    int index = _size++;
+
+    // grow by a full block of spheres that can't be hit: the local origin is at (2, 0, 0)
+    // and the local direction is null, so the discriminant is always 0
+    if (index % WIDTH == 0) {
+        for (int k = 0; k < 12; k++) _inverse[k].resize(_inverse[k].size() + WIDTH, k == 3 ? 2.0f : 0.0f);
+    }
+
+    set(index, transformation);
+    return index;
+}
+
+void SpherePack::set(int index, const Transformation& transformation) {
+    for (int k = 0; k < 12; k++) _inverse[k][index] = transformation.inverseMatrix[k];
+
+    // The bounding sphere is centred in the transformed origin, its radius is an upper bound
+    // to the largest axis of the ellipsoid: the smallest between the Frobenius norm
+    // and sqrt(|M|_1 |M|_inf) of the linear part of the matrix.
+    const float* M = transformation.matrix;
+    float frobenius2 = 0.0f, maxRow = 0.0f, maxColumn = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        float row = 0.0f, column = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            frobenius2 += M[4 * i + j] * M[4 * i + j];
+            row += std::abs(M[4 * i + j]);
+            column += std::abs(M[4 * j + i]);
+        }
+        maxRow = std::max(maxRow, row), maxColumn = std::max(maxColumn, column);
+    }
+
+    if (static_cast<int>(_bounds.size()) <= index) _bounds.resize(index + 1);
+    _bounds[index] = {Point3(M[3], M[7], M[11]), std::sqrt(std::min(frobenius2, maxRow * maxColumn))};
+}
+
+void SpherePack::reserve(int nSpheres) {
+    int padded = (nSpheres + WIDTH - 1) / WIDTH * WIDTH;
+    for (auto& row : _inverse) row.reserve(padded);
+    _bounds.reserve(nSpheres);
+}
+
+Transformation SpherePack::transformation(int index) const {
+    float inv[16] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    for (int k = 0; k < 12; k++) inv[k] = _inverse[k][index];
+
+    // inverse of the affine transformation y = A x + b: x = A^-1 y - A^-1 b, with A^-1 from the adjugate
+    double a[12];
+    for (int k = 0; k < 12; k++) a[k] = inv[k];
+    double adj[9] = {a[5] * a[10] - a[6] * a[9], a[2] * a[9] - a[1] * a[10], a[1] * a[6] - a[2] * a[5],
+                     a[6] * a[8] - a[4] * a[10], a[0] * a[10] - a[2] * a[8], a[2] * a[4] - a[0] * a[6],
+                     a[4] * a[9] - a[5] * a[8], a[1] * a[8] - a[0] * a[9], a[0] * a[5] - a[1] * a[4]};
+    double invDet = 1.0 / (a[0] * adj[0] + a[1] * adj[3] + a[2] * adj[6]);
+
+    float mat[16] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    for (int i = 0; i < 3; i++) {
+        double translation = 0.0;
+        for (int j = 0; j < 3; j++) {
+            mat[4 * i + j] = static_cast<float>(adj[3 * i + j] * invDet);
+            translation -= adj[3 * i + j] * invDet * a[4 * j + 3];
+        }
+        mat[4 * i + 3] = static_cast<float>(translation);
+    }
+    return Transformation(mat, inv);
+}
+
+size_t SpherePack::memoryUsage() const {
+    size_t bytes = _bounds.capacity() * sizeof(BoundingSphere);
+    for (const auto& row : _inverse) bytes += row.capacity() * sizeof(float);
+    return bytes;
+}
+
+int SpherePack::closestHit(const Ray& ray, float& t, SimdLevel level) const {
+    const float* m[12];
+    for (int k = 0; k < 12; k++) m[k] = _inverse[k].data();
+    int n = static_cast<int>(_inverse[0].size()); // includes the padding
+
+#ifdef RAYTRACER_X86
+    if (level == SimdLevel::AVX2) return closestHitAVX2(m, n, ray, t);
+    if (level == SimdLevel::SSE4) return closestHitSSE4(m, n, ray, t);
+#endif
+    (void)level;
+    return closestHitScalar(m, _size, ray, t);
+}
+
+int SpherePack::anyHit(const Ray& ray, SimdLevel level) const {
+    const float* m[12];
+    for (int k = 0; k < 12; k++) m[k] = _inverse[k].data();
+    int n = static_cast<int>(_inverse[0].size());
+
+#ifdef RAYTRACER_X86
+    if (level == SimdLevel::AVX2) return anyHitAVX2(m, n, ray);
+    if (level == SimdLevel::SSE4) return anyHitSSE4(m, n, ray);
+#endif
+    (void)level;
+    return anyHitScalar(m, _size, ray);
+}
+
+float SpherePack::distance(int index, const Ray& ray) const {
+    const float* m[12];
+    for (int k = 0; k < 12; k++) m[k] = _inverse[k].data();
+    return sphereDistance(m, index, ray);
+}
+
+void SpherePack::closestHits(const RayPacket& packet, const std::vector<int>& spheres, float* t, int* index, SimdLevel level) const {
+    const float* m[12];
+    for (int k = 0; k < 12; k++) m[k] = _inverse[k].data();
+
+#ifdef RAYTRACER_X86
+    if (level == SimdLevel::AVX2) return closestHitsAVX2(m, spheres, packet, t, index);
+    if (level == SimdLevel::SSE4) return closestHitsSSE4(m, spheres, packet, t, index);
+#endif
+    (void)level;
+    closestHitsScalar(m, spheres, packet, t, index);
+}
+
+void SpherePack::cull(const RayPacket& packet, std::vector<int>& spheres) const {
+    spheres.clear();
+    for (int i = 0; i < _size; i++) {
+        if (!packet.isSphereOutside(_bounds[i].centre, _bounds[i].radius)) spheres.push_back(i);
+    }
+}
@@ -1,4 +1,15 @@
 #include "utils.hpp"
+
+#include <vector>
+#include <stdexcept>
+#include <atomic>
+#include <filesystem>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
 #include "Vec3.hpp"
 #include "Normal3.hpp"
 
@@ -89,4 +100,69 @@ void validateFloatVariable(std::string& s, std::unordered_map<std::string, float
     catch (std::invalid_argument& e) { throw std::invalid_argument(stringVal + " is not a valid number"); }
 
     floatVariables[key] = value;
-}
\ No newline at end of file
+}
+
+void validateAnimation(const std::string& s, std::string& name, float& start, float& end) {
+    size_t position = s.rfind(':');
+    if (position == std::string::npos || s.find(':') == position)
+        throw std::invalid_argument("ERROR: \"" + s + "\" does not define an animated variable\n"
+                                    "the correct syntax is --animate=name:start:end");
+
+    // name:start has the same syntax of the float variables
+    std::unordered_map<std::string, float> variable;
+    std::string first = s.substr(0, position), last = s.substr(position + 1);
+    validateFloatVariable(first, variable);
+    name = variable.begin()->first, start = variable.begin()->second;
+
+    try { end = std::stof(last); }
+    catch (std::out_of_range& e) { throw std::out_of_range(last + " is out of float range"); }
+    catch (std::invalid_argument& e) { throw std::invalid_argument(last + " is not a valid number"); }
+}
+
+void validateOutputTarget(const std::string& s, std::string& fileName, float& a, float& gamma) {
+    std::vector<float> numbers;
+    fileName = s;
+    for (size_t position = fileName.rfind(':'); position != std::string::npos && numbers.size() < 2; position = fileName.rfind(':')) {
+        std::string field = fileName.substr(position + 1);
+        size_t length = 0;
+        float value;
+        try { value = std::stof(field, &length); }
+        catch (std::exception& e) { break; } // part of the file name
+        if (length != field.size()) break;
+        if (!(value > 0.0f)) throw std::invalid_argument("ERROR: " + field + " in \"" + s + "\" is not a positive number");
+
+        numbers.insert(numbers.begin(), value);
+        fileName.erase(position);
+    }
+    if (fileName.empty()) throw std::invalid_argument("ERROR: \"" + s + "\" does not define an output image\n"
+                                                      "the correct syntax is --output=file[:normalization[:gamma]]");
+
+    if (numbers.size() > 0) a = numbers[0];
+    if (numbers.size() > 1) gamma = numbers[1];
+}
+
+size_t peakMemoryUsage() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss; // already in bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+std::string temporaryPath(const std::string& path) {
+    static std::atomic<unsigned> count(0);
+#ifdef _WIN32
+    long process = _getpid();
+#else
+    long process = getpid();
+#endif
+    std::filesystem::path result(path);
+    std::string name = result.stem().string() + ".tmp" + std::to_string(process) + "-" + std::to_string(count++) + result.extension().string();
+    return result.replace_filename(name).string();
+}
@@ -0,0 +1,765 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include "AABB.hpp"
+#include "BVH.hpp"
+#include "QuantizedBVH.hpp"
+#include "Grid.hpp"
+#include "World.hpp"
+#include "Instance.hpp"
+#include "Camera.hpp"
+#include "ThreadPool.hpp"
+
+using std::cout, std::endl;
+
+auto bufferMaterial = std::make_shared<DiffuseMaterial>(DiffuseMaterial());
+
+// tests for the bounding boxes
+namespace aabb {
+
+void testBasics() {
+    AABB box;
+    sassert(box.isEmpty());
+    sassert(areClose(box.surfaceArea(), 0.0f));
+
+    box.grow(Point3(1., 2., 3.));
+    box.grow(Point3(-1., 0., 4.));
+    sassert(!box.isEmpty() && box.isFinite());
+    sassert(box.min.isClose(Point3(-1., 0., 3.)));
+    sassert(box.max.isClose(Point3(1., 2., 4.)));
+    sassert(box.centroid().isClose(Point3(0., 1., 3.5)));
+    sassert(areClose(box.surfaceArea(), 2.0f * (2. * 2. + 2. * 1. + 1. * 2.)));
+    sassert(box.largestAxis() == 0);
+
+    sassert(!AABB::infinite().isFinite());
+
+    float t;
+    sassert(box.isHit(Ray(Point3(0., 1., 0.), Vec3(0., 0., 1.)), t) && areClose(t, 3.0f));
+    sassert(!box.isHit(Ray(Point3(0., 3., 0.), Vec3(0., 0., 1.)), t));
+    sassert(!box.isHit(Ray(Point3(0., 1., 0.), Vec3(0., 0., 1.), RAY_MIN, 2.0f), t));
+    sassert(box.isHit(Ray(Point3(0., 1., 3.5), Vec3(1., 0., 0.)), t) && areClose(t, RAY_MIN)); // starting inside
+
+    cout << "AABB works" << endl;
+}
+
+void testShapeBoxes() {
+    PCG pcg;
+    for (int i = 0; i < 20; i++) {
+        Transformation t = translation(pcg.random(-5., 5.), pcg.random(-5., 5.), pcg.random(-5., 5.))
+                           * rotation(pcg.random(0., 360.), Axis::Z) * rotation(pcg.random(0., 360.), Axis::X)
+                           * scaling(pcg.random(0.2, 1.5), pcg.random(0.2, 1.5), pcg.random(0.2, 1.5));
+        Sphere sphere(bufferMaterial, t);
+        AABB box = sphere.boundingBox();
+
+        // points on the surface are inside the box, and some get close to its sides
+        AABB reached;
+        for (int k = 0; k < 20000; k++) {
+            Point3 p = t * Point3() + t * pcg.randomVersor();
+            sassert(box.contains(AABB(p, p)));
+            reached.grow(p);
+        }
+        sassert(reached.min.isClose(box.min, 0.1f) && reached.max.isClose(box.max, 0.1f));
+    }
+
+    sassert(!Plane(bufferMaterial).boundingBox().isFinite());
+
+    cout << "boxes of the shapes work" << endl;
+}
+
+}
+
+// tests for the tree
+namespace bvh {
+
+std::vector<AABB> randomBoxes(PCG& pcg, int n) {
+    std::vector<AABB> boxes;
+    for (int i = 0; i < n; i++) {
+        Point3 centre(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.));
+        Vec3 half(pcg.random(0.05, 1.), pcg.random(0.05, 1.), pcg.random(0.05, 1.));
+        boxes.emplace_back(centre - half, centre + half);
+    }
+    return boxes;
+}
+
+// checks that every primitive is in exactly one leaf, and that every box contains its children
+void checkNode(const BVH& tree, const std::vector<AABB>& boxes, int index, std::vector<int>& seen) {
+    const BVH::Node& node = tree.nodes()[index];
+    for (int k = 0; k < BVH::WIDTH; k++) {
+        if (node.isEmpty(k)) continue;
+        AABB box = node.childBox(k);
+        if (node.isLeaf(k)) {
+            for (int p = node.child[k]; p < node.child[k] + node.count[k]; p++) {
+                int primitive = tree.primitives()[p];
+                seen[primitive]++;
+                sassert(box.contains(boxes[primitive]));
+            }
+        } else {
+            sassert(node.child[k] > index); // depth-first order
+            const BVH::Node& child = tree.nodes()[node.child[k]];
+            for (int c = 0; c < BVH::WIDTH; c++) {
+                if (!child.isEmpty(c)) sassert(box.contains(child.childBox(c)));
+            }
+            checkNode(tree, boxes, node.child[k], seen);
+        }
+    }
+}
+
+void testBuild() {
+    PCG pcg;
+    for (int n : {1, 3, 8, 9, 100, 2000}) {
+        std::vector<AABB> boxes = randomBoxes(pcg, n);
+        BVH tree;
+        tree.build(boxes);
+        sassert(tree.size() == n);
+
+        std::vector<int> seen(n, 0);
+        checkNode(tree, boxes, 0, seen);
+        for (int count : seen) sassert(count == 1);
+
+        // the first inner child of a node comes right after it
+        const BVH::Node& root = tree.nodes()[0];
+        for (int k = 0; k < BVH::WIDTH; k++) {
+            if (!root.isEmpty(k) && !root.isLeaf(k)) {
+                sassert(root.child[k] == 1);
+                break;
+            }
+        }
+    }
+
+    // many identical boxes can't be split by the heuristic
+    std::vector<AABB> same(100, AABB(Point3(0., 0., 0.), Point3(1., 1., 1.)));
+    BVH tree;
+    tree.build(same);
+    std::vector<int> seen(100, 0);
+    checkNode(tree, same, 0, seen);
+    for (int count : seen) sassert(count == 1);
+
+    // centroids apart by less than the inverse of the largest float, in the denormal range
+    std::vector<AABB> close;
+    for (int k = 0; k < 40; k++) close.emplace_back(Point3(0., -1., -1.), Point3(k * 1e-44f, 1., 1.));
+    for (BVH::Preset preset : {BVH::Preset::SAH, BVH::Preset::LBVH}) {
+        tree.build(close, preset);
+        seen.assign(40, 0);
+        checkNode(tree, close, 0, seen);
+        for (int count : seen) sassert(count == 1);
+    }
+
+    cout << "BVH build works" << endl;
+}
+
+void testTraversal() {
+    PCG pcg;
+    std::vector<AABB> boxes = randomBoxes(pcg, 500);
+    BVH tree;
+    tree.build(boxes);
+
+    for (int i = 0; i < 2000; i++) {
+        Ray ray(Point3(pcg.random(-12., 12.), pcg.random(-12., 12.), pcg.random(-12., 12.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 30.));
+        if (i % 10 == 0) ray.direction = Vec3(0., 0., 1.); // zeros in the direction
+
+        // brute force, using the entry point in the box as the distance
+        int expected = -1;
+        float expectedT = ray.tmax, t;
+        for (int p = 0; p < static_cast<int>(boxes.size()); p++) {
+            if (boxes[p].isHit(ray, t) && t < expectedT) expected = p, expectedT = t;
+        }
+
+        int found = -1;
+        float tmax = ray.tmax;
+        bool hit = tree.closestHit(ray, tmax, [&](int p, float& tmax) {
+            float t;
+            if (!boxes[p].isHit(ray, t) || t >= tmax) return false;
+            tmax = t, found = p;
+            return true;
+        });
+
+        sassert(hit == (expected >= 0));
+        if (hit) sassert(areClose(tmax, expectedT) && boxes[found].isHit(ray, t) && areClose(t, expectedT));
+
+        bool any = tree.anyHit(ray, [&](int p) { float t; return boxes[p].isHit(ray, t); });
+        sassert(any == (expected >= 0));
+    }
+
+    cout << "BVH traversal works" << endl;
+}
+
+bool sameTree(const BVH& a, const BVH& b) {
+    if (a.nodes().size() != b.nodes().size() || !std::ranges::equal(a.primitives(), b.primitives())) return false;
+    for (size_t n = 0; n < a.nodes().size(); n++) {
+        for (int k = 0; k < BVH::WIDTH; k++) {
+            if (a.child(n, k) != b.child(n, k) || a.count(n, k) != b.count(n, k)) return false;
+            if (!a.isEmpty(n, k) && !a.childBox(n, k).contains(b.childBox(n, k), 0.0f)) return false;
+            if (!a.isEmpty(n, k) && !b.childBox(n, k).contains(a.childBox(n, k), 0.0f)) return false;
+        }
+    }
+    return true;
+}
+
+void testPresets() {
+    PCG pcg;
+    ThreadPool pool(4);
+    // the biggest one is binned in parallel too
+    for (int n : {1, 7, 9, 2000, 100000}) {
+        std::vector<AABB> boxes = randomBoxes(pcg, n);
+        float costs[2];
+        for (BVH::Preset preset : {BVH::Preset::SAH, BVH::Preset::LBVH}) {
+            BVH tree, parallel;
+            tree.build(boxes, preset);
+            parallel.build(boxes, preset, &pool);
+            sassert(sameTree(tree, parallel));
+
+            std::vector<int> seen(n, 0);
+            checkNode(tree, boxes, 0, seen);
+            for (int count : seen) sassert(count == 1);
+            costs[preset == BVH::Preset::LBVH] = tree.sahCost();
+        }
+        if (n >= 2000) sassert(costs[0] < costs[1]); // SAH gives better trees
+    }
+
+    // the Morton tree is still a correct tree
+    std::vector<AABB> boxes = randomBoxes(pcg, 500);
+    BVH tree;
+    tree.build(boxes, BVH::Preset::LBVH, &pool);
+    for (int i = 0; i < 500; i++) {
+        Ray ray(Point3(pcg.random(-12., 12.), pcg.random(-12., 12.), pcg.random(-12., 12.)), pcg.randomVersor(), RAY_MIN, 50.0f);
+        float expectedT = ray.tmax, t;
+        for (const AABB& box : boxes) {
+            if (box.isHit(ray, t)) expectedT = std::min(expectedT, t);
+        }
+        float tmax = ray.tmax;
+        tree.closestHit(ray, tmax, [&](int p, float& tmax) {
+            float t;
+            if (!boxes[p].isHit(ray, t) || t >= tmax) return false;
+            tmax = t;
+            return true;
+        });
+        sassert(areClose(tmax, expectedT));
+    }
+
+    cout << "BVH presets work, and don't depend on the threads" << endl;
+}
+
+void testRefit() {
+    PCG pcg;
+    std::vector<AABB> boxes = randomBoxes(pcg, 2000);
+    BVH tree, moved;
+    tree.build(boxes);
+    QuantizedBVH compact;
+    compact.build(tree);
+
+    for (AABB& box : boxes) {
+        Vec3 shift(pcg.random(-3., 3.), pcg.random(-3., 3.), pcg.random(-3., 3.));
+        box = AABB(box.min + shift, box.max + shift);
+    }
+    tree.refit(boxes);
+    compact.refit(boxes);
+    moved.build(boxes);
+
+    // same structure, boxes still containing everything
+    std::vector<int> seen(boxes.size(), 0);
+    checkNode(tree, boxes, 0, seen);
+    for (int count : seen) sassert(count == 1);
+    for (int n = 0; n < static_cast<int>(tree.nodes().size()); n++) {
+        for (int k = 0; k < BVH::WIDTH; k++) {
+            if (!tree.isEmpty(n, k)) sassert(compact.childBox(n, k).contains(tree.childBox(n, k), 0.0f));
+        }
+    }
+    sassert(tree.sahCost() > moved.sahCost()); // but worse than a new tree
+
+    cout << "BVH refit works" << endl;
+}
+
+void testCache() {
+    PCG pcg;
+    std::vector<AABB> boxes = randomBoxes(pcg, 2000);
+    const std::string path = "testCache.bvh";
+
+    for (BVH::Preset preset : {BVH::Preset::SAH, BVH::Preset::LBVH}) {
+        BVH tree, loaded;
+        tree.build(boxes, preset);
+        uint64_t key = BVH::key(boxes, preset);
+        sassert(tree.save(path, key));
+        sassert(loaded.load(path, key) && loaded.isMapped() && !tree.isMapped());
+        sassert(sameTree(tree, loaded));
+        sassert(loaded.sahCost() == tree.sahCost());
+        sassert(areClose(loaded.bounds().min.x, tree.bounds().min.x) && areClose(loaded.bounds().max.z, tree.bounds().max.z));
+
+        for (int i = 0; i < 200; i++) {
+            Ray ray(Point3(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.)), pcg.randomVersor(), RAY_MIN, 50.0f);
+            auto hit = [&](int p) { float t; return boxes[p].isHit(ray, t); };
+            sassert(loaded.anyHit(ray, hit) == tree.anyHit(ray, hit));
+        }
+
+        // copied before refitting, the file stays as it was
+        QuantizedBVH compact;
+        compact.build(loaded);
+        sassert(compact.primitives().size() == boxes.size());
+        std::vector<AABB> moved = boxes;
+        for (AABB& box : moved) box = AABB(box.min + Vec3(1., 0., 0.), box.max + Vec3(1., 0., 0.));
+        loaded.refit(moved);
+        sassert(!loaded.isMapped());
+        sassert(areClose(loaded.bounds().min.x, tree.bounds().min.x + 1.0f));
+        BVH again;
+        sassert(again.load(path, key) && sameTree(again, tree));
+    }
+
+    // anything different is not loaded, and leaves the tree as it was
+    BVH tree, other;
+    tree.build(boxes);
+    uint64_t key = BVH::key(boxes, BVH::Preset::SAH);
+    sassert(key != BVH::key(boxes, BVH::Preset::LBVH));
+    std::vector<AABB> changed = boxes;
+    changed[1000].max.x += 0.01f;
+    sassert(key != BVH::key(changed, BVH::Preset::SAH));
+
+    sassert(tree.save(path, key));
+    other.build(changed);
+    sassert(!other.load(path, key + 1) && !other.isMapped() && other.size() == static_cast<int>(changed.size()));
+    sassert(!other.load("missing.bvh", key));
+
+    // a damaged file of the right size is rejected if the traversal could go out of the arrays: the 64 bytes
+    // of the header, then the nodes, then the primitives
+    auto damaged = [&](size_t offset, int32_t value) {
+        sassert(tree.save(path, key));
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(offset);
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+        return !other.load(path, key) && !other.isMapped();
+    };
+    int leaf = 0, slot = 0;
+    while (!tree.nodes()[leaf].isLeaf(slot)) slot = (slot + 1) % 4, leaf += slot == 0;
+    size_t nodes = 64 + offsetof(BVH::Node, child), leaves = 64 + leaf * sizeof(BVH::Node) + offsetof(BVH::Node, count) + 4 * slot;
+    sassert(!tree.nodes()[0].isLeaf(0));
+    sassert(damaged(nodes, static_cast<int32_t>(tree.nodes().size()))); // a child after the last node
+    sassert(damaged(nodes, 0));                                         // the root as its own child
+    sassert(damaged(leaves, static_cast<int32_t>(boxes.size()) + 1));   // a leaf past the last primitive
+    sassert(damaged(64 + tree.nodes().size_bytes(), -1));              // a primitive that doesn't exist
+    sassert(!damaged(64 + offsetof(BVH::Node, bounds), 0));             // the boxes can be anything
+    other.build(changed); // no longer mapped from the file
+    {
+        std::ofstream truncated(path, std::ios::binary | std::ios::trunc);
+        truncated << "RTBVH";
+    }
+    sassert(!other.load(path, key) && !other.isMapped());
+    std::remove(path.c_str());
+
+    cout << "BVH cache works" << endl;
+}
+
+void testQuantized() {
+    PCG pcg;
+    std::vector<AABB> boxes = randomBoxes(pcg, 1000);
+    boxes.push_back(AABB(Point3(3., 3., 3.), Point3(3., 3., 3.))); // flat box
+    BVH tree;
+    tree.build(boxes);
+    QuantizedBVH compact;
+    compact.build(tree);
+
+    sassert(compact.size() == tree.size());
+    sassert(compact.nodes().size() == tree.nodes().size());
+    sassert(compact.memoryUsage() < tree.memoryUsage());
+
+    // quantized boxes contain the exact ones, without being much bigger
+    for (int n = 0; n < static_cast<int>(tree.nodes().size()); n++) {
+        for (int k = 0; k < BVH::WIDTH; k++) {
+            sassert(compact.isEmpty(n, k) == tree.isEmpty(n, k));
+            if (tree.isEmpty(n, k)) continue;
+            AABB exact = tree.childBox(n, k), quantized = compact.childBox(n, k);
+            sassert(quantized.contains(exact, 0.0f));
+            sassert(quantized.surfaceArea() < exact.surfaceArea() * 1.2f + 1e-3f);
+            sassert(compact.child(n, k) == tree.child(n, k) && compact.count(n, k) == tree.count(n, k));
+        }
+    }
+
+    // same hits as the normal tree
+    for (int i = 0; i < 2000; i++) {
+        Ray ray(Point3(pcg.random(-12., 12.), pcg.random(-12., 12.), pcg.random(-12., 12.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 30.));
+        if (i % 10 == 0) ray.direction = Vec3(1., 0., 0.);
+
+        auto closest = [&](const auto& bvh, int& found) {
+            float tmax = ray.tmax;
+            found = -1;
+            bvh.closestHit(ray, tmax, [&](int p, float& tmax) {
+                float t;
+                if (!boxes[p].isHit(ray, t) || t >= tmax) return false;
+                tmax = t, found = p;
+                return true;
+            });
+            return tmax;
+        };
+        int expected, found;
+        sassert(areClose(closest(tree, expected), closest(compact, found)));
+        sassert((expected >= 0) == (found >= 0));
+        sassert(tree.anyHit(ray, [&](int p) { float t; return boxes[p].isHit(ray, t); })
+                == compact.anyHit(ray, [&](int p) { float t; return boxes[p].isHit(ray, t); }));
+    }
+
+    cout << "quantized BVH works (" << static_cast<float>(compact.memoryUsage()) / compact.size() << " bytes per primitive instead of "
+         << static_cast<float>(tree.memoryUsage()) / tree.size() << ")" << endl;
+}
+
+}
+
+// tests for the uniform grid
+namespace grid {
+
+void testBuild() {
+    PCG pcg;
+    for (int n : {1, 10, 2000}) {
+        std::vector<AABB> boxes = bvh::randomBoxes(pcg, n);
+        Grid grid;
+        grid.build(boxes);
+        sassert(!grid.isEmpty() && grid.nCells() > 0);
+        sassert(static_cast<int>(grid.primitives().size()) >= n);
+        for (const AABB& box : boxes) sassert(grid.bounds().contains(box, 0.0f));
+
+        std::vector<int> seen(n, 0);
+        for (int primitive : grid.primitives()) seen[primitive]++;
+        for (int count : seen) sassert(count >= 1);
+    }
+
+    // all the boxes on a plane, the cells still have some thickness
+    std::vector<AABB> flat;
+    for (int i = 0; i < 100; i++) flat.emplace_back(Point3(i, 0., 0.), Point3(i + 0.5, 1., 0.));
+    Grid grid;
+    grid.build(flat);
+    sassert(grid.resolution()[2] == 1 && grid.bounds().extent().z > 0.0f);
+
+    // a huge box around everything doesn't go in the cells
+    std::vector<AABB> sky = bvh::randomBoxes(pcg, 100);
+    sky.emplace_back(Point3(-1000., -1000., -1000.), Point3(1000., 1000., 1000.));
+    grid.build(sky);
+    sassert(grid.large().size() == 1 && grid.large()[0] == 100);
+    sassert(grid.bounds().extent().x < 30.0f);
+    for (int primitive : grid.primitives()) sassert(primitive != 100);
+
+    grid.clear();
+    sassert(grid.isEmpty() && grid.memoryUsage() == 0);
+
+    cout << "grid build works" << endl;
+}
+
+void testTraversal() {
+    PCG pcg;
+    for (float density : {0.5f, Grid::DENSITY, 8.0f}) {
+        std::vector<AABB> boxes = bvh::randomBoxes(pcg, 500);
+        if (density > Grid::DENSITY) boxes.emplace_back(Point3(-100., -100., -100.), Point3(100., 100., 100.)); // kept out of the cells
+        Grid grid;
+        grid.build(boxes, density);
+
+        for (int i = 0; i < 2000; i++) {
+            // some rays start outside the grid
+            Ray ray(Point3(pcg.random(-15., 15.), pcg.random(-15., 15.), pcg.random(-15., 15.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 30.));
+            if (i % 10 == 0) ray.direction = Vec3(0., 0., -1.); // zeros in the direction
+
+            int expected = -1;
+            float expectedT = ray.tmax, t;
+            for (int p = 0; p < static_cast<int>(boxes.size()); p++) {
+                if (boxes[p].isHit(ray, t) && t < expectedT) expected = p, expectedT = t;
+            }
+
+            float tmax = ray.tmax;
+            bool hit = grid.closestHit(ray, tmax, [&](int p, float& tmax) {
+                float t;
+                if (!boxes[p].isHit(ray, t) || t >= tmax) return false;
+                tmax = t;
+                return true;
+            });
+            sassert(hit == (expected >= 0));
+            if (hit) sassert(areClose(tmax, expectedT));
+
+            bool any = grid.anyHit(ray, [&](int p) { float t; return boxes[p].isHit(ray, t); });
+            sassert(any == (expected >= 0));
+        }
+    }
+
+    cout << "grid traversal works" << endl;
+}
+
+}
+
+// tests for the world with a BVH
+namespace world {
+
+void fill(World& world, PCG& pcg, int nSpheres) {
+    for (int i = 0; i < nSpheres; i++) {
+        Transformation t = translation(pcg.random(-8., 8.), pcg.random(-8., 8.), pcg.random(-8., 8.))
+                           * rotation(pcg.random(0., 360.), Axis::Y) * scaling(pcg.random(0.1, 1.), pcg.random(0.1, 1.), pcg.random(0.1, 1.));
+        world.addShape(std::make_shared<Sphere>(bufferMaterial, t));
+    }
+    world.addShape(std::make_shared<Plane>(bufferMaterial, translation(0., 0., -9.)));
+}
+
+void testSameResults() {
+    PCG pcg, copy = pcg;
+    World linear, built;
+    fill(linear, pcg, 300);
+    fill(built, copy, 300);
+    built.build();
+    sassert(!linear.isBuilt() && built.isBuilt());
+
+    // the BVH with every setting, then the other accelerators
+    for (int setting = 0; setting < 5; setting++) {
+        bool compact = setting == 1;
+        built.buildSettings.accelerator = setting == 3 ? Accelerator::Type::Grid : setting == 4 ? Accelerator::Type::Linear : Accelerator::Type::BVH;
+        built.buildSettings.compact = compact;
+        built.buildSettings.preset = setting == 2 ? BVH::Preset::LBVH : BVH::Preset::SAH;
+        built.buildSettings.nThreads = setting == 2 ? 3 : 1;
+        built.build();
+        sassert(built.accelerator().type() == built.buildSettings.accelerator);
+        if (setting < 3) {
+            const auto& accelerator = dynamic_cast<const BVHAccelerator&>(built.accelerator());
+            sassert(accelerator.quantizedBVH().isEmpty() != compact && accelerator.bvh().isEmpty() == compact);
+            sassert(built.buildStats().sahCost > 0.0f);
+        }
+        sassert((built.buildStats().memory > 0) == (setting < 4));
+
+        for (int i = 0; i < 3000; i++) {
+            Ray ray(Point3(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 40.));
+            HitRecord expected, rec;
+            bool hit = linear.isHit(ray, expected);
+            sassert(built.isHit(ray, rec) == hit);
+            if (hit) sassert(rec.isClose(expected, 1e-4f));
+            sassert(built.occluded(ray) == hit);
+        }
+    }
+
+    // adding a shape discards the BVH
+    built.addShape(std::make_shared<Sphere>(bufferMaterial));
+    sassert(!built.isBuilt());
+
+    cout << "the BVH and the grid give the same hits as the linear search" << endl;
+}
+
+void testPackets() {
+    PCG pcg, copy = pcg;
+    World linear, built;
+    fill(linear, pcg, 300);
+    fill(built, copy, 300);
+
+    for (int setting = 0; setting < 3; setting++) {
+        built.buildSettings.compact = setting == 1;
+        built.buildSettings.accelerator = setting == 2 ? Accelerator::Type::Grid : Accelerator::Type::BVH;
+        built.build();
+
+        Camera camera("perspective", 1., 64, 1., translation(-20., 0., 0.));
+        RayPacket packet;
+        HitRecord records[RayPacket::MAX_SIZE], expected[RayPacket::MAX_SIZE];
+        bool hits[RayPacket::MAX_SIZE], expectedHits[RayPacket::MAX_SIZE], occluded[RayPacket::MAX_SIZE];
+
+        for (int j0 = 0; j0 < 64; j0 += 8) {
+            for (int i0 = 0; i0 < 64; i0 += 8) {
+                Ray corners[4] = {camera.castRay(i0, j0, 0., 0.), camera.castRay(i0 + 7, j0, 1., 0.),
+                                  camera.castRay(i0 + 7, j0 + 7, 1., 1.), camera.castRay(i0, j0 + 7, 0., 1.)};
+                packet.setFrustum(corners);
+                packet.clear();
+                for (int j = j0; j < j0 + 8; j++) {
+                    for (int i = i0; i < i0 + 8; i++) packet.add(camera.castRay(i, j));
+                }
+
+                linear.isHit(packet, expected, expectedHits);
+                built.isHit(packet, records, hits);
+                built.occluded(packet, occluded);
+                for (int r = 0; r < packet.size; r++) {
+                    sassert(hits[r] == expectedHits[r] && occluded[r] == expectedHits[r]);
+                    if (hits[r]) sassert(records[r].isClose(expected[r], 1e-4f));
+                }
+            }
+        }
+    }
+
+    cout << "packets work with the BVH and the grid" << endl;
+}
+
+void testCompactShapes() {
+    PCG pcg;
+    std::vector<std::shared_ptr<Material>> materials = {std::make_shared<DiffuseMaterial>(), std::make_shared<SpecularMaterial>()};
+    World objects, compact;
+    compact.buildSettings.compactShapes = true;
+    compact.reserve(401, 400);
+    for (int i = 0; i < 400; i++) {
+        Transformation t = translation(pcg.random(-8., 8.), pcg.random(-8., 8.), pcg.random(-8., 8.))
+                           * rotation(pcg.random(0., 360.), Axis::Y) * scaling(pcg.random(0.1, 1.), pcg.random(0.1, 1.), pcg.random(0.1, 1.));
+        objects.addSphere(materials[i % 2], t);
+        compact.addSphere(materials[i % 2], t);
+    }
+    sassert(compact.bounds().min.isClose(objects.bounds().min, 1e-4f) && compact.bounds().max.isClose(objects.bounds().max, 1e-4f));
+    objects.addShape(std::make_shared<Plane>(bufferMaterial, translation(0., 0., -9.)));
+    compact.addShape(std::make_shared<Plane>(bufferMaterial, translation(0., 0., -9.)));
+    sassert(objects._shapes.size() == 401 && compact._shapes.size() == 1 && compact.compactSpheres() == 400);
+
+    for (bool build : {false, true}) {
+        if (build) objects.build(), compact.build();
+        for (int i = 0; i < 3000; i++) {
+            Ray ray(Point3(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 40.));
+            HitRecord expected, rec;
+            bool hit = objects.isHit(ray, expected);
+            sassert(compact.isHit(ray, rec) == hit);
+            if (hit) sassert(rec.isClose(expected, 1e-4f) && rec.material == expected.material);
+            sassert(compact.occluded(ray) == hit);
+        }
+    }
+
+    World::MemoryStats objectStats = objects.memoryStats(), compactStats = compact.memoryStats();
+    sassert(objectStats.shapes == 401 && objectStats.compactSpheres == 0 && compactStats.shapes == 401 && compactStats.compactSpheres == 400);
+    sassert(objectStats.materials == 2 && compactStats.materials == 2);
+    sassert(compactStats.shapeBytes < objectStats.shapeBytes / 5 && compactStats.total() < objectStats.total() / 2);
+
+    cout << "compact spheres give the same hits as the Sphere objects, in " << compactStats.total() / 401
+         << " bytes per shape instead of " << objectStats.total() / 401 << endl;
+}
+
+void testUpdate() {
+    PCG pcg, copy = pcg;
+    World linear, built;
+    fill(linear, pcg, 300);
+    fill(built, copy, 300);
+
+    for (bool compact : {false, true}) {
+        built.buildSettings.compact = compact;
+        built.build();
+
+        // small movements are refitted, the same ones in both worlds
+        for (int frame = 0; frame < 3; frame++) {
+            Transformation move = rotation(2., Axis::Z) * translation(0.1, 0., 0.);
+            for (World* world : {&linear, &built}) {
+                for (auto& shape : world->_shapes) shape->transformation = move * shape->transformation;
+            }
+            linear.update();
+            sassert(!built.update() && built.buildStats().refits == frame + 1);
+
+            for (int i = 0; i < 1000; i++) {
+                Ray ray(Point3(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 40.));
+                HitRecord expected, rec;
+                bool hit = linear.isHit(ray, expected);
+                sassert(built.isHit(ray, rec) == hit);
+                if (hit) sassert(rec.isClose(expected, 1e-4f));
+                sassert(built.occluded(ray) == hit);
+            }
+        }
+    }
+
+    // shuffling the spheres makes the tree much worse, so it's built again
+    for (auto& shape : built._shapes) {
+        shape->transformation = translation(pcg.random(-8., 8.), pcg.random(-8., 8.), pcg.random(-8., 8.)) * scaling(0.5);
+    }
+    sassert(built.update() && built.buildStats().refits == 0);
+    sassert(areClose(built.buildStats().sahCost, built.buildStats().builtSahCost));
+
+    cout << "the BVH follows the shapes when they move" << endl;
+}
+
+void testCache() {
+    PCG pcg, copy = pcg, other = pcg;
+    World linear, saved, loaded;
+    fill(linear, pcg, 300);
+    fill(saved, copy, 300);
+    fill(loaded, other, 300);
+    const std::string path = "testWorldCache.bvh";
+    std::remove(path.c_str());
+
+    saved.buildSettings.cachePath = loaded.buildSettings.cachePath = path;
+    saved.build();
+    sassert(!saved.buildStats().cached);
+    for (bool compact : {false, true}) {
+        loaded.buildSettings.compact = compact;
+        loaded.build();
+        sassert(loaded.buildStats().cached);
+        if (!compact) sassert(loaded.buildStats().sahCost == saved.buildStats().sahCost);
+
+        for (int i = 0; i < 1000; i++) {
+            Ray ray(Point3(pcg.random(-10., 10.), pcg.random(-10., 10.), pcg.random(-10., 10.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 40.));
+            HitRecord expected, rec;
+            bool hit = linear.isHit(ray, expected);
+            sassert(loaded.isHit(ray, rec) == hit);
+            if (hit) sassert(rec.isClose(expected, 1e-4f));
+        }
+    }
+
+    // once a shape moves the tree is built again, and saved in place of the old one
+    loaded.buildSettings.compact = false;
+    loaded._shapes[0]->transformation = translation(0., 0., 1.) * loaded._shapes[0]->transformation;
+    loaded.build();
+    sassert(!loaded.buildStats().cached);
+    saved.build();
+    sassert(!saved.buildStats().cached);
+    loaded.build();
+    sassert(!loaded.buildStats().cached);
+    loaded.build();
+    sassert(loaded.buildStats().cached);
+    std::remove(path.c_str());
+
+    cout << "the BVH is loaded from the cache only when the shapes match" << endl;
+}
+
+void testInstances() {
+    PCG pcg;
+    auto group = std::make_shared<World>();
+    std::vector<Transformation> shapes;
+    for (int i = 0; i < 50; i++) {
+        shapes.push_back(translation(pcg.random(-2., 2.), pcg.random(-2., 2.), pcg.random(-2., 2.)) * scaling(pcg.random(0.1, 0.5)));
+        group->addShape(std::make_shared<Sphere>(bufferMaterial, shapes.back()));
+    }
+    group->build();
+
+    // the same spheres, with the transformations of the instances applied to every one of them
+    World instanced, flat;
+    for (int i = 0; i < 100; i++) {
+        Transformation t = translation(pcg.random(-20., 20.), pcg.random(-20., 20.), pcg.random(-20., 20.))
+                           * rotation(pcg.random(0., 360.), Axis::X) * scaling(pcg.random(0.5, 2.));
+        instanced.addShape(std::make_shared<Instance>(group, t));
+        for (const Transformation& s : shapes) flat.addShape(std::make_shared<Sphere>(bufferMaterial, t * s));
+    }
+    instanced.build();
+    flat.build();
+    sassert(group.use_count() == 101);
+    sassert(instanced.bounds().contains(flat.bounds()));
+
+    for (int i = 0; i < 3000; i++) {
+        Ray ray(Point3(pcg.random(-25., 25.), pcg.random(-25., 25.), pcg.random(-25., 25.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 50.));
+        HitRecord expected, rec;
+        bool hit = flat.isHit(ray, expected);
+        sassert(instanced.isHit(ray, rec) == hit);
+        if (hit) {
+            sassert(rec.worldPoint.isClose(expected.worldPoint, 1e-3f) && areClose(rec.t, expected.t, 1e-3f));
+            sassert(rec.normal.normalize().isClose(expected.normal.normalize(), 1e-2f) && rec.ray.isClose(ray)); // matrices multiplied in another order
+        }
+        sassert(instanced.occluded(ray) == hit);
+    }
+
+    cout << "instances give the same hits as copies of the shapes" << endl;
+}
+
+}
+
+int main() {
+    cout << "AABB:" << endl;
+    aabb::testBasics();
+    aabb::testShapeBoxes();
+
+    cout << "\nBVH:" << endl;
+    bvh::testBuild();
+    bvh::testTraversal();
+    bvh::testPresets();
+    bvh::testQuantized();
+    bvh::testRefit();
+    bvh::testCache();
+
+    cout << "\nGrid:" << endl;
+    grid::testBuild();
+    grid::testTraversal();
+
+    cout << "\nWorld:" << endl;
+    world::testSameResults();
+    world::testPackets();
+    world::testCompactShapes();
+    world::testUpdate();
+    world::testCache();
+    world::testInstances();
+
+    return 0;
+}
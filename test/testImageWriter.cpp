@@ -0,0 +1,513 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+#include "HDRImage.hpp"
+#include "ImageWriter.hpp"
+#include "ThreadPool.hpp"
+#include "simd.hpp"
+#include "utils.hpp"
+
+using std::cout, std::endl;
+
+std::string readBytes(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+uint32_t bigEndian32(const std::string& bytes, size_t position) {
+    uint32_t value = 0;
+    for (int k = 0; k < 4; k++) value = value << 8 | static_cast<unsigned char>(bytes[position + k]);
+    return value;
+}
+
+HDRImage testImage(int width, int height) {
+    PCG pcg;
+    HDRImage image(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) image.setPixel(i, j, Color(pcg.random(0., 10.), pcg.random(), (i + j) % 5));
+    }
+    return image;
+}
+
+void testToneMappedPFM() {
+    HDRImage image = testImage(37, 101);
+    image.save("testImageWriter.pfm");
+
+    // from a mapped image, written a strip at a time from the bottom, as normalize, clamp and save would
+    HDRImage mapped = HDRImage::map("testImageWriter.pfm");
+    float luminosity = mapped.averageLuminosity();
+    mapped.saveToneMapped("testToneMapped.pfm", 0.5f / luminosity);
+    image.normalize(0.5f, luminosity);
+    image.clamp();
+
+    HDRImage read("testToneMapped.pfm");
+    for (int j = 0; j < image._height; j++) {
+        for (int i = 0; i < image._width; i++) sassert(read.getPixel(i, j).isClose(image.getPixel(i, j)));
+    }
+    std::remove("testImageWriter.pfm");
+    std::remove("testToneMapped.pfm");
+}
+
+void testToneMapKernels() {
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (bestSimdLevel() >= SimdLevel::SSE4) levels.push_back(SimdLevel::SSE4);
+    if (bestSimdLevel() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+    // values over many orders of magnitude, zeros and negatives, and counts with every tail length
+    PCG pcg;
+    std::vector<float> values(3 * 1001 + 1);
+    for (float& value : values) value = std::pow(10.0f, pcg.random(-6.0f, 4.0f)) * (pcg.random() < 0.05f ? -1.0f : 1.0f);
+    for (size_t k = 0; k < values.size(); k += 37) values[k] = 0.0f;
+    std::vector<float> colors(values.size()); // luminosities are never negative
+    for (size_t k = 0; k < values.size(); k++) colors[k] = std::abs(values[k]);
+
+    for (size_t count : {0, 1, 3, 7, 8, 9, 100, 1001}) {
+        double reference = sumLogLuminosity(colors.data() + 1, count, 1e-10f, SimdLevel::SCALAR);
+        for (SimdLevel level : levels) {
+            sassert(std::abs(sumLogLuminosity(colors.data() + 1, count, 1e-10f, level) - reference) <= 1e-5 * (1.0 + count));
+        }
+
+        for (bool clamp : {false, true}) {
+            for (float invGamma : {1.0f, 1.0f / 2.2f, 2.0f}) {
+                std::vector<uint8_t> expected(3 * count), bytes(3 * count);
+                toneMap(values.data() + 1, 3 * count, 0.3f, clamp, invGamma, expected.data(), SimdLevel::SCALAR);
+                for (SimdLevel level : levels) {
+                    toneMap(values.data() + 1, 3 * count, 0.3f, clamp, invGamma, bytes.data(), level);
+                    // an ulp of difference can only move a value across an integer
+                    size_t different = 0;
+                    for (size_t k = 0; k < bytes.size(); k++) {
+                        sassert(std::abs(bytes[k] - expected[k]) <= 1);
+                        different += bytes[k] != expected[k];
+                    }
+                    sassert(different * 100 <= bytes.size());
+                }
+            }
+        }
+    }
+
+    // the parallel luminosity is exactly the serial one, whatever the number of threads
+    HDRImage image = testImage(123, 77);
+    float serial = image.averageLuminosity();
+    for (int nThreads : {1, 2, 4}) {
+        ThreadPool pool(nThreads);
+        for (int k = 0; k < 5; k++) sassert(image.averageLuminosity(1e-10f, &pool) == serial);
+    }
+}
+
+void testHalves() {
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (bestSimdLevel() >= SimdLevel::SSE4) levels.push_back(SimdLevel::SSE4);
+    if (bestSimdLevel() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+    // every half, to float and back, exactly
+    std::vector<uint16_t> halves(65536), back(65536);
+    for (size_t k = 0; k < halves.size(); k++) halves[k] = static_cast<uint16_t>(k);
+    std::vector<float> values(65536);
+    for (SimdLevel level : levels) {
+        halvesToFloats(halves.data(), halves.size(), values.data(), level);
+        floatsToHalves(values.data(), values.size(), back.data(), level);
+        for (size_t k = 0; k < halves.size(); k++) {
+            bool nan = (k & 0x7c00) == 0x7c00 && (k & 0x3ff) != 0;
+            sassert(nan ? std::isnan(values[k]) && (back[k] & 0x7fff) > 0x7c00 : back[k] == halves[k]);
+        }
+    }
+    sassert(values[0x3c00] == 1.0f && values[0xc000] == -2.0f && values[0x0001] == std::ldexp(1.0f, -24) && std::isinf(values[0x7c00]));
+
+    // rounding to the nearest even, overflow, denormals, with counts that leave a tail
+    std::vector<float> floats = {1.0f + std::ldexp(1.0f, -11), 1.0f + 3 * std::ldexp(1.0f, -11), 65504.0f, 65520.0f, 1e10f, -1e-8f, 3e-5f, 0.0f, -0.0f};
+    std::vector<uint16_t> expected = {0x3c00, 0x3c02, 0x7bff, 0x7c00, 0x7c00, 0x8000, 0x01f7, 0x0000, 0x8000};
+    PCG pcg;
+    for (int k = 0; k < 1000; k++) floats.push_back(std::pow(10.0f, pcg.random(-9.0f, 6.0f)) * (pcg.random() < 0.5f ? -1.0f : 1.0f));
+    std::vector<uint16_t> reference(floats.size()), converted(floats.size());
+    floatsToHalves(floats.data(), floats.size(), reference.data(), SimdLevel::SCALAR);
+    for (size_t k = 0; k < expected.size(); k++) sassert(reference[k] == expected[k]);
+    for (SimdLevel level : levels) {
+        floatsToHalves(floats.data(), floats.size(), converted.data(), level);
+        sassert(converted == reference);
+    }
+}
+
+// the formats keeping the dynamic range, through save, the constructor and map
+void testHDRFormats() {
+    HDRImage image = testImage(300, 41);
+    image.setPixel(0, 0, Color(1e4f, 1e-3f, 0.0f));
+    for (int i = 0; i < 300; i++) image.setPixel(i, 40, Color(2.0f, 0.5f, 0.25f)); // a row of runs
+    for (const char* fileName : {"testImageWriter.hdr", "testImageWriter.exr"}) {
+        image.save(fileName);
+        bool rgbe = std::string(fileName).ends_with(".hdr");
+        for (const HDRImage& read : {HDRImage(std::string(fileName)), HDRImage::map(fileName)}) {
+            sassert(read._width == 300 && read._height == 41 && !read.isMapped());
+            for (int j = 0; j < 41; j++) {
+                for (int i = 0; i < 300; i++) {
+                    // RGBE has 8 bits of mantissa shared by the channels, halves 11 bits each
+                    Color c = image.getPixel(i, j), r = read.getPixel(i, j);
+                    float tolerance = rgbe ? std::max({c.r, c.g, c.b}) / 128 : 0.0f;
+                    for (auto [x, y] : {std::pair(c.r, r.r), std::pair(c.g, r.g), std::pair(c.b, r.b)}) {
+                        sassert(std::abs(x - y) <= (rgbe ? tolerance : std::abs(x) / 1024));
+                    }
+                }
+            }
+        }
+        std::remove(fileName);
+    }
+
+    // sizes: RGBE is at most 4 bytes per pixel and compresses uniform rows, OpenEXR takes 6 bytes per pixel
+    HDRImage flat(300, 200);
+    for (int j = 0; j < 200; j++) {
+        for (int i = 0; i < 300; i++) flat.setPixel(i, j, Color(0.5f, 0.5f, 1.0f));
+    }
+    flat.save("testImageWriter.hdr");
+    flat.save("testImageWriter.exr");
+    sassert(readBytes("testImageWriter.hdr").size() < 300 * 200 / 10);
+    size_t exr = readBytes("testImageWriter.exr").size();
+    sassert(exr > 300 * 200 * 6 && exr < 300 * 200 * 6 + 200 * 16 + 400);
+    std::remove("testImageWriter.hdr");
+    std::remove("testImageWriter.exr");
+
+    std::ofstream("testImageWriter.exr", std::ios::binary) << "v/1\x01 not an image";
+    testException("testImageWriter.exr", [](std::string s) -> auto {return HDRImage(s);});
+    std::remove("testImageWriter.exr");
+}
+
+// reads a deflate stream, with only the block types the PNG writer makes: stored and fixed Huffman
+class Inflater {
+public:
+    explicit Inflater(const std::string& stream, size_t position = 0) : _stream(stream), _position(position) {}
+
+    std::string inflate() {
+        static const int lengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int lengthBits[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const int distanceBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const int distanceBits[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        std::string output;
+        bool last = false;
+        while (!last) {
+            last = bits(1);
+            int type = bits(2);
+            sassert(type == 0 || type == 1);
+            if (type == 0) {
+                _bit = 0, _position++; // to the next byte
+                size_t length = byte(0) | byte(1) << 8;
+                sassert((length ^ (byte(2) | byte(3) << 8)) == 0xffff);
+                output += _stream.substr(_position + 4, length);
+                _position += 4 + length;
+                continue;
+            }
+            for (int symbol = literal(); symbol != 256; symbol = literal()) {
+                if (symbol < 256) {
+                    output += static_cast<char>(symbol);
+                    continue;
+                }
+                int length = lengthBase[symbol - 257] + bits(lengthBits[symbol - 257]);
+                int code = reversed(5);
+                size_t distance = distanceBase[code] + bits(distanceBits[code]);
+                sassert(distance <= output.size());
+                for (int k = 0; k < length; k++) output += output[output.size() - distance];
+            }
+        }
+        if (_bit > 0) _bit = 0, _position++;
+        return output;
+    }
+
+    size_t position() const { return _position; }
+
+private:
+    const std::string& _stream;
+    size_t _position;
+    int _bit = 0;
+
+    unsigned byte(size_t offset) const { return static_cast<unsigned char>(_stream[_position + offset]); }
+
+    // n bits, the first one the least significant
+    int bits(int n) {
+        int value = 0;
+        for (int k = 0; k < n; k++) {
+            value |= (byte(0) >> _bit & 1) << k;
+            if (++_bit == 8) _bit = 0, _position++;
+        }
+        return value;
+    }
+
+    // n bits of a Huffman code, the first one the most significant
+    int reversed(int n) {
+        int value = 0;
+        for (int k = 0; k < n; k++) value = value << 1 | bits(1);
+        return value;
+    }
+
+    // a literal or length symbol of the fixed Huffman code, 7 to 9 bits long
+    int literal() {
+        int code = reversed(7);
+        if (code < 24) return 256 + code;
+        code = code << 1 | bits(1);
+        if (code < 192) return code - 48;
+        if (code < 200) return 280 + code - 192;
+        return 144 + (code << 1 | bits(1)) - 400;
+    }
+};
+
+// the 8-bit RGB rows of a PNG, from its filtered rows
+std::vector<uint8_t> unfilter(const std::string& data, int width, int height) {
+    size_t stride = 3 * static_cast<size_t>(width);
+    sassert(data.size() == height * (stride + 1));
+    std::vector<uint8_t> pixels(height * stride);
+    for (int j = 0; j < height; j++) {
+        int filter = data[j * (stride + 1)];
+        sassert(filter >= 0 && filter <= 4);
+        for (size_t k = 0; k < stride; k++) {
+            int a = k >= 3 ? pixels[j * stride + k - 3] : 0, b = j > 0 ? pixels[(j - 1) * stride + k] : 0;
+            int c = k >= 3 && j > 0 ? pixels[(j - 1) * stride + k - 3] : 0;
+            int p = a + b - c, predictor = 0;
+            if (filter == 1) predictor = a;
+            if (filter == 2) predictor = b;
+            if (filter == 3) predictor = (a + b) / 2;
+            if (filter == 4) predictor = std::abs(p - a) <= std::abs(p - b) && std::abs(p - a) <= std::abs(p - c) ? a : std::abs(p - b) <= std::abs(p - c) ? b : c;
+            pixels[j * stride + k] = static_cast<uint8_t>(data[j * (stride + 1) + 1 + k] + predictor);
+        }
+    }
+    return pixels;
+}
+
+void testPNG() {
+    auto writer = ImageWriter::open("testImageWriter.png", 500, 300);
+    int stripHeight = writer->stripHeight();
+    writer.reset();
+    sassert(stripHeight % 16 == 0 && stripHeight < 300);
+
+    HDRImage image = testImage(500, 300);
+    image.clamp();
+    image.save("testImageWriter.png");
+    std::string bytes = readBytes("testImageWriter.png");
+    sassert(bytes.substr(1, 3) == "PNG");
+
+    // the header, one data chunk per strip, the end
+    std::vector<std::string> chunks;
+    std::string stream;
+    for (size_t position = 8; position + 12 <= bytes.size(); position += 12 + bigEndian32(bytes, position)) {
+        chunks.push_back(bytes.substr(position + 4, 4));
+        if (chunks.back() == "IHDR") sassert(bigEndian32(bytes, position + 8) == 500 && bigEndian32(bytes, position + 12) == 300);
+        if (chunks.back() == "IDAT") stream += bytes.substr(position + 8, bigEndian32(bytes, position));
+    }
+    sassert(chunks.size() == 2 + static_cast<size_t>((300 + stripHeight - 1) / stripHeight));
+    sassert(chunks.front() == "IHDR" && chunks[1] == "IDAT" && chunks.back() == "IEND");
+
+    // the zlib stream holds the filtered rows, then their Adler-32, and nothing else
+    sassert(stream.substr(0, 2) == "\x78\x5e");
+    Inflater inflater(stream, 2);
+    std::string data = inflater.inflate();
+    uint32_t a = 1, b = 0;
+    for (char byte : data) a = (a + static_cast<unsigned char>(byte)) % 65521, b = (b + a) % 65521;
+    sassert(inflater.position() + 4 == stream.size() && bigEndian32(stream, inflater.position()) == (b << 16 | a));
+
+    // and the pixels are the ones of the image, converted as saveToneMapped does
+    std::vector<uint8_t> pixels = unfilter(data, 500, 300), expected(3 * 500);
+    std::vector<float> row(3 * 500);
+    for (int j = 0; j < 300; j++) {
+        for (int i = 0; i < 500; i++) {
+            Color color = image.getPixel(i, j);
+            row[3 * i] = color.r, row[3 * i + 1] = color.g, row[3 * i + 2] = color.b;
+        }
+        toneMap(row.data(), row.size(), 1.0f, false, 1.0f, expected.data());
+        sassert(std::equal(expected.begin(), expected.end(), pixels.begin() + j * expected.size()));
+    }
+    std::remove("testImageWriter.png");
+}
+
+void testJPEG() {
+    auto writer = ImageWriter::open("testImageWriter.jpg", 500, 300);
+    int stripHeight = writer->stripHeight();
+    writer.reset();
+
+    HDRImage image = testImage(500, 300);
+    image.clamp();
+    image.save("testImageWriter.jpg");
+    std::string bytes = readBytes("testImageWriter.jpg");
+    sassert(bytes.substr(0, 2) == "\xff\xd8" && bytes.substr(bytes.size() - 2) == "\xff\xd9");
+
+    // the height of the whole image, a restart interval of one strip, then a restart marker between strips
+    size_t position = 2, scan = 0;
+    bool restartInterval = false;
+    while (scan == 0) {
+        unsigned char marker = bytes[position + 1];
+        int length = static_cast<unsigned char>(bytes[position + 2]) << 8 | static_cast<unsigned char>(bytes[position + 3]);
+        if (marker == 0xc0) sassert((static_cast<unsigned char>(bytes[position + 5]) << 8 | static_cast<unsigned char>(bytes[position + 6])) == 300);
+        if (marker == 0xdd) restartInterval = (static_cast<unsigned char>(bytes[position + 4]) << 8 | static_cast<unsigned char>(bytes[position + 5])) == (500 + 7) / 8 * (stripHeight / 8);
+        if (marker == 0xda) scan = position + 2 + length;
+        position += 2 + length;
+    }
+    sassert(restartInterval);
+    int nRestarts = 0;
+    for (size_t k = scan; k + 1 < bytes.size(); k++) {
+        if (bytes[k] == '\xff' && (bytes[k + 1] & 0xf8) == 0xd0) sassert(static_cast<unsigned char>(bytes[k + 1]) == 0xd0 + nRestarts++ % 8);
+    }
+    sassert(nRestarts == (300 + stripHeight - 1) / stripHeight - 1);
+    std::remove("testImageWriter.jpg");
+}
+
+void testParallelStrips() {
+    // the strips encoded at the same time are the ones encoded one after the other
+    HDRImage image = testImage(500, 300);
+    ThreadPool pool(4);
+    for (std::string extension : {".pfm", ".png", ".jpg", ".hdr", ".exr"}) {
+        image.saveToneMapped("testImageWriter" + extension, 0.3f, 2.2f);
+        std::string serial = readBytes("testImageWriter" + extension);
+        image.saveToneMapped("testImageWriter" + extension, 0.3f, 2.2f, &pool);
+        sassert(readBytes("testImageWriter" + extension) == serial);
+        std::remove(("testImageWriter" + extension).c_str());
+    }
+
+    // two strips, then the last shorter one, as all of them together
+    std::vector<uint8_t> rows(3 * 6000 * 40);
+    for (size_t k = 0; k < rows.size(); k++) rows[k] = static_cast<uint8_t>(k % 251);
+    for (std::string extension : {".png", ".jpg"}) {
+        auto writer = ImageWriter::open("testImageWriter" + extension, 6000, 40);
+        sassert(writer->stripHeight() == 16);
+        writer->write(rows.data(), 40, &pool);
+        writer->finish();
+        std::string together = readBytes("testImageWriter" + extension);
+        writer = ImageWriter::open("testImageWriter" + extension, 6000, 40);
+        writer->write(rows.data(), 32, &pool);
+        writer->write(&rows[3 * 6000 * 32], 8);
+        writer->finish();
+        sassert(readBytes("testImageWriter" + extension) == together);
+        std::remove(("testImageWriter" + extension).c_str());
+    }
+}
+
+void testManyOutputs() {
+    // the files written together are the ones written one at a time, the image is not changed
+    HDRImage image = testImage(500, 300);
+    ThreadPool pool(4);
+    std::vector<HDRImage::Output> outputs = {{"testImageWriter.png", 0.3f, 2.2f, true}, {"testImageWriter.jpg", 0.1f, 1.0f, true},
+                                             {"testImageWriter.pfm", 1.0f, 1.0f, false}, {"testImageWriter.exr", 0.5f, 1.0f, false}};
+    std::vector<std::string> alone;
+    for (const auto& output : outputs) {
+        if (output.clamp) image.saveToneMapped(output.fileName, output.scale, output.gamma);
+        else image.saveToneMapped({output});
+        alone.push_back(readBytes(output.fileName));
+    }
+    HDRImage copy = image;
+    image.saveToneMapped(outputs, &pool);
+    for (size_t k = 0; k < outputs.size(); k++) {
+        sassert(readBytes(outputs[k].fileName) == alone[k]);
+        std::remove(outputs[k].fileName.c_str());
+    }
+    sassert(image.getPixel(499, 299).isClose(copy.getPixel(499, 299)));
+
+    // a .pfm saved as rendered is the one of save
+    image.save("testImageWriter.pfm");
+    sassert(readBytes("testImageWriter.pfm") == alone[2]);
+    std::remove("testImageWriter.pfm");
+
+    std::string fileName;
+    float a = 1.0f, gamma = 1.0f;
+    validateOutputTarget("C:image.png:0.5:2.2", fileName, a, gamma);
+    sassert(fileName == "C:image.png" && a == 0.5f && gamma == 2.2f);
+    validateOutputTarget("image.jpg:0.25", fileName, a, gamma);
+    sassert(fileName == "image.jpg" && a == 0.25f && gamma == 2.2f);
+    testException("image.png:-1", [&](std::string s) -> auto {return validateOutputTarget(s, fileName, a, gamma);});
+}
+
+void testStandardInput() {
+    // "-" reads the image from std::cin, in any format, and map reads it instead of mapping it
+    HDRImage image = testImage(50, 30);
+    for (std::string extension : {".pfm", ".exr"}) {
+        image.save("testImageWriter" + extension);
+        std::istringstream input(readBytes("testImageWriter" + extension));
+        std::streambuf* standardInput = std::cin.rdbuf(input.rdbuf());
+        HDRImage read("-");
+        std::cin.rdbuf(standardInput);
+        sassert(read._width == 50 && read._height == 30 && read.getPixel(49, 29).isClose(image.getPixel(49, 29), 0.01f));
+
+        input.str(readBytes("testImageWriter" + extension));
+        standardInput = std::cin.rdbuf(input.rdbuf());
+        HDRImage mapped = HDRImage::map("-");
+        std::cin.rdbuf(standardInput);
+        sassert(!mapped.isMapped() && mapped.getPixel(0, 0).isClose(read.getPixel(0, 0)));
+        std::remove(("testImageWriter" + extension).c_str());
+    }
+}
+
+void testMappedOutput() {
+    // a mapped PFM converted onto itself, as convert in.pfm 1 1 in.pfm does, keeps its pages until it's written
+    HDRImage image = testImage(500, 300);
+    image.save("testImageWriter.pfm");
+    HDRImage mapped = HDRImage::map("testImageWriter.pfm");
+    sassert(mapped.isMapped());
+    mapped.saveToneMapped("testImageWriter.pfm", 0.5f);
+    sassert(mapped.getPixel(499, 299).isClose(image.getPixel(499, 299)));
+
+    HDRImage converted("testImageWriter.pfm");
+    sassert(converted._width == 500 && converted._height == 300);
+    for (int j : {0, 150, 299}) {
+        Color expected = image.getPixel(250, j) * 0.5f;
+        sassert(converted.getPixel(250, j).isClose(Color(clamp(expected.r), clamp(expected.g), clamp(expected.b))));
+    }
+    auto noTemporaryFiles = []() {
+        for (const auto& entry : std::filesystem::directory_iterator(".")) {
+            if (entry.path().filename().string().starts_with("testImageWriter.tmp")) return false;
+        }
+        return true;
+    };
+    sassert(noTemporaryFiles());
+
+    // if another output fails, the temporary file is removed and the mapped one is not touched
+    HDRImage again = HDRImage::map("testImageWriter.pfm");
+    bool thrown = false;
+    try {
+        again.saveToneMapped({{"testImageWriter.pfm", 2.0f}, {"missingDirectory/testImageWriter.png", 1.0f}});
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    sassert(thrown && noTemporaryFiles());
+    HDRImage unchanged("testImageWriter.pfm");
+    for (int j : {0, 150, 299}) sassert(unchanged.getPixel(250, j).isClose(converted.getPixel(250, j)));
+    std::remove("testImageWriter.pfm");
+}
+
+void testErrors() {
+    testException("testImageWriter.gif", [](std::string s) -> auto {return ImageWriter::open(s, 10, 10);});
+
+    // missing rows
+    auto writer = ImageWriter::open("testImageWriter.png", 10, 40);
+    std::vector<uint8_t> rows(3 * 10 * 16);
+    writer->write(rows.data(), 16);
+    testException(writer, [](std::unique_ptr<ImageWriter>& w) -> auto {return w->finish();});
+    std::remove("testImageWriter.png");
+}
+
+int main() {
+    testToneMappedPFM();
+    cout << "saving tone mapped images works" << endl;
+
+    testToneMapKernels();
+    cout << "tone mapping kernels work (" << simdLevelName(bestSimdLevel()) << " available)" << endl;
+
+    testHalves();
+    testHDRFormats();
+    cout << "writing and reading RGBE and OpenEXR images works" << endl;
+
+    testPNG();
+    testJPEG();
+    cout << "writing PNG and JPEG images in strips works" << endl;
+
+    testParallelStrips();
+    cout << "encoding strips in parallel works" << endl;
+
+    testManyOutputs();
+    cout << "saving many outputs at once works" << endl;
+
+    testStandardInput();
+    cout << "reading images from the standard input works" << endl;
+
+    testMappedOutput();
+    cout << "converting a mapped image onto itself works" << endl;
+
+    testErrors();
+    cout << "image writer errors work" << endl;
+
+    return 0;
+}
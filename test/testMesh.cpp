@@ -0,0 +1,369 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <bit>
+#include <algorithm>
+#include "TriangleMesh.hpp"
+#include "World.hpp"
+
+using std::cout, std::endl;
+
+auto bufferMaterial = std::make_shared<DiffuseMaterial>(DiffuseMaterial());
+
+// unit sphere made of triangles, closed: the poles and the seam share their vertices
+MeshData uvSphere(int rings, int segments) {
+    MeshData mesh;
+    auto add = [&](float x, float y, float z) {
+        mesh.x.push_back(x), mesh.y.push_back(y), mesh.z.push_back(z);
+        mesh.nx.push_back(x), mesh.ny.push_back(y), mesh.nz.push_back(z);
+    };
+    add(0.0f, 0.0f, 1.0f);
+    for (int i = 1; i < rings; i++) {
+        float theta = PI * i / rings;
+        for (int j = 0; j < segments; j++) {
+            float phi = 2.0f * PI * j / segments;
+            add(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+        }
+    }
+    add(0.0f, 0.0f, -1.0f);
+
+    int south = mesh.nVertices() - 1;
+    auto vertex = [&](int ring, int j) { return 1 + (ring - 1) * segments + j % segments; };
+    auto triangle = [&](int a, int b, int c) { mesh.indices.insert(mesh.indices.end(), {a, b, c}); };
+    for (int j = 0; j < segments; j++) {
+        triangle(0, vertex(1, j), vertex(1, j + 1));
+        for (int i = 1; i < rings - 1; i++) {
+            triangle(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1));
+            triangle(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1));
+        }
+        triangle(vertex(rings - 1, j), south, vertex(rings - 1, j + 1));
+    }
+    return mesh;
+}
+
+MeshData singleTriangle(const Point3& a, const Point3& b, const Point3& c) {
+    MeshData mesh;
+    mesh.x = {a.x, b.x, c.x}, mesh.y = {a.y, b.y, c.y}, mesh.z = {a.z, b.z, c.z};
+    mesh.indices = {0, 1, 2};
+    return mesh;
+}
+
+bool sameMesh(const MeshData& a, const MeshData& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.nx == b.nx && a.ny == b.ny && a.nz == b.nz
+        && a.u == b.u && a.v == b.v && a.indices == b.indices;
+}
+
+// tests for the shape
+namespace mesh {
+
+void testHit() {
+    TriangleMesh mesh(bufferMaterial, singleTriangle(Point3(0., 0., 0.), Point3(1., 0., 0.), Point3(0., 1., 0.)));
+    HitRecord rec;
+
+    Ray ray(Point3(0.25, 0.25, 1.), Vec3(0., 0., -1.));
+    sassert(mesh.isHit(ray, rec));
+    HitRecord expected;
+    expected.worldPoint = Point3(0.25, 0.25, 0.), expected.normal = Normal3(0., 0., 1.), expected.surfacePoint = Vec2(0.25, 0.25), expected.t = 1., expected.ray = ray;
+    sassert(expected.isClose(rec) && !rec.isInside);
+    sassert(mesh.quickIsHit(ray));
+
+    // from behind the normal faces the ray
+    sassert(mesh.isHit(Ray(Point3(0.5, 0.25, -2.), Vec3(0., 0., 1.)), rec));
+    sassert(rec.normal.isClose(Normal3(0., 0., -1.)) && rec.isInside && areClose(rec.t, 2.0f));
+
+    sassert(!mesh.isHit(Ray(Point3(0.75, 0.75, 1.), Vec3(0., 0., -1.)), rec));
+    sassert(!mesh.isHit(Ray(Point3(0.25, 0.25, 1.), Vec3(0., 0., 1.)), rec));
+    sassert(!mesh.quickIsHit(Ray(Point3(0.25, 0.25, 1.), Vec3(0., 0., -1.), RAY_MIN, 0.5)));
+
+    sassert(mesh.boundingBox().contains(AABB(Point3(0., 0., 0.), Point3(1., 1., 0.))));
+
+    cout << "isHit works" << endl;
+}
+
+void testTransformation() {
+    TriangleMesh mesh(bufferMaterial, singleTriangle(Point3(0., 0., 0.), Point3(1., 0., 0.), Point3(0., 1., 0.)),
+                      translation(Vec3(10., 0., 0.)) * rotation(90., Axis::X));
+    HitRecord rec;
+
+    // the triangle is now on the xz plane, facing -y
+    Ray ray(Point3(10.25, -3., 0.25), Vec3(0., 1., 0.));
+    sassert(mesh.isHit(ray, rec));
+    sassert(rec.worldPoint.isClose(Point3(10.25, 0., 0.25)) && areClose(rec.t, 3.0f));
+    sassert(rec.normal.normalize().isClose(Normal3(0., -1., 0.)));
+    sassert(!mesh.isHit(Ray(Point3(0.25, -3., 0.25), Vec3(0., 1., 0.)), rec));
+
+    AABB box = mesh.boundingBox();
+    sassert(box.contains(AABB(Point3(10., 0., 0.), Point3(11., 0., 1.))) && box.min.x > 9.9f && box.max.x < 11.1f);
+
+    cout << "transformations work" << endl;
+}
+
+void testWatertight() {
+    // rays from the centre exactly through the vertices, and through the middle of the edges
+    MeshData data = uvSphere(16, 32);
+    TriangleMesh sphere(bufferMaterial, data);
+    HitRecord rec;
+    for (int i = 0; i < data.nVertices(); i++) {
+        sassert(sphere.isHit(Ray(Point3(), Vec3(data.x[i], data.y[i], data.z[i])), rec));
+        sassert(rec.isInside);
+    }
+    for (int i = 0; i < data.nTriangles(); i++) {
+        for (int k = 0; k < 3; k++) {
+            int a = data.indices[3 * i + k], b = data.indices[3 * i + (k + 1) % 3];
+            Vec3 direction(data.x[a] + data.x[b], data.y[a] + data.y[b], data.z[a] + data.z[b]);
+            sassert(sphere.quickIsHit(Ray(Point3(), direction)));
+        }
+    }
+
+    // a plane of triangles, hit exactly on the shared edges and vertices
+    MeshData grid;
+    int n = 8;
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) grid.x.push_back(x), grid.y.push_back(y), grid.z.push_back(0.0f);
+    }
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int a = y * (n + 1) + x;
+            grid.indices.insert(grid.indices.end(), {a, a + 1, a + n + 2, a, a + n + 2, a + n + 1});
+        }
+    }
+    TriangleMesh plane(bufferMaterial, grid);
+    PCG pcg;
+    for (int y = 1; y < 2 * n; y++) {
+        for (int x = 1; x < 2 * n; x++) {
+            Point3 target(0.5f * x, 0.5f * y, 0.0f);
+            Point3 origin(target.x + pcg.random(-0.3, 0.3), target.y + pcg.random(-0.3, 0.3), 1.0f);
+            sassert(plane.isHit(Ray(origin, target - origin), rec));
+            sassert(rec.worldPoint.isClose(target, 1e-4f));
+        }
+    }
+
+    // random rays from inside never escape
+    for (int i = 0; i < 10000; i++) {
+        Point3 origin(pcg.random(-0.5, 0.5), pcg.random(-0.5, 0.5), pcg.random(-0.5, 0.5));
+        sassert(sphere.quickIsHit(Ray(origin, pcg.randomVersor())));
+    }
+
+    cout << "the intersection is watertight" << endl;
+}
+
+void testSphere() {
+    TriangleMesh mesh(bufferMaterial, uvSphere(64, 128));
+    Sphere sphere;
+    PCG pcg;
+    HitRecord meshRec, sphereRec;
+
+    int hits = 0;
+    for (int i = 0; i < 2000; i++) {
+        Ray ray(Point3(pcg.random(-1.2, 1.2), pcg.random(-1.2, 1.2), 3.), Vec3(pcg.random(-0.1, 0.1), pcg.random(-0.1, 0.1), -1.));
+        bool meshHit = mesh.isHit(ray, meshRec), sphereHit = sphere.isHit(ray, sphereRec);
+        if (meshHit) { // the triangles are inside the sphere, close to it
+            float radius = ray.at(meshRec.t).toVec().norm();
+            sassert(radius < 1.0f + 1e-5f && radius > 0.999f);
+        }
+        if (!meshHit || !sphereHit) continue;
+
+        // far from the silhouette, where the distance changes slowly
+        hits++;
+        sassert(!meshRec.isInside);
+        if (std::abs(dot(sphereRec.normal.normalize(), ray.direction.normalize())) < 0.5f) continue;
+        sassert(std::abs(meshRec.t - sphereRec.t) < 2e-3f);
+        sassert(meshRec.normal.normalize().isClose(sphereRec.normal.normalize(), 1e-2f));
+    }
+    sassert(hits > 500);
+
+    cout << "a sphere of triangles is close to a sphere" << endl;
+}
+
+void testBruteForce() {
+    // a soup of random triangles, compared with searching all of them
+    PCG pcg;
+    MeshData soup;
+    std::vector<TriangleMesh> single;
+    for (int i = 0; i < 300; i++) {
+        Point3 centre(pcg.random(0., 10.), pcg.random(0., 10.), pcg.random(0., 10.));
+        Point3 corners[3];
+        for (Point3& corner : corners) {
+            corner = centre + Vec3(pcg.random(-1., 1.), pcg.random(-1., 1.), pcg.random(-1., 1.));
+            soup.x.push_back(corner.x), soup.y.push_back(corner.y), soup.z.push_back(corner.z);
+        }
+        soup.indices.insert(soup.indices.end(), {3 * i, 3 * i + 1, 3 * i + 2});
+        single.emplace_back(bufferMaterial, singleTriangle(corners[0], corners[1], corners[2]));
+    }
+    TriangleMesh mesh(bufferMaterial, soup);
+    sassert(mesh.nTriangles() == 300 && !mesh.bvh().isEmpty());
+
+    for (int i = 0; i < 2000; i++) {
+        Ray ray(Point3(pcg.random(-2., 12.), pcg.random(-2., 12.), pcg.random(-2., 12.)), pcg.randomVersor());
+        float closest = INF;
+        HitRecord rec;
+        for (const TriangleMesh& triangle : single) {
+            if (triangle.isHit(ray, rec)) closest = std::min(closest, rec.t);
+        }
+        bool hit = mesh.isHit(ray, rec);
+        sassert(hit == (closest < INF));
+        if (hit) sassert(rec.t == closest);
+        sassert(mesh.quickIsHit(ray) == hit);
+    }
+
+    cout << "the BVH of the triangles works" << endl;
+}
+
+void testInvalid() {
+    MeshData mesh = singleTriangle(Point3(0., 0., 0.), Point3(1., 0., 0.), Point3(0., 1., 0.));
+    mesh.indices[2] = 3;
+    testException(mesh, [](MeshData& m) { TriangleMesh(bufferMaterial, m); });
+    mesh.indices = {0, 1};
+    testException(mesh, [](MeshData& m) { TriangleMesh(bufferMaterial, m); });
+
+    cout << "invalid meshes are rejected" << endl;
+}
+
+void testWorld() {
+    World world;
+    world.addShape(std::make_shared<TriangleMesh>(bufferMaterial, uvSphere(16, 32), translation(Vec3(0., 0., 5.))));
+    world.addShape(std::make_shared<Sphere>(bufferMaterial, translation(Vec3(0., 0., 2.)) * scaling(0.5)));
+    world.build();
+
+    HitRecord rec;
+    sassert(world.isHit(Ray(Point3(0., 0., 10.), Vec3(0., 0., -1.)), rec));
+    sassert(rec.worldPoint.isClose(Point3(0., 0., 6.), 1e-4f) && rec.normal.isClose(Normal3(0., 0., 1.), 1e-4f));
+    sassert(world.isHit(Ray(Point3(0., 0., 4.9), Vec3(0., 0., -1.)), rec));
+    sassert(rec.worldPoint.isClose(Point3(0., 0., 4.), 1e-4f) && rec.isInside);
+    sassert(world.isHit(Ray(Point3(0., 0., 3.), Vec3(0., 0., -1.)), rec) && areClose(rec.t, 0.5f));
+    sassert(world.occluded(Ray(Point3(0., 3., 5.), Vec3(0., -1., 0.))));
+    sassert(!world.occluded(Ray(Point3(3., 3., 5.), Vec3(0., -1., 0.))));
+
+    cout << "meshes work inside a World" << endl;
+}
+
+} // namespace mesh
+
+// tests for the file formats
+namespace io {
+
+void testOBJ() {
+    MeshData square = parseOBJ(
+        "# a square with texture coordinates and a normal\n"
+        "o square\n"
+        "v 0 0 0\nv 1 0 0\r\nv 1 1 0\nv 0 1 0\n"
+        "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1 0\n"
+        "vn 0 0 +1\n"
+        "usemtl nothing\n"
+        "f 1/1/1 2/2/1 3/3/1 -1/-1/-1\n"
+    );
+    sassert(square.nVertices() == 4 && square.nTriangles() == 2 && square.hasNormals() && square.hasUVs());
+    sassert(square.indices == std::vector<int>({0, 1, 2, 0, 2, 3}));
+    sassert(square.u == std::vector<float>({0., 1., 1., 0.}) && square.v == std::vector<float>({0., 0., 1., 1.}));
+    sassert(square.nz == std::vector<float>({1., 1., 1., 1.}));
+
+    // positions only, relative indices
+    MeshData plain = parseOBJ("v 0 0 0\nv 1 0 0\nv 0 1 0\nf -3 -2 -1\nv 0 0 1\nf 1 2 4\n");
+    sassert(plain.nVertices() == 4 && plain.indices == std::vector<int>({0, 1, 2, 0, 1, 3}));
+    sassert(!plain.hasNormals() && !plain.hasUVs());
+
+    // the same position with two normals is two vertices
+    MeshData split = parseOBJ("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvn 0 0 1\nvn 0 0 -1\n"
+                              "f 1//1 2//1 3//1\nf 1//2 3//2 4//2\nf 3//1 2//1 1//1\n");
+    sassert(split.nVertices() == 6 && split.nTriangles() == 3 && split.hasNormals() && !split.hasUVs());
+    sassert(split.indices[6] == split.indices[2] && split.indices[8] == split.indices[0]);
+
+    for (std::string wrong : {"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n", "v 0 0\n", "v 0 0 0\nf 1 1\n", "v 0 0 0\nf 0 1 1\n", "v 0 0 0\nf 1 1 x\n"}) {
+        testException(wrong, [](std::string& text) { parseOBJ(text); });
+    }
+
+    cout << "OBJ files are read" << endl;
+}
+
+// a PLY file with the same content in the three formats, with extra properties and elements to skip
+std::string plyFile(const std::string& format) {
+    std::string header =
+        "ply\n"
+        "format " + format + " 1.0\n"
+        "comment the unit square\n"
+        "element vertex 4\n"
+        "property float x\nproperty float y\nproperty float z\n"
+        "property uchar red\n"
+        "property float s\nproperty float t\n"
+        "element face 1\n"
+        "property list uchar int vertex_indices\n"
+        "property int flags\n"
+        "element edge 1\n"
+        "property int vertex1\nproperty short vertex2\n"
+        "end_header\n";
+    if (format == "ascii") {
+        return header + "0 0 0 255 0 0\n1 0 0 255 1 0\n1 1 0 255 1 1\n0 1 0 255 0 1\n4 0 1 2 3 7\n0 2\n";
+    }
+
+    bool swap = (format == "binary_little_endian") != (std::endian::native == std::endian::little);
+    std::string body;
+    auto put = [&](auto value) {
+        char bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        if (swap) std::reverse(bytes, bytes + sizeof(value));
+        body.append(bytes, sizeof(value));
+    };
+    const float vertices[4][5] = {{0, 0, 0, 0, 0}, {1, 0, 0, 1, 0}, {1, 1, 0, 1, 1}, {0, 1, 0, 0, 1}};
+    for (const auto& vertex : vertices) {
+        put(vertex[0]), put(vertex[1]), put(vertex[2]), put(static_cast<uint8_t>(255)), put(vertex[3]), put(vertex[4]);
+    }
+    put(static_cast<uint8_t>(4)), put(0), put(1), put(2), put(3), put(7);
+    put(0), put(static_cast<int16_t>(2));
+    return header + body;
+}
+
+void testPLY() {
+    MeshData ascii = parsePLY(plyFile("ascii"));
+    sassert(ascii.nVertices() == 4 && ascii.nTriangles() == 2 && !ascii.hasNormals() && ascii.hasUVs());
+    sassert(ascii.indices == std::vector<int>({0, 1, 2, 0, 2, 3}));
+    sassert(ascii.x == std::vector<float>({0., 1., 1., 0.}) && ascii.v == std::vector<float>({0., 0., 1., 1.}));
+
+    sassert(sameMesh(ascii, parsePLY(plyFile("binary_little_endian"))));
+    sassert(sameMesh(ascii, parsePLY(plyFile("binary_big_endian"))));
+
+    std::string truncated = plyFile("binary_little_endian");
+    truncated.resize(truncated.size() - 10);
+    for (std::string wrong : {std::string("obj\n"), std::string("ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\n"),
+                              std::string("ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nend_header\n0\n"), truncated}) {
+        testException(wrong, [](std::string& data) { parsePLY(data); });
+    }
+
+    cout << "PLY files are read" << endl;
+}
+
+void testReadMesh() {
+    std::string path = "testMesh.obj";
+    {
+        std::ofstream file(path);
+        file << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+    }
+    MeshData triangle = readMesh(path);
+    sassert(triangle.nVertices() == 3 && triangle.nTriangles() == 1);
+    std::remove(path.c_str());
+
+    std::string missing = "missing.ply", unknown = "mesh.stl";
+    testException(missing, [](std::string& p) { readMesh(p); });
+    testException(unknown, [](std::string& p) { readMesh(p); });
+
+    cout << "mesh files are read" << endl;
+}
+
+} // namespace io
+
+int main() {
+    cout << "Triangle mesh:" << endl;
+    mesh::testHit();
+    mesh::testTransformation();
+    mesh::testWatertight();
+    mesh::testSphere();
+    mesh::testBruteForce();
+    mesh::testInvalid();
+    mesh::testWorld();
+
+    cout << "\nMesh files:" << endl;
+    io::testOBJ();
+    io::testPLY();
+    io::testReadMesh();
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "HDRImage.hpp"
 #include "utils.hpp"
+#include "simd.hpp"
 
 using std::cout, std::endl;
 
@@ -77,7 +78,142 @@ void testWritePMF() {
     testReadFile("../test/test.pfm");
 }
 
+void testSwapBytes() {
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (bestSimdLevel() >= SimdLevel::SSE4) levels.push_back(SimdLevel::SSE4);
+    if (bestSimdLevel() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
 
+    // every length up to a few full AVX2 blocks, starting at an odd address
+    for (SimdLevel level : levels) {
+        for (size_t count = 0; count < 70; count++) {
+            std::vector<uint8_t> bytes(4 * count + 1);
+            for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<uint8_t>(i * 7 + 1);
+            std::vector<uint8_t> expected = bytes;
+            swapBytes32(bytes.data() + 1, count, level);
+            for (size_t i = 0; i < count; i++) {
+                for (int k = 0; k < 4; k++) sassert(bytes[1 + 4 * i + k] == expected[1 + 4 * i + 3 - k]);
+            }
+            sassert(bytes[0] == expected[0]);
+        }
+    }
+}
+
+void testBulkRead() {
+    // an image with rows that are not a multiple of the SIMD width, in both byte orders
+    PCG pcg;
+    int width = 37, height = 5;
+    std::vector<Color> colors;
+    for (int i = 0; i < width * height; i++) colors.emplace_back(pcg.random(-1e3, 1e3), pcg.random(), pcg.random(0., 1e-3));
+
+    for (Endianness endianness : {Endianness::LITTLE, Endianness::BIG}) {
+        std::stringstream ss;
+        ss << "PF\n" << width << " " << height << "\n" << (endianness == Endianness::LITTLE ? "-1.0" : "1.0") << "\n";
+        for (int j = height - 1; j >= 0; j--) {
+            for (int i = 0; i < width; i++) {
+                const Color& c = colors[i + width * j];
+                writeFloat(ss, c.r, endianness), writeFloat(ss, c.g, endianness), writeFloat(ss, c.b, endianness);
+            }
+        }
+        std::string bytes = ss.str();
+
+        std::istringstream full(bytes);
+        HDRImage image(full);
+        sassert(image._width == width && image._height == height);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) sassert(image.getPixel(i, j).isClose(colors[i + width * j]));
+        }
+
+        // a missing byte in the last row
+        std::istringstream truncated(bytes.substr(0, bytes.size() - 1));
+        testException(truncated, [](std::istringstream& s) -> auto {return HDRImage(s);});
+    }
+
+    float values[3];
+    unsigned char toRead[] = {0x00, 0x00, 0xc8, 0x42, 0x43, 0x48, 0x00, 0x00, 0x42, 0xc8, 0x00, 0x00};
+    auto stream = streamFromArray(toRead, 12);
+    readFloats(stream, values, 1, Endianness::LITTLE);
+    readFloats(stream, values + 1, 2, Endianness::BIG);
+    sassert(areClose(values[0], 100) && areClose(values[1], 200) && areClose(values[2], 100));
+}
+
+void testBulkWrite() {
+    // more floats than the block swapped at a time
+    PCG pcg;
+    std::vector<float> values(40000);
+    for (float& value : values) value = pcg.random(-1e3, 1e3);
+
+    for (Endianness endianness : {Endianness::LITTLE, Endianness::BIG}) {
+        std::stringstream ss;
+        writeFloats(ss, values.data(), values.size(), endianness);
+        sassert(ss.str().size() == 4 * values.size());
+        std::vector<float> read(values.size());
+        readFloats(ss, read.data(), read.size(), endianness);
+        sassert(read == values);
+    }
+
+    // the same bytes as the reference file, written one row at a time
+    auto stream = streamFromArray(LE_REFERENCE_BYTES, 84);
+    HDRImage image(stream);
+    image.save("testBulkWrite.pfm");
+    std::ifstream file("testBulkWrite.pfm", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    sassert(bytes == std::string(reinterpret_cast<const char*>(LE_REFERENCE_BYTES), 84));
+    file.close();
+    std::remove("testBulkWrite.pfm");
+}
+
+void testMap() {
+    PCG pcg;
+    int width = 37, height = 5;
+    HDRImage image(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) image.setPixel(i, j, Color(pcg.random(), pcg.random(0., 1e3), pcg.random()));
+    }
+
+    // the file has the byte order of the machine: mapped, with the same pixels and luminosity
+    image.save("testMap.pfm");
+    HDRImage mapped = HDRImage::map("testMap.pfm");
+    sassert(mapped.isMapped() == (NATIVE_ENDIANNESS == Endianness::LITTLE));
+    sassert(mapped._width == width && mapped._height == height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) sassert(mapped.getPixel(i, j).isClose(image.getPixel(i, j)));
+    }
+    sassert(areClose(mapped.averageLuminosity(), image.averageLuminosity()));
+    testException(width, [&mapped](int i) -> auto {return mapped.getPixel(i, 0);});
+
+    // copies share the mapping, changing a pixel copies them
+    HDRImage copy = mapped;
+    copy.setPixel(1, 2, Color(7., 8., 9.));
+    sassert(!copy.isMapped());
+    sassert(copy.getPixel(1, 2).isClose(Color(7., 8., 9.)) && copy.getPixel(3, 4).isClose(image.getPixel(3, 4)));
+    sassert(mapped.getPixel(1, 2).isClose(image.getPixel(1, 2)));
+
+    // saving over the file it's mapped from
+    mapped.save("testMap.pfm");
+    sassert(HDRImage("testMap.pfm").getPixel(width - 1, height - 1).isClose(image.getPixel(width - 1, height - 1)));
+
+    // the other byte order is converted when reading
+    Endianness other = NATIVE_ENDIANNESS == Endianness::LITTLE ? Endianness::BIG : Endianness::LITTLE;
+    std::ofstream file("testMap.pfm", std::ios::binary);
+    file << "PF\n" << width << " " << height << "\n" << (other == Endianness::LITTLE ? "-1.0" : "1.0") << "\n";
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            Color c = image.getPixel(i, j);
+            writeFloat(file, c.r, other), writeFloat(file, c.g, other), writeFloat(file, c.b, other);
+        }
+    }
+    file.close();
+    HDRImage converted = HDRImage::map("testMap.pfm");
+    sassert(!converted.isMapped() && converted.getPixel(3, 4).isClose(image.getPixel(3, 4)));
+
+    // a missing byte
+    file.open("testMap.pfm", std::ios::binary);
+    file << "PF\n" << width << " " << height << "\n" << (NATIVE_ENDIANNESS == Endianness::LITTLE ? "-1.0" : "1.0") << "\n";
+    file << std::string(sizeof(Color) * width * height - 1, '\0');
+    file.close();
+    testException("testMap.pfm", [](std::string s) -> auto {return HDRImage::map(s);});
+    std::remove("testMap.pfm");
+}
 
 int main() {
     // test readLine
@@ -118,6 +254,16 @@ int main() {
     testException(ss, [](std::istringstream& s) -> auto {return HDRImage(s);});
     cout << "readPFM works" << endl;
 
+    testSwapBytes();
+    testBulkRead();
+    cout << "bulk reading and byte swapping work (" << simdLevelName(bestSimdLevel()) << " available)" << endl;
+
+    testBulkWrite();
+    cout << "bulk writing works" << endl;
+
+    testMap();
+    cout << "mapping PFM files works" << endl;
+
     testReadFile("../test/reference_le.pfm");
     testReadFile("../test/reference_be.pfm");
     HDRImage image("../test/memorial.pfm");
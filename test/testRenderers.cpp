@@ -1,6 +1,7 @@
 #include "Camera.hpp"
 #include "renderers.hpp"
 #include "utils.hpp"
+#include "WavefrontRenderer.hpp"
 
 const Color BLACK(0.0f, 0.0f, 0.0f);
 const Color WHITE(1.0f, 1.0f, 1.0f);
@@ -125,13 +126,112 @@ void testPathTracer() { // furnace test
     std::cout << "furnace tests works" << std::endl;
 }
 
+void testPackets() {
+    // flat colours make it easy to spot a wrong intersection
+    World world;
+    PCG pcg;
+    for (int i = 0; i < 30; i++) {
+        auto material = std::make_shared<DiffuseMaterial>(std::make_shared<UniformTexture>(Color(pcg.random(), pcg.random(), pcg.random())));
+        world.addShape(std::make_shared<Sphere>(material, translation(pcg.random(2., 6.), pcg.random(-3., 3.), pcg.random(-2., 2.)) * scaling(pcg.random(0.1, 0.6))));
+    }
+    world.addShape(std::make_shared<Plane>(std::make_shared<DiffuseMaterial>(std::make_shared<CheckeredTexture>()), translation(0., 0., -1.5)));
+
+    // 21 x 13 pixels, so the tiles on the borders are incomplete
+    for (std::string type : {"perspective", "orthogonal"}) {
+        for (int side : {4, 8}) {
+            Camera single(type, 21. / 13., 21, 1., rotation(10., Axis::Z) * scaling(3.));
+            Camera packets(type, 21. / 13., 21, 1., rotation(10., Axis::Z) * scaling(3.));
+
+            single.render(Renderers::Flat, 1, world);
+            packets.renderPackets(Renderers::FromHit::Flat, side, 1, world);
+
+            for (int j = 0; j < single.imageHeight; j++) {
+                for (int i = 0; i < single.imageWidth; i++) {
+                    sassert(single.image.getPixel(i, j).isClose(packets.image.getPixel(i, j)));
+                }
+            }
+
+            // the on/off renderer only asks if the packet hits anything
+            single.render(Renderers::OnOff, 1, world);
+            packets.renderPackets(Renderers::FromHit::OnOff, side, 1, world);
+
+            for (int j = 0; j < single.imageHeight; j++) {
+                for (int i = 0; i < single.imageWidth; i++) {
+                    sassert(single.image.getPixel(i, j).isClose(packets.image.getPixel(i, j)));
+                }
+            }
+        }
+    }
+
+    std::cout << "packet tracing gives the same image as single rays" << std::endl;
+}
+
+
+
+void testWavefront() {
+    // furnace test: every path bounces inside a closed sphere until the maximum depth
+    PCG pcg;
+    for (int i = 0; i < 3; i++) {
+        float emittedRadiance = pcg.random();
+        float reflectance = pcg.random() * 0.9;
+
+        World world;
+        auto material = std::make_shared<DiffuseMaterial>(std::make_shared<UniformTexture>(WHITE * reflectance),
+                                                          std::make_shared<UniformTexture>(WHITE * emittedRadiance));
+        world.addShape(std::make_shared<Sphere>(material, scaling(2.)));
+
+        WavefrontRenderer::Settings settings;
+        settings.samplesPerPixel = 1, settings.maxDepth = 100, settings.russianRouletteLimit = 101;
+        Camera camera("perspective", 1., 4);
+        WavefrontRenderer(world, settings).render(camera);
+
+        float expected = emittedRadiance * (1.0f - std::pow(reflectance, 101)) / (1.0f - reflectance);
+        for (int j = 0; j < camera.imageHeight; j++) {
+            for (int k = 0; k < camera.imageWidth; k++) {
+                sassert(camera.image.getPixel(k, j).isClose(WHITE * expected, 1e-4));
+            }
+        }
+    }
 
+    // the image must not depend on the threads, the blocks and the size of the queues
+    World world;
+    for (int i = 0; i < 10; i++) {
+        auto material = std::make_shared<DiffuseMaterial>(std::make_shared<UniformTexture>(Color(pcg.random(), pcg.random(), pcg.random())),
+                                                          std::make_shared<UniformTexture>(Color(pcg.random(), 0., 0.)));
+        world.addShape(std::make_shared<Sphere>(material, translation(pcg.random(2., 6.), pcg.random(-3., 3.), pcg.random(-2., 2.)) * scaling(pcg.random(0.1, 0.6))));
+    }
+    world.addShape(std::make_shared<Plane>(std::make_shared<DiffuseMaterial>(std::make_shared<CheckeredTexture>()), translation(0., 0., -1.5)));
+    world.addLight(PointLight(Point3(0., 0., 5.), WHITE));
+    world.backgroundColor = Color(0.2, 0.3, 0.4);
+
+    WavefrontRenderer::Settings serial, parallel;
+    serial.nThreads = 1, serial.queueSize = 7, serial.blockRows = 13;
+    parallel.nThreads = 4, parallel.blockRows = 2;
+    Camera first("perspective", 21. / 13., 21, 1., scaling(3.));
+    Camera second("perspective", 21. / 13., 21, 1., scaling(3.));
+    WavefrontRenderer(world, serial).render(first);
+    parallel.reorderRays = true; // must not change the image either
+    RayCounters counters = WavefrontRenderer(world, parallel).render(second);
+
+    sassert(counters.cameraRays == 21 * 13 * parallel.samplesPerPixel);
+    sassert(counters.secondaryRays > 0 && counters.shadowRays > 0);
+
+    for (int j = 0; j < first.imageHeight; j++) {
+        for (int i = 0; i < first.imageWidth; i++) {
+            sassert(first.image.getPixel(i, j).isClose(second.image.getPixel(i, j)));
+        }
+    }
+
+    std::cout << "wavefront renderer works" << std::endl;
+}
 
 int main() {
     testOnOffRenderer();
     testFlatRenderer();
     testPointLight();
     testPathTracer();
+    testPackets();
+    testWavefront();
 
     std::cout << "All tests passed!\n";
 
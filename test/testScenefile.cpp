@@ -1,4 +1,6 @@
 #include <iostream>
+#include <fstream>
+#include <filesystem>
 #include "utils.hpp"
 #include "scenefile.hpp"
 
@@ -268,6 +270,326 @@ void testDoubleCamera() {
 
 
 
+void testGroups() {
+    std::istringstream ss;
+    ss.str(
+        "material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "group pair {\n"
+        "    sphere(red, translation([0, 0, 1]))\n"
+        "    sphere(red, translation([0, 0, -1]))\n"
+        "}\n"
+        "group pairs {\n"
+        "    instance(pair, identity)\n"
+        "    instance(pair, translation([0, 4, 0]))\n"
+        "}\n"
+        "instance(pair, translation([10, 0, 0]))\n"
+        "instance(pairs, translation([20, 0, 0]) * scaling([2, 2, 2]))\n"
+    );
+    InputStream stream(ss, "testfile.fake");
+
+    Scene scene;
+    scene.parse(stream);
+
+    sassert(scene.groups.size() == 2);
+    sassert(scene.groups["pair"]->_shapes.size() == 2 && scene.groups["pairs"]->_shapes.size() == 2);
+    sassert(scene.world._shapes.size() == 2);
+    sassert(scene.world.isBuilt() && scene.groups["pair"]->isBuilt());
+
+    // the instances share their group
+    auto first = std::dynamic_pointer_cast<Instance>(scene.world._shapes[0]);
+    auto nested = std::dynamic_pointer_cast<Instance>(scene.groups["pairs"]->_shapes[1]);
+    sassert(first != nullptr && nested != nullptr && &first->group() == &nested->group());
+
+    // top sphere of the first instance, and of the second pair in the scaled instance
+    HitRecord rec;
+    sassert(scene.world.isHit(Ray(Point3(10., 0., 5.), Vec3(0., 0., -1.)), rec));
+    sassert(rec.worldPoint.isClose(Point3(10., 0., 2.)) && rec.normal.normalize().isClose(Normal3(0., 0., 1.)));
+    sassert(scene.world.isHit(Ray(Point3(20., 8., 10.), Vec3(0., 0., -1.)), rec));
+    sassert(rec.worldPoint.isClose(Point3(20., 8., 4.)) && areClose(rec.t, 6.0f));
+    sassert(!scene.world.isHit(Ray(Point3(15., 0., 10.), Vec3(0., 0., -1.)), rec));
+    sassert(scene.world.occluded(Ray(Point3(20., 0., -10.), Vec3(0., 0., 1.))));
+
+    std::istringstream unknown, twice;
+    unknown.str("instance(nothing, identity)");
+    twice.str("group g { } group g { }");
+    InputStream unknownStream(unknown, 0), twiceStream(twice, 0);
+    testException(unknownStream, [](InputStream s){ Scene scene; scene.parse(s); });
+    testException(twiceStream, [](InputStream s){ Scene scene; scene.parse(s); });
+
+    cout << "groups and instances work" << endl;
+}
+
+void testMeshes() {
+    std::string path = "testScenefile.obj";
+    {
+        std::ofstream file(path);
+        file << "v -1 -1 0\nv 1 -1 0\nv 1 1 0\nv -1 1 0\nf 1 2 3 4\n";
+    }
+
+    std::istringstream ss;
+    ss.str(
+        "material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "mesh(red, \"testScenefile.obj\", translation([0, 0, -1]))\n"
+        "group squares {\n"
+        "    mesh(red, \"testScenefile.obj\", identity)\n"
+        "}\n"
+        "instance(squares, translation([10, 0, 0]))\n"
+    );
+    InputStream stream(ss, "testfile.fake");
+
+    Scene scene;
+    scene.parse(stream);
+
+    auto mesh = std::dynamic_pointer_cast<TriangleMesh>(scene.world._shapes[0]);
+    sassert(mesh != nullptr && mesh->nTriangles() == 2);
+
+    HitRecord rec;
+    sassert(scene.world.isHit(Ray(Point3(0.5, 0.5, 5.), Vec3(0., 0., -1.)), rec));
+    sassert(rec.worldPoint.isClose(Point3(0.5, 0.5, -1.)) && rec.normal.isClose(Normal3(0., 0., 1.)));
+    sassert(scene.world.isHit(Ray(Point3(10.5, -0.5, 5.), Vec3(0., 0., -1.)), rec) && areClose(rec.t, 5.0f));
+    sassert(!scene.world.isHit(Ray(Point3(5., 0., 5.), Vec3(0., 0., -1.)), rec));
+
+    std::istringstream missing, unknown;
+    missing.str("material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\nmesh(red, \"missing.obj\", identity)");
+    unknown.str("mesh(blue, \"testScenefile.obj\", identity)");
+    InputStream missingStream(missing, 0), unknownStream(unknown, 0);
+    testException(missingStream, [](InputStream s){ Scene scene; scene.parse(s); });
+    testException(unknownStream, [](InputStream s){ Scene scene; scene.parse(s); });
+
+    std::remove(path.c_str());
+
+    cout << "meshes work" << endl;
+}
+
+void testAnimate() {
+    std::string meshPath = "testAnimate.obj";
+    {
+        std::ofstream file(meshPath);
+        file << "v -1 -1 0\nv 1 -1 0\nv 1 1 0\nv -1 1 0\nf 1 2 3 4\n";
+    }
+    std::string text =
+        "float angle(0)\n"
+        "material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "sphere(red, rotationZ(angle) * translation([2, 0, 0]))\n"
+        "plane(red, translation([0, 0, -1]))\n"
+        "mesh(red, \"testAnimate.obj\", rotationZ(angle) * translation([0, 0, -3]))\n"
+        "group pair {\n"
+        "    sphere(red, identity)\n"
+        "    mesh(red, \"testAnimate.obj\", identity)\n"
+        "}\n"
+        "instance(pair, translation([0, 0, 5]))\n"
+        "camera(perspective, 1.0, 100, 1.0, rotationZ(angle))\n";
+
+    auto parse = [&](float angle, bool build) {
+        std::istringstream ss(text);
+        InputStream stream(ss, "testfile.fake");
+        Scene scene;
+        scene.buildWorld = build;
+        scene.parse(stream, {{"angle", angle}});
+        return scene;
+    };
+
+    // the scene read for the next frame only gives transformations: nothing in it is built, no mesh is read
+    Scene scene = parse(0., true), next = parse(90., false);
+    sassert(!next.world.isBuilt() && !next.groups["pair"]->isBuilt());
+    sassert(std::dynamic_pointer_cast<TriangleMesh>(next.world._shapes[2])->nTriangles() == 0);
+    sassert(scene.animate(next));
+    sassert(std::dynamic_pointer_cast<TriangleMesh>(scene.world._shapes[2])->nTriangles() == 2);
+    sassert(scene.world._shapes[2]->transformation.isClose(rotation(90., Axis::Z) * translation(0., 0., -3.)));
+    sassert(scene.world._shapes[0]->transformation.isClose(rotation(90., Axis::Z) * translation(2., 0., 0.)));
+    sassert(scene.camera->transformation.isClose(rotation(90., Axis::Z)));
+
+    HitRecord rec;
+    sassert(scene.world.isHit(Ray(Point3(0., 5., 0.), Vec3(0., -1., 0.)), rec) && rec.worldPoint.isClose(Point3(0., 3., 0.)));
+    sassert(!scene.world.isHit(Ray(Point3(5., 0., 0.), Vec3(-1., 0., 0.)), rec));
+
+    // different shapes
+    std::istringstream other("material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>))) sphere(red, identity)");
+    InputStream stream(other, "testfile.fake");
+    Scene different;
+    different.parse(stream);
+    sassert(!scene.animate(different));
+    std::remove(meshPath.c_str());
+
+    cout << "animations work" << endl;
+}
+
+void testCompile() {
+    std::string meshPath = "testCompile.obj", path = "testCompile.rtscene", textPath = "testCompile.txt";
+    {
+        std::ofstream file(meshPath);
+        file << "v -1 -1 0\nv 1 -1 0\nv 1 1 0\nv -1 1 0\nf 1 2 3 4\n";
+    }
+    std::string text =
+        "float height(3)\n"
+        "material sky(diffuse(uniform(<0, 0, 0>), uniform(<0.7, 0.5, 1>)))\n"
+        "material ground(diffuse(checkered(<0.3, 0.5, 0.1>, <0.1, 0.2, 0.5>, 4), uniform(<0, 0, 0>)))\n"
+        "material mirror(specular(uniform(<0.5, 0.5, 0.5>), uniform(<0, 0, 0>), 0.1, 45))\n"
+        "material glass(transparent(uniform(<1, 1, 1>), uniform(<0, 0, 0>), 1.5))\n"
+        "plane(ground, identity)\n"
+        "sphere(mirror, translation([0, 0, height]))\n"
+        "group pair {\n"
+        "    sphere(glass, translation([0, -2, 0]))\n"
+        "    mesh(sky, \"testCompile.obj\", translation([0, 2, 0]))\n"
+        "}\n"
+        "group pairs {\n"
+        "    instance(pair, identity)\n"
+        "    instance(pair, translation([0, 0, 5]))\n"
+        "}\n"
+        "instance(pairs, translation([10, 0, 0]))\n"
+        "pointLight([1, 1, height], <0, 0.1, 4>, 2)\n"
+        "camera(orthogonal, 1.5, 120, 2.0, rotationZ(30) * translation([-4, 0, 1]))\n";
+
+    Scene textScene;
+    textScene.compiled = std::make_shared<CompiledScene>();
+    {
+        std::istringstream ss(text);
+        InputStream stream(ss, "testfile.fake");
+        textScene.parse(stream, {{"height", 4.}});
+    }
+    sassert(textScene.compiled->shapes.size() == 7 && textScene.compiled->groups.size() == 2);
+    textScene.compiled->save(path);
+    sassert(CompiledScene::isCompiled(path));
+
+    Scene scene(path);
+
+    // materials
+    sassert(scene.materials.size() == 4);
+    sassert(scene.materials["ground"]->color({0., 0.}).isClose(Color(0.3, 0.5, 0.1)));
+    sassert(scene.materials["ground"]->color({0.2501, 0.}).isClose(Color(0.1, 0.2, 0.5)));
+    sassert(scene.materials["sky"]->emittedColor({0., 0.}).isClose(Color(0.7, 0.5, 1.)));
+    sassert(std::dynamic_pointer_cast<SpecularMaterial>(scene.materials["mirror"]) != nullptr);
+    sassert(std::dynamic_pointer_cast<TransparentMaterial>(scene.materials["glass"]) != nullptr);
+
+    // shapes, with the variables as they were when compiling
+    sassert(scene.world._shapes.size() == 3 && scene.groups.size() == 2);
+    sassert(std::dynamic_pointer_cast<Plane>(scene.world._shapes[0]) != nullptr);
+    sassert(scene.world._shapes[1]->transformation.isClose(translation(Vec3(0., 0., 4.))));
+    sassert(std::dynamic_pointer_cast<Instance>(scene.world._shapes[2]) != nullptr);
+    sassert(scene.world.isBuilt() && scene.groups["pair"]->isBuilt() && scene.groups["pairs"]->isBuilt());
+
+    textScene.world.build();
+    for (Ray ray : {Ray(Point3(0., 0., 10.), Vec3(0., 0., -1.)), Ray(Point3(10., -2., 10.), Vec3(0., 0., -1.)),
+                    Ray(Point3(10.5, 2.5, 10.), Vec3(0., 0., -1.)), Ray(Point3(-5., -5., 4.), Vec3(1., 1., 0.))}) {
+        HitRecord expected, rec;
+        sassert(textScene.world.isHit(ray, expected) && scene.world.isHit(ray, rec));
+        sassert(areClose(expected.t, rec.t) && expected.normal.isClose(rec.normal));
+        for (auto& [name, material] : textScene.materials) {
+            if (material == expected.material) sassert(scene.materials[name] == rec.material);
+        }
+    }
+
+    // camera and lights
+    sassert(scene.camera->transformation.isClose(rotation(30., Axis::Z) * translation(Vec3(-4., 0., 1.))));
+    sassert(areClose(scene.camera->aspectRatio, 1.5) && scene.camera->imageWidth == 120);
+    sassert(scene.world.pointLights.size() == 1 && scene.world.pointLights[0].position.isClose(Point3(1., 1., 4.)));
+    sassert(scene.world.pointLights[0].color.isClose(Color(0., 0.1, 4.)) && areClose(scene.world.pointLights[0].linearRadius, 2.));
+
+    // text files are still parsed, broken compiled ones are rejected
+    {
+        std::ofstream file(textPath);
+        file << text;
+    }
+    sassert(!CompiledScene::isCompiled(textPath));
+    sassert(Scene(textPath).world._shapes.size() == 3);
+
+    auto rejected = [&](size_t size, size_t corruptedByte) {
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bytes.resize(size);
+        if (corruptedByte < size) bytes[corruptedByte] ^= 0x7f;
+        std::string brokenPath = "testCompileBroken.rtscene";
+        std::ofstream(brokenPath, std::ios::binary) << bytes;
+        bool thrown = false;
+        try { Scene broken(brokenPath); }
+        catch (const std::runtime_error&) { thrown = true; }
+        std::remove(brokenPath.c_str());
+        return thrown;
+    };
+    size_t size = std::filesystem::file_size(path);
+    sassert(rejected(size - 1, size));
+    sassert(rejected(size, 8));      // version
+    sassert(rejected(size, 12));     // byte order
+    sassert(rejected(size, 16));     // number of textures, so the size
+    sassert(!rejected(size, size));
+
+    std::remove(path.c_str());
+    std::remove(textPath.c_str());
+    std::remove(meshPath.c_str());
+
+    cout << "compiled scenes work" << endl;
+}
+
+void testSharedMaterials() {
+    std::istringstream ss(
+        "material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "material also_red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "material red_mirror(specular(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\n"
+        "material checks(diffuse(checkered(<1, 0, 0>, <0, 0, 0>, 4), uniform(<0, 0, 0>)))\n"
+        "material other_checks(diffuse(checkered(<1, 0, 0>, <0, 0, 0>, 2), uniform(<0, 0, 0>)))\n"
+        "sphere(red, identity)\n"
+        "sphere(also_red, translation([3, 0, 0]))\n"
+    );
+    InputStream stream(ss, "testfile.fake");
+    Scene scene;
+    scene.world.buildSettings.compactShapes = true;
+    scene.parse(stream);
+
+    // identical definitions are the same object, same textures too
+    sassert(scene.materials.size() == 5 && scene.materials["red"] == scene.materials["also_red"]);
+    sassert(scene.materials["red"] != scene.materials["red_mirror"] && scene.materials["checks"] != scene.materials["other_checks"]);
+    sassert(scene.materials["red"]->texture() == scene.materials["red_mirror"]->texture());
+    sassert(scene.materials["red"]->emittedRadiance() == scene.materials["checks"]->emittedRadiance());
+    sassert(scene.materials["red"]->texture() != scene.materials["red"]->emittedRadiance());
+
+    // compact spheres, with one material
+    World::MemoryStats stats = scene.world.memoryStats();
+    sassert(stats.shapes == 2 && stats.compactSpheres == 2 && stats.materials == 1);
+    HitRecord rec;
+    sassert(scene.world.isHit(Ray(Point3(3., 0., 5.), Vec3(0., 0., -1.)), rec) && rec.material == scene.materials["red"]);
+    sassert(rec.worldPoint.isClose(Point3(3., 0., 1.)) && rec.normal.isClose(Normal3(0., 0., 1.)));
+
+    // they can't be animated
+    std::istringstream again("material red(diffuse(uniform(<1, 0, 0>), uniform(<0, 0, 0>)))\nsphere(red, identity)\nsphere(red, translation([3, 0, 0]))\n");
+    InputStream againStream(again, "testfile.fake");
+    Scene next;
+    next.buildWorld = false;
+    next.parse(againStream);
+    sassert(!scene.animate(next));
+
+    cout << "materials are shared" << endl;
+}
+
+void testGroupCache() {
+    const std::string path = "testGroupCache.txt";
+    {
+        std::ofstream file(path);
+        file << "material white(diffuse(uniform(<1, 1, 1>), uniform(<0, 0, 0>)))\n"
+                "group pair {\n"
+                "    sphere(white, identity)\n"
+                "    sphere(white, translation([0, 2, 0]))\n"
+                "}\n"
+                "sphere(white, translation([0, 0, 5]))\n"
+                "instance(pair, identity)\n"
+                "instance(pair, translation([5, 0, 0]))\n";
+    }
+
+    // the group has a cache file of its own, so both trees are loaded the second time
+    World::BuildSettings settings;
+    settings.cachePath = path + ".bvh";
+    for (bool cached : {false, true}) {
+        Scene scene(path, {}, settings);
+        sassert(scene.world.buildStats().cached == cached && scene.groups["pair"]->buildStats().cached == cached);
+    }
+    sassert(std::filesystem::exists("testGroupCache.txt.pair.bvh"));
+
+    std::remove(path.c_str());
+    std::remove("testGroupCache.txt.bvh");
+    std::remove("testGroupCache.txt.pair.bvh");
+
+    cout << "groups are cached in their own files" << endl;
+}
+
 int main() {
     testFileRegistry();
     testInputStream();
@@ -277,6 +599,12 @@ int main() {
     testParser();
     testUndefinedMaterial();
     testDoubleCamera();
+    testGroups();
+    testMeshes();
+    testAnimate();
+    testCompile();
+    testSharedMaterials();
+    testGroupCache();
 
     return 0;
 }
\ No newline at end of file
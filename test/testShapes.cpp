@@ -1,6 +1,7 @@
 #include <iostream>
 #include "shapes.hpp"
 #include "World.hpp"
+#include "simd.hpp"
 
 using std::cout, std::endl;
 
@@ -243,6 +244,54 @@ auto testHit() {
     cout << "isHit works" << endl;
 }
 
+void testSpherePack() {
+    PCG pcg;
+    std::vector<Sphere> spheres;
+    SpherePack pack;
+
+    // 37 spheres, so the last block of 8 is partially filled
+    for (int i = 0; i < 37; i++) {
+        Transformation t = translation(pcg.random(-5., 5.), pcg.random(-5., 5.), pcg.random(-5., 5.))
+                           * rotation(pcg.random(0., 360.), Axis::Z)
+                           * scaling(pcg.random(0.2, 1.5), pcg.random(0.2, 1.5), pcg.random(0.2, 1.5));
+        spheres.emplace_back(bufferMaterial, t);
+        sassert(pack.add(t) == i);
+    }
+
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (bestSimdLevel() >= SimdLevel::SSE4) levels.push_back(SimdLevel::SSE4);
+    if (bestSimdLevel() >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+    for (int r = 0; r < 1000; r++) {
+        Ray ray(Point3(pcg.random(-8., 8.), pcg.random(-8., 8.), pcg.random(-8., 8.)), pcg.randomVersor(), RAY_MIN, pcg.random(1., 20.));
+
+        // reference: one sphere at a time with the scalar code
+        int expected = -1;
+        bool anyExpected = false;
+        HitRecord rec, closestRec;
+        for (int i = 0; i < 37; i++) {
+            if (spheres[i].isHit(ray, rec) && (expected < 0 || rec.t < closestRec.t)) expected = i, closestRec = rec;
+            anyExpected = anyExpected || spheres[i].quickIsHit(ray);
+        }
+
+        for (SimdLevel level : levels) {
+            float t = -1.0f;
+            int index = pack.closestHit(ray, t, level);
+            sassert(index == expected);
+            if (expected >= 0) sassert(areClose(t, closestRec.t, 1e-4f));
+
+            int any = pack.anyHit(ray, level);
+            sassert((any >= 0) == anyExpected);
+            if (any >= 0) sassert(spheres[any].quickIsHit(ray));
+        }
+    }
+
+    // the transformations rebuilt from the inverses
+    for (int i = 0; i < 37; i++) sassert(pack.transformation(i).isClose(spheres[i].transformation));
+
+    cout << "packed spheres match the scalar code (" << simdLevelName(bestSimdLevel()) << " available)" << endl;
+}
+
 void testQuickHit() {
     World world;
 
@@ -261,6 +310,26 @@ void testQuickHit() {
     cout << "quick hit works" << endl;
 }
 
+void testOccluded() {
+    PCG pcg;
+    World world;
+    for (int i = 0; i < 20; i++) {
+        world.addShape(std::make_shared<Sphere>(bufferMaterial, translation(pcg.random(-5., 5.), pcg.random(-5., 5.), pcg.random(-5., 5.))
+                                                                * scaling(pcg.random(0.2, 1.5))));
+    }
+    world.addShape(std::make_shared<Plane>(bufferMaterial, translation(0., 0., -4.)));
+
+    // same rays many times in a row, so the last occluder is reused, both when it's right and when it's wrong
+    for (int i = 0; i < 500; i++) {
+        Ray ray(Point3(pcg.random(-6., 6.), pcg.random(-6., 6.), pcg.random(-6., 6.)), pcg.randomVersor(), RAY_MIN, pcg.random(0., 10.));
+        HitRecord rec;
+        bool expected = world.isHit(ray, rec);
+        for (int k = 0; k < 3; k++) sassert(world.occluded(ray) == expected);
+    }
+
+    cout << "occlusion queries work" << endl;
+}
+
 }
 
 
@@ -285,6 +354,8 @@ int main() {
     cout << "\nWorld:" << endl;
     world::testHit();
     world::testQuickHit();
+    world::testOccluded();
+    world::testSpherePack();
 
     return 0;
 }
\ No newline at end of file
@@ -30,6 +30,26 @@ void testImageTexture(){
     std::cout << "texture from image works" << std::endl;
 }
 
+void testImageTextureFromFile(){
+    HDRImage image(2, 2);
+    image.setPixel(0, 0, Color(1., 2., 3.));
+    image.setPixel(1, 0, Color(2., 3., 1.));
+    image.setPixel(0, 1, Color(20., 10., 30.));
+    image.setPixel(1, 1, Color(3., 2., 1.));
+    image.save("testTexture.pfm");
+
+    // mapped, with the colors normalized and clamped when read
+    ImageTexture texture("testTexture.pfm");
+    image.normalize(1.0f);
+    image.clamp();
+    sassert(texture.color(Vec2(0., 0.)).isClose(image.getPixel(0, 0)));
+    sassert(texture.color(Vec2(0., 1.)).isClose(image.getPixel(0, 1)));
+    sassert(texture.color(Vec2(1., 1.)).isClose(image.getPixel(1, 1)));
+    std::remove("testTexture.pfm");
+
+    std::cout << "texture from file works" << std::endl;
+}
+
 void testCheckeredTexture(){
     Color color1(1., 2., 3.);
     Color color2(10., 20., 30.);
@@ -62,6 +82,7 @@ void testCheckeredTexture(){
 int main() {
     testUniformTexture();
     testImageTexture();
+    testImageTextureFromFile();
     testCheckeredTexture();
 
     return 0;